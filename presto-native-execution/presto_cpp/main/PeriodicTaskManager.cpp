@@ -195,6 +195,15 @@ void PeriodicTaskManager::addPrestoExchangeSourceMemoryStatsTask() {
             kCounterExchangeSourceQueuedBytes, currQueuedMemoryBytes);
         REPORT_ADD_STAT_VALUE(
             kCounterExchangeSourcePeakQueuedBytes, peakQueuedMemoryBytes);
+
+        int64_t maxEventBaseClients{0};
+        int64_t avgEventBaseClients{0};
+        PrestoExchangeSource::getEventBaseLoad(
+            maxEventBaseClients, avgEventBaseClients);
+        REPORT_ADD_STAT_VALUE(
+            kCounterExchangeSourceEventBaseMaxClients, maxEventBaseClients);
+        REPORT_ADD_STAT_VALUE(
+            kCounterExchangeSourceEventBaseAvgClients, avgEventBaseClients);
       },
       std::chrono::microseconds{kExchangeSourcePeriodGlobalCounters},
       "exchange_source_counters");
@@ -15,6 +15,11 @@
 
 #include <fmt/core.h>
 #include <folly/SocketAddress.h>
+#include <folly/Synchronized.h>
+#include <folly/container/F14Map.h>
+#include <folly/executors/GlobalExecutor.h>
+#include <folly/executors/IOThreadPoolExecutor.h>
+#include <folly/hash/Hash.h>
 #include <re2/re2.h>
 #include <sstream>
 
@@ -51,6 +56,38 @@ void onFinalFailure(
 
   queue->setError(errorMessage);
 }
+
+// Returns the number of PrestoExchangeSource http clients on each event base.
+folly::Synchronized<folly::F14FastMap<folly::EventBase*, int64_t>>&
+eventBaseClients() {
+  static folly::Synchronized<folly::F14FastMap<folly::EventBase*, int64_t>>
+      clients;
+  return clients;
+}
+
+// Returns the event bases of the network IO executor, or an empty vector if it
+// is not an IOThreadPoolExecutor.
+std::vector<folly::Executor::KeepAlive<folly::EventBase>>
+networkEventBases() {
+  auto ioExecutor = folly::getUnsafeMutableGlobalIOExecutor();
+  if (auto* ioThreadPool =
+          dynamic_cast<folly::IOThreadPoolExecutor*>(ioExecutor.get())) {
+    return ioThreadPool->getAllEventBases();
+  }
+  return {};
+}
+
+// Picks the event base for the http client of an exchange source reading from
+// 'host':'port' by hashing the address, so that the sources of a remote host
+// stay on one event base and the hosts spread over all the network threads.
+folly::EventBase* pickEventBase(const std::string& host, uint16_t port) {
+  const auto eventBases = networkEventBases();
+  if (eventBases.empty()) {
+    return folly::getUnsafeMutableGlobalEventBase();
+  }
+  const auto hash = folly::hash::hash_combine(host, port);
+  return eventBases[hash % eventBases.size()].get();
+}
 } // namespace
 
 PrestoExchangeSource::PrestoExchangeSource(
@@ -59,17 +96,20 @@ PrestoExchangeSource::PrestoExchangeSource(
     std::shared_ptr<exec::ExchangeQueue> queue,
     memory::MemoryPool* pool,
     const std::string& clientCertAndKeyPath,
-    const std::string& ciphers)
+    const std::string& ciphers,
+    uint64_t acknowledgeDelayMs)
     : ExchangeSource(extractTaskId(baseUri.path()), destination, queue, pool),
       basePath_(baseUri.path()),
       host_(baseUri.host()),
       port_(baseUri.port()),
       clientCertAndKeyPath_(clientCertAndKeyPath),
-      ciphers_(ciphers) {
+      ciphers_(ciphers),
+      acknowledgeDelayMs_(acknowledgeDelayMs) {
   folly::SocketAddress address(folly::IPAddress(host_).str(), port_, true);
-  auto* eventBase = folly::getUnsafeMutableGlobalEventBase();
+  eventBase_ = pickEventBase(host_, port_);
+  ++(*eventBaseClients().wlock())[eventBase_];
   httpClient_ = std::make_unique<http::HttpClient>(
-      eventBase,
+      eventBase_,
       address,
       std::chrono::milliseconds(10'000),
       clientCertAndKeyPath_,
@@ -81,6 +121,21 @@ PrestoExchangeSource::PrestoExchangeSource(
       });
 }
 
+PrestoExchangeSource::~PrestoExchangeSource() {
+  auto clients = eventBaseClients().wlock();
+  auto it = clients->find(eventBase_);
+  // Does not throw from the destructor.
+  if (it == clients->end()) {
+    LOG(ERROR) << "PrestoExchangeSource for " << host_ << ":" << port_
+               << " is not counted on its event base";
+    DCHECK(false);
+    return;
+  }
+  if (--it->second == 0) {
+    clients->erase(it);
+  }
+}
+
 bool PrestoExchangeSource::shouldRequestLocked() {
   if (atEnd_) {
     return false;
@@ -92,6 +147,11 @@ bool PrestoExchangeSource::shouldRequestLocked() {
 
 void PrestoExchangeSource::request() {
   failedAttempts_ = 0;
+  {
+    std::lock_guard<std::mutex> l(queue_->mutex());
+    // The result request for 'sequence_' acknowledges the pages before it.
+    pendingAckToken_.reset();
+  }
   doRequest();
 }
 
@@ -223,6 +283,11 @@ void PrestoExchangeSource::processDataResponse(
       if (complete || !empty) {
         requestPending_ = false;
       }
+      if (complete) {
+        pendingAckToken_.reset();
+      } else if (!empty && acknowledgeDelayMs_ > 0) {
+        pendingAckToken_ = ackSequence;
+      }
     }
     for (auto& promise : promises) {
       promise.setValue();
@@ -234,7 +299,11 @@ void PrestoExchangeSource::processDataResponse(
   } else {
     if (!empty) {
       // Acknowledge results for non-empty content.
-      acknowledgeResults(ackSequence);
+      if (acknowledgeDelayMs_ > 0) {
+        scheduleAcknowledgeResults(ackSequence);
+      } else {
+        acknowledgeResults(ackSequence);
+      }
     } else {
       // Rerequest results for incomplete results with no pages.
       request();
@@ -285,6 +354,31 @@ void PrestoExchangeSource::acknowledgeResults(int64_t ackSequence) {
           });
 }
 
+void PrestoExchangeSource::scheduleAcknowledgeResults(int64_t ackToken) {
+  // Does not keep the source alive for the delay.
+  std::weak_ptr<PrestoExchangeSource> weakSelf = getSelfPtr();
+  folly::futures::sleep(std::chrono::milliseconds(acknowledgeDelayMs_))
+      .via(driverCPUExecutor())
+      .thenValue([weakSelf, ackToken](auto&& /* unused */) {
+        auto self = weakSelf.lock();
+        if (self == nullptr) {
+          return;
+        }
+        {
+          std::lock_guard<std::mutex> l(self->queue_->mutex());
+          // The token was acknowledged by a result request or a later
+          // acknowledgement supersedes it.
+          if (self->pendingAckToken_ != ackToken) {
+            return;
+          }
+          self->pendingAckToken_.reset();
+        }
+        if (!self->closed_.load()) {
+          self->acknowledgeResults(ackToken);
+        }
+      });
+}
+
 void PrestoExchangeSource::abortResults() {
   VLOG(1) << "Sending abort results " << basePath_;
   auto queue = queue_;
@@ -336,11 +430,17 @@ PrestoExchangeSource::createExchangeSource(
     int destination,
     std::shared_ptr<exec::ExchangeQueue> queue,
     memory::MemoryPool* pool) {
+  const auto systemConfig = SystemConfig::instance();
   if (strncmp(url.c_str(), "http://", 7) == 0) {
     return std::make_unique<PrestoExchangeSource>(
-        folly::Uri(url), destination, queue, pool);
+        folly::Uri(url),
+        destination,
+        queue,
+        pool,
+        "",
+        "",
+        systemConfig->exchangeAcknowledgeDelayMs());
   } else if (strncmp(url.c_str(), "https://", 8) == 0) {
-    const auto systemConfig = SystemConfig::instance();
     const auto clientCertAndKeyPath =
         systemConfig->httpsClientCertAndKeyPath().value_or("");
     const auto ciphers = systemConfig->httpsSupportedCiphers();
@@ -350,7 +450,8 @@ PrestoExchangeSource::createExchangeSource(
         queue,
         pool,
         clientCertAndKeyPath,
-        ciphers);
+        ciphers,
+        systemConfig->exchangeAcknowledgeDelayMs());
   }
   return nullptr;
 }
@@ -377,4 +478,23 @@ void PrestoExchangeSource::testingClearMemoryUsage() {
   currQueuedMemoryBytes() = 0;
   peakQueuedMemoryBytes() = 0;
 }
+
+void PrestoExchangeSource::getEventBaseLoad(
+    int64_t& maxClients,
+    int64_t& avgClients) {
+  const auto numEventBases = networkEventBases().size();
+  maxClients = 0;
+  int64_t totalClients{0};
+  size_t numLoadedEventBases{0};
+  {
+    auto clients = eventBaseClients().rlock();
+    for (const auto& [eventBase, numClients] : *clients) {
+      maxClients = std::max(maxClients, numClients);
+      totalClients += numClients;
+    }
+    numLoadedEventBases = clients->size();
+  }
+  avgClients = totalClients /
+      std::max({numEventBases, numLoadedEventBases, size_t{1}});
+}
 } // namespace facebook::presto
@@ -14,6 +14,7 @@
 #pragma once
 
 #include <folly/Uri.h>
+#include <optional>
 
 #include "presto_cpp/main/common/Configs.h"
 #include "presto_cpp/main/http/HttpClient.h"
@@ -23,13 +24,20 @@
 namespace facebook::presto {
 class PrestoExchangeSource : public velox::exec::ExchangeSource {
  public:
+  /// If 'acknowledgeDelayMs' > 0, leaves the acknowledgement of received
+  /// pages to the next result request, which acknowledges the pages before its
+  /// token on the remote task. A separate acknowledge request is sent only if
+  /// no result request is sent within 'acknowledgeDelayMs'.
   PrestoExchangeSource(
       const folly::Uri& baseUri,
       int destination,
       std::shared_ptr<velox::exec::ExchangeQueue> queue,
       velox::memory::MemoryPool* pool,
       const std::string& clientCertAndKeyPath_ = "",
-      const std::string& ciphers_ = "");
+      const std::string& ciphers_ = "",
+      uint64_t acknowledgeDelayMs = 0);
+
+  ~PrestoExchangeSource() override;
 
   bool shouldRequestLocked() override;
 
@@ -49,6 +57,10 @@ class PrestoExchangeSource : public velox::exec::ExchangeSource {
     return failedAttempts_;
   }
 
+  folly::EventBase* testingEventBase() const {
+    return eventBase_;
+  }
+
   /// Invoked to track the node-wise memory usage queued in
   /// PrestoExchangeSource. If 'updateBytes' > 0, then increment the usage,
   /// otherwise decrement the usage.
@@ -61,6 +73,10 @@ class PrestoExchangeSource : public velox::exec::ExchangeSource {
   /// Used by test to clear the node-wise memory usage tracking.
   static void testingClearMemoryUsage();
 
+  /// Invoked to get the largest and the average number of PrestoExchangeSource
+  /// http clients on an event base of the network IO executor.
+  static void getEventBaseLoad(int64_t& maxClients, int64_t& avgClients);
+
  private:
   void request() override;
 
@@ -79,6 +95,10 @@ class PrestoExchangeSource : public velox::exec::ExchangeSource {
 
   void acknowledgeResults(int64_t ackSequence);
 
+  // Acknowledges the pages before 'ackToken' with a separate request if no
+  // result request acknowledged them within 'acknowledgeDelayMs_'.
+  void scheduleAcknowledgeResults(int64_t ackToken);
+
   void abortResults();
 
   // Returns a shared ptr owning the current object.
@@ -103,10 +123,18 @@ class PrestoExchangeSource : public velox::exec::ExchangeSource {
   const std::string clientCertAndKeyPath_;
   const std::string ciphers_;
 
+  // The event base of the network IO executor running 'httpClient_'. The
+  // sources of one remote host share the same event base.
+  folly::EventBase* eventBase_;
   std::unique_ptr<http::HttpClient> httpClient_;
   int failedAttempts_;
   // The number of pages received from this presto exchange source.
   uint64_t numPages_{0};
+
+  const uint64_t acknowledgeDelayMs_;
+  // The token of the received pages that are not acknowledged yet, if any.
+  // Guarded by the mutex of 'queue_'.
+  std::optional<int64_t> pendingAckToken_;
   std::atomic_bool closed_{false};
   // A boolean indicating whether abortResults() call was issued and was
   // successfully processed by the remote server.
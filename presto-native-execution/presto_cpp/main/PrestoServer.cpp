@@ -26,12 +26,15 @@
 #include "presto_cpp/main/common/ConfigReader.h"
 #include "presto_cpp/main/common/Configs.h"
 #include "presto_cpp/main/common/Counters.h"
+#include "presto_cpp/main/common/IoUringFileSystem.h"
 #include "presto_cpp/main/connectors/hive/storage_adapters/FileSystems.h"
 #include "presto_cpp/main/http/HttpServer.h"
 #include "presto_cpp/main/http/filters/AccessLogFilter.h"
 #include "presto_cpp/main/http/filters/StatsFilter.h"
 #include "presto_cpp/main/operators/LocalPersistentShuffle.h"
+#include "presto_cpp/main/operators/MemoryShuffle.h"
 #include "presto_cpp/main/operators/PartitionAndSerialize.h"
+#include "presto_cpp/main/operators/PartitionAndShuffleWrite.h"
 #include "presto_cpp/main/operators/ShuffleInterface.h"
 #include "presto_cpp/main/operators/ShuffleRead.h"
 #include "presto_cpp/main/operators/UnsafeRowExchangeSource.h"
@@ -242,7 +245,12 @@ void PrestoServer::run() {
     httpsSocketAddress.setFromLocalPort(httpsPort.value());
 
     httpsConfig = std::make_unique<http::HttpsConfig>(
-        httpsSocketAddress, certPath, keyPath, ciphers, reusePort);
+        httpsSocketAddress,
+        certPath,
+        keyPath,
+        ciphers,
+        reusePort,
+        SystemConfig::instance()->httpServerHttp2Enabled());
   }
 
   httpServer_ = std::make_unique<http::HttpServer>(
@@ -635,11 +643,16 @@ void PrestoServer::registerShuffleInterfaceFactories() {
   operators::ShuffleInterfaceFactory::registerFactory(
       operators::LocalPersistentShuffleFactory::kShuffleName.toString(),
       std::make_unique<operators::LocalPersistentShuffleFactory>());
+  operators::ShuffleInterfaceFactory::registerFactory(
+      operators::MemoryShuffleFactory::kShuffleName.toString(),
+      std::make_unique<operators::MemoryShuffleFactory>());
 }
 
 void PrestoServer::registerCustomOperators() {
   facebook::velox::exec::Operator::registerOperator(
       std::make_unique<operators::PartitionAndSerializeTranslator>());
+  facebook::velox::exec::Operator::registerOperator(
+      std::make_unique<operators::PartitionAndShuffleWriteTranslator>());
   facebook::velox::exec::Operator::registerOperator(
       std::make_unique<facebook::presto::operators::ShuffleWriteTranslator>());
   facebook::velox::exec::Operator::registerOperator(
@@ -670,6 +683,14 @@ void PrestoServer::registerVectorSerdes() {
 
 void PrestoServer::registerFileSystems() {
   velox::filesystems::registerLocalFileSystem();
+#ifdef PRESTO_ENABLE_IO_URING
+  registerIoUringFileSystem(SystemConfig::instance()->ioUringQueueDepth());
+#else
+  VELOX_USER_CHECK(
+      !SystemConfig::instance()->localShuffleUseIoUring() &&
+          !SystemConfig::instance()->spillerUseIoUring(),
+      "The io_uring file system requires a build with PRESTO_ENABLE_IO_URING");
+#endif
 }
 
 void PrestoServer::registerStatsCounters() {
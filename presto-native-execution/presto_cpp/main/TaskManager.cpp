@@ -19,7 +19,9 @@
 #include <velox/core/PlanNode.h>
 #include "presto_cpp/main/common/Configs.h"
 #include "presto_cpp/main/common/Counters.h"
+#include "presto_cpp/main/common/IoUringFileSystem.h"
 #include "presto_cpp/main/common/Utils.h"
+#include "presto_cpp/main/operators/ShuffleInterface.h"
 #include "presto_cpp/main/types/PrestoToVeloxSplit.h"
 #include "velox/common/base/StatsReporter.h"
 #include "velox/common/file/FileSystems.h"
@@ -50,7 +52,11 @@ namespace {
 static void maybeSetupTaskSpillDirectory(
     const core::PlanFragment& planFragment,
     exec::Task& execTask) {
-  const auto baseSpillPath = SystemConfig::instance()->spillerSpillPath();
+  const bool useIoUring = SystemConfig::instance()->spillerUseIoUring();
+  const auto spillPath = SystemConfig::instance()->spillerSpillPath();
+  const auto baseSpillPath = useIoUring && !spillPath.empty()
+      ? toIoUringPath(spillPath)
+      : spillPath;
   if (!baseSpillPath.empty() &&
       planFragment.canSpill(execTask.queryCtx()->queryConfig())) {
     const auto taskSpillDirPath = TaskManager::buildTaskSpillDirectoryPath(
@@ -108,6 +114,11 @@ void TaskManager::abortResults(const TaskId& taskId, long bufferId) {
   bufferManager_->deleteResults(taskId, bufferId);
 }
 
+void TaskManager::removeQuery(const protocol::QueryId& queryId) {
+  LOG(INFO) << "Removing query " << queryId;
+  operators::ShuffleInterfaceFactory::removeQueryFromAll(queryId);
+}
+
 void TaskManager::acknowledgeResults(
     const TaskId& taskId,
     const long bufferId,
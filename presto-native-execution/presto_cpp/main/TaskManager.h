@@ -49,6 +49,12 @@ class TaskManager {
   void
   acknowledgeResults(const protocol::TaskId& taskId, long bufferId, long token);
 
+  /// Releases the shuffle data kept for 'queryId' beyond the lifetime of its
+  /// tasks, e.g. memory shuffle blocks. Called once the query has ended,
+  /// successfully or not, as tasks of later stages may still read the data
+  /// after the tasks of this worker are gone.
+  void removeQuery(const protocol::QueryId& queryId);
+
   // Creating an empty task that only contains the error information so that
   // next time coordinator checks for the status it retrieves the error.
   std::unique_ptr<protocol::TaskInfo> createOrUpdateErrorTask(
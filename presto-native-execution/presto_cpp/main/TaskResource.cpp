@@ -57,6 +57,13 @@ std::optional<protocol::Duration> getMaxWait(proxygen::HTTPMessage* message) {
 } // namespace
 
 void TaskResource::registerUris(http::HttpServer& server) {
+  server.registerDelete(
+      R"(/v1/query/(.+))",
+      [&](proxygen::HTTPMessage* message,
+          const std::vector<std::string>& pathMatch) {
+        return removeQuery(message, pathMatch);
+      });
+
   server.registerDelete(
       R"(/v1/task/(.+)/results/(.+))",
       [&](proxygen::HTTPMessage* message,
@@ -150,6 +157,25 @@ proxygen::RequestHandler* TaskResource::abortResults(
       });
 }
 
+proxygen::RequestHandler* TaskResource::removeQuery(
+    proxygen::HTTPMessage* /*message*/,
+    const std::vector<std::string>& pathMatch) {
+  protocol::QueryId queryId = pathMatch[1];
+  return new http::CallbackRequestHandler(
+      [this, queryId](
+          proxygen::HTTPMessage* /*message*/,
+          const std::vector<std::unique_ptr<folly::IOBuf>>& /*body*/,
+          proxygen::ResponseHandler* downstream) {
+        try {
+          taskManager_.removeQuery(queryId);
+        } catch (const std::exception& e) {
+          http::sendErrorResponse(downstream, e.what());
+          return;
+        }
+        http::sendOkResponse(downstream);
+      });
+}
+
 proxygen::RequestHandler* TaskResource::acknowledgeResults(
     proxygen::HTTPMessage* /*message*/,
     const std::vector<std::string>& pathMatch) {
@@ -239,7 +265,15 @@ proxygen::RequestHandler* TaskResource::createOrUpdateBatchTask(
         }
 
         VeloxBatchQueryPlanConverter converter(
-            shuffleName, std::move(serializedShuffleWriteInfo), pool_);
+            shuffleName,
+            std::move(serializedShuffleWriteInfo),
+            pool_,
+            SystemConfig::instance()->shuffleFusePartitionAndWrite(),
+            operators::shuffleSerializationFormatFromName(
+                SystemConfig::instance()->shuffleSerializationFormat()),
+            SystemConfig::instance()->shuffleSharedTaskWriter(),
+            SystemConfig::instance()->shuffleClustered(),
+            SystemConfig::instance()->shuffleSorted());
         auto planFragment = converter.toVeloxQueryPlan(
             prestoPlan, updateRequest.tableWriteInfo, taskId);
 
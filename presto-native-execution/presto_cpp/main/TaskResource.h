@@ -86,6 +86,12 @@ class TaskResource {
       proxygen::HTTPMessage* message,
       const std::vector<std::string>& pathMatch);
 
+  /// Handles DELETE /v1/query/{queryId}, sent when the query has ended, see
+  /// TaskManager::removeQuery().
+  proxygen::RequestHandler* removeQuery(
+      proxygen::HTTPMessage* message,
+      const std::vector<std::string>& pathMatch);
+
   proxygen::RequestHandler* removeRemoteSource(
       proxygen::HTTPMessage* message,
       const std::vector<std::string>& pathMatch);
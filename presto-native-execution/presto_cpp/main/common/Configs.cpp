@@ -43,6 +43,7 @@ void checkIncomingSystemProperties(
       SystemConfig::kHttpExecThreads,
       SystemConfig::kHttpServerHttpsPort,
       SystemConfig::kHttpServerHttpsEnabled,
+      SystemConfig::kHttpServerHttp2Enabled,
       SystemConfig::kHttpsSupportedCiphers,
       SystemConfig::kHttpsCertPath,
       SystemConfig::kHttpsKeyPath,
@@ -51,7 +52,10 @@ void checkIncomingSystemProperties(
       SystemConfig::kNumConnectorIoThreads,
       SystemConfig::kNumQueryThreads,
       SystemConfig::kNumSpillThreads,
+      SystemConfig::kNumShuffleIoThreads,
       SystemConfig::kSpillerSpillPath,
+      SystemConfig::kSpillerUseIoUring,
+      SystemConfig::kIoUringQueueDepth,
       SystemConfig::kShutdownOnsetSec,
       SystemConfig::kSystemMemoryGb,
       SystemConfig::kAsyncCacheSsdGb,
@@ -65,11 +69,28 @@ void checkIncomingSystemProperties(
       SystemConfig::kEnableVeloxTaskLogging,
       SystemConfig::kEnableVeloxExprSetLogging,
       SystemConfig::kLocalShuffleMaxPartitionBytes,
+      SystemConfig::kLocalShuffleConsolidatedFiles,
+      SystemConfig::kLocalShuffleMaxInflightWrites,
+      SystemConfig::kLocalShuffleReadAheadBlocks,
+      SystemConfig::kLocalShuffleMmapReads,
+      SystemConfig::kLocalShuffleUseIoUring,
+      SystemConfig::kLocalShuffleDirectIo,
+      SystemConfig::kLocalShuffleCompressionCodec,
+      SystemConfig::kLocalShuffleMaxBufferedBytes,
       SystemConfig::kShuffleName,
+      SystemConfig::kShuffleFusePartitionAndWrite,
+      SystemConfig::kShuffleSharedTaskWriter,
+      SystemConfig::kShuffleClustered,
+      SystemConfig::kShuffleSorted,
+      SystemConfig::kShuffleSortedReadChunkBytes,
+      SystemConfig::kShuffleSerializationFormat,
+      SystemConfig::kShuffleReadBatchBytes,
       SystemConfig::kHttpEnableAccessLog,
       SystemConfig::kHttpEnableStatsFilter,
       SystemConfig::kRegisterTestFunctions,
       SystemConfig::kHttpMaxAllocateBytes,
+      SystemConfig::kHttpClientHttp2Enabled,
+      SystemConfig::kExchangeAcknowledgeDelayMs,
       SystemConfig::kQueryMaxMemoryPerNode,
       SystemConfig::kEnableMemoryLeakCheck,
       SystemConfig::kRemoteFunctionServerThriftPort,
@@ -250,6 +271,11 @@ bool SystemConfig::httpServerHttpsEnabled() const {
   return opt.value_or(kHttpServerHttpsEnabledDefault);
 }
 
+bool SystemConfig::httpServerHttp2Enabled() const {
+  auto opt = optionalProperty<bool>(std::string(kHttpServerHttp2Enabled));
+  return opt.value_or(kHttpServerHttp2EnabledDefault);
+}
+
 std::string SystemConfig::httpsSupportedCiphers() const {
   auto opt = optionalProperty<std::string>(std::string(kHttpsSupportedCiphers));
   return opt.value_or(std::string(kHttpsSupportedCiphersDefault));
@@ -329,11 +355,26 @@ int32_t SystemConfig::numSpillThreads() const {
   return opt.hasValue() ? opt.value() : std::thread::hardware_concurrency();
 }
 
+int32_t SystemConfig::numShuffleIoThreads() const {
+  auto opt = optionalProperty<int32_t>(std::string(kNumShuffleIoThreads));
+  return opt.value_or(kNumShuffleIoThreadsDefault);
+}
+
 std::string SystemConfig::spillerSpillPath() const {
   auto opt = optionalProperty<std::string>(std::string(kSpillerSpillPath));
   return opt.hasValue() ? opt.value() : "";
 }
 
+bool SystemConfig::spillerUseIoUring() const {
+  auto opt = optionalProperty<bool>(std::string(kSpillerUseIoUring));
+  return opt.value_or(kSpillerUseIoUringDefault);
+}
+
+uint32_t SystemConfig::ioUringQueueDepth() const {
+  auto opt = optionalProperty<uint32_t>(std::string(kIoUringQueueDepth));
+  return opt.value_or(kIoUringQueueDepthDefault);
+}
+
 int32_t SystemConfig::shutdownOnsetSec() const {
   auto opt = optionalProperty<int32_t>(std::string(kShutdownOnsetSec));
   return opt.value_or(kShutdownOnsetSecDefault);
@@ -361,6 +402,52 @@ uint64_t SystemConfig::localShuffleMaxPartitionBytes() const {
   return opt.value_or(kLocalShuffleMaxPartitionBytesDefault);
 }
 
+bool SystemConfig::localShuffleConsolidatedFiles() const {
+  auto opt =
+      optionalProperty<bool>(std::string(kLocalShuffleConsolidatedFiles));
+  return opt.value_or(kLocalShuffleConsolidatedFilesDefault);
+}
+
+uint32_t SystemConfig::localShuffleMaxInflightWrites() const {
+  auto opt =
+      optionalProperty<uint32_t>(std::string(kLocalShuffleMaxInflightWrites));
+  return opt.value_or(kLocalShuffleMaxInflightWritesDefault);
+}
+
+uint32_t SystemConfig::localShuffleReadAheadBlocks() const {
+  auto opt =
+      optionalProperty<uint32_t>(std::string(kLocalShuffleReadAheadBlocks));
+  return opt.value_or(kLocalShuffleReadAheadBlocksDefault);
+}
+
+bool SystemConfig::localShuffleMmapReads() const {
+  auto opt = optionalProperty<bool>(std::string(kLocalShuffleMmapReads));
+  return opt.value_or(kLocalShuffleMmapReadsDefault);
+}
+
+bool SystemConfig::localShuffleUseIoUring() const {
+  auto opt = optionalProperty<bool>(std::string(kLocalShuffleUseIoUring));
+  return opt.value_or(kLocalShuffleUseIoUringDefault);
+}
+
+bool SystemConfig::localShuffleDirectIo() const {
+  auto opt = optionalProperty<bool>(std::string(kLocalShuffleDirectIo));
+  return opt.value_or(kLocalShuffleDirectIoDefault);
+}
+
+std::string SystemConfig::localShuffleCompressionCodec() const {
+  auto opt = optionalProperty<std::string>(
+      std::string(kLocalShuffleCompressionCodec));
+  return opt.hasValue() ? opt.value()
+                        : std::string(kLocalShuffleCompressionCodecDefault);
+}
+
+uint64_t SystemConfig::localShuffleMaxBufferedBytes() const {
+  auto opt =
+      optionalProperty<uint64_t>(std::string(kLocalShuffleMaxBufferedBytes));
+  return opt.value_or(kLocalShuffleMaxBufferedBytesDefault);
+}
+
 std::string SystemConfig::asyncCacheSsdPath() const {
   auto opt = optionalProperty<std::string>(std::string(kAsyncCacheSsdPath));
   return opt.hasValue() ? opt.value() : std::string(kAsyncCacheSsdPathDefault);
@@ -376,6 +463,45 @@ std::string SystemConfig::shuffleName() const {
   return opt.hasValue() ? opt.value() : std::string(kShuffleNameDefault);
 }
 
+bool SystemConfig::shuffleFusePartitionAndWrite() const {
+  auto opt =
+      optionalProperty<bool>(std::string(kShuffleFusePartitionAndWrite));
+  return opt.value_or(kShuffleFusePartitionAndWriteDefault);
+}
+
+bool SystemConfig::shuffleSharedTaskWriter() const {
+  auto opt = optionalProperty<bool>(std::string(kShuffleSharedTaskWriter));
+  return opt.value_or(kShuffleSharedTaskWriterDefault);
+}
+
+bool SystemConfig::shuffleClustered() const {
+  auto opt = optionalProperty<bool>(std::string(kShuffleClustered));
+  return opt.value_or(kShuffleClusteredDefault);
+}
+
+bool SystemConfig::shuffleSorted() const {
+  auto opt = optionalProperty<bool>(std::string(kShuffleSorted));
+  return opt.value_or(kShuffleSortedDefault);
+}
+
+uint64_t SystemConfig::shuffleSortedReadChunkBytes() const {
+  auto opt =
+      optionalProperty<uint64_t>(std::string(kShuffleSortedReadChunkBytes));
+  return opt.value_or(kShuffleSortedReadChunkBytesDefault);
+}
+
+std::string SystemConfig::shuffleSerializationFormat() const {
+  auto opt =
+      optionalProperty<std::string>(std::string(kShuffleSerializationFormat));
+  return opt.hasValue() ? opt.value()
+                        : std::string(kShuffleSerializationFormatDefault);
+}
+
+uint64_t SystemConfig::shuffleReadBatchBytes() const {
+  auto opt = optionalProperty<uint64_t>(std::string(kShuffleReadBatchBytes));
+  return opt.value_or(kShuffleReadBatchBytesDefault);
+}
+
 bool SystemConfig::enableSerializedPageChecksum() const {
   auto opt = optionalProperty<bool>(std::string(kEnableSerializedPageChecksum));
   return opt.value_or(kEnableSerializedPageChecksumDefault);
@@ -426,6 +552,17 @@ uint64_t SystemConfig::httpMaxAllocateBytes() const {
   return opt.value_or(kHttpMaxAllocateBytesDefault);
 }
 
+bool SystemConfig::httpClientHttp2Enabled() const {
+  auto opt = optionalProperty<bool>(std::string(kHttpClientHttp2Enabled));
+  return opt.value_or(kHttpClientHttp2EnabledDefault);
+}
+
+uint64_t SystemConfig::exchangeAcknowledgeDelayMs() const {
+  auto opt =
+      optionalProperty<uint64_t>(std::string(kExchangeAcknowledgeDelayMs));
+  return opt.value_or(kExchangeAcknowledgeDelayMsDefault);
+}
+
 uint64_t SystemConfig::queryMaxMemoryPerNode() const {
   auto opt = optionalProperty(std::string(kQueryMaxMemoryPerNode));
   if (opt.hasValue()) {
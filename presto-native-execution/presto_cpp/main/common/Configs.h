@@ -107,6 +107,11 @@ class SystemConfig : public ConfigBase {
       "http-server.https.port"};
   static constexpr std::string_view kHttpServerHttpsEnabled{
       "http-server.https.enabled"};
+  /// If true, the https server offers HTTP/2 to its clients through ALPN, so
+  /// that the clients with http-client.http2-enabled can multiplex their
+  /// requests. Otherwise the https server only speaks HTTP/1.1.
+  static constexpr std::string_view kHttpServerHttp2Enabled{
+      "http-server.http2-enabled"};
   static constexpr std::string_view kHttpsSupportedCiphers{
       "https-supported-ciphers"};
   static constexpr std::string_view kHttpsCertPath{"https-cert-path"};
@@ -120,8 +125,20 @@ class SystemConfig : public ConfigBase {
       "num-connector-io-threads"};
   static constexpr std::string_view kNumQueryThreads{"num-query-threads"};
   static constexpr std::string_view kNumSpillThreads{"num-spill-threads"};
+  /// Number of threads writing and reading ahead local shuffle blocks in the
+  /// background. If zero, blocks are read and written inline by the driver
+  /// threads.
+  static constexpr std::string_view kNumShuffleIoThreads{
+      "num-shuffle-io-threads"};
   static constexpr std::string_view kSpillerSpillPath{
       "experimental.spiller-spill-path"};
+  /// If true, spill files under kSpillerSpillPath are written and read
+  /// through the io_uring file system. Requires a build with
+  /// PRESTO_ENABLE_IO_URING.
+  static constexpr std::string_view kSpillerUseIoUring{
+      "experimental.spiller-use-io-uring"};
+  /// Number of entries of the submission queue of each io_uring.
+  static constexpr std::string_view kIoUringQueueDepth{"io-uring.queue-depth"};
   static constexpr std::string_view kShutdownOnsetSec{"shutdown-onset-sec"};
   static constexpr std::string_view kSystemMemoryGb{"system-memory-gb"};
   static constexpr std::string_view kAsyncCacheSsdGb{"async-cache-ssd-gb"};
@@ -146,7 +163,84 @@ class SystemConfig : public ConfigBase {
       "enable_velox_expression_logging"};
   static constexpr std::string_view kLocalShuffleMaxPartitionBytes{
       "shuffle.local.max-partition-bytes"};
+  /// If true, each local shuffle writer appends all its blocks to a single
+  /// data file, instead of writing one file per flushed partition block. The
+  /// offsets of the blocks of each partition are recorded in the manifest of
+  /// the writer.
+  static constexpr std::string_view kLocalShuffleConsolidatedFiles{
+      "shuffle.local.consolidated-files"};
+  /// Maximum number of blocks a local shuffle writer may have queued for
+  /// background writing before it blocks its driver. Only used if
+  /// kNumShuffleIoThreads is set.
+  static constexpr std::string_view kLocalShuffleMaxInflightWrites{
+      "shuffle.local.max-inflight-writes"};
+  /// Number of upcoming blocks a local shuffle reader loads in the background
+  /// while the current one is processed. Only used if kNumShuffleIoThreads is
+  /// set.
+  static constexpr std::string_view kLocalShuffleReadAheadBlocks{
+      "shuffle.local.read-ahead-blocks"};
+  /// If true, local shuffle readers memory-map the blocks of shuffle files on
+  /// the local file system and pass the mapped bytes on without copying them.
+  static constexpr std::string_view kLocalShuffleMmapReads{
+      "shuffle.local.mmap-reads"};
+  /// If true, local shuffle files are written and read through the io_uring
+  /// file system, which writes the last blocks of all the partitions of a
+  /// writer in one batch. Requires a build with PRESTO_ENABLE_IO_URING.
+  static constexpr std::string_view kLocalShuffleUseIoUring{
+      "shuffle.local.use-io-uring"};
+  /// If true, local shuffle files on the local file system are written and
+  /// read with O_DIRECT, keeping shuffle data out of the page cache.
+  static constexpr std::string_view kLocalShuffleDirectIo{
+      "shuffle.local.direct-io"};
+  /// Codec used to compress the blocks written by local shuffle writers. One
+  /// of 'none', 'lz4' or 'zstd'. Readers detect compressed blocks on their
+  /// own.
+  static constexpr std::string_view kLocalShuffleCompressionCodec{
+      "shuffle.local.compression-codec"};
+  /// Maximum total capacity of the partition buffers of a local shuffle
+  /// writer. The largest partitions are flushed first when it is exceeded.
+  /// Zero means no limit.
+  static constexpr std::string_view kLocalShuffleMaxBufferedBytes{
+      "shuffle.local.max-buffered-bytes"};
   static constexpr std::string_view kShuffleName{"shuffle.name"};
+  /// If true, batch plans partition, serialize and write shuffle rows in one
+  /// operator per driver instead of gathering the serialized rows into a
+  /// single shuffle writer per task.
+  static constexpr std::string_view kShuffleFusePartitionAndWrite{
+      "shuffle.fuse-partition-and-write"};
+  /// If true, the fused partition and write operators of all the drivers of
+  /// a task append to one shared shuffle writer, so that a task has one set
+  /// of partition buffers and files instead of one per driver. Only used if
+  /// kShuffleFusePartitionAndWrite is set.
+  static constexpr std::string_view kShuffleSharedTaskWriter{
+      "shuffle.shared-task-writer"};
+  /// If true, batch plans order the serialized shuffle rows of each batch by
+  /// partition and lay them out back to back, so that shuffle writers append
+  /// the rows of a partition with a single copy. Not used if
+  /// kShuffleFusePartitionAndWrite is set.
+  static constexpr std::string_view kShuffleClustered{"shuffle.clustered"};
+  /// If true, batch plans turn a partial sort feeding a shuffle into a sorted
+  /// shuffle: the shuffle writers sort each block they write and the merging
+  /// reads of the next stage merge the sorted blocks. Only used if the
+  /// shuffle writers support sorted blocks, the rows are serialized in the
+  /// 'unsafe-row' format and all the sorting keys are of supported types.
+  static constexpr std::string_view kShuffleSorted{"shuffle.sorted"};
+  /// Bytes of each sorted block that the reads of a sorted shuffle hold in
+  /// memory while merging the blocks. A read holds this much for each block
+  /// of its partition, or a whole row if larger.
+  static constexpr std::string_view kShuffleSortedReadChunkBytes{
+      "shuffle.sorted.read-chunk-bytes"};
+  /// Format of the data written to and read from shuffles by batch plans.
+  /// 'unsafe-row' serializes each row on its own. 'presto' serializes the rows
+  /// of each partition of a batch together as a PrestoPage, which keeps data
+  /// columnar and is cheaper to write and read for wide rows.
+  static constexpr std::string_view kShuffleSerializationFormat{
+      "shuffle.serialization-format"};
+  /// Target size in bytes of the serialized rows that shuffle reads turn into
+  /// one output batch in the 'unsafe-row' format. Larger shuffle blocks are
+  /// split into several batches.
+  static constexpr std::string_view kShuffleReadBatchBytes{
+      "shuffle.read-batch-bytes"};
   static constexpr std::string_view kHttpEnableAccessLog{
       "http-server.enable-access-log"};
   static constexpr std::string_view kHttpEnableStatsFilter{
@@ -158,6 +252,19 @@ class SystemConfig : public ConfigBase {
   /// the received http response data.
   static constexpr std::string_view kHttpMaxAllocateBytes{
       "http-server.max-response-allocate-bytes"};
+  /// Whether http clients negotiate HTTP/2 with the remote server: through
+  /// ALPN for https and through an 'Upgrade: h2c' request for http. Requests
+  /// of all the clients to a host are then multiplexed over shared sessions.
+  /// Servers that only speak HTTP/1.1 keep being served over HTTP/1.1. Https
+  /// workers offer HTTP/2 only with http-server.http2-enabled.
+  static constexpr std::string_view kHttpClientHttp2Enabled{
+      "http-client.http2-enabled"};
+  /// How long a PrestoExchangeSource waits for its next result request to
+  /// acknowledge the pages it received, before acknowledging them with a
+  /// separate request. 0 acknowledges every response with a separate request
+  /// right away.
+  static constexpr std::string_view kExchangeAcknowledgeDelayMs{
+      "exchange.http-client.acknowledge-delay-ms"};
   static constexpr std::string_view kQueryMaxMemoryPerNode{
       "query.max-memory-per-node"};
 
@@ -178,6 +285,7 @@ class SystemConfig : public ConfigBase {
   static constexpr int32_t kConcurrentLifespansPerTaskDefault = 1;
   static constexpr int32_t kHttpExecThreadsDefault = 8;
   static constexpr bool kHttpServerHttpsEnabledDefault = false;
+  static constexpr bool kHttpServerHttp2EnabledDefault = false;
   static constexpr std::string_view kHttpsSupportedCiphersDefault{
       "ECDHE-ECDSA-AES256-GCM-SHA384,AES256-GCM-SHA384"};
   static constexpr int32_t kNumIoThreadsDefault = 30;
@@ -186,12 +294,32 @@ class SystemConfig : public ConfigBase {
   static constexpr int32_t kSystemMemoryGbDefault = 40;
   static constexpr int32_t kMmapArenaCapacityRatioDefault = 10;
   static constexpr uint64_t kLocalShuffleMaxPartitionBytesDefault = 1 << 28;
+  static constexpr bool kLocalShuffleConsolidatedFilesDefault = false;
+  static constexpr int32_t kNumShuffleIoThreadsDefault = 0;
+  static constexpr uint32_t kLocalShuffleMaxInflightWritesDefault = 4;
+  static constexpr uint32_t kLocalShuffleReadAheadBlocksDefault = 2;
+  static constexpr bool kLocalShuffleMmapReadsDefault = false;
+  static constexpr bool kLocalShuffleUseIoUringDefault = false;
+  static constexpr bool kLocalShuffleDirectIoDefault = false;
+  static constexpr bool kSpillerUseIoUringDefault = false;
+  static constexpr uint32_t kIoUringQueueDepthDefault = 128;
+  static constexpr uint64_t kLocalShuffleMaxBufferedBytesDefault = 1 << 28;
+  static constexpr std::string_view kLocalShuffleCompressionCodecDefault{
+      "none"};
   static constexpr uint64_t kAsyncCacheSsdGbDefault = 0;
   static constexpr uint64_t kAsyncCacheSsdCheckpointGbDefault = 0;
   static constexpr std::string_view kAsyncCacheSsdPathDefault{
       "/mnt/flash/async_cache."};
   static constexpr bool kAsyncCacheSsdDisableFileCowDefault{false};
   static constexpr std::string_view kShuffleNameDefault{""};
+  static constexpr bool kShuffleFusePartitionAndWriteDefault = false;
+  static constexpr bool kShuffleSharedTaskWriterDefault = false;
+  static constexpr bool kShuffleClusteredDefault = false;
+  static constexpr bool kShuffleSortedDefault = false;
+  static constexpr uint64_t kShuffleSortedReadChunkBytesDefault = 1 << 20;
+  static constexpr std::string_view kShuffleSerializationFormatDefault{
+      "unsafe-row"};
+  static constexpr uint64_t kShuffleReadBatchBytesDefault = 10 << 20;
   static constexpr bool kEnableSerializedPageChecksumDefault = true;
   static constexpr bool kEnableVeloxTaskLoggingDefault = false;
   static constexpr bool kEnableVeloxExprSetLoggingDefault = false;
@@ -201,6 +329,8 @@ class SystemConfig : public ConfigBase {
   static constexpr bool kHttpEnableStatsFilterDefault = false;
   static constexpr bool kRegisterTestFunctionsDefault = false;
   static constexpr uint64_t kHttpMaxAllocateBytesDefault = 64 << 10;
+  static constexpr bool kHttpClientHttp2EnabledDefault = false;
+  static constexpr uint64_t kExchangeAcknowledgeDelayMsDefault = 0;
   /// 1/10 of kSystemMemoryGbDefault.
   static constexpr uint64_t kQueryMaxMemoryPerNodeDefault = 4UL << 30;
   static constexpr bool kEnableMemoryLeakCheckDefault = true;
@@ -213,6 +343,8 @@ class SystemConfig : public ConfigBase {
 
   bool httpServerHttpsEnabled() const;
 
+  bool httpServerHttp2Enabled() const;
+
   int httpServerHttpsPort() const;
 
   // A list of ciphers (comma separated) that are supported by
@@ -262,8 +394,14 @@ class SystemConfig : public ConfigBase {
 
   int32_t numSpillThreads() const;
 
+  int32_t numShuffleIoThreads() const;
+
   std::string spillerSpillPath() const;
 
+  bool spillerUseIoUring() const;
+
+  uint32_t ioUringQueueDepth() const;
+
   int32_t shutdownOnsetSec() const;
 
   int32_t systemMemoryGb() const;
@@ -274,12 +412,42 @@ class SystemConfig : public ConfigBase {
 
   uint64_t localShuffleMaxPartitionBytes() const;
 
+  bool localShuffleConsolidatedFiles() const;
+
+  uint32_t localShuffleMaxInflightWrites() const;
+
+  uint32_t localShuffleReadAheadBlocks() const;
+
+  bool localShuffleMmapReads() const;
+
+  bool localShuffleUseIoUring() const;
+
+  bool localShuffleDirectIo() const;
+
+  std::string localShuffleCompressionCodec() const;
+
+  uint64_t localShuffleMaxBufferedBytes() const;
+
   std::string asyncCacheSsdPath() const;
 
   bool asyncCacheSsdDisableFileCow() const;
 
   std::string shuffleName() const;
 
+  bool shuffleFusePartitionAndWrite() const;
+
+  bool shuffleSharedTaskWriter() const;
+
+  bool shuffleClustered() const;
+
+  bool shuffleSorted() const;
+
+  uint64_t shuffleSortedReadChunkBytes() const;
+
+  std::string shuffleSerializationFormat() const;
+
+  uint64_t shuffleReadBatchBytes() const;
+
   bool enableSerializedPageChecksum() const;
 
   bool enableVeloxTaskLogging() const;
@@ -300,6 +468,10 @@ class SystemConfig : public ConfigBase {
 
   uint64_t httpMaxAllocateBytes() const;
 
+  bool httpClientHttp2Enabled() const;
+
+  uint64_t exchangeAcknowledgeDelayMs() const;
+
   uint64_t queryMaxMemoryPerNode() const;
 
   bool enableMemoryLeakCheck() const;
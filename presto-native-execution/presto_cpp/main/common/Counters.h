@@ -139,6 +139,14 @@ constexpr folly::StringPiece kCounterExchangeSourceQueuedBytes{
 /// Peak number of bytes queued in PrestoExchangeSource waiting for consume.
 constexpr folly::StringPiece kCounterExchangeSourcePeakQueuedBytes{
     "presto_cpp.exchange_source_peak_queued_bytes"};
+/// Largest number of PrestoExchangeSource http clients on one event base of
+/// the network IO executor.
+constexpr folly::StringPiece kCounterExchangeSourceEventBaseMaxClients{
+    "presto_cpp.exchange_source_event_base_max_clients"};
+/// Average number of PrestoExchangeSource http clients on an event base of the
+/// network IO executor.
+constexpr folly::StringPiece kCounterExchangeSourceEventBaseAvgClients{
+    "presto_cpp.exchange_source_event_base_avg_clients"};
 
 // ================== Cache Counters ==================
 
@@ -0,0 +1,372 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "presto_cpp/main/common/IoUringFileSystem.h"
+#include <fcntl.h>
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <deque>
+#include <filesystem>
+#include "velox/common/base/Exceptions.h"
+#include "velox/common/file/File.h"
+
+namespace facebook::presto {
+
+namespace {
+
+std::string_view extractPath(std::string_view path) {
+  VELOX_CHECK_EQ(
+      path.compare(0, kIoUringScheme.size(), kIoUringScheme),
+      0,
+      "Not an io_uring path: {}",
+      path);
+  return path.substr(kIoUringScheme.size());
+}
+
+// The io_uring instance of one thread. A ring must not be used by several
+// threads at once, so each thread gets its own on first use.
+class Ring {
+ public:
+  explicit Ring(uint32_t queueDepth) {
+    const auto ret = ::io_uring_queue_init(queueDepth, &ring_, 0);
+    VELOX_CHECK_EQ(
+        ret, 0, "Cannot create io_uring: {}", folly::errnoStr(-ret));
+  }
+
+  ~Ring() {
+    ::io_uring_queue_exit(&ring_);
+  }
+
+  io_uring* get() {
+    return &ring_;
+  }
+
+  static Ring& forThread(uint32_t queueDepth) {
+    thread_local std::unique_ptr<Ring> ring;
+    if (ring == nullptr) {
+      ring = std::make_unique<Ring>(queueDepth);
+    }
+    return *ring;
+  }
+
+ private:
+  io_uring ring_;
+};
+
+struct IoOp {
+  int fd;
+  bool write;
+  char* buffer;
+  uint64_t size;
+  uint64_t offset;
+};
+
+// Runs 'ops' on the ring of the calling thread with as many of them in flight
+// as the ring takes. Short reads and writes are resubmitted for the rest of
+// their bytes. On error, waits for the ops in flight before throwing, as
+// these still use their buffers.
+void runIo(std::vector<IoOp>& ops, uint32_t queueDepth) {
+  auto* ring = Ring::forThread(queueDepth).get();
+  std::deque<size_t> queue;
+  for (size_t i = 0; i < ops.size(); ++i) {
+    if (ops[i].size > 0) {
+      queue.push_back(i);
+    }
+  }
+  size_t numInflight = 0;
+  std::string error;
+  while (!queue.empty() || numInflight > 0) {
+    while (!queue.empty()) {
+      auto* sqe = ::io_uring_get_sqe(ring);
+      if (sqe == nullptr) {
+        break;
+      }
+      const auto i = queue.front();
+      queue.pop_front();
+      auto& op = ops[i];
+      if (op.write) {
+        ::io_uring_prep_write(sqe, op.fd, op.buffer, op.size, op.offset);
+      } else {
+        ::io_uring_prep_read(sqe, op.fd, op.buffer, op.size, op.offset);
+      }
+      ::io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(i));
+      ++numInflight;
+    }
+    const auto ret = ::io_uring_submit_and_wait(ring, 1);
+    if (ret < 0 && ret != -EINTR) {
+      // The prepared ops stay queued in the ring and the next submission
+      // retries them. Stops queueing more.
+      if (error.empty()) {
+        error =
+            fmt::format("io_uring submit failed: {}", folly::errnoStr(-ret));
+      }
+      queue.clear();
+    }
+
+    io_uring_cqe* cqe;
+    unsigned head;
+    unsigned numCompleted = 0;
+    io_uring_for_each_cqe(ring, head, cqe) {
+      ++numCompleted;
+      --numInflight;
+      const auto i = reinterpret_cast<uintptr_t>(::io_uring_cqe_get_data(cqe));
+      auto& op = ops[i];
+      if (cqe->res <= 0) {
+        // A write that makes no progress would be resubmitted forever.
+        if (error.empty()) {
+          if (cqe->res < 0) {
+            error = fmt::format(
+                "io_uring {} failed: {}",
+                op.write ? "write" : "read",
+                folly::errnoStr(-cqe->res));
+          } else {
+            error = op.write ? "io_uring write made no progress"
+                             : "io_uring read past the end of file";
+          }
+        }
+        queue.clear();
+      } else if (static_cast<uint64_t>(cqe->res) < op.size) {
+        op.buffer += cqe->res;
+        op.size -= cqe->res;
+        op.offset += cqe->res;
+        if (error.empty()) {
+          queue.push_back(i);
+        }
+      }
+    }
+    ::io_uring_cq_advance(ring, numCompleted);
+  }
+  if (!error.empty()) {
+    VELOX_FAIL(error);
+  }
+}
+
+int openFile(const std::string& path, int flags) {
+  const auto fd = ::open(path.c_str(), flags, 0644);
+  VELOX_CHECK_GE(
+      fd, 0, "Cannot open file {}: {}", path, folly::errnoStr(errno));
+  return fd;
+}
+
+class IoUringReadFile : public velox::ReadFile {
+ public:
+  IoUringReadFile(std::string_view path, uint32_t queueDepth)
+      : path_(path),
+        fd_(openFile(path_, O_RDONLY)),
+        queueDepth_(queueDepth) {
+    struct stat st;
+    VELOX_CHECK_EQ(::fstat(fd_, &st), 0, "Cannot stat file {}", path_);
+    size_ = st.st_size;
+  }
+
+  ~IoUringReadFile() override {
+    ::close(fd_);
+  }
+
+  std::string_view pread(uint64_t offset, uint64_t length, void* buf)
+      const final {
+    std::vector<IoOp> ops{
+        {fd_, false, static_cast<char*>(buf), length, offset}};
+    runIo(ops, queueDepth_);
+    return {static_cast<char*>(buf), length};
+  }
+
+  // Submits the reads of all the ranges together.
+  uint64_t preadv(
+      uint64_t offset,
+      const std::vector<folly::Range<char*>>& buffers) const final {
+    std::vector<IoOp> ops;
+    ops.reserve(buffers.size());
+    uint64_t length = 0;
+    for (const auto& range : buffers) {
+      // A range without data is a gap that is not read.
+      if (range.data() != nullptr) {
+        ops.push_back(
+            {fd_, false, range.data(), range.size(), offset + length});
+      }
+      length += range.size();
+    }
+    runIo(ops, queueDepth_);
+    return length;
+  }
+
+  uint64_t size() const final {
+    return size_;
+  }
+
+  uint64_t memoryUsage() const final {
+    return sizeof(*this);
+  }
+
+  bool shouldCoalesce() const final {
+    return false;
+  }
+
+  std::string getName() const final {
+    return path_;
+  }
+
+  uint64_t getNaturalReadSize() const final {
+    return 10 << 20;
+  }
+
+ private:
+  const std::string path_;
+  const int fd_;
+  const uint32_t queueDepth_;
+  uint64_t size_;
+};
+
+class IoUringWriteFile : public velox::WriteFile {
+ public:
+  IoUringWriteFile(std::string_view path, uint32_t queueDepth)
+      : path_(path),
+        fd_(openFile(path_, O_WRONLY | O_CREAT | O_EXCL)),
+        queueDepth_(queueDepth) {}
+
+  ~IoUringWriteFile() override {
+    close();
+  }
+
+  void append(std::string_view data) final {
+    VELOX_CHECK_GE(fd_, 0, "File is closed: {}", path_);
+    std::vector<IoOp> ops{
+        {fd_, true, const_cast<char*>(data.data()), data.size(), size_}};
+    runIo(ops, queueDepth_);
+    size_ += data.size();
+  }
+
+  // The appends go straight to the file.
+  void flush() final {}
+
+  void close() final {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  uint64_t size() const final {
+    return size_;
+  }
+
+ private:
+  const std::string path_;
+  int fd_;
+  const uint32_t queueDepth_;
+  uint64_t size_{0};
+};
+
+} // namespace
+
+IoUringFileSystem::IoUringFileSystem(
+    std::shared_ptr<const velox::Config> config,
+    uint32_t queueDepth)
+    : FileSystem(std::move(config)), queueDepth_(queueDepth) {
+  VELOX_CHECK_GT(queueDepth_, 0);
+}
+
+std::unique_ptr<velox::ReadFile> IoUringFileSystem::openFileForRead(
+    std::string_view path) {
+  return std::make_unique<IoUringReadFile>(extractPath(path), queueDepth_);
+}
+
+std::unique_ptr<velox::WriteFile> IoUringFileSystem::openFileForWrite(
+    std::string_view path) {
+  return std::make_unique<IoUringWriteFile>(extractPath(path), queueDepth_);
+}
+
+void IoUringFileSystem::remove(std::string_view path) {
+  const std::string file(extractPath(path));
+  VELOX_CHECK_EQ(
+      ::remove(file.c_str()),
+      0,
+      "Cannot remove file {}: {}",
+      file,
+      folly::errnoStr(errno));
+}
+
+void IoUringFileSystem::rename(
+    std::string_view oldPath,
+    std::string_view newPath,
+    bool overwrite) {
+  const auto oldFile = extractPath(oldPath);
+  const auto newFile = extractPath(newPath);
+  if (!overwrite) {
+    VELOX_CHECK(
+        !std::filesystem::exists(newFile),
+        "Cannot rename {} to existing file {}",
+        oldFile,
+        newFile);
+  }
+  std::filesystem::rename(oldFile, newFile);
+}
+
+bool IoUringFileSystem::exists(std::string_view path) {
+  return std::filesystem::exists(extractPath(path));
+}
+
+std::vector<std::string> IoUringFileSystem::list(std::string_view path) {
+  std::vector<std::string> files;
+  for (const auto& entry :
+       std::filesystem::directory_iterator{extractPath(path)}) {
+    files.push_back(std::string(kIoUringScheme) + entry.path().string());
+  }
+  return files;
+}
+
+void IoUringFileSystem::mkdir(std::string_view path) {
+  std::error_code ec;
+  std::filesystem::create_directories(extractPath(path), ec);
+  VELOX_CHECK_EQ(
+      0, ec.value(), "Cannot create directory {}: {}", path, ec.message());
+}
+
+void IoUringFileSystem::writeFiles(const std::vector<WriteRequest>& requests) {
+  std::vector<IoOp> ops;
+  ops.reserve(requests.size());
+  SCOPE_EXIT {
+    for (const auto& op : ops) {
+      ::close(op.fd);
+    }
+  };
+  for (const auto& request : requests) {
+    ops.push_back(
+        {openFile(
+             std::string(extractPath(request.path)),
+             O_WRONLY | O_CREAT | O_EXCL),
+         true,
+         const_cast<char*>(request.data.data()),
+         request.data.size(),
+         0});
+  }
+  runIo(ops, queueDepth_);
+}
+
+void registerIoUringFileSystem(uint32_t queueDepth) {
+  velox::filesystems::registerFileSystem(
+      [](std::string_view path) {
+        return path.compare(0, kIoUringScheme.size(), kIoUringScheme) == 0;
+      },
+      [queueDepth](
+          std::shared_ptr<const velox::Config> config, std::string_view) {
+        static std::shared_ptr<velox::filesystems::FileSystem> fileSystem =
+            std::make_shared<IoUringFileSystem>(std::move(config), queueDepth);
+        return fileSystem;
+      });
+}
+
+} // namespace facebook::presto
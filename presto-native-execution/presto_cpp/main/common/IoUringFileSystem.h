@@ -0,0 +1,89 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "velox/common/file/FileSystems.h"
+
+namespace facebook::presto {
+
+/// Scheme of the paths served by IoUringFileSystem.
+constexpr std::string_view kIoUringScheme{"uring:"};
+
+/// Returns the io_uring path of 'path', a path on the local file system with
+/// or without the 'file:' scheme.
+inline std::string toIoUringPath(const std::string& path) {
+  static const std::string kFileScheme = "file:";
+  if (path.compare(0, kIoUringScheme.size(), kIoUringScheme) == 0) {
+    return path;
+  }
+  if (path.compare(0, kFileScheme.size(), kFileScheme) == 0) {
+    return std::string(kIoUringScheme) + path.substr(kFileScheme.size());
+  }
+  return std::string(kIoUringScheme) + path;
+}
+
+/// A file system over the local disks which reads and writes files through
+/// io_uring. Serves the paths of the local file system prefixed with
+/// 'uring:'. Each thread submits its I/O to a ring of its own. Next to the
+/// one-file-at-a-time FileSystem API, writeFiles() submits the writes of many
+/// files together, which saves most of the system calls when writing many
+/// small shuffle blocks. Only available when built with
+/// PRESTO_ENABLE_IO_URING.
+class IoUringFileSystem : public velox::filesystems::FileSystem {
+ public:
+  IoUringFileSystem(
+      std::shared_ptr<const velox::Config> config,
+      uint32_t queueDepth);
+
+  std::string name() const override {
+    return "io_uring FS";
+  }
+
+  std::unique_ptr<velox::ReadFile> openFileForRead(
+      std::string_view path) override;
+
+  std::unique_ptr<velox::WriteFile> openFileForWrite(
+      std::string_view path) override;
+
+  void remove(std::string_view path) override;
+
+  void rename(
+      std::string_view oldPath,
+      std::string_view newPath,
+      bool overwrite = false) override;
+
+  bool exists(std::string_view path) override;
+
+  std::vector<std::string> list(std::string_view path) override;
+
+  void mkdir(std::string_view path) override;
+
+  struct WriteRequest {
+    std::string path;
+    std::string_view data;
+  };
+
+  /// Creates the files of 'requests' and writes their data. Fails if any of
+  /// the files exists. All the writes are in flight together, up to the
+  /// queue depth.
+  void writeFiles(const std::vector<WriteRequest>& requests);
+
+ private:
+  const uint32_t queueDepth_;
+};
+
+/// Registers IoUringFileSystem for the paths prefixed with 'uring:'.
+void registerIoUringFileSystem(uint32_t queueDepth);
+
+} // namespace facebook::presto
@@ -0,0 +1,108 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <folly/testing/TestUtil.h>
+#include <gtest/gtest.h>
+#include "presto_cpp/main/common/IoUringFileSystem.h"
+#include "velox/common/base/tests/GTestUtils.h"
+#include "velox/common/file/File.h"
+
+using namespace facebook::velox;
+using namespace facebook::presto;
+
+class IoUringFileSystemTest : public testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    registerIoUringFileSystem(8);
+  }
+
+  std::string path(const std::string& name) const {
+    return toIoUringPath(tempDir_.path().string() + "/" + name);
+  }
+
+  std::shared_ptr<filesystems::FileSystem> fileSystem() const {
+    return filesystems::getFileSystem(path(""), nullptr);
+  }
+
+  folly::test::TemporaryDirectory tempDir_;
+};
+
+TEST_F(IoUringFileSystemTest, toIoUringPath) {
+  EXPECT_EQ("uring:/a/b", toIoUringPath("/a/b"));
+  EXPECT_EQ("uring:/a/b", toIoUringPath("file:/a/b"));
+  EXPECT_EQ("uring:/a/b", toIoUringPath("uring:/a/b"));
+}
+
+TEST_F(IoUringFileSystemTest, writeAndRead) {
+  auto fs = fileSystem();
+  ASSERT_EQ("io_uring FS", fs->name());
+  const auto file = path("data");
+  {
+    auto writeFile = fs->openFileForWrite(file);
+    writeFile->append("hello ");
+    writeFile->append("io_uring");
+    EXPECT_EQ(14, writeFile->size());
+    writeFile->close();
+  }
+  VELOX_ASSERT_THROW(fs->openFileForWrite(file), "Cannot open file");
+  ASSERT_TRUE(fs->exists(file));
+
+  auto readFile = fs->openFileForRead(file);
+  ASSERT_EQ(14, readFile->size());
+  EXPECT_EQ("hello io_uring", readFile->pread(0, 14));
+  EXPECT_EQ("io_uring", readFile->pread(6, 8));
+
+  // Reads both words in one batch and skips the space between them.
+  std::string first(5, '\0');
+  std::string second(8, '\0');
+  EXPECT_EQ(
+      14,
+      readFile->preadv(
+          0,
+          {folly::Range<char*>(first.data(), first.size()),
+           folly::Range<char*>(nullptr, 1),
+           folly::Range<char*>(second.data(), second.size())}));
+  EXPECT_EQ("hello", first);
+  EXPECT_EQ("io_uring", second);
+  VELOX_ASSERT_THROW(readFile->pread(10, 8), "past the end of file");
+
+  fs->rename(file, path("renamed"));
+  EXPECT_FALSE(fs->exists(file));
+  EXPECT_EQ(std::vector<std::string>{path("renamed")}, fs->list(path("")));
+  fs->remove(path("renamed"));
+  EXPECT_TRUE(fs->list(path("")).empty());
+}
+
+TEST_F(IoUringFileSystemTest, batches) {
+  auto fs = std::dynamic_pointer_cast<IoUringFileSystem>(fileSystem());
+  ASSERT_NE(fs, nullptr);
+  fs->mkdir(path("dir/sub"));
+  // More files than the queue depth of 8.
+  constexpr int32_t kNumFiles = 50;
+  std::vector<std::string> contents;
+  std::vector<IoUringFileSystem::WriteRequest> writes;
+  for (auto i = 0; i < kNumFiles; ++i) {
+    contents.push_back(std::string(1000 + i, 'a' + i % 26));
+  }
+  for (auto i = 0; i < kNumFiles; ++i) {
+    writes.push_back({path(fmt::format("dir/sub/{}", i)), contents[i]});
+  }
+  fs->writeFiles(writes);
+  EXPECT_EQ(kNumFiles, fs->list(path("dir/sub")).size());
+  VELOX_ASSERT_THROW(fs->writeFiles({writes[0]}), "Cannot open file");
+
+  for (auto i = 0; i < kNumFiles; ++i) {
+    auto file = fs->openFileForRead(writes[i].path);
+    EXPECT_EQ(contents[i], file->pread(0, file->size()));
+  }
+}
@@ -11,12 +11,106 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <fmt/format.h>
+#include <folly/Synchronized.h>
+#include <folly/container/F14Map.h>
+#include <proxygen/lib/http/codec/HTTP2Codec.h>
 #include <velox/common/base/Exceptions.h>
 
 #include "presto_cpp/main/common/Configs.h"
 #include "presto_cpp/main/http/HttpClient.h"
 
 namespace facebook::presto::http {
+
+// The sessions shared by the HttpClients of one EventBase, remote address,
+// timeout and TLS settings, and the timer of their connections. Must be
+// destructed on the EventBase thread.
+class ConnectionPool {
+ public:
+  ConnectionPool(
+      folly::EventBase* FOLLY_NONNULL eventBase,
+      std::chrono::milliseconds timeout)
+      : timer_(folly::HHWheelTimer::newTimer(
+            eventBase,
+            std::chrono::milliseconds(
+                folly::HHWheelTimer::DEFAULT_TICK_INTERVAL),
+            folly::AsyncTimeout::InternalEnum::NORMAL,
+            timeout)),
+        sessionPool_(std::make_unique<proxygen::SessionPool>(
+            nullptr,
+            kMaxIdleSessions)) {}
+
+  proxygen::SessionPool* sessionPool() const {
+    return sessionPool_.get();
+  }
+
+  folly::HHWheelTimer* timer() const {
+    return timer_.get();
+  }
+
+ private:
+  // The idle HTTP/1.1 sessions kept open for the requests to come. Sized for
+  // the many HttpClients of the exchange sources of a host.
+  static constexpr uint32_t kMaxIdleSessions = 64;
+
+  const folly::HHWheelTimer::UniquePtr timer_;
+  // Declared after 'timer_' to be destructed first as its sessions use the
+  // timer.
+  std::unique_ptr<proxygen::SessionPool> sessionPool_;
+};
+
+namespace {
+folly::Synchronized<
+    folly::F14FastMap<std::string, std::weak_ptr<ConnectionPool>>>&
+connectionPools() {
+  static folly::Synchronized<
+      folly::F14FastMap<std::string, std::weak_ptr<ConnectionPool>>>
+      pools;
+  return pools;
+}
+
+// Returns the ConnectionPool of the HttpClients with the given settings,
+// creating it if there is none.
+std::shared_ptr<ConnectionPool> getConnectionPool(
+    folly::EventBase* eventBase,
+    const folly::SocketAddress& address,
+    std::chrono::milliseconds timeout,
+    const std::string& clientCertAndKeyPath,
+    const std::string& ciphers) {
+  const auto key = fmt::format(
+      "{}|{}|{}|{}|{}",
+      static_cast<void*>(eventBase),
+      address.describe(),
+      timeout.count(),
+      clientCertAndKeyPath,
+      ciphers);
+  auto pools = connectionPools().wlock();
+  auto it = pools->find(key);
+  if (it != pools->end()) {
+    if (auto pool = it->second.lock()) {
+      return pool;
+    }
+  }
+  // Drops the pools that are gone before adding a new one.
+  for (auto expiredIt = pools->begin(); expiredIt != pools->end();) {
+    if (expiredIt->second.expired()) {
+      expiredIt = pools->erase(expiredIt);
+    } else {
+      ++expiredIt;
+    }
+  }
+  std::shared_ptr<ConnectionPool> pool(
+      new ConnectionPool(eventBase, timeout),
+      [eventBase](ConnectionPool* pool) {
+        // Make sure to destroy the SessionPool on the EventBase thread.
+        eventBase->runImmediatelyOrRunInEventBaseThreadAndWait(
+            [pool] { delete pool; });
+      });
+  (*pools)[key] = pool;
+  return pool;
+}
+} // namespace
+
 HttpClient::HttpClient(
     folly::EventBase* eventBase,
     const folly::SocketAddress& address,
@@ -26,28 +120,31 @@ HttpClient::HttpClient(
     std::function<void(int)>&& reportOnBodyStatsFunc)
     : eventBase_(eventBase),
       address_(address),
-      timer_(folly::HHWheelTimer::newTimer(
-          eventBase_,
-          std::chrono::milliseconds(folly::HHWheelTimer::DEFAULT_TICK_INTERVAL),
-          folly::AsyncTimeout::InternalEnum::NORMAL,
-          timeout)),
       clientCertAndKeyPath_(clientCertAndKeyPath),
       ciphers_(ciphers),
       reportOnBodyStatsFunc_(std::move(reportOnBodyStatsFunc)),
-      maxResponseAllocBytes_(SystemConfig::instance()->httpMaxAllocateBytes()) {
-  sessionPool_ = std::make_unique<proxygen::SessionPool>(nullptr, 10);
+      maxResponseAllocBytes_(SystemConfig::instance()->httpMaxAllocateBytes()),
+      http2Enabled_(SystemConfig::instance()->httpClientHttp2Enabled()) {
   // clientCertAndKeyPath_ and ciphers_ both needed to be set for https. For
   // http, both need to be unset. One set and another is not set is not a valid
   // configuration.
   VELOX_CHECK_EQ(clientCertAndKeyPath_.empty(), ciphers_.empty());
+  connectionPool_ = getConnectionPool(
+      eventBase_, address_, timeout, clientCertAndKeyPath_, ciphers_);
 }
 
-HttpClient::~HttpClient() {
-  if (sessionPool_) {
-    // make sure to destroy SessionPool on the EventBase thread
-    eventBase_->runImmediatelyOrRunInEventBaseThreadAndWait(
-        [this] { sessionPool_.reset(); });
+HttpClient::~HttpClient() = default;
+
+// static
+size_t HttpClient::numConnectionPools() {
+  auto pools = connectionPools().rlock();
+  size_t numPools{0};
+  for (const auto& [key, pool] : *pools) {
+    if (!pool.expired()) {
+      ++numPools;
+    }
   }
+  return numPools;
 }
 
 HttpResponse::HttpResponse(
@@ -211,8 +308,18 @@ class ResponseHandler : public proxygen::HTTPTransactionHandler {
     self_.reset();
   }
 
-  void sendRequest(proxygen::HTTPTransaction* txn) {
-    txn->sendHeaders(request_);
+  // Sends the request on 'txn'. If 'upgradeToHttp2' is true, asks the server to
+  // switch the HTTP/1.1 connection of 'txn' to HTTP/2 (h2c).
+  void sendRequest(
+      proxygen::HTTPTransaction* txn,
+      bool upgradeToHttp2 = false) {
+    if (upgradeToHttp2 && body_.empty()) {
+      proxygen::HTTPMessage request = request_;
+      proxygen::HTTP2Codec::requestUpgrade(request);
+      txn->sendHeaders(request);
+    } else {
+      txn->sendHeaders(request_);
+    }
     if (!body_.empty()) {
       txn->sendBody(folly::IOBuf::wrapBuffer(body_.c_str(), body_.size()));
     }
@@ -235,31 +342,35 @@ class ConnectionHandler : public proxygen::HTTPConnector::Callback {
  public:
   ConnectionHandler(
       const std::shared_ptr<ResponseHandler>& responseHandler,
-      proxygen::SessionPool* sessionPool,
-      folly::HHWheelTimer* timer,
+      std::shared_ptr<ConnectionPool> connectionPool,
       folly::EventBase* eventBase,
       const folly::SocketAddress& address,
       const std::string& clientCertAndKeyPath,
-      const std::string& ciphers)
+      const std::string& ciphers,
+      bool http2Enabled)
       : responseHandler_(responseHandler),
-        sessionPool_(sessionPool),
-        timer_(timer),
+        connectionPool_(std::move(connectionPool)),
         eventBase_(eventBase),
         address_(address),
         clientCertAndKeyPath_(clientCertAndKeyPath),
-        ciphers_(ciphers) {}
+        ciphers_(ciphers),
+        http2Enabled_(http2Enabled) {}
 
   bool useHttps() {
     return !(clientCertAndKeyPath_.empty() && ciphers_.empty());
   }
 
   void connect() {
-    connector_ = std::make_unique<proxygen::HTTPConnector>(this, timer_);
+    connector_ = std::make_unique<proxygen::HTTPConnector>(
+        this, connectionPool_->timer());
     if (useHttps()) {
       auto context = std::make_shared<folly::SSLContext>();
       context->loadCertKeyPairFromFiles(
           clientCertAndKeyPath_.c_str(), clientCertAndKeyPath_.c_str());
       context->setCiphersOrThrow(ciphers_);
+      if (http2Enabled_) {
+        context->setAdvertisedNextProtocols({"h2", "http/1.1"});
+      }
       connector_->connectSSL(eventBase_, address_, context);
     } else {
       connector_->connect(eventBase_, address_);
@@ -269,10 +380,13 @@ class ConnectionHandler : public proxygen::HTTPConnector::Callback {
   void connectSuccess(proxygen::HTTPUpstreamSession* session) override {
     auto txn = session->newTransaction(responseHandler_.get());
     if (txn) {
-      responseHandler_->sendRequest(txn);
+      // Https connections negotiate HTTP/2 through ALPN on connect.
+      const bool upgradeToHttp2 = http2Enabled_ && !useHttps() &&
+          session->getCodecProtocol() == proxygen::CodecProtocol::HTTP_1_1;
+      responseHandler_->sendRequest(txn, upgradeToHttp2);
     }
 
-    sessionPool_->putSession(session);
+    connectionPool_->sessionPool()->putSession(session);
     delete this;
   }
 
@@ -283,13 +397,14 @@ class ConnectionHandler : public proxygen::HTTPConnector::Callback {
 
  private:
   std::shared_ptr<ResponseHandler> responseHandler_;
-  proxygen::SessionPool* sessionPool_;
+  // Kept alive until the new session is added to it.
+  const std::shared_ptr<ConnectionPool> connectionPool_;
   std::unique_ptr<proxygen::HTTPConnector> connector_;
-  folly::HHWheelTimer* timer_;
   folly::EventBase* eventBase_;
   const folly::SocketAddress address_;
   const std::string clientCertAndKeyPath_;
   const std::string ciphers_;
+  const bool http2Enabled_;
 };
 
 folly::SemiFuture<std::unique_ptr<HttpResponse>> HttpClient::sendRequest(
@@ -301,7 +416,8 @@ folly::SemiFuture<std::unique_ptr<HttpResponse>> HttpClient::sendRequest(
   auto future = responseHandler->initialize(responseHandler);
 
   eventBase_->runInEventBaseThreadAlwaysEnqueue([this, responseHandler]() {
-    auto txn = sessionPool_->getTransaction(responseHandler.get());
+    auto txn =
+        connectionPool_->sessionPool()->getTransaction(responseHandler.get());
     if (txn) {
       responseHandler->sendRequest(txn);
       return;
@@ -309,12 +425,12 @@ folly::SemiFuture<std::unique_ptr<HttpResponse>> HttpClient::sendRequest(
 
     auto connectionHandler = new ConnectionHandler(
         responseHandler,
-        sessionPool_.get(),
-        timer_.get(),
+        connectionPool_,
         eventBase_,
         address_,
         clientCertAndKeyPath_,
-        ciphers_);
+        ciphers_,
+        http2Enabled_);
 
     connectionHandler->connect();
   });
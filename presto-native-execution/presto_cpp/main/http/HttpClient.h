@@ -95,10 +95,18 @@ class HttpResponse {
   size_t bodyChainBytes_{0};
 };
 
-// HttpClient uses proxygen::SessionPool which must be destructed on the
-// EventBase thread. Hence, the destructor of HttpClient must run on the
-// EventBase thread as well. Consider running HttpClient's destructor
-// via EventBase::runOnDestruction.
+class ConnectionPool;
+
+// HttpClient sends its requests over the sessions of a ConnectionPool that is
+// shared by all the HttpClients of the process with the same EventBase, remote
+// address, timeout and TLS settings. A task reading from hundreds of upstream
+// sources thus reuses the connections to each host rather than opening its
+// own, and multiplexes its requests over them if the host speaks HTTP/2.
+//
+// The ConnectionPool is destructed on the EventBase thread once the last
+// HttpClient and in-flight request using it are gone. Hence, the EventBase
+// must outlive the HttpClient. Consider running HttpClient's destructor via
+// EventBase::runOnDestruction.
 class HttpClient {
  public:
   HttpClient(
@@ -117,10 +125,16 @@ class HttpClient {
       velox::memory::MemoryPool* pool,
       const std::string& body = "");
 
+  const ConnectionPool* testingConnectionPool() const {
+    return connectionPool_.get();
+  }
+
+  /// Returns the number of ConnectionPools in use in the process.
+  static size_t numConnectionPools();
+
  private:
   folly::EventBase* const eventBase_;
   const folly::SocketAddress address_;
-  const folly::HHWheelTimer::UniquePtr timer_;
   // clientCertAndKeyPath_ Points to a file (usually with pem extension) which
   // contains certificate and key concatenated together
   const std::string clientCertAndKeyPath_;
@@ -130,7 +144,9 @@ class HttpClient {
   const std::string ciphers_;
   const std::function<void(int)> reportOnBodyStatsFunc_;
   const uint64_t maxResponseAllocBytes_;
-  std::unique_ptr<proxygen::SessionPool> sessionPool_;
+  // Whether to negotiate HTTP/2 on new connections.
+  const bool http2Enabled_;
+  std::shared_ptr<ConnectionPool> connectionPool_;
 };
 
 class RequestBuilder {
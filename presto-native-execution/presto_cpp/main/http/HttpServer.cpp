@@ -95,12 +95,14 @@ HttpsConfig::HttpsConfig(
     const std::string& certPath,
     const std::string& keyPath,
     const std::string& supportedCiphers,
-    bool reusePort)
+    bool reusePort,
+    bool http2Enabled)
     : address_(address),
       certPath_(certPath),
       keyPath_(keyPath),
       supportedCiphers_(supportedCiphers),
-      reusePort_(reusePort) {
+      reusePort_(reusePort),
+      http2Enabled_(http2Enabled) {
   // Wangle separates ciphers by ":" where in the config it's separated with ","
   std::replace(supportedCiphers_.begin(), supportedCiphers_.end(), ',', ':');
 }
@@ -115,6 +117,10 @@ proxygen::HTTPServer::IPConfig HttpsConfig::ipConfig() const {
       folly::SSLContext::VerifyClientCertificate::DO_NOT_REQUEST;
   sslCfg.setCertificate(certPath_, keyPath_, "");
   sslCfg.sslCiphers = supportedCiphers_;
+  if (http2Enabled_) {
+    // Lets the http clients negotiate HTTP/2 to multiplex their requests.
+    sslCfg.setNextProtocols({"h2", "http/1.1"});
+  }
 
   ipConfig.sslConfigs.push_back(sslCfg);
 
@@ -239,7 +239,8 @@ class HttpsConfig {
       const std::string& certPath,
       const std::string& keyPath,
       const std::string& supportedCiphers,
-      bool reusePort = false);
+      bool reusePort = false,
+      bool http2Enabled = false);
 
   proxygen::HTTPServer::IPConfig ipConfig() const;
 
@@ -249,6 +250,8 @@ class HttpsConfig {
   const std::string keyPath_;
   std::string supportedCiphers_;
   const bool reusePort_;
+  // If true, offers HTTP/2 besides HTTP/1.1 through ALPN.
+  const bool http2Enabled_;
 };
 
 class HttpServer {
@@ -604,6 +604,56 @@ TEST_P(HttpTestSuite, testReportOnBodyStatsFunc) {
   wrapper.stop();
 }
 
+TEST_P(HttpTestSuite, sharedConnectionPool) {
+  auto memoryPool = defaultMemoryManager().addLeafPool("sharedConnectionPool");
+
+  const bool useHttps = GetParam();
+  auto server = getServer(useHttps);
+  server->registerGet(R"(/echo.*)", echo);
+
+  HttpServerWrapper wrapper(std::move(server));
+  auto serverAddress = wrapper.start().get();
+
+  const auto numPools = http::HttpClient::numConnectionPools();
+  {
+    HttpClientFactory clientFactory;
+    std::vector<std::unique_ptr<http::HttpClient>> clients;
+    for (int i = 0; i < 3; ++i) {
+      clients.push_back(clientFactory.newClient(
+          serverAddress, std::chrono::milliseconds(1'000), useHttps));
+    }
+    // A client with a different timeout gets its own pool.
+    clients.push_back(clientFactory.newClient(
+        serverAddress, std::chrono::milliseconds(2'000), useHttps));
+    for (int i = 1; i < 3; ++i) {
+      ASSERT_EQ(
+          clients[i]->testingConnectionPool(),
+          clients[0]->testingConnectionPool());
+    }
+    ASSERT_NE(
+        clients[3]->testingConnectionPool(),
+        clients[0]->testingConnectionPool());
+    ASSERT_EQ(http::HttpClient::numConnectionPools(), numPools + 2);
+
+    std::vector<folly::SemiFuture<std::unique_ptr<http::HttpResponse>>>
+        responseFutures;
+    for (int i = 0; i < clients.size(); ++i) {
+      responseFutures.push_back(sendGet(
+          clients[i].get(), fmt::format("/echo/{}", i), memoryPool.get()));
+    }
+    for (int i = 0; i < clients.size(); ++i) {
+      auto response = std::move(responseFutures[i]).get();
+      ASSERT_EQ(response->headers()->getStatusCode(), http::kHttpOk);
+      ASSERT_EQ(
+          bodyAsString(*response, memoryPool.get()),
+          fmt::format("/echo/{}", i));
+    }
+    clients.clear();
+    ASSERT_EQ(http::HttpClient::numConnectionPools(), numPools);
+  }
+  wrapper.stop();
+}
+
 INSTANTIATE_TEST_CASE_P(
     HTTPTest,
     HttpTestSuite,
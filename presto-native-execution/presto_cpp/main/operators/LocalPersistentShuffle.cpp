@@ -12,8 +12,20 @@
  * limitations under the License.
  */
 #include "presto_cpp/main/operators/LocalPersistentShuffle.h"
+#include <fcntl.h>
+#include <folly/Conv.h>
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
+#include <folly/executors/IOThreadPoolExecutor.h>
+#include <folly/futures/Future.h>
+#include <folly/lang/Bits.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "presto_cpp/external/json/json.hpp"
 #include "presto_cpp/main/common/Configs.h"
+#include "presto_cpp/main/operators/SortedShuffle.h"
+#include "velox/common/base/BitUtil.h"
+#include "velox/common/time/Timer.h"
 
 using namespace facebook::velox::exec;
 using namespace facebook::velox;
@@ -21,85 +33,787 @@ using namespace facebook::velox;
 namespace facebook::presto::operators {
 
 namespace {
+// Block files are named after the writer so that the writers created on the
+// same thread don't pick the same names for blocks they have not yet created.
 inline std::string createShuffleFileName(
+    const std::string& writerFilePrefix,
+    int32_t partition,
+    int fileIndex) {
+  return fmt::format("{}_{}_{}.bin", writerFilePrefix, partition, fileIndex);
+}
+
+inline std::string createWriterFilePrefix(
     const std::string& rootPath,
     const std::string& queryId,
     uint32_t shuffleId,
-    int32_t partition,
-    int fileIndex,
     const std::thread::id& id) {
-  // Follow Spark's shuffle file name format: shuffle_shuffleId_0_reduceId
+  // Used to tell apart the writers created on the same thread.
+  static std::atomic<uint64_t> nextWriterId{0};
   return fmt::format(
-      "{}/{}_shuffle_{}_0_{}_{}_{}.bin",
+      "{}/{}_shuffle_{}_0_{}_{}",
       rootPath,
       queryId,
       shuffleId,
-      partition,
-      fileIndex,
-      id);
+      id,
+      ++nextWriterId);
 }
 
+// The capacity of a new partition buffer. Buffers double in size as they fill
+// up until they reach the maximum block size.
+constexpr uint64_t kInitialPartitionBytes = 64 << 10;
+
 // This file is used to indicate that the shuffle system is ready to be used for
 // reading (acts as a sync point between readers if needed). Mostly used for
 // test purposes.
 const static std::string kReadyForReadFilename = "readyForRead";
+
+const static std::string kDataFileSuffix = ".data";
+const static std::string kManifestFileSuffix = ".manifest";
+const static std::string kTmpFileSuffix = ".tmp";
+
+// The manifest of a writer has the following layout, all integers being big
+// endian:
+// | numFiles (uint32) |
+// | nameSize (uint32) | name | ... <- names relative to the root directory
+// | numPartitions (uint32) |
+// | flags (uint32) | <- kManifestSortedBlocks
+// | numBlocks (uint32) | file (uint32) | offset (uint64) | size (uint64) | ...
+// ... <- one list of blocks per partition
+// kManifestSortedBlocks is set in the flags if the writer sorted the rows of
+// each block.
+constexpr uint32_t kManifestSortedBlocks = 1;
+
+template <typename T>
+void appendBigEndian(std::string& out, T value) {
+  value = folly::Endian::big(value);
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T readBigEndian(const std::string& in, size_t& offset) {
+  VELOX_CHECK_LE(
+      offset + sizeof(T), in.size(), "Corrupted local shuffle manifest");
+  T value;
+  ::memcpy(&value, in.data() + offset, sizeof(T));
+  offset += sizeof(T);
+  return folly::Endian::big(value);
+}
+
+// Returns the name of 'path' relative to its directory.
+std::string fileName(const std::string& path) {
+  const auto pos = path.rfind('/');
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// A compressed block starts with the following header, all integers being big
+// endian:
+// | marker (uint32) | codec (uint8) | uncompressed size (uint32) |
+// The marker takes the place of the size of the first row of an uncompressed
+// block and can't be a valid row size.
+constexpr uint32_t kCompressedBlockMarker = 0xFFFFFFFF;
+constexpr size_t kCompressedBlockHeaderSize =
+    sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t);
+
+std::unique_ptr<folly::io::Codec> createCodec(
+    LocalShuffleCompression compression) {
+  switch (compression) {
+    case LocalShuffleCompression::kNone:
+      return nullptr;
+    case LocalShuffleCompression::kLz4:
+      return folly::io::getCodec(folly::io::CodecType::LZ4);
+    case LocalShuffleCompression::kZstd:
+      return folly::io::getCodec(folly::io::CodecType::ZSTD);
+    default:
+      VELOX_FAIL(
+          "Unknown local shuffle compression: {}",
+          static_cast<int>(compression));
+  }
+}
+
+// Returns the first 'size' bytes of 'block' compressed with 'codec' and
+// prefixed with the compressed block header.
+BufferPtr compressBlock(
+    folly::io::Codec& codec,
+    LocalShuffleCompression compression,
+    const BufferPtr& block,
+    size_t size,
+    memory::MemoryPool* pool) {
+  VELOX_CHECK_LE(
+      size,
+      std::numeric_limits<uint32_t>::max(),
+      "Local shuffle block too large to compress");
+  auto input = folly::IOBuf::wrapBuffer(block->as<char>(), size);
+  auto compressed = codec.compress(input.get());
+  auto buffer = AlignedBuffer::allocate<char>(
+      kCompressedBlockHeaderSize + compressed->computeChainDataLength(), pool);
+  auto* rawBuffer = buffer->asMutable<char>();
+  const auto marker = folly::Endian::big(kCompressedBlockMarker);
+  ::memcpy(rawBuffer, &marker, sizeof(marker));
+  rawBuffer[sizeof(marker)] = static_cast<char>(compression);
+  const auto uncompressedSize = folly::Endian::big<uint32_t>(size);
+  ::memcpy(
+      rawBuffer + sizeof(marker) + sizeof(uint8_t),
+      &uncompressedSize,
+      sizeof(uncompressedSize));
+  rawBuffer += kCompressedBlockHeaderSize;
+  for (const auto& range : *compressed) {
+    ::memcpy(rawBuffer, range.data(), range.size());
+    rawBuffer += range.size();
+  }
+  return buffer;
+}
+
+// Returns 'block' decompressed if it is a compressed block.
+BufferPtr maybeDecompressBlock(BufferPtr block, memory::MemoryPool* pool) {
+  if (block->size() < kCompressedBlockHeaderSize) {
+    return block;
+  }
+  const auto* rawBlock = block->as<char>();
+  uint32_t marker;
+  ::memcpy(&marker, rawBlock, sizeof(marker));
+  if (folly::Endian::big(marker) != kCompressedBlockMarker) {
+    return block;
+  }
+  const auto compression = static_cast<LocalShuffleCompression>(
+      static_cast<uint8_t>(rawBlock[sizeof(marker)]));
+  uint32_t uncompressedSize;
+  ::memcpy(
+      &uncompressedSize,
+      rawBlock + sizeof(marker) + sizeof(uint8_t),
+      sizeof(uncompressedSize));
+  uncompressedSize = folly::Endian::big(uncompressedSize);
+
+  // Codecs keep state between calls, so each call gets its own as blocks may
+  // be decompressed concurrently by the read-ahead.
+  auto codec = createCodec(compression);
+  VELOX_CHECK_NOT_NULL(codec, "Corrupted local shuffle block header");
+  auto input = folly::IOBuf::wrapBuffer(
+      rawBlock + kCompressedBlockHeaderSize,
+      block->size() - kCompressedBlockHeaderSize);
+  auto uncompressed = codec->uncompress(input.get(), uncompressedSize);
+  auto buffer = AlignedBuffer::allocate<char>(uncompressedSize, pool);
+  auto* rawBuffer = buffer->asMutable<char>();
+  for (const auto& range : *uncompressed) {
+    ::memcpy(rawBuffer, range.data(), range.size());
+    rawBuffer += range.size();
+  }
+  return buffer;
+}
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+      str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Returns the path of 'file' in the local file system, or an empty string if
+// 'file' is not on the local file system.
+std::string localPath(const std::string& file) {
+  static const std::string kFilePrefix = "file:";
+  if (file.compare(0, kFilePrefix.size(), kFilePrefix) == 0) {
+    return file.substr(kFilePrefix.size());
+  }
+  if (file.compare(0, kIoUringScheme.size(), kIoUringScheme) == 0) {
+    return file.substr(kIoUringScheme.size());
+  }
+  if (!file.empty() && file[0] == '/') {
+    return file;
+  }
+  return "";
+}
+
+// Unmaps a region mapped by LocalPersistentShuffleReader::mapBlock() when the
+// BufferView of the region is destroyed.
+class MappedRegionReleaser {
+ public:
+  MappedRegionReleaser(
+      void* address,
+      size_t size,
+      std::shared_ptr<std::atomic<uint64_t>> bytesInUse)
+      : address_(address), size_(size), bytesInUse_(std::move(bytesInUse)) {}
+
+  void addRef() const {}
+
+  void release() const {
+    ::munmap(address_, size_);
+    *bytesInUse_ -= size_;
+  }
+
+ private:
+  void* const address_;
+  const size_t size_;
+  const std::shared_ptr<std::atomic<uint64_t>> bytesInUse_;
+};
+
+// Process-wide pool of buffers aligned for direct I/O. Buffers come in power of
+// two sizes. Released buffers are kept for reuse up to kMaxCachedBytes.
+class DirectIoBufferPool {
+ public:
+  // Direct I/O needs buffers, offsets and sizes aligned to the logical block
+  // size of the device. 4KB covers the common devices.
+  static constexpr uint64_t kAlignment = 4096;
+  static constexpr uint64_t kMaxCachedBytes = 64 << 20;
+
+  static DirectIoBufferPool& instance() {
+    static DirectIoBufferPool pool;
+    return pool;
+  }
+
+  // Returns a buffer of at least 'size' bytes aligned to kAlignment. The
+  // buffer goes back to the pool when the last reference to it is gone.
+  std::shared_ptr<char> allocate(uint64_t size) {
+    const auto capacity =
+        std::max<uint64_t>(kAlignment, folly::nextPowTwo(size));
+    char* data = nullptr;
+    {
+      std::lock_guard<std::mutex> l(mutex_);
+      auto& buffers = freeBuffers_[capacity];
+      if (!buffers.empty()) {
+        data = buffers.back();
+        buffers.pop_back();
+        cachedBytes_ -= capacity;
+      }
+    }
+    if (data == nullptr) {
+      void* memory;
+      VELOX_CHECK_EQ(
+          ::posix_memalign(&memory, kAlignment, capacity),
+          0,
+          "Cannot allocate {} bytes for direct I/O",
+          capacity);
+      data = static_cast<char*>(memory);
+    }
+    return std::shared_ptr<char>(
+        data, [this, capacity](char* data) { free(data, capacity); });
+  }
+
+ private:
+  void free(char* data, uint64_t capacity) {
+    {
+      std::lock_guard<std::mutex> l(mutex_);
+      if (cachedBytes_ + capacity <= kMaxCachedBytes) {
+        freeBuffers_[capacity].push_back(data);
+        cachedBytes_ += capacity;
+        return;
+      }
+    }
+    ::free(data);
+  }
+
+  std::mutex mutex_;
+  folly::F14FastMap<uint64_t, std::vector<char*>> freeBuffers_;
+  uint64_t cachedBytes_{0};
+};
+
+uint64_t alignForDirectIo(uint64_t size) {
+  return bits::roundUp(size, DirectIoBufferPool::kAlignment);
+}
+
+// Opens 'path' with O_DIRECT. Some file systems like tmpfs do not support
+// O_DIRECT, in which case the aligned I/O goes through the page cache.
+int openDirect(const std::string& path, int flags) {
+  auto fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+  if (fd < 0 && errno == EINVAL) {
+    fd = ::open(path.c_str(), flags, 0644);
+  }
+  VELOX_CHECK_GE(
+      fd,
+      0,
+      "Cannot open local shuffle file {}: {}",
+      path,
+      folly::errnoStr(errno));
+  return fd;
+}
+
+// Writes 'block' at 'offset' of 'fd' opened by openDirect(). The block is
+// copied to an aligned buffer and padded with zeros to the alignment.
+void writeDirect(int fd, std::string_view block, uint64_t offset) {
+  const auto paddedSize = alignForDirectIo(block.size());
+  auto buffer = DirectIoBufferPool::instance().allocate(paddedSize);
+  ::memcpy(buffer.get(), block.data(), block.size());
+  ::memset(buffer.get() + block.size(), 0, paddedSize - block.size());
+  uint64_t written = 0;
+  while (written < paddedSize) {
+    const auto ret = ::pwrite(
+        fd, buffer.get() + written, paddedSize - written, offset + written);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    VELOX_CHECK_GT(
+        ret, 0, "Cannot write local shuffle file: {}", folly::errnoStr(errno));
+    written += ret;
+  }
+}
+
+// Keeps the pooled buffer of a block read by
+// LocalPersistentShuffleReader::readBlockDirect() until the BufferView of the
+// block is destroyed.
+class DirectIoBufferReleaser {
+ public:
+  explicit DirectIoBufferReleaser(std::shared_ptr<char> buffer)
+      : buffer_(std::move(buffer)) {}
+
+  void addRef() const {}
+
+  void release() const {}
+
+ private:
+  const std::shared_ptr<char> buffer_;
+};
+
+// Returns true if the serialized rows of 'rows' are back to back in one of its
+// string buffers, each preceded by its size as a big-endian uint32, as laid
+// out by PartitionAndSerialize in clustered mode. Inlined rows, and vectors
+// copied or wrapped on the way to the writer, don't have this layout.
+bool hasClusteredLayout(const FlatVector<StringView>& rows) {
+  using TRowSize = uint32_t;
+
+  const auto numRows = rows.size();
+  if (numRows == 0 || rows.mayHaveNulls()) {
+    return false;
+  }
+  const auto* rawRows = rows.rawValues();
+  const char* begin = rawRows[0].data() - sizeof(TRowSize);
+  const char* end = begin;
+  for (auto i = 0; i < numRows; ++i) {
+    if (rawRows[i].isInline() ||
+        rawRows[i].data() != end + sizeof(TRowSize)) {
+      return false;
+    }
+    end = rawRows[i].data() + rawRows[i].size();
+  }
+
+  for (const auto& buffer : rows.stringBuffers()) {
+    const auto* data = buffer->as<char>();
+    if (begin < data || end > data + buffer->size()) {
+      continue;
+    }
+    for (auto i = 0; i < numRows; ++i) {
+      TRowSize rowSize;
+      ::memcpy(&rowSize, rawRows[i].data() - sizeof(TRowSize), sizeof(rowSize));
+      if (folly::Endian::big(rowSize) != rawRows[i].size()) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+// Executor for the background writes of local shuffle writers and the
+// read-ahead of local shuffle readers. Null if I/O happens inline.
+folly::IOThreadPoolExecutor* shuffleIoExecutor() {
+  static const int32_t numShuffleIoThreads =
+      SystemConfig::instance()->numShuffleIoThreads();
+  if (numShuffleIoThreads <= 0) {
+    return nullptr;
+  }
+  static auto executor = std::make_unique<folly::IOThreadPoolExecutor>(
+      numShuffleIoThreads,
+      std::make_shared<folly::NamedThreadFactory>("ShuffleIO"));
+  return executor.get();
+}
 }; // namespace
 
+LocalShuffleCompression localShuffleCompressionFromString(
+    const std::string& codec) {
+  if (codec == "none") {
+    return LocalShuffleCompression::kNone;
+  }
+  if (codec == "lz4") {
+    return LocalShuffleCompression::kLz4;
+  }
+  if (codec == "zstd") {
+    return LocalShuffleCompression::kZstd;
+  }
+  VELOX_USER_FAIL("Unsupported local shuffle compression codec: {}", codec);
+}
+
 LocalPersistentShuffleWriter::LocalPersistentShuffleWriter(
     const std::string& rootPath,
     const std::string& queryId,
     uint32_t shuffleId,
     uint32_t numPartitions,
     uint64_t maxBytesPerPartition,
-    velox::memory::MemoryPool* FOLLY_NONNULL pool)
+    velox::memory::MemoryPool* FOLLY_NONNULL pool,
+    bool consolidatedFiles,
+    folly::Executor* FOLLY_NULLABLE executor,
+    uint32_t maxInflightWrites,
+    LocalShuffleCompression compression,
+    uint64_t maxBufferedBytes,
+    bool directIo)
     : maxBytesPerPartition_(maxBytesPerPartition),
+      maxBufferedBytes_(maxBufferedBytes),
+      consolidatedFiles_(consolidatedFiles),
+      directIo_(directIo && !localPath(rootPath).empty()),
+      compression_(compression),
+      codec_(createCodec(compression)),
       threadId_(std::this_thread::get_id()),
       pool_(pool),
       numPartitions_(numPartitions),
       rootPath_(std::move(rootPath)),
       shuffleId_(shuffleId),
-      queryId_(std::move(queryId)) {
+      queryId_(std::move(queryId)),
+      maxInflightWrites_(std::max<uint32_t>(1, maxInflightWrites)) {
   // Use resize/assign instead of resize(size, val).
   inProgressPartitions_.resize(numPartitions_);
   inProgressPartitions_.assign(numPartitions_, nullptr);
   inProgressSizes_.resize(numPartitions_);
   inProgressSizes_.assign(numPartitions_, 0);
+  nextFileIndices_.resize(numPartitions_);
+  nextFileIndices_.assign(numPartitions_, 0);
+  partitionRows_.assign(numPartitions_, 0);
+  partitionBytes_.assign(numPartitions_, 0);
   fileSystem_ = velox::filesystems::getFileSystem(rootPath_, nullptr);
+#ifdef PRESTO_ENABLE_IO_URING
+  if (!consolidatedFiles_ && !directIo_) {
+    batchFileSystem_ = dynamic_cast<IoUringFileSystem*>(fileSystem_.get());
+  }
+#endif
+  writerFilePrefix_ =
+      createWriterFilePrefix(rootPath_, queryId_, shuffleId_, threadId_);
+  partitionBlocks_.resize(numPartitions_);
+  if (consolidatedFiles_) {
+    files_.push_back(fileName(writerFilePrefix_ + kDataFileSuffix));
+  }
+  if (executor != nullptr) {
+    ioExecutor_ =
+        folly::SerialExecutor::create(folly::getKeepAliveToken(executor));
+  }
 }
 
-std::unique_ptr<velox::WriteFile>
-LocalPersistentShuffleWriter::getNextOutputFile(int32_t partition) {
-  auto filename = nextAvailablePartitionFileName(rootPath_, partition);
-  return fileSystem_->openFileForWrite(filename);
+LocalPersistentShuffleWriter::~LocalPersistentShuffleWriter() {
+  // The background writes reference this writer.
+  waitForInflightWrites();
+  if (dataFd_ >= 0) {
+    ::close(dataFd_);
+  }
 }
 
 std::string LocalPersistentShuffleWriter::nextAvailablePartitionFileName(
-    const std::string& root,
-    int32_t partition) const {
-  int fileCount = 0;
-  std::string filename;
-  // TODO: consider to maintain the next to create file count in memory as we
-  // always do cleanup when switch to a new root directory path.
-  do {
-    filename = createShuffleFileName(
-        root, queryId_, shuffleId_, partition, fileCount, threadId_);
-    if (!fileSystem_->exists(filename)) {
-      break;
+    int32_t partition) {
+  // The names are unique as they start with 'writerFilePrefix_'.
+  return createShuffleFileName(
+      writerFilePrefix_, partition, nextFileIndices_[partition]++);
+}
+
+void LocalPersistentShuffleWriter::storePartitionBlock(
+    int32_t partition,
+    std::vector<PendingBlock>* batch) {
+  auto buffer = std::move(inProgressPartitions_[partition]);
+  auto size = inProgressSizes_[partition];
+  inProgressPartitions_[partition].reset();
+  inProgressSizes_[partition] = 0;
+  bufferedBytes_ -= buffer->capacity();
+
+  if (sortedBlocks_) {
+    buffer = sortShuffleBlock(buffer->as<char>(), size, pool_);
+  }
+  if (codec_ != nullptr) {
+    buffer = compressBlock(*codec_, compression_, buffer, size, pool_);
+    size = buffer->size();
+  }
+  ++numBlocks_;
+  storedBytes_ += size;
+
+  if (consolidatedFiles_) {
+    // Offsets are assigned here as the background writes run in order.
+    const auto offset = dataFileSize_;
+    partitionBlocks_[partition].push_back({0, offset, size});
+    dataFileSize_ += directIo_ ? alignForDirectIo(size) : size;
+    runWrite([this, buffer = std::move(buffer), size, offset]() {
+      appendToDataFile(std::string_view(buffer->as<char>(), size), offset);
+    });
+  } else {
+    auto filename = nextAvailablePartitionFileName(partition);
+    partitionBlocks_[partition].push_back(
+        {static_cast<uint32_t>(files_.size()), 0, size});
+    files_.push_back(fileName(filename));
+    if (batch != nullptr) {
+      batch->push_back({std::move(filename), std::move(buffer), size});
+      return;
+    }
+    runWrite([this,
+              filename = std::move(filename),
+              buffer = std::move(buffer),
+              size]() {
+      writeBlockFile(filename, std::string_view(buffer->as<char>(), size));
+    });
+  }
+}
+
+void LocalPersistentShuffleWriter::writeBlockFile(
+    const std::string& filename,
+    std::string_view block) {
+  uint64_t openNanos{0};
+  std::unique_ptr<WriteFile> file;
+  int fd = -1;
+  {
+    NanosecondTimer timer(&openNanos);
+    if (directIo_) {
+      fd = openDirect(localPath(filename), O_WRONLY | O_CREAT | O_EXCL);
+    } else {
+      file = fileSystem_->openFileForWrite(filename);
+    }
+  }
+  ++numFiles_;
+  openWallNanos_ += openNanos;
+  uint64_t writeNanos{0};
+  {
+    NanosecondTimer timer(&writeNanos);
+    if (directIo_) {
+      SCOPE_EXIT {
+        ::close(fd);
+      };
+      writeDirect(fd, block, 0);
+    } else {
+      file->append(block);
+      file->close();
+    }
+  }
+  writeWallNanos_ += writeNanos;
+}
+
+void LocalPersistentShuffleWriter::writeBatch(
+    std::vector<PendingBlock> batch) {
+  runWrite([this, batch = std::move(batch)]() {
+    std::vector<IoUringFileSystem::WriteRequest> requests;
+    requests.reserve(batch.size());
+    for (const auto& block : batch) {
+      requests.push_back(
+          {block.filename,
+           std::string_view(block.buffer->as<char>(), block.size)});
+    }
+    uint64_t writeNanos{0};
+    {
+      NanosecondTimer timer(&writeNanos);
+      batchFileSystem_->writeFiles(requests);
+    }
+    numFiles_ += batch.size();
+    writeWallNanos_ += writeNanos;
+  });
+}
+
+void LocalPersistentShuffleWriter::runWrite(std::function<void()> write) {
+  if (!ioExecutor_) {
+    write();
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    ++numInflightWrites_;
+  }
+  ioExecutor_->add([this, write = std::move(write)]() {
+    bool failed;
+    {
+      std::lock_guard<std::mutex> l(mutex_);
+      failed = writeError_ != nullptr;
+    }
+    std::exception_ptr error;
+    // The writes after a failed one are skipped.
+    if (!failed) {
+      try {
+        write();
+      } catch (...) {
+        error = std::current_exception();
+      }
     }
-    ++fileCount;
-  } while (true);
 
-  return filename;
+    std::vector<ContinuePromise> promises;
+    {
+      std::lock_guard<std::mutex> l(mutex_);
+      if (error != nullptr && writeError_ == nullptr) {
+        writeError_ = error;
+      }
+      --numInflightWrites_;
+      if (numInflightWrites_ < maxInflightWrites_ || writeError_ != nullptr) {
+        promises.swap(promises_);
+      }
+      // Notify under the lock as the writer may be destroyed right after.
+      inflightWritesCv_.notify_all();
+    }
+    for (auto& promise : promises) {
+      promise.setValue();
+    }
+  });
+}
+
+void LocalPersistentShuffleWriter::waitForInflightWrites() {
+  std::unique_lock<std::mutex> l(mutex_);
+  inflightWritesCv_.wait(l, [&]() { return numInflightWrites_ == 0; });
+}
+
+bool LocalPersistentShuffleWriter::hasWriteError() {
+  std::lock_guard<std::mutex> l(mutex_);
+  return writeError_ != nullptr;
+}
+
+void LocalPersistentShuffleWriter::checkWriteError() {
+  std::lock_guard<std::mutex> l(mutex_);
+  if (writeError_ != nullptr) {
+    std::rethrow_exception(writeError_);
+  }
+}
+
+void LocalPersistentShuffleWriter::closeDataFile() {
+  if (dataFile_ != nullptr) {
+    dataFile_->close();
+    dataFile_.reset();
+  }
+  if (dataFd_ >= 0) {
+    ::close(dataFd_);
+    dataFd_ = -1;
+  }
+}
+
+BlockingReason LocalPersistentShuffleWriter::isBlocked(
+    ContinueFuture* future) {
+  std::lock_guard<std::mutex> l(mutex_);
+  if (writeError_ != nullptr) {
+    std::rethrow_exception(writeError_);
+  }
+  if (numInflightWrites_ < maxInflightWrites_) {
+    return BlockingReason::kNotBlocked;
+  }
+  auto [promise, blockingFuture] = makeVeloxContinuePromiseContract(
+      "LocalPersistentShuffleWriter::isBlocked");
+  promises_.push_back(std::move(promise));
+  *future = std::move(blockingFuture);
+  return BlockingReason::kWaitForConsumer;
+}
+
+void LocalPersistentShuffleWriter::appendToDataFile(
+    std::string_view block,
+    uint64_t offset) {
+  if (dataFile_ == nullptr && dataFd_ < 0) {
+    const auto filename = writerFilePrefix_ + kDataFileSuffix;
+    uint64_t openNanos{0};
+    {
+      NanosecondTimer timer(&openNanos);
+      if (directIo_) {
+        dataFd_ = openDirect(localPath(filename), O_WRONLY | O_CREAT | O_EXCL);
+      } else {
+        dataFile_ = fileSystem_->openFileForWrite(filename);
+      }
+    }
+    ++numFiles_;
+    openWallNanos_ += openNanos;
+  }
+  uint64_t writeNanos{0};
+  {
+    NanosecondTimer timer(&writeNanos);
+    if (directIo_) {
+      writeDirect(dataFd_, block, offset);
+    } else {
+      dataFile_->append(block);
+    }
+  }
+  writeWallNanos_ += writeNanos;
+}
+
+void LocalPersistentShuffleWriter::writeManifest() {
+  std::string manifest;
+  appendBigEndian<uint32_t>(manifest, files_.size());
+  for (const auto& file : files_) {
+    appendBigEndian<uint32_t>(manifest, file.size());
+    manifest.append(file);
+  }
+  appendBigEndian<uint32_t>(manifest, numPartitions_);
+  appendBigEndian<uint32_t>(
+      manifest, sortedBlocks_ ? kManifestSortedBlocks : 0);
+  for (const auto& blocks : partitionBlocks_) {
+    appendBigEndian<uint32_t>(manifest, blocks.size());
+    for (const auto& block : blocks) {
+      appendBigEndian<uint32_t>(manifest, block.file);
+      appendBigEndian<uint64_t>(manifest, block.offset);
+      appendBigEndian<uint64_t>(manifest, block.size);
+    }
+  }
+
+  const auto manifestPath = writerFilePrefix_ + kManifestFileSuffix;
+  const auto tmpPath = manifestPath + kTmpFileSuffix;
+  uint64_t openNanos{0};
+  std::unique_ptr<WriteFile> file;
+  {
+    NanosecondTimer timer(&openNanos);
+    file = fileSystem_->openFileForWrite(tmpPath);
+  }
+  ++numFiles_;
+  openWallNanos_ += openNanos;
+  uint64_t writeNanos{0};
+  {
+    NanosecondTimer timer(&writeNanos);
+    file->append(manifest);
+    file->close();
+    fileSystem_->rename(tmpPath, manifestPath);
+  }
+  writeWallNanos_ += writeNanos;
 }
 
-void LocalPersistentShuffleWriter::storePartitionBlock(int32_t partition) {
+char* LocalPersistentShuffleWriter::reserve(int32_t partition, uint64_t bytes) {
   auto& buffer = inProgressPartitions_[partition];
-  auto file = getNextOutputFile(partition);
-  file->append(
-      std::string_view(buffer->as<char>(), inProgressSizes_[partition]));
-  file->close();
-  inProgressPartitions_[partition].reset();
-  inProgressSizes_[partition] = 0;
+  auto& size = inProgressSizes_[partition];
+  if (buffer != nullptr && size + bytes <= buffer->capacity()) {
+    return buffer->asMutable<char>() + size;
+  }
+
+  // Grow the buffer up to the maximum block size, or else store it as a block
+  // and start a new one.
+  if (buffer != nullptr && size + bytes > maxBytesPerPartition_) {
+    if (size > 0) {
+      storePartitionBlock(partition);
+    } else {
+      bufferedBytes_ -= buffer->capacity();
+      buffer.reset();
+    }
+  }
+  auto newCapacity = [&]() -> uint64_t {
+    if (buffer == nullptr) {
+      return std::max(
+          bytes, std::min(kInitialPartitionBytes, maxBytesPerPartition_));
+    }
+    return std::min(
+        maxBytesPerPartition_,
+        std::max<uint64_t>(2 * buffer->capacity(), size + bytes));
+  };
+  const auto oldCapacity = buffer == nullptr ? 0 : buffer->capacity();
+  if (maxBufferedBytes_ > 0 &&
+      bufferedBytes_ + newCapacity() - oldCapacity > maxBufferedBytes_) {
+    flushLargestPartitions(newCapacity() - oldCapacity);
+  }
+
+  auto newBuffer = AlignedBuffer::allocate<char>(newCapacity(), pool_);
+  if (buffer == nullptr) {
+    size = 0;
+  } else {
+    ::memcpy(newBuffer->asMutable<char>(), buffer->as<char>(), size);
+    bufferedBytes_ -= buffer->capacity();
+  }
+  buffer = std::move(newBuffer);
+  bufferedBytes_ += buffer->capacity();
+  return buffer->asMutable<char>() + size;
+}
+
+uint64_t LocalPersistentShuffleWriter::flushLargestPartitions(
+    uint64_t targetBytes) {
+  std::vector<int32_t> partitions;
+  for (auto i = 0; i < numPartitions_; ++i) {
+    if (inProgressSizes_[i] > 0) {
+      partitions.push_back(i);
+    }
+  }
+  std::sort(partitions.begin(), partitions.end(), [&](auto left, auto right) {
+    return inProgressSizes_[left] > inProgressSizes_[right];
+  });
+
+  const auto initialBytes = bufferedBytes_;
+  for (auto partition : partitions) {
+    if (initialBytes - bufferedBytes_ >= targetBytes) {
+      break;
+    }
+    storePartitionBlock(partition);
+  }
+  return initialBytes - bufferedBytes_;
 }
 
 void LocalPersistentShuffleWriter::collect(
@@ -107,45 +821,220 @@ void LocalPersistentShuffleWriter::collect(
     std::string_view data) {
   using TRowSize = uint32_t;
 
-  auto& buffer = inProgressPartitions_[partition];
   const TRowSize rowSize = data.size();
   const auto size = sizeof(TRowSize) + rowSize;
+  auto rawBuffer = reserve(partition, size);
+  *(TRowSize*)(rawBuffer) = folly::Endian::big(rowSize);
+  ::memcpy(rawBuffer + sizeof(TRowSize), data.data(), rowSize);
+  advance(partition, 1, size);
+}
 
-  // Check if there is enough space in the buffer.
-  if ((buffer != nullptr) &&
-      (inProgressSizes_[partition] + size >= buffer->capacity())) {
-    storePartitionBlock(partition);
-    // NOTE: the referenced 'buffer' will be reset in storePartitionBlock.
+void LocalPersistentShuffleWriter::collectBatch(
+    const VectorPtr& partitions,
+    const VectorPtr& serializedRows) {
+  using TRowSize = uint32_t;
+
+  auto flatPartitions = partitions->asFlatVector<int32_t>();
+  auto flatRows = serializedRows->asFlatVector<StringView>();
+  if (flatPartitions == nullptr || flatRows == nullptr) {
+    ShuffleWriter::collectBatch(partitions, serializedRows);
+    return;
   }
+  const auto numRows = partitions->size();
+  const auto* rawPartitions = flatPartitions->rawValues();
+  const auto* rawRows = flatRows->rawValues();
 
-  // Allocate buffer if needed.
-  if (buffer == nullptr) {
-    buffer = AlignedBuffer::allocate<char>(
-        std::max((uint64_t)size, maxBytesPerPartition_), pool_);
-    inProgressSizes_[partition] = 0;
-    inProgressPartitions_[partition] = buffer;
+  // Counting sort of the row numbers by partition.
+  batchPartitionOffsets_.assign(numPartitions_ + 1, 0);
+  batchPartitionBytes_.assign(numPartitions_, 0);
+  for (auto row = 0; row < numRows; ++row) {
+    const auto partition = rawPartitions[row];
+    VELOX_DCHECK_LT(partition, numPartitions_);
+    ++batchPartitionOffsets_[partition + 1];
+    batchPartitionBytes_[partition] += sizeof(TRowSize) + rawRows[row].size();
+  }
+  for (auto i = 0; i < numPartitions_; ++i) {
+    batchPartitionOffsets_[i + 1] += batchPartitionOffsets_[i];
+  }
+  batchRows_.resize(numRows);
+  for (auto row = 0; row < numRows; ++row) {
+    batchRows_[batchPartitionOffsets_[rawPartitions[row]]++] = row;
+  }
+  // The increments above moved each offset to the start of the next
+  // partition.
+  for (auto i = numPartitions_; i > 0; --i) {
+    batchPartitionOffsets_[i] = batchPartitionOffsets_[i - 1];
+  }
+  batchPartitionOffsets_[0] = 0;
+
+  for (auto partition = 0; partition < numPartitions_; ++partition) {
+    const auto begin = batchPartitionOffsets_[partition];
+    const auto end = batchPartitionOffsets_[partition + 1];
+    if (begin == end) {
+      continue;
+    }
+    const auto bytes = batchPartitionBytes_[partition];
+    if (bytes > maxBytesPerPartition_) {
+      // The rows don't fit in one block. Go row by row to split them into
+      // blocks.
+      for (auto i = begin; i < end; ++i) {
+        const auto& data = rawRows[batchRows_[i]];
+        LocalPersistentShuffleWriter::collect(
+            partition, std::string_view(data.data(), data.size()));
+      }
+      continue;
+    }
+
+    auto rawBuffer = reserve(partition, bytes);
+    for (auto i = begin; i < end; ++i) {
+      const auto& data = rawRows[batchRows_[i]];
+      const TRowSize rowSize = data.size();
+      *(TRowSize*)(rawBuffer) = folly::Endian::big(rowSize);
+      ::memcpy(rawBuffer + sizeof(TRowSize), data.data(), rowSize);
+      rawBuffer += sizeof(TRowSize) + rowSize;
+    }
+    advance(partition, end - begin, bytes);
   }
+}
 
-  // Copy data.
-  auto offset = inProgressSizes_[partition];
-  auto rawBuffer = buffer->asMutable<char>() + offset;
+void LocalPersistentShuffleWriter::collectClusteredBatch(
+    const VectorPtr& partitions,
+    const VectorPtr& serializedRows) {
+  using TRowSize = uint32_t;
 
-  *(TRowSize*)(rawBuffer) = folly::Endian::big(rowSize);
-  ::memcpy(rawBuffer + sizeof(TRowSize), data.data(), rowSize);
+  auto flatPartitions = partitions->asFlatVector<int32_t>();
+  auto flatRows = serializedRows->asFlatVector<StringView>();
+  if (flatPartitions == nullptr || flatRows == nullptr) {
+    ShuffleWriter::collectClusteredBatch(partitions, serializedRows);
+    return;
+  }
+  // The runs of rows are copied from the buffer of the serialized rows, which
+  // must be laid out as expected.
+  if (!hasClusteredLayout(*flatRows)) {
+    LocalPersistentShuffleWriter::collectBatch(partitions, serializedRows);
+    return;
+  }
+  const auto numRows = partitions->size();
+  const auto* rawPartitions = flatPartitions->rawValues();
+  const auto* rawRows = flatRows->rawValues();
+
+  vector_size_t begin = 0;
+  while (begin < numRows) {
+    const auto partition = rawPartitions[begin];
+    auto end = begin + 1;
+    while (end < numRows && rawPartitions[end] == partition) {
+      ++end;
+    }
+
+    const char* runStart = rawRows[begin].data() - sizeof(TRowSize);
+    const char* runEnd = rawRows[end - 1].data() + rawRows[end - 1].size();
+    const uint64_t runSize = runEnd - runStart;
+    if (runSize <= maxBytesPerPartition_) {
+      ::memcpy(reserve(partition, runSize), runStart, runSize);
+      advance(partition, end - begin, runSize);
+    } else {
+      // The run doesn't fit in one block. Go row by row to split it into
+      // blocks.
+      for (auto i = begin; i < end; ++i) {
+        LocalPersistentShuffleWriter::collect(
+            partition, std::string_view(rawRows[i].data(), rawRows[i].size()));
+      }
+    }
+    begin = end;
+  }
+}
+
+char* LocalPersistentShuffleWriter::reserveRow(
+    int32_t partition,
+    uint32_t size) {
+  using TRowSize = uint32_t;
+
+  auto rawBuffer = reserve(partition, sizeof(TRowSize) + size);
+  *(TRowSize*)(rawBuffer) = folly::Endian::big(size);
+  ::memset(rawBuffer + sizeof(TRowSize), 0, size);
+  advance(partition, 1, sizeof(TRowSize) + size);
+  return rawBuffer + sizeof(TRowSize);
+}
 
-  inProgressSizes_[partition] += size;
+uint64_t LocalPersistentShuffleWriter::reclaim(uint64_t targetBytes) {
+  const auto bytes = flushLargestPartitions(targetBytes);
+  // The flushed blocks are released once written.
+  waitForInflightWrites();
+  checkWriteError();
+  return bytes;
 }
 
 void LocalPersistentShuffleWriter::noMoreData(bool success) {
-  // Delete all shuffle files on failure.
+  // Drop the unwritten blocks and delete the files of this writer on failure.
   if (!success) {
+    for (auto i = 0; i < numPartitions_; ++i) {
+      inProgressPartitions_[i].reset();
+      inProgressSizes_[i] = 0;
+    }
+    bufferedBytes_ = 0;
+    waitForInflightWrites();
+    closeDataFile();
     cleanup();
+    return;
   }
+  // The last blocks of all the partitions go out in one batch if the file
+  // system supports it.
+  std::vector<PendingBlock> batch;
   for (auto i = 0; i < numPartitions_; ++i) {
     if (inProgressSizes_[i] > 0) {
-      storePartitionBlock(i);
+      storePartitionBlock(i, batchFileSystem_ != nullptr ? &batch : nullptr);
+    }
+  }
+  if (!batch.empty()) {
+    writeBatch(std::move(batch));
+  }
+  // The manifest is the commit point of this writer: readers ignore the files
+  // of writers without one. It is written after all the blocks as the writes
+  // run in order, and never if one of them failed.
+  runWrite([this]() {
+    closeDataFile();
+    if (!hasWriteError()) {
+      writeManifest();
+    }
+  });
+  waitForInflightWrites();
+  // The write above is skipped after an error.
+  closeDataFile();
+  checkWriteError();
+}
+
+folly::F14FastMap<std::string, int64_t> LocalPersistentShuffleWriter::stats()
+    const {
+  uint64_t rawBytes = 0;
+  uint64_t numRows = 0;
+  int32_t maxPartition = 0;
+  for (auto i = 0; i < numPartitions_; ++i) {
+    rawBytes += partitionBytes_[i];
+    numRows += partitionRows_[i];
+    if (partitionBytes_[i] > partitionBytes_[maxPartition]) {
+      maxPartition = i;
     }
   }
+  const uint64_t maxPartitionBytes =
+      numPartitions_ == 0 ? 0 : partitionBytes_[maxPartition];
+  const uint64_t maxPartitionRows =
+      numPartitions_ == 0 ? 0 : partitionRows_[maxPartition];
+  // Max over mean, as a percentage.
+  const int64_t skewPct =
+      rawBytes == 0 ? 100 : maxPartitionBytes * numPartitions_ * 100 / rawBytes;
+  return {
+      {"local.write", storedBytes_},
+      {"local.write.rawBytes", rawBytes},
+      {"local.write.rows", numRows},
+      {"local.write.blocks", numBlocks_},
+      {"local.write.files", numFiles_},
+      {"local.write.wallNanos", writeWallNanos_},
+      {"local.write.openWallNanos", openWallNanos_},
+      {"local.write.maxPartition", maxPartition},
+      {"local.write.maxPartitionBytes", maxPartitionBytes},
+      {"local.write.maxPartitionRows", maxPartitionRows},
+      {"local.write.partitionSkewPct", skewPct},
+  };
 }
 
 LocalPersistentShuffleReader::LocalPersistentShuffleReader(
@@ -153,39 +1042,395 @@ LocalPersistentShuffleReader::LocalPersistentShuffleReader(
     const std::string& queryId,
     std::vector<std::string> partitionIds,
     const int32_t partition,
-    velox::memory::MemoryPool* FOLLY_NONNULL pool)
+    velox::memory::MemoryPool* FOLLY_NONNULL pool,
+    folly::Executor* FOLLY_NULLABLE executor,
+    uint32_t numReadAheadBlocks,
+    bool mmapReads,
+    bool directIo,
+    uint32_t blockBegin,
+    uint32_t blockEnd)
     : rootPath_(rootPath),
       queryId_(queryId),
       partitionIds_(std::move(partitionIds)),
       partition_(partition),
-      pool_(pool) {
+      pool_(pool),
+      blockBegin_(blockBegin),
+      blockEnd_(blockEnd),
+      executor_(numReadAheadBlocks > 0 ? executor : nullptr),
+      numReadAheadBlocks_(numReadAheadBlocks),
+      mmapReads_(mmapReads && !localPath(rootPath).empty()),
+      directIo_(directIo && !localPath(rootPath).empty()),
+      mappedBytesInUse_(std::make_shared<std::atomic<uint64_t>>(0)) {
+  VELOX_CHECK_LE(blockBegin_, blockEnd_, "Invalid local shuffle block range");
   fileSystem_ = velox::filesystems::getFileSystem(rootPath_, nullptr);
 }
 
+LocalPersistentShuffleReader::~LocalPersistentShuffleReader() {
+  // The background reads reference this reader.
+  clearReadAhead();
+}
+
 bool LocalPersistentShuffleReader::hasNext() {
-  if (readPartitionFiles_.empty()) {
-    readPartitionFiles_ = getReadPartitionFiles();
+  initialize();
+  return readPartitionBlockIndex_ < readPartitionBlocks_.size();
+}
+
+bool LocalPersistentShuffleReader::sortedBlocks() {
+  initialize();
+  return sortedBlocks_;
+}
+
+void LocalPersistentShuffleReader::initialize() {
+  if (!readPartitionBlocksInitialized_) {
+    uint64_t listNanos{0};
+    {
+      NanosecondTimer timer(&listNanos);
+      readPartitionBlocks_ = getReadPartitionBlocks();
+    }
+    if (blockEnd_ < readPartitionBlocks_.size()) {
+      readPartitionBlocks_.resize(blockEnd_);
+    }
+    readPartitionBlocks_.erase(
+        readPartitionBlocks_.begin(),
+        readPartitionBlocks_.begin() +
+            std::min<size_t>(blockBegin_, readPartitionBlocks_.size()));
+    openWallNanos_ += listNanos;
+    readPartitionBlocksInitialized_ = true;
   }
+}
 
-  return readPartitionFileIndex_ < readPartitionFiles_.size();
+std::vector<uint64_t> LocalPersistentShuffleReader::blockSizes() {
+  std::vector<uint64_t> sizes;
+  for (const auto& block : getReadPartitionBlocks()) {
+    sizes.push_back(block.size);
+  }
+  return sizes;
 }
 
 BufferPtr LocalPersistentShuffleReader::next(bool success) {
-  // On failure, reset the index of the files to be read.
+  // On failure, reset the index of the blocks to be read.
   if (!success) {
-    readPartitionFileIndex_ = 0;
+    clearReadAhead();
+    readPartitionBlockIndex_ = 0;
+  }
+
+  if (executor_ == nullptr) {
+    return readBlock(readPartitionBlocks_[readPartitionBlockIndex_++]);
   }
 
-  auto filename = readPartitionFiles_[readPartitionFileIndex_];
-  auto file = fileSystem_->openFileForRead(filename);
-  auto buffer = AlignedBuffer::allocate<char>(file->size(), pool_, 0);
-  file->pread(0, file->size(), buffer->asMutable<void>());
-  ++readPartitionFileIndex_;
+  scheduleReadAhead();
+  auto future = std::move(readAheadBlocks_.front());
+  readAheadBlocks_.pop_front();
+  ++readPartitionBlockIndex_;
+  // Keep the next blocks loading while the caller processes this one.
+  scheduleReadAhead();
+  return std::move(future).get();
+}
+
+class LocalPersistentShuffleReader::BlockCursor : public ShuffleBlockCursor {
+ public:
+  BlockCursor(
+      LocalPersistentShuffleReader* reader,
+      ReadBlock block,
+      uint64_t chunkBytes)
+      : reader_(reader), block_(std::move(block)), chunkBytes_(chunkBytes) {}
+
+  BufferPtr next() override {
+    using TRowSize = uint32_t;
+    if (position_ == block_.size) {
+      return nullptr;
+    }
+    auto chunk = read(std::min<uint64_t>(
+        std::max<uint64_t>(chunkBytes_, sizeof(TRowSize)),
+        block_.size - position_));
+    if (position_ == 0) {
+      if (isCompressed(*chunk)) {
+        position_ = block_.size;
+        return reader_->readBlock(block_);
+      }
+      ++reader_->numBlocks_;
+    }
+
+    // Cuts the chunk after its last whole row. A first row larger than the
+    // chunk is read whole instead.
+    const auto* data = chunk->as<char>();
+    uint64_t size = 0;
+    while (size + sizeof(TRowSize) <= chunk->size()) {
+      TRowSize rowSize;
+      ::memcpy(&rowSize, data + size, sizeof(rowSize));
+      const auto rowEnd = size + sizeof(TRowSize) + folly::Endian::big(rowSize);
+      if (rowEnd <= chunk->size()) {
+        size = rowEnd;
+        continue;
+      }
+      if (size == 0) {
+        VELOX_CHECK_LE(
+            position_ + rowEnd,
+            block_.size,
+            "Corrupted local shuffle block in {}",
+            block_.file);
+        chunk = read(rowEnd);
+        size = rowEnd;
+      }
+      break;
+    }
+    VELOX_CHECK_GT(size, 0, "Corrupted local shuffle block in {}", block_.file);
+    chunk->setSize(size);
+    position_ += size;
+    reader_->rawBytes_ += size;
+    return chunk;
+  }
+
+  void reset() override {
+    position_ = 0;
+  }
+
+ private:
+  static bool isCompressed(const Buffer& chunk) {
+    if (chunk.size() < kCompressedBlockHeaderSize) {
+      return false;
+    }
+    uint32_t marker;
+    ::memcpy(&marker, chunk.as<char>(), sizeof(marker));
+    return folly::Endian::big(marker) == kCompressedBlockMarker;
+  }
+
+  // Reads 'size' bytes of the block from 'position_'.
+  BufferPtr read(uint64_t size) {
+    if (file_ == nullptr) {
+      file_ = reader_->cursorFile(block_.file);
+    }
+    auto buffer = AlignedBuffer::allocate<char>(size, reader_->pool_);
+    uint64_t readNanos{0};
+    {
+      NanosecondTimer timer(&readNanos);
+      file_->pread(block_.offset + position_, size, buffer->asMutable<void>());
+    }
+    reader_->readWallNanos_ += readNanos;
+    reader_->storedBytes_ += size;
+    return buffer;
+  }
+
+  LocalPersistentShuffleReader* const reader_;
+  const ReadBlock block_;
+  const uint64_t chunkBytes_;
+  std::shared_ptr<velox::ReadFile> file_;
+  // The offset of the next row in the block.
+  uint64_t position_{0};
+};
+
+std::vector<std::unique_ptr<ShuffleBlockCursor>>
+LocalPersistentShuffleReader::blockCursors(uint64_t chunkBytes) {
+  initialize();
+  std::vector<std::unique_ptr<ShuffleBlockCursor>> cursors;
+  cursors.reserve(readPartitionBlocks_.size());
+  for (const auto& block : readPartitionBlocks_) {
+    cursors.push_back(std::make_unique<BlockCursor>(this, block, chunkBytes));
+  }
+  return cursors;
+}
+
+std::shared_ptr<velox::ReadFile> LocalPersistentShuffleReader::cursorFile(
+    const std::string& file) {
+  auto it = cursorFiles_.find(file);
+  if (it == cursorFiles_.end()) {
+    uint64_t openNanos{0};
+    {
+      NanosecondTimer timer(&openNanos);
+      it = cursorFiles_.emplace(file, fileSystem_->openFileForRead(file)).first;
+    }
+    ++numFiles_;
+    openWallNanos_ += openNanos;
+  }
+  return it->second;
+}
+
+BufferPtr LocalPersistentShuffleReader::readBlock(const ReadBlock& block) {
+  if (directIo_ || mmapReads_) {
+    auto buffer = directIo_ ? readBlockDirect(block) : mapBlock(block);
+    ++numBlocks_;
+    storedBytes_ += block.size;
+    buffer = maybeDecompressBlock(std::move(buffer), pool_);
+    rawBytes_ += buffer->size();
+    return buffer;
+  }
+
+  std::shared_ptr<velox::ReadFile> file;
+  {
+    std::lock_guard<std::mutex> l(currentFileMutex_);
+    if (currentFile_ == nullptr || currentFileName_ != block.file) {
+      uint64_t openNanos{0};
+      {
+        NanosecondTimer timer(&openNanos);
+        currentFile_ = fileSystem_->openFileForRead(block.file);
+      }
+      ++numFiles_;
+      openWallNanos_ += openNanos;
+      currentFileName_ = block.file;
+    }
+    file = currentFile_;
+  }
+  const auto size = block.size;
+  auto buffer = AlignedBuffer::allocate<char>(size, pool_, 0);
+  uint64_t readNanos{0};
+  {
+    NanosecondTimer timer(&readNanos);
+    file->pread(block.offset, size, buffer->asMutable<void>());
+  }
+  readWallNanos_ += readNanos;
+  ++numBlocks_;
+  storedBytes_ += size;
+  buffer = maybeDecompressBlock(std::move(buffer), pool_);
+  rawBytes_ += buffer->size();
   return buffer;
 }
 
-std::vector<std::string> LocalPersistentShuffleReader::getReadPartitionFiles()
+BufferPtr LocalPersistentShuffleReader::readBlockDirect(
+    const ReadBlock& block) {
+  const auto path = localPath(block.file);
+  std::shared_ptr<folly::File> file;
+  {
+    std::lock_guard<std::mutex> l(currentFileMutex_);
+    if (currentDirectFile_ == nullptr ||
+        currentDirectFileName_ != block.file) {
+      uint64_t openNanos{0};
+      {
+        NanosecondTimer timer(&openNanos);
+        currentDirectFile_ =
+            std::make_shared<folly::File>(openDirect(path, O_RDONLY), true);
+      }
+      ++numFiles_;
+      openWallNanos_ += openNanos;
+      currentDirectFileName_ = block.file;
+    }
+    file = currentDirectFile_;
+  }
+  const auto fd = file->fd();
+
+  // Reads the aligned range around the block. Files not written with direct
+  // I/O may end before the padding of their last block.
+  const auto readOffset =
+      block.offset - block.offset % DirectIoBufferPool::kAlignment;
+  const auto readEnd = alignForDirectIo(block.offset + block.size);
+  const auto blockEnd = block.offset + block.size - readOffset;
+  auto buffer = DirectIoBufferPool::instance().allocate(readEnd - readOffset);
+  uint64_t bytesRead = 0;
+  uint64_t readNanos{0};
+  {
+    NanosecondTimer timer(&readNanos);
+    while (bytesRead < blockEnd) {
+      const auto ret = ::pread(
+          fd,
+          buffer.get() + bytesRead,
+          readEnd - readOffset - bytesRead,
+          readOffset + bytesRead);
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      VELOX_CHECK_GE(
+          ret,
+          0,
+          "Cannot read local shuffle file {}: {}",
+          path,
+          folly::errnoStr(errno));
+      VELOX_CHECK_GT(ret, 0, "Local shuffle file {} is truncated", path);
+      bytesRead += ret;
+    }
+  }
+  readWallNanos_ += readNanos;
+
+  auto* data = buffer.get() + (block.offset - readOffset);
+  return BufferView<DirectIoBufferReleaser>::create(
+      reinterpret_cast<const uint8_t*>(data),
+      block.size,
+      DirectIoBufferReleaser(std::move(buffer)));
+}
+
+BufferPtr LocalPersistentShuffleReader::mapBlock(const ReadBlock& block) {
+  static const uint64_t kPageSize = ::sysconf(_SC_PAGESIZE);
+
+  const auto path = localPath(block.file);
+  uint64_t openNanos{0};
+  int fd;
+  {
+    NanosecondTimer timer(&openNanos);
+    fd = ::open(path.c_str(), O_RDONLY);
+  }
+  VELOX_CHECK_GE(
+      fd,
+      0,
+      "Cannot open local shuffle file {}: {}",
+      path,
+      folly::errnoStr(errno));
+  ++numFiles_;
+  openWallNanos_ += openNanos;
+
+  // The offset of a mapping must be a multiple of the page size.
+  const auto mapOffset = block.offset - block.offset % kPageSize;
+  const auto mapSize = block.size + (block.offset - mapOffset);
+  uint64_t mapNanos{0};
+  void* address;
+  {
+    NanosecondTimer timer(&mapNanos);
+    address = ::mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, mapOffset);
+  }
+  const auto error = address == MAP_FAILED ? errno : 0;
+  // The mapping stays valid after the file is closed.
+  ::close(fd);
+  VELOX_CHECK_EQ(
+      error,
+      0,
+      "Cannot map local shuffle file {}: {}",
+      path,
+      folly::errnoStr(error));
+  ::madvise(address, mapSize, MADV_SEQUENTIAL);
+  readWallNanos_ += mapNanos;
+  mappedBytes_ += mapSize;
+  *mappedBytesInUse_ += mapSize;
+
+  return BufferView<MappedRegionReleaser>::create(
+      static_cast<const uint8_t*>(address) + (block.offset - mapOffset),
+      block.size,
+      MappedRegionReleaser(address, mapSize, mappedBytesInUse_));
+}
+
+folly::F14FastMap<std::string, int64_t> LocalPersistentShuffleReader::stats()
     const {
+  return {
+      {"local.read", storedBytes_},
+      {"local.read.rawBytes", rawBytes_},
+      {"local.read.blocks", numBlocks_},
+      {"local.read.files", numFiles_},
+      {"local.read.wallNanos", readWallNanos_},
+      {"local.read.openWallNanos", openWallNanos_},
+      {"local.read.mappedBytes", mappedBytes_},
+      {"local.read.mappedBytesInUse", *mappedBytesInUse_},
+  };
+}
+
+void LocalPersistentShuffleReader::scheduleReadAhead() {
+  while (readAheadBlocks_.size() < numReadAheadBlocks_ &&
+         readPartitionBlockIndex_ + readAheadBlocks_.size() <
+             readPartitionBlocks_.size()) {
+    const auto index = readPartitionBlockIndex_ + readAheadBlocks_.size();
+    const auto& block = readPartitionBlocks_[index];
+    readAheadBlocks_.push_back(
+        folly::via(
+            folly::getKeepAliveToken(executor_),
+            [this, &block]() { return readBlock(block); })
+            .semi());
+  }
+}
+
+void LocalPersistentShuffleReader::clearReadAhead() {
+  for (auto& future : readAheadBlocks_) {
+    future.wait();
+  }
+  readAheadBlocks_.clear();
+}
+
+std::vector<LocalPersistentShuffleReader::ReadBlock>
+LocalPersistentShuffleReader::getReadPartitionBlocks() {
   // Get rid of excess '/' characters in the path.
   auto trimmedRootPath = rootPath_;
   while (trimmedRootPath.length() > 0 &&
@@ -193,25 +1438,128 @@ std::vector<std::string> LocalPersistentShuffleReader::getReadPartitionFiles()
     trimmedRootPath.erase(trimmedRootPath.length() - 1, 1);
   }
 
-  std::vector<std::string> partitionFiles;
+  std::vector<std::string> manifestFiles;
+  for (auto& file : fileSystem_->list(fmt::format("{}/", rootPath_))) {
+    if (endsWith(file, kManifestFileSuffix)) {
+      manifestFiles.push_back(std::move(file));
+    }
+  }
+  std::sort(manifestFiles.begin(), manifestFiles.end());
+
+  // The content of the manifests read so far.
+  folly::F14FastMap<std::string, std::string> manifests;
+  std::vector<ReadBlock> blocks;
+  // Whether the writers of the manifests read so far sorted their blocks.
+  std::optional<bool> sortedBlocks;
   for (const auto& partitionId : partitionIds_) {
-    auto prefix =
-        fmt::format("{}/{}_{}_", trimmedRootPath, queryId_, partitionId);
-    auto files = fileSystem_->list(fmt::format("{}/", rootPath_));
-    for (const auto& file : files) {
-      if (file.find(prefix) == 0) {
-        partitionFiles.push_back(file);
+    // The partition ID follows Spark's block ID format
+    // shuffle_<SHUFFLE_ID>_<MAP_ID>_<PARTITION> while the manifests of a map
+    // output are named <QUERY_ID>_shuffle_<SHUFFLE_ID>_<MAP_ID>_<WRITER>.
+    const auto pos = partitionId.rfind('_');
+    if (pos == std::string::npos) {
+      continue;
+    }
+    const auto partition = folly::tryTo<uint32_t>(
+        folly::StringPiece(partitionId).subpiece(pos + 1));
+    if (!partition.hasValue()) {
+      continue;
+    }
+    const auto prefix = fmt::format(
+        "{}/{}_{}_", trimmedRootPath, queryId_, partitionId.substr(0, pos));
+    for (const auto& manifestFile : manifestFiles) {
+      if (manifestFile.find(prefix) != 0) {
+        continue;
+      }
+      auto it = manifests.find(manifestFile);
+      if (it == manifests.end()) {
+        auto file = fileSystem_->openFileForRead(manifestFile);
+        ++numFiles_;
+        it = manifests.emplace(manifestFile, file->pread(0, file->size()))
+                 .first;
       }
+      const bool manifestSortedBlocks =
+          readManifest(manifestFile, it->second, partition.value(), blocks);
+      // Merging unsorted blocks, or not merging sorted ones, would corrupt
+      // the rows, which carry sort keys only in a sorted shuffle.
+      VELOX_CHECK(
+          !sortedBlocks.has_value() ||
+              sortedBlocks.value() == manifestSortedBlocks,
+          "Writers of local shuffle {} disagree on sorted blocks: {}",
+          partitionId,
+          manifestFile);
+      sortedBlocks = manifestSortedBlocks;
     }
   }
+  sortedBlocks_ = sortedBlocks.value_or(false);
 
-  return partitionFiles;
+  for (auto& block : blocks) {
+    block.file = fmt::format("{}/{}", trimmedRootPath, block.file);
+  }
+  return blocks;
+}
+
+bool LocalPersistentShuffleReader::readManifest(
+    const std::string& manifestFile,
+    const std::string& manifest,
+    uint32_t partition,
+    std::vector<ReadBlock>& blocks) const {
+  size_t offset = 0;
+  const auto numFiles = readBigEndian<uint32_t>(manifest, offset);
+  std::vector<std::string> files;
+  files.reserve(numFiles);
+  for (uint32_t i = 0; i < numFiles; ++i) {
+    const auto nameSize = readBigEndian<uint32_t>(manifest, offset);
+    VELOX_CHECK_LE(
+        offset + nameSize,
+        manifest.size(),
+        "Corrupted local shuffle manifest {}",
+        manifestFile);
+    files.push_back(manifest.substr(offset, nameSize));
+    offset += nameSize;
+  }
+
+  const auto numPartitions = readBigEndian<uint32_t>(manifest, offset);
+  VELOX_CHECK_LT(
+      partition,
+      numPartitions,
+      "Partition out of range in local shuffle manifest {}",
+      manifestFile);
+  const auto flags = readBigEndian<uint32_t>(manifest, offset);
+  constexpr size_t kBlockLocationSize =
+      sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t);
+  for (uint32_t i = 0; i <= partition; ++i) {
+    const auto numBlocks = readBigEndian<uint32_t>(manifest, offset);
+    if (i < partition) {
+      offset += numBlocks * kBlockLocationSize;
+      continue;
+    }
+    for (uint32_t j = 0; j < numBlocks; ++j) {
+      const auto file = readBigEndian<uint32_t>(manifest, offset);
+      VELOX_CHECK_LT(
+          file,
+          files.size(),
+          "Corrupted local shuffle manifest {}",
+          manifestFile);
+      const auto blockOffset = readBigEndian<uint64_t>(manifest, offset);
+      const auto blockSize = readBigEndian<uint64_t>(manifest, offset);
+      blocks.push_back({files[file], blockOffset, blockSize});
+    }
+  }
+  return (flags & kManifestSortedBlocks) != 0;
 }
 
 void LocalPersistentShuffleWriter::cleanup() {
+  // Other writers may share the root directory, so only the block, data and
+  // manifest files of this writer are deleted.
+  const auto prefix = fileName(writerFilePrefix_);
   auto files = fileSystem_->list(rootPath_);
   for (auto& file : files) {
-    fileSystem_->remove(file);
+    const auto name = fileName(file);
+    if (name.size() > prefix.size() &&
+        name.compare(0, prefix.size(), prefix) == 0 &&
+        (name[prefix.size()] == '_' || name[prefix.size()] == '.')) {
+      fileSystem_->remove(file);
+    }
   }
 }
 
@@ -237,21 +1585,61 @@ LocalShuffleReadInfo LocalShuffleReadInfo::deserialize(
   jsonReadInfo.at("queryId").get_to(shuffleInfo.queryId);
   jsonReadInfo.at("partitionIds").get_to(shuffleInfo.partitionIds);
   jsonReadInfo.at("numPartitions").get_to(shuffleInfo.numPartitions);
+  if (jsonReadInfo.contains("blockBegin")) {
+    jsonReadInfo.at("blockBegin").get_to(shuffleInfo.blockBegin);
+  }
+  if (jsonReadInfo.contains("blockEnd")) {
+    jsonReadInfo.at("blockEnd").get_to(shuffleInfo.blockEnd);
+  }
   return shuffleInfo;
 }
 
+std::vector<std::pair<uint32_t, uint32_t>> splitLocalShuffleBlocks(
+    const std::vector<uint64_t>& blockSizes,
+    uint64_t targetBytes) {
+  VELOX_CHECK_GT(targetBytes, 0);
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  uint32_t begin = 0;
+  uint64_t bytes = 0;
+  for (uint32_t i = 0; i < blockSizes.size(); ++i) {
+    if (i > begin && bytes + blockSizes[i] > targetBytes) {
+      ranges.emplace_back(begin, i);
+      begin = i;
+      bytes = 0;
+    }
+    bytes += blockSizes[i];
+  }
+  if (begin < blockSizes.size()) {
+    ranges.emplace_back(begin, blockSizes.size());
+  }
+  return ranges;
+}
+
 std::shared_ptr<ShuffleReader> LocalPersistentShuffleFactory::createReader(
     const std::string& serializedStr,
     const int32_t partition,
     velox::memory::MemoryPool* pool) {
   const operators::LocalShuffleReadInfo readInfo =
       operators::LocalShuffleReadInfo::deserialize(serializedStr);
+  static const uint32_t numReadAheadBlocks =
+      SystemConfig::instance()->localShuffleReadAheadBlocks();
+  static const bool mmapReads =
+      SystemConfig::instance()->localShuffleMmapReads();
+  static const bool useIoUring =
+      SystemConfig::instance()->localShuffleUseIoUring();
+  static const bool directIo = SystemConfig::instance()->localShuffleDirectIo();
   return std::make_shared<operators::LocalPersistentShuffleReader>(
-      readInfo.rootPath,
+      useIoUring ? toIoUringPath(readInfo.rootPath) : readInfo.rootPath,
       readInfo.queryId,
       readInfo.partitionIds,
       partition,
-      pool);
+      pool,
+      shuffleIoExecutor(),
+      numReadAheadBlocks,
+      mmapReads,
+      directIo,
+      readInfo.blockBegin,
+      readInfo.blockEnd);
 }
 
 std::shared_ptr<ShuffleWriter> LocalPersistentShuffleFactory::createWriter(
@@ -259,15 +1647,33 @@ std::shared_ptr<ShuffleWriter> LocalPersistentShuffleFactory::createWriter(
     velox::memory::MemoryPool* pool) {
   static const uint64_t maxBytesPerPartition =
       SystemConfig::instance()->localShuffleMaxPartitionBytes();
+  static const bool consolidatedFiles =
+      SystemConfig::instance()->localShuffleConsolidatedFiles();
+  static const uint32_t maxInflightWrites =
+      SystemConfig::instance()->localShuffleMaxInflightWrites();
+  static const LocalShuffleCompression compression =
+      localShuffleCompressionFromString(
+          SystemConfig::instance()->localShuffleCompressionCodec());
+  static const uint64_t maxBufferedBytes =
+      SystemConfig::instance()->localShuffleMaxBufferedBytes();
+  static const bool useIoUring =
+      SystemConfig::instance()->localShuffleUseIoUring();
+  static const bool directIo = SystemConfig::instance()->localShuffleDirectIo();
   const operators::LocalShuffleWriteInfo writeInfo =
       operators::LocalShuffleWriteInfo::deserialize(serializedStr);
   return std::make_shared<operators::LocalPersistentShuffleWriter>(
-      writeInfo.rootPath,
+      useIoUring ? toIoUringPath(writeInfo.rootPath) : writeInfo.rootPath,
       writeInfo.queryId,
       writeInfo.shuffleId,
       writeInfo.numPartitions,
       maxBytesPerPartition,
-      pool);
+      pool,
+      consolidatedFiles,
+      shuffleIoExecutor(),
+      maxInflightWrites,
+      compression,
+      maxBufferedBytes,
+      directIo);
 }
 
 } // namespace facebook::presto::operators
@@ -13,6 +13,15 @@
  */
 #pragma once
 
+#include <folly/File.h>
+#include <folly/compression/Compression.h>
+#include <folly/executors/SerialExecutor.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include "presto_cpp/main/common/IoUringFileSystem.h"
 #include "presto_cpp/main/operators/ShuffleInterface.h"
 #include "velox/buffer/Buffer.h"
 #include "velox/common/file/File.h"
@@ -49,27 +58,106 @@ struct LocalShuffleReadInfo {
   std::string queryId;
   uint32_t numPartitions;
   std::vector<std::string> partitionIds;
+  /// The range [blockBegin, blockEnd) of the blocks of 'partitionIds' to read,
+  /// so that several readers can share a large partition. Optional, all the
+  /// blocks by default. See LocalPersistentShuffleReader::blockSizes() and
+  /// splitLocalShuffleBlocks().
+  uint32_t blockBegin{0};
+  uint32_t blockEnd{std::numeric_limits<uint32_t>::max()};
+
+  bool hasBlockRange() const {
+    return blockBegin != 0 ||
+        blockEnd != std::numeric_limits<uint32_t>::max();
+  }
 
   /// Deserializes shuffle information that is used by LocalPersistentShuffle.
   /// Structures are assumed to be encoded in JSON format.
   static LocalShuffleReadInfo deserialize(const std::string& info);
 };
 
+/// Splits the blocks of a partition, given their sizes, into consecutive ranges
+/// [begin, end) of about 'targetBytes' each. A block larger than
+/// 'targetBytes' gets a range of its own. Used to assign the blocks of a
+/// skewed partition to several readers through LocalShuffleReadInfo.
+std::vector<std::pair<uint32_t, uint32_t>> splitLocalShuffleBlocks(
+    const std::vector<uint64_t>& blockSizes,
+    uint64_t targetBytes);
+
+/// Compression codec of the blocks written by LocalPersistentShuffleWriter.
+enum class LocalShuffleCompression : uint8_t {
+  kNone = 0,
+  kLz4 = 1,
+  kZstd = 2,
+};
+
+/// Parses a 'shuffle.local.compression-codec' config value.
+LocalShuffleCompression localShuffleCompressionFromString(
+    const std::string& codec);
+
 /// This class is a persistent shuffle server that implements
 /// ShuffleInterface for read and write and also uses generalized Velox
 /// file system to maintain its state and data.
 ///
 /// Except for in-progress blocks of current output vectors in the writer,
 /// each produced vector is stored as a binary file of unsafe rows. Each block
-/// filename reflects the partition and sequence number of the block (vector)
-/// for that partition. For example <ROOT_PATH>/10_12.bin is the 12th (block)
-/// vector in partition #10.
+/// filename reflects the writer, the partition and the sequence number of the
+/// block (vector) for that partition. For example
+/// <ROOT_PATH>/<QUERY_ID>_shuffle_1_0_<WRITER_ID>_10_12.bin is the 12th
+/// (block) vector of the writer in partition #10.
 ///
-/// The class also uses Velox filesystem to figure out the number of written
-/// shuffle files for each partition. This enables the multi-threaded or
+/// On noMoreData(true), each writer commits its output by publishing a
+/// manifest listing the (file, offset, size) of each block of each partition,
+/// for example <ROOT_PATH>/<QUERY_ID>_shuffle_1_0_<WRITER_ID>.manifest. The
+/// manifest is written under a temporary name and then renamed, so readers
+/// never see a partial one. Readers list the root directory once to find the
+/// manifests and build their read plan from them only, ignoring the files of
+/// writers that have not committed. This enables the multi-threaded or
 /// multi-process use scenarios as long as each producer or consumer is assigned
 /// to a distinct group of partition IDs. Each of them can create an instance of
 /// this class (pointing to the same root path) to read and write shuffle data.
+///
+/// If 'consolidatedFiles' is set, the writer instead appends all the blocks of
+/// all partitions to a single data file, for example
+/// <ROOT_PATH>/<QUERY_ID>_shuffle_1_0_<WRITER_ID>.data. This keeps the number
+/// of files independent of the number of partitions and flushed blocks.
+///
+/// If 'executor' is set, full blocks are written in the background in the
+/// order they were produced, and isBlocked() blocks the caller while more than
+/// 'maxInflightWrites' blocks are queued. noMoreData() waits for all the queued
+/// writes to complete.
+///
+/// If 'compression' is set, each block is compressed on its own and prefixed
+/// with a header carrying the codec and the uncompressed size. The reader
+/// decompresses such blocks transparently.
+///
+/// If 'directIo' is set and 'rootPath' is on the local file system, blocks
+/// are written with O_DIRECT so that shuffle data does not go through the page
+/// cache. Each block is copied to a pooled buffer aligned for direct I/O and
+/// padded with zeros to a multiple of the alignment, so that blocks of
+/// consolidated files start at aligned offsets. The manifest records the
+/// unpadded sizes.
+///
+/// Partition buffers start small and double in size up to
+/// 'maxBytesPerPartition', the maximum block size. If 'maxBufferedBytes' is
+/// set, the capacity of all the partition buffers is kept under it by storing
+/// the largest partitions as blocks first. reclaim() does the same to release
+/// memory on request of the memory arbitrator.
+///
+/// stats() reports the following counters:
+///   local.write - bytes written to storage, after compression.
+///   local.write.rawBytes - bytes of the collected rows and their sizes.
+///   local.write.rows - number of collected rows.
+///   local.write.blocks - number of blocks written.
+///   local.write.files - number of files created.
+///   local.write.wallNanos - wall time spent writing and closing files.
+///   local.write.openWallNanos - wall time spent creating files.
+///   local.write.maxPartition - partition with the most raw bytes.
+///   local.write.maxPartitionBytes - raw bytes of that partition.
+///   local.write.maxPartitionRows - rows of that partition.
+///   local.write.partitionSkewPct - raw bytes of the largest partition as a
+///       percentage of the average over all partitions. 100 means no skew.
+/// The bytes and rows of each partition are available from partitionBytes()
+/// and partitionRows().
 class LocalPersistentShuffleWriter : public ShuffleWriter {
  public:
   LocalPersistentShuffleWriter(
@@ -78,49 +166,237 @@ class LocalPersistentShuffleWriter : public ShuffleWriter {
       uint32_t shuffleId,
       uint32_t numPartitions,
       uint64_t maxBytesPerPartition,
-      velox::memory::MemoryPool* FOLLY_NONNULL pool);
+      velox::memory::MemoryPool* FOLLY_NONNULL pool,
+      bool consolidatedFiles = false,
+      folly::Executor* FOLLY_NULLABLE executor = nullptr,
+      uint32_t maxInflightWrites = 0,
+      LocalShuffleCompression compression = LocalShuffleCompression::kNone,
+      uint64_t maxBufferedBytes = 0,
+      bool directIo = false);
+
+  ~LocalPersistentShuffleWriter() override;
 
   void collect(int32_t partition, std::string_view data) override;
 
+  /// Groups the rows of a flat batch by partition and appends each partition's
+  /// rows in one pass.
+  void collectBatch(
+      const velox::VectorPtr& partitions,
+      const velox::VectorPtr& serializedRows) override;
+
+  /// Appends the run of length-prefixed rows of each partition with a single
+  /// copy. Falls back to collectBatch() if the rows are not laid out back to
+  /// back in one buffer.
+  void collectClusteredBatch(
+      const velox::VectorPtr& partitions,
+      const velox::VectorPtr& serializedRows) override;
+
+  char* reserveRow(int32_t partition, uint32_t size) override;
+
+  bool enableSortedBlocks() override {
+    sortedBlocks_ = true;
+    return true;
+  }
+
   void noMoreData(bool success) override;
 
-  folly::F14FastMap<std::string, int64_t> stats() const override {
-    // Fake counter for testing only.
-    return {{"local.write", 2345}};
+  velox::exec::BlockingReason isBlocked(velox::ContinueFuture* future) override;
+
+  bool canReclaim() const override {
+    return true;
+  }
+
+  uint64_t reclaim(uint64_t targetBytes) override;
+
+  folly::F14FastMap<std::string, int64_t> stats() const override;
+
+  /// Raw bytes collected for each partition, including the row sizes.
+  const std::vector<uint64_t>& partitionBytes() const {
+    return partitionBytes_;
+  }
+
+  /// Rows collected for each partition.
+  const std::vector<uint64_t>& partitionRows() const {
+    return partitionRows_;
   }
 
  private:
-  // Finds and creates the next file for writing the next block of the
-  // given 'partition'.
-  std::unique_ptr<velox::WriteFile> getNextOutputFile(int32_t partition);
+  // Returns a pointer to 'bytes' bytes of free space at the end of the
+  // in-progress block of 'partition', growing or storing the block as needed.
+  // The caller calls advance() with the bytes written.
+  char* reserve(int32_t partition, uint64_t bytes);
+
+  // Accounts for 'numRows' rows taking 'bytes' bytes appended to the
+  // in-progress block of 'partition'.
+  void advance(int32_t partition, uint64_t numRows, uint64_t bytes) {
+    inProgressSizes_[partition] += bytes;
+    partitionRows_[partition] += numRows;
+    partitionBytes_[partition] += bytes;
+  }
+
+  // Stores the in-progress blocks of the partitions in decreasing size order
+  // until the capacity of their buffers adds up to 'targetBytes'. Returns the
+  // capacity released.
+  uint64_t flushLargestPartitions(uint64_t targetBytes);
+
+  // A block stored to a file of its own that is not yet written.
+  struct PendingBlock {
+    std::string filename;
+    velox::BufferPtr buffer;
+    uint64_t size;
+  };
+
+  // Writes the in-progress block to the given partition. If 'batch' is set, a
+  // block going to a file of its own is added to 'batch' instead.
+  void storePartitionBlock(
+      int32_t partition,
+      std::vector<PendingBlock>* batch = nullptr);
+
+  // Writes the blocks of 'batch' together through 'batchFileSystem_'.
+  void writeBatch(std::vector<PendingBlock> batch);
+
+  // Runs 'write' inline or queues it on 'ioExecutor_'.
+  void runWrite(std::function<void()> write);
+
+  // Waits for all the writes queued on 'ioExecutor_' to complete.
+  void waitForInflightWrites();
+
+  // Returns true if one of the background writes failed.
+  bool hasWriteError();
+
+  // Throws the first error of the background writes if any.
+  void checkWriteError();
 
-  // Writes the in-progress block to the given partition.
-  void storePartitionBlock(int32_t partition);
+  // Closes the consolidated data file if open.
+  void closeDataFile();
 
-  // Deletes all the files in the root directory.
+  // Deletes the files of this writer in the root directory.
   void cleanup();
 
-  // find next available partition file name to store shuffle data
-  std::string nextAvailablePartitionFileName(
-      const std::string& root,
-      int32_t partition) const;
+  // Returns the name of the next block file of 'partition'.
+  std::string nextAvailablePartitionFileName(int32_t partition);
+
+  // Writes 'block' to a new file 'filename'.
+  void writeBlockFile(const std::string& filename, std::string_view block);
+
+  // Appends 'block' to the consolidated data file at 'offset'.
+  void appendToDataFile(std::string_view block, uint64_t offset);
+
+  // Writes the manifest of this writer under a temporary name and renames it
+  // to its final name.
+  void writeManifest();
 
   const uint64_t maxBytesPerPartition_;
+  // The limit of 'bufferedBytes_'. No limit if zero.
+  const uint64_t maxBufferedBytes_;
+  const bool consolidatedFiles_;
+  const bool directIo_;
+  // Set by enableSortedBlocks().
+  bool sortedBlocks_{false};
+  const LocalShuffleCompression compression_;
+  // Compresses the blocks if 'compression_' is set.
+  std::unique_ptr<folly::io::Codec> codec_;
 
   velox::memory::MemoryPool* FOLLY_NONNULL pool_;
   uint32_t numPartitions_;
   /// The latest written block buffers and sizes.
   std::vector<velox::BufferPtr> inProgressPartitions_;
   std::vector<size_t> inProgressSizes_;
+  // The total capacity of 'inProgressPartitions_'.
+  uint64_t bufferedBytes_{0};
   // The top directory of the shuffle files and its file system.
   std::string rootPath_;
   std::string queryId_;
   uint32_t shuffleId_;
   std::shared_ptr<velox::filesystems::FileSystem> fileSystem_;
-  // Used to make sure files created by this thread have unique names.
+  // Set if 'fileSystem_' writes many files in one batch. Used for the last
+  // blocks of the partitions at noMoreData().
+  IoUringFileSystem* batchFileSystem_{nullptr};
+  // Part of 'writerFilePrefix_'.
   std::thread::id threadId_;
+  // The index of the next block file of each partition.
+  std::vector<int> nextFileIndices_;
+
+  // Reused by collectBatch(). The start offset into 'batchRows_' and the
+  // number of bytes of each partition, and the row numbers of the batch
+  // grouped by partition.
+  std::vector<velox::vector_size_t> batchPartitionOffsets_;
+  std::vector<uint64_t> batchPartitionBytes_;
+  std::vector<velox::vector_size_t> batchRows_;
+
+  // Stats. The rows and raw bytes collected for each partition, and the
+  // blocks and bytes passed to the writes.
+  std::vector<uint64_t> partitionRows_;
+  std::vector<uint64_t> partitionBytes_;
+  uint64_t numBlocks_{0};
+  uint64_t storedBytes_{0};
+  // Stats updated by the writes, which may run in the background.
+  std::atomic<uint64_t> numFiles_{0};
+  std::atomic<uint64_t> writeWallNanos_{0};
+  std::atomic<uint64_t> openWallNanos_{0};
+
+  // Location of a block in one of 'files_'.
+  struct BlockLocation {
+    uint32_t file;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // The path prefix of the manifest and, with 'consolidatedFiles_', of the
+  // data file of this writer.
+  std::string writerFilePrefix_;
+  // The names of the files written so far relative to 'rootPath_', and the
+  // blocks written so far for each partition. Recorded in the manifest.
+  std::vector<std::string> files_;
+  std::vector<std::vector<BlockLocation>> partitionBlocks_;
+
+  // Used only with 'consolidatedFiles_'. The open data file and its size
+  // including the queued writes. With 'directIo_', the data file is written
+  // through 'dataFd_' instead.
+  std::unique_ptr<velox::WriteFile> dataFile_;
+  int dataFd_{-1};
+  uint64_t dataFileSize_{0};
+
+  // Runs the background writes of this writer one at a time. Not set if
+  // blocks are written inline.
+  folly::Executor::KeepAlive<folly::SerialExecutor> ioExecutor_;
+  const uint32_t maxInflightWrites_;
+
+  // Protects the members below, which are shared with the background writes.
+  std::mutex mutex_;
+  std::condition_variable inflightWritesCv_;
+  uint32_t numInflightWrites_{0};
+  std::vector<velox::ContinuePromise> promises_;
+  std::exception_ptr writeError_;
 };
 
+/// If 'executor' is set, the reader keeps the next 'numReadAheadBlocks' blocks
+/// loading in the background while the caller processes the current one.
+///
+/// If 'mmapReads' is set and 'rootPath' is on the local file system, blocks
+/// are memory-mapped instead of read into buffers. next() returns a read-only
+/// view of the mapped region, which is unmapped when the last reference to the
+/// view goes away. Compressed blocks are decompressed from the mapping.
+///
+/// If 'directIo' is set and 'rootPath' is on the local file system, blocks
+/// are read with O_DIRECT into pooled aligned buffers, bypassing the page
+/// cache, and next() returns a view of the block in the buffer. Takes
+/// precedence over 'mmapReads'.
+///
+/// blockCursors() reads the blocks in chunks through the file system,
+/// regardless of 'mmapReads' and 'directIo', and keeps the files of the
+/// blocks open until the reader is destroyed. A compressed block can't be
+/// read in part, so its cursor returns it whole after decompression.
+///
+/// stats() reports the following counters:
+///   local.read - bytes read from storage, before decompression.
+///   local.read.rawBytes - bytes of the blocks returned by next().
+///   local.read.blocks - number of blocks read.
+///   local.read.files - number of data and manifest files opened.
+///   local.read.wallNanos - wall time spent reading blocks.
+///   local.read.openWallNanos - wall time spent listing and opening files.
+///   local.read.mappedBytes - bytes of the blocks memory-mapped.
+///   local.read.mappedBytesInUse - bytes of the mappings still referenced.
 class LocalPersistentShuffleReader : public ShuffleReader {
  public:
   LocalPersistentShuffleReader(
@@ -128,32 +404,141 @@ class LocalPersistentShuffleReader : public ShuffleReader {
       const std::string& queryId,
       std::vector<std::string> partitionIds_,
       const int32_t partition,
-      velox::memory::MemoryPool* FOLLY_NONNULL pool);
+      velox::memory::MemoryPool* FOLLY_NONNULL pool,
+      folly::Executor* FOLLY_NULLABLE executor = nullptr,
+      uint32_t numReadAheadBlocks = 0,
+      bool mmapReads = false,
+      bool directIo = false,
+      uint32_t blockBegin = 0,
+      uint32_t blockEnd = std::numeric_limits<uint32_t>::max());
+
+  ~LocalPersistentShuffleReader() override;
+
+  /// Returns the size of each committed block of 'partitionIds', in the order
+  /// in which readers see them, regardless of the block range of this reader.
+  /// Lets a scheduler split a skewed partition into block ranges for several
+  /// readers.
+  std::vector<uint64_t> blockSizes();
 
   bool hasNext() override;
 
   velox::BufferPtr next(bool success) override;
 
-  folly::F14FastMap<std::string, int64_t> stats() const override {
-    // Fake counter for testing only.
-    return {{"local.read", 123}};
+  /// Returns true if the writers of the partition recorded sorted blocks in
+  /// their manifests.
+  bool sortedBlocks() override;
+
+  bool supportsBlockCursors() const override {
+    return true;
   }
 
+  std::vector<std::unique_ptr<ShuffleBlockCursor>> blockCursors(
+      uint64_t chunkBytes) override;
+
+  folly::F14FastMap<std::string, int64_t> stats() const override;
+
  private:
-  // Returns all created shuffle files for 'partition_'.
-  std::vector<std::string> getReadPartitionFiles() const;
+  // Reads a block in chunks, see blockCursors().
+  class BlockCursor;
+
+  // Location of one block of serialized rows in a shuffle file.
+  struct ReadBlock {
+    std::string file;
+    uint64_t offset{0};
+    uint64_t size{0};
+  };
+
+  // Reads the manifests and determines the blocks to read on first call.
+  void initialize();
+
+  // Returns all committed shuffle blocks for 'partitionIds_'. Lists the root
+  // directory once to find the manifests of the writers and reads each of
+  // them at most once. The manifests are read in name order, so that all the
+  // readers of a partition see its blocks in the same order. Sets
+  // 'sortedBlocks_'.
+  std::vector<ReadBlock> getReadPartitionBlocks();
+
+  // Appends the blocks of 'partition' recorded in 'manifest', the content of
+  // the manifest file 'manifestFile', to 'blocks'. Returns true if the writer
+  // sorted its blocks.
+  bool readManifest(
+      const std::string& manifestFile,
+      const std::string& manifest,
+      uint32_t partition,
+      std::vector<ReadBlock>& blocks) const;
+
+  // Reads 'block' into a new buffer. Called from the background threads when
+  // reading ahead.
+  velox::BufferPtr readBlock(const ReadBlock& block);
+
+  // Returns a view of 'block' memory-mapped from its file.
+  velox::BufferPtr mapBlock(const ReadBlock& block);
+
+  // Returns a view of 'block' read with direct I/O into an aligned buffer.
+  velox::BufferPtr readBlockDirect(const ReadBlock& block);
+
+  // Returns 'file' opened for the block cursors.
+  std::shared_ptr<velox::ReadFile> cursorFile(const std::string& file);
+
+  // Starts loading blocks in the background until 'numReadAheadBlocks_'
+  // blocks after the current one are loading or loaded.
+  void scheduleReadAhead();
+
+  // Waits for and discards the blocks loading in the background.
+  void clearReadAhead();
 
   std::string rootPath_;
   std::string queryId_;
   std::vector<std::string> partitionIds_;
   int32_t partition_;
   velox::memory::MemoryPool* FOLLY_NONNULL pool_;
+  // The range of the blocks of 'partitionIds_' to read.
+  const uint32_t blockBegin_;
+  const uint32_t blockEnd_;
+
+  // Latest read block index in 'readPartitionBlocks_' for 'partition_'.
+  size_t readPartitionBlockIndex_{0};
+
+  // List of generated blocks for 'partition_' in the block range.
+  std::vector<ReadBlock> readPartitionBlocks_;
+  bool readPartitionBlocksInitialized_{false};
+  // Set if the writers of 'partitionIds_' sorted their blocks.
+  bool sortedBlocks_{false};
 
-  // Latest read block (file) index in 'readPartitionFiles_' for 'partition_'.
-  size_t readPartitionFileIndex_{0};
+  // The last opened file. Consecutive blocks of a partition usually come from
+  // the same consolidated data file.
+  std::mutex currentFileMutex_;
+  std::string currentFileName_;
+  std::shared_ptr<velox::ReadFile> currentFile_;
+  // The last file opened with O_DIRECT by readBlockDirect(). Guarded by
+  // 'currentFileMutex_'. Shared with the reads in flight, so that it stays
+  // open until they finish.
+  std::string currentDirectFileName_;
+  std::shared_ptr<folly::File> currentDirectFile_;
 
-  // List of generated files for 'partition_'.
-  std::vector<std::string> readPartitionFiles_;
+  // The files opened for the block cursors, which read their blocks side by
+  // side.
+  folly::F14FastMap<std::string, std::shared_ptr<velox::ReadFile>>
+      cursorFiles_;
+
+  folly::Executor* FOLLY_NULLABLE const executor_;
+  const uint32_t numReadAheadBlocks_;
+  const bool mmapReads_;
+  const bool directIo_;
+  // The blocks loading in the background, starting at
+  // 'readPartitionBlockIndex_'.
+  std::deque<folly::SemiFuture<velox::BufferPtr>> readAheadBlocks_;
+
+  // Stats. Updated by readBlock(), which may run in the background.
+  std::atomic<uint64_t> storedBytes_{0};
+  std::atomic<uint64_t> rawBytes_{0};
+  std::atomic<uint64_t> numBlocks_{0};
+  std::atomic<uint64_t> numFiles_{0};
+  std::atomic<uint64_t> readWallNanos_{0};
+  std::atomic<uint64_t> openWallNanos_{0};
+  std::atomic<uint64_t> mappedBytes_{0};
+  // Shared with the views returned by next(), which may outlive this reader.
+  std::shared_ptr<std::atomic<uint64_t>> mappedBytesInUse_;
 
   // The top directory of the shuffle files and its file system.
   std::shared_ptr<velox::filesystems::FileSystem> fileSystem_;
@@ -170,6 +555,10 @@ class LocalPersistentShuffleFactory : public ShuffleInterfaceFactory {
   std::shared_ptr<ShuffleWriter> createWriter(
       const std::string& serializedStr,
       velox::memory::MemoryPool* FOLLY_NONNULL pool) override;
+
+  bool supportsSortedBlocks() const override {
+    return true;
+  }
 };
 
 } // namespace facebook::presto::operators
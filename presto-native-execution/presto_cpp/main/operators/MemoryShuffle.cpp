@@ -0,0 +1,712 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "presto_cpp/main/operators/MemoryShuffle.h"
+#include <folly/Conv.h>
+#include <folly/lang/Bits.h>
+#include <algorithm>
+#include <atomic>
+#include "presto_cpp/main/common/Configs.h"
+#include "presto_cpp/main/operators/SortedShuffle.h"
+
+using namespace facebook::velox;
+
+namespace facebook::presto::operators {
+
+namespace {
+// The capacity of the first block of a partition. Blocks double in size up to
+// the maximum block size.
+constexpr uint64_t kInitialBlockBytes = 64 << 10;
+
+std::string trimTrailingSlashes(std::string path) {
+  while (!path.empty() && path.back() == '/') {
+    path.pop_back();
+  }
+  return path;
+}
+
+// Keeps a block and its pool alive until the view returned by a reader is
+// destroyed. The block is released before the pool.
+class BlockReleaser {
+ public:
+  explicit BlockReleaser(MemoryShuffleBlock block)
+      : pool_(std::move(block.pool)), buffer_(std::move(block.buffer)) {}
+
+  void addRef() const {}
+
+  void release() const {}
+
+ private:
+  const std::shared_ptr<memory::MemoryPool> pool_;
+  const BufferPtr buffer_;
+};
+
+// Returns the root of the memory pool tree of 'pool', the query pool for the
+// pools of operators.
+memory::MemoryPool* rootPool(memory::MemoryPool* pool) {
+  while (pool->parent() != nullptr) {
+    pool = pool->parent();
+  }
+  return pool;
+}
+
+// Appends the length-prefixed rows of the block of 'size' bytes at 'data' to
+// 'partition' of 'writer'.
+void collectBlockRows(
+    ShuffleWriter& writer,
+    int32_t partition,
+    const char* data,
+    uint64_t size) {
+  using TRowSize = uint32_t;
+
+  for (uint64_t offset = 0; offset < size;) {
+    const auto rowSize =
+        folly::Endian::big(*reinterpret_cast<const TRowSize*>(data + offset));
+    offset += sizeof(TRowSize);
+    writer.collect(partition, std::string_view(data + offset, rowSize));
+    offset += rowSize;
+  }
+}
+
+// The pool of the buffers of the writers that spill committed blocks. It is
+// not under a query pool, so that spilling does not allocate from the pools
+// being reclaimed, which could reenter the memory arbitrator.
+memory::MemoryPool* spillPool() {
+  static const auto pool =
+      memory::addDefaultLeafMemoryPool("memory-shuffle-spill");
+  return pool.get();
+}
+
+// Spills the blocks committed to MemoryShuffleStore from the block pool of a
+// MemoryShuffleWriter on request of the memory arbitrator.
+class CommittedBlockReclaimer : public memory::MemoryReclaimer {
+ public:
+  bool canReclaim(const memory::MemoryPool& /*pool*/) const override {
+    return true;
+  }
+
+  uint64_t reclaimableBytes(const memory::MemoryPool& pool, bool& reclaimable)
+      const override {
+    reclaimable = true;
+    return pool.currentBytes();
+  }
+
+  uint64_t reclaim(memory::MemoryPool* pool, uint64_t /*targetBytes*/)
+      override {
+    return MemoryShuffleStore::instance().spill(pool);
+  }
+};
+} // namespace
+
+// static
+MemoryShuffleStore& MemoryShuffleStore::instance() {
+  static MemoryShuffleStore store;
+  return store;
+}
+
+void MemoryShuffleStore::commit(
+    const std::string& rootPath,
+    const std::string& queryId,
+    uint32_t shuffleId,
+    uint64_t maxBytesPerPartition,
+    std::vector<std::vector<MemoryShuffleBlock>> partitionBlocks,
+    bool spilled,
+    bool sortedBlocks) {
+  const auto shuffle = fmt::format(
+      "{}/{}_shuffle_{}_0", trimTrailingSlashes(rootPath), queryId, shuffleId);
+  std::lock_guard<std::mutex> l(mutex_);
+  auto [it, created] = queries_[queryId].try_emplace(shuffle);
+  auto& entry = it->second;
+  VELOX_CHECK(
+      created || entry.sortedBlocks == sortedBlocks,
+      "Writers of memory shuffle {} disagree on sorted blocks",
+      shuffle);
+  entry.rootPath = rootPath;
+  entry.shuffleId = shuffleId;
+  entry.maxBytesPerPartition = maxBytesPerPartition;
+  entry.sortedBlocks = sortedBlocks;
+  if (entry.partitionBlocks.size() < partitionBlocks.size()) {
+    entry.partitionBlocks.resize(partitionBlocks.size());
+  }
+  for (auto i = 0; i < partitionBlocks.size(); ++i) {
+    for (auto& block : partitionBlocks[i]) {
+      bytes_ += block.buffer->size();
+      entry.partitionBlocks[i].push_back(std::move(block));
+    }
+  }
+  entry.spilled |= spilled;
+}
+
+MemoryShuffleStore::Shuffle* MemoryShuffleStore::findLocked(
+    const std::string& queryId,
+    const std::string& shuffle) {
+  auto queryIt = queries_.find(queryId);
+  if (queryIt == queries_.end()) {
+    return nullptr;
+  }
+  auto it = queryIt->second.find(shuffle);
+  return it == queryIt->second.end() ? nullptr : &it->second;
+}
+
+std::vector<MemoryShuffleBlock> MemoryShuffleStore::acquire(
+    const std::string& queryId,
+    const std::string& shuffle,
+    uint32_t partition,
+    bool& spilled,
+    bool& sortedBlocks) {
+  std::unique_lock<std::mutex> l(mutex_);
+  // Blocks being spilled are neither in memory nor in committed files. The
+  // entry is looked up again after waiting as the map may have changed.
+  Shuffle* entry;
+  while ((entry = findLocked(queryId, shuffle)) != nullptr &&
+         entry->spilling) {
+    spillCv_.wait(l);
+  }
+  // Every writer commits, even without rows, so a missing shuffle is either
+  // not written yet or removed with its query. Reading no rows would then
+  // silently produce a wrong result.
+  VELOX_CHECK_NOT_NULL(
+      entry,
+      "Memory shuffle {} of query {} is not committed",
+      shuffle,
+      queryId);
+  ++entry->numReaders;
+  spilled = entry->spilled;
+  sortedBlocks = entry->sortedBlocks;
+  if (partition >= entry->partitionBlocks.size()) {
+    return {};
+  }
+  return entry->partitionBlocks[partition];
+}
+
+void MemoryShuffleStore::release(
+    const std::string& queryId,
+    const std::string& shuffle) {
+  std::lock_guard<std::mutex> l(mutex_);
+  // The query may have been removed already.
+  auto* entry = findLocked(queryId, shuffle);
+  if (entry == nullptr) {
+    return;
+  }
+  VELOX_CHECK_GT(entry->numReaders, 0);
+  --entry->numReaders;
+}
+
+uint64_t MemoryShuffleStore::spill(memory::MemoryPool* pool) {
+  // Takes the blocks of 'pool' out of the shuffles that are not being read.
+  // Readers of these shuffles wait in acquire() until the blocks are in
+  // committed files.
+  std::vector<PendingSpill> spills;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    for (auto& [queryId, shuffles] : queries_) {
+      for (auto& [name, shuffle] : shuffles) {
+        if (shuffle.numReaders > 0 || shuffle.spilling) {
+          continue;
+        }
+        PendingSpill spill{
+            queryId,
+            name,
+            shuffle.rootPath,
+            shuffle.shuffleId,
+            shuffle.maxBytesPerPartition,
+            shuffle.sortedBlocks,
+            {}};
+        spill.partitionBlocks.resize(shuffle.partitionBlocks.size());
+        bool hasBlocks = false;
+        for (auto i = 0; i < shuffle.partitionBlocks.size(); ++i) {
+          auto& blocks = shuffle.partitionBlocks[i];
+          auto it = std::stable_partition(
+              blocks.begin(), blocks.end(), [&](const auto& block) {
+                return block.pool.get() != pool;
+              });
+          for (auto block = it; block != blocks.end(); ++block) {
+            bytes_ -= block->buffer->size();
+            spill.partitionBlocks[i].push_back(std::move(*block));
+            hasBlocks = true;
+          }
+          blocks.erase(it, blocks.end());
+        }
+        if (hasBlocks) {
+          shuffle.spilling = true;
+          spills.push_back(std::move(spill));
+        }
+      }
+    }
+  }
+
+  uint64_t releasedBytes = 0;
+  for (auto& spill : spills) {
+    bool spilled = false;
+    try {
+      writeSpill(spill);
+      spilled = true;
+    } catch (const std::exception& e) {
+      // The blocks stay in memory.
+      LOG(WARNING) << "Failed to spill memory shuffle " << spill.shuffle
+                   << ": " << e.what();
+    }
+    {
+      std::lock_guard<std::mutex> l(mutex_);
+      // The query may have been removed meanwhile.
+      if (auto* shuffle = findLocked(spill.queryId, spill.shuffle)) {
+        shuffle->spilling = false;
+        shuffle->spilled |= spilled;
+        if (!spilled) {
+          for (auto i = 0; i < spill.partitionBlocks.size(); ++i) {
+            for (auto& block : spill.partitionBlocks[i]) {
+              bytes_ += block.buffer->size();
+              shuffle->partitionBlocks[i].push_back(std::move(block));
+            }
+          }
+        }
+      }
+    }
+    spillCv_.notify_all();
+    // The spilled blocks are freed here, outside of 'mutex_'.
+    for (auto& blocks : spill.partitionBlocks) {
+      for (auto& block : blocks) {
+        if (block.buffer != nullptr) {
+          releasedBytes += block.buffer->capacity();
+        }
+      }
+      blocks.clear();
+    }
+  }
+  return releasedBytes;
+}
+
+// static
+void MemoryShuffleStore::writeSpill(const PendingSpill& spill) {
+  const auto numPartitions = spill.partitionBlocks.size();
+  LocalPersistentShuffleWriter writer(
+      spill.rootPath,
+      spill.queryId,
+      spill.shuffleId,
+      numPartitions,
+      spill.maxBytesPerPartition,
+      spillPool());
+  if (spill.sortedBlocks) {
+    writer.enableSortedBlocks();
+  }
+  try {
+    for (auto partition = 0; partition < numPartitions; ++partition) {
+      for (const auto& block : spill.partitionBlocks[partition]) {
+        collectBlockRows(
+            writer, partition, block.buffer->as<char>(), block.buffer->size());
+      }
+      // Keeps the buffers of the writer to one partition.
+      writer.reclaim(std::numeric_limits<uint64_t>::max());
+    }
+    writer.noMoreData(true);
+  } catch (const std::exception&) {
+    // Deletes the files written so far. Readers ignore them anyway as they
+    // have no manifest.
+    try {
+      writer.noMoreData(false);
+    } catch (const std::exception& e) {
+      LOG(WARNING) << "Failed to delete memory shuffle spill files: "
+                   << e.what();
+    }
+    throw;
+  }
+}
+
+void MemoryShuffleStore::removeQuery(const std::string& queryId) {
+  folly::F14FastMap<std::string, Shuffle> shuffles;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    auto it = queries_.find(queryId);
+    if (it == queries_.end()) {
+      return;
+    }
+    for (const auto& [name, shuffle] : it->second) {
+      for (const auto& blocks : shuffle.partitionBlocks) {
+        for (const auto& block : blocks) {
+          bytes_ -= block.buffer->size();
+        }
+      }
+    }
+    shuffles = std::move(it->second);
+    queries_.erase(it);
+  }
+  // The blocks and their pools are freed outside of 'mutex_' as freeing
+  // memory may call into the memory arbitrator, which calls spill().
+}
+
+uint64_t MemoryShuffleStore::bytes() const {
+  std::lock_guard<std::mutex> l(mutex_);
+  return bytes_;
+}
+
+MemoryShuffleWriter::MemoryShuffleWriter(
+    const std::string& rootPath,
+    const std::string& queryId,
+    uint32_t shuffleId,
+    uint32_t numPartitions,
+    uint64_t maxBytesPerPartition,
+    memory::MemoryPool* FOLLY_NONNULL pool)
+    : rootPath_(rootPath),
+      queryId_(queryId),
+      shuffleId_(shuffleId),
+      numPartitions_(numPartitions),
+      maxBytesPerPartition_(maxBytesPerPartition),
+      pool_(pool) {
+  // Used to tell apart the block pools of the writers of a query.
+  static std::atomic<uint64_t> nextWriterId{0};
+  blockPool_ = rootPool(pool_)->addLeafChild(
+      fmt::format("memory-shuffle-{}", ++nextWriterId),
+      true,
+      std::make_unique<CommittedBlockReclaimer>());
+  partitionBlocks_.resize(numPartitions_);
+  inProgressBlocks_.resize(numPartitions_);
+  inProgressSizes_.assign(numPartitions_, 0);
+}
+
+void MemoryShuffleWriter::completeBlock(int32_t partition) {
+  auto buffer = std::move(inProgressBlocks_[partition]);
+  buffer->setSize(inProgressSizes_[partition]);
+  if (sortedBlocks_) {
+    buffer = sortShuffleBlock(
+        buffer->as<char>(), buffer->size(), blockPool_.get());
+  }
+  partitionBlocks_[partition].push_back({blockPool_, std::move(buffer)});
+}
+
+char* MemoryShuffleWriter::reserve(int32_t partition, uint64_t bytes) {
+  auto& buffer = inProgressBlocks_[partition];
+  auto& size = inProgressSizes_[partition];
+  if (buffer != nullptr && size + bytes <= buffer->capacity()) {
+    return buffer->asMutable<char>() + size;
+  }
+
+  // Completes the full block and starts a block of twice its capacity. Blocks
+  // are not copied into larger ones as they grow.
+  uint64_t capacity = std::min(kInitialBlockBytes, maxBytesPerPartition_);
+  if (buffer != nullptr) {
+    capacity = std::min(maxBytesPerPartition_, 2 * buffer->capacity());
+    if (size > 0) {
+      completeBlock(partition);
+    }
+  }
+  buffer = AlignedBuffer::allocate<char>(
+      std::max(capacity, bytes), blockPool_.get());
+  size = 0;
+  return buffer->asMutable<char>();
+}
+
+void MemoryShuffleWriter::collect(int32_t partition, std::string_view data) {
+  using TRowSize = uint32_t;
+
+  const TRowSize rowSize = data.size();
+  const auto size = sizeof(TRowSize) + rowSize;
+  auto rawBuffer = reserve(partition, size);
+  *(TRowSize*)(rawBuffer) = folly::Endian::big(rowSize);
+  ::memcpy(rawBuffer + sizeof(TRowSize), data.data(), rowSize);
+  inProgressSizes_[partition] += size;
+  ++numRows_;
+}
+
+char* MemoryShuffleWriter::reserveRow(int32_t partition, uint32_t size) {
+  using TRowSize = uint32_t;
+
+  auto rawBuffer = reserve(partition, sizeof(TRowSize) + size);
+  *(TRowSize*)(rawBuffer) = folly::Endian::big(size);
+  ::memset(rawBuffer + sizeof(TRowSize), 0, size);
+  inProgressSizes_[partition] += sizeof(TRowSize) + size;
+  ++numRows_;
+  return rawBuffer + sizeof(TRowSize);
+}
+
+uint64_t MemoryShuffleWriter::spill() {
+  if (spillWriter_ == nullptr) {
+    spillWriter_ = std::make_unique<LocalPersistentShuffleWriter>(
+        rootPath_,
+        queryId_,
+        shuffleId_,
+        numPartitions_,
+        maxBytesPerPartition_,
+        pool_);
+    if (sortedBlocks_) {
+      spillWriter_->enableSortedBlocks();
+    }
+  }
+  uint64_t releasedBytes = 0;
+  auto spillBlock = [&](int32_t partition, const char* data, uint64_t size) {
+    collectBlockRows(*spillWriter_, partition, data, size);
+    spilledBytes_ += size;
+  };
+  for (auto partition = 0; partition < numPartitions_; ++partition) {
+    for (auto& block : partitionBlocks_[partition]) {
+      spillBlock(partition, block.buffer->as<char>(), block.buffer->size());
+      releasedBytes += block.buffer->capacity();
+    }
+    partitionBlocks_[partition].clear();
+    if (auto& buffer = inProgressBlocks_[partition]) {
+      spillBlock(partition, buffer->as<char>(), inProgressSizes_[partition]);
+      releasedBytes += buffer->capacity();
+      buffer.reset();
+      inProgressSizes_[partition] = 0;
+    }
+  }
+  // Writes out what the spill writer buffered.
+  spillWriter_->reclaim(std::numeric_limits<uint64_t>::max());
+  ++numSpills_;
+  return releasedBytes;
+}
+
+uint64_t MemoryShuffleWriter::reclaim(uint64_t /*targetBytes*/) {
+  return spill();
+}
+
+void MemoryShuffleWriter::noMoreData(bool success) {
+  if (spillWriter_ != nullptr) {
+    spillWriter_->noMoreData(success);
+  }
+  if (!success) {
+    partitionBlocks_.clear();
+    inProgressBlocks_.clear();
+    return;
+  }
+  for (auto partition = 0; partition < numPartitions_; ++partition) {
+    if (inProgressBlocks_[partition] != nullptr &&
+        inProgressSizes_[partition] > 0) {
+      completeBlock(partition);
+    }
+    inProgressBlocks_[partition].reset();
+    for (const auto& block : partitionBlocks_[partition]) {
+      bytes_ += block.buffer->size();
+      ++numBlocks_;
+    }
+  }
+  MemoryShuffleStore::instance().commit(
+      rootPath_,
+      queryId_,
+      shuffleId_,
+      maxBytesPerPartition_,
+      std::move(partitionBlocks_),
+      spillWriter_ != nullptr,
+      sortedBlocks_);
+  partitionBlocks_.clear();
+}
+
+folly::F14FastMap<std::string, int64_t> MemoryShuffleWriter::stats() const {
+  return {
+      {"memory.write", bytes_},
+      {"memory.write.rows", numRows_},
+      {"memory.write.blocks", numBlocks_},
+      {"memory.write.spilledBytes", spilledBytes_},
+      {"memory.write.spills", numSpills_},
+  };
+}
+
+MemoryShuffleReader::MemoryShuffleReader(
+    const std::string& rootPath,
+    const std::string& queryId,
+    std::vector<std::string> partitionIds,
+    int32_t partition,
+    memory::MemoryPool* FOLLY_NONNULL pool)
+    : rootPath_(rootPath),
+      queryId_(queryId),
+      partitionIds_(std::move(partitionIds)),
+      partition_(partition),
+      pool_(pool) {}
+
+MemoryShuffleReader::~MemoryShuffleReader() {
+  releaseShuffles();
+}
+
+void MemoryShuffleReader::initialize() {
+  initialized_ = true;
+  bool spilled = false;
+  std::optional<bool> sortedBlocks;
+  for (const auto& partitionId : partitionIds_) {
+    // The partition ID follows Spark's block ID format
+    // shuffle_<SHUFFLE_ID>_<MAP_ID>_<PARTITION>, like for
+    // LocalPersistentShuffleReader.
+    const auto pos = partitionId.rfind('_');
+    if (pos == std::string::npos) {
+      continue;
+    }
+    const auto partition = folly::tryTo<uint32_t>(
+        folly::StringPiece(partitionId).subpiece(pos + 1));
+    if (!partition.hasValue()) {
+      continue;
+    }
+    auto shuffle = fmt::format(
+        "{}/{}_{}",
+        trimTrailingSlashes(rootPath_),
+        queryId_,
+        partitionId.substr(0, pos));
+    bool shuffleSpilled = false;
+    bool shuffleSortedBlocks = false;
+    auto blocks = MemoryShuffleStore::instance().acquire(
+        queryId_,
+        shuffle,
+        partition.value(),
+        shuffleSpilled,
+        shuffleSortedBlocks);
+    pinnedShuffles_.push_back(shuffle);
+    VELOX_CHECK(
+        !sortedBlocks.has_value() ||
+            sortedBlocks.value() == shuffleSortedBlocks,
+        "Writers of memory shuffle {} disagree on sorted blocks",
+        shuffle);
+    sortedBlocks = shuffleSortedBlocks;
+    spilled |= shuffleSpilled;
+    for (auto& block : blocks) {
+      blocks_.push_back(std::move(block));
+    }
+  }
+  sortedBlocks_ = sortedBlocks.value_or(false);
+  if (spilled) {
+    spillReader_ = std::make_unique<LocalPersistentShuffleReader>(
+        rootPath_, queryId_, partitionIds_, partition_, pool_);
+    VELOX_CHECK_EQ(
+        spillReader_->sortedBlocks(),
+        sortedBlocks_,
+        "Spilled blocks of memory shuffle {} are not sorted like the others",
+        rootPath_);
+  }
+}
+
+void MemoryShuffleReader::releaseShuffles() {
+  for (const auto& shuffle : pinnedShuffles_) {
+    MemoryShuffleStore::instance().release(queryId_, shuffle);
+  }
+  pinnedShuffles_.clear();
+}
+
+bool MemoryShuffleReader::hasNext() {
+  if (!initialized_) {
+    initialize();
+  }
+  return blockIndex_ < blocks_.size() ||
+      (spillReader_ != nullptr && spillReader_->hasNext());
+}
+
+BufferPtr MemoryShuffleReader::next(bool success) {
+  // On failure, restart from the first block with the blocks and the spilled
+  // files of the store at this time.
+  if (!success) {
+    releaseShuffles();
+    blocks_.clear();
+    blockIndex_ = 0;
+    spillReader_.reset();
+    initialize();
+  }
+  if (blockIndex_ < blocks_.size()) {
+    return readBlock(blocks_[blockIndex_++]);
+  }
+  return spillReader_->next(true);
+}
+
+BufferPtr MemoryShuffleReader::readBlock(const MemoryShuffleBlock& block) {
+  bytes_ += block.buffer->size();
+  ++numBlocks_;
+  return BufferView<BlockReleaser>::create(
+      block.buffer->as<uint8_t>(), block.buffer->size(), BlockReleaser(block));
+}
+
+class MemoryShuffleReader::BlockCursor : public ShuffleBlockCursor {
+ public:
+  BlockCursor(MemoryShuffleReader* reader, MemoryShuffleBlock block)
+      : reader_(reader), block_(std::move(block)) {}
+
+  BufferPtr next() override {
+    if (done_) {
+      return nullptr;
+    }
+    done_ = true;
+    return reader_->readBlock(block_);
+  }
+
+  void reset() override {
+    done_ = false;
+  }
+
+ private:
+  MemoryShuffleReader* const reader_;
+  const MemoryShuffleBlock block_;
+  bool done_{false};
+};
+
+std::vector<std::unique_ptr<ShuffleBlockCursor>>
+MemoryShuffleReader::blockCursors(uint64_t chunkBytes) {
+  if (!initialized_) {
+    initialize();
+  }
+  std::vector<std::unique_ptr<ShuffleBlockCursor>> cursors;
+  for (const auto& block : blocks_) {
+    cursors.push_back(std::make_unique<BlockCursor>(this, block));
+  }
+  if (spillReader_ != nullptr) {
+    for (auto& cursor : spillReader_->blockCursors(chunkBytes)) {
+      cursors.push_back(std::move(cursor));
+    }
+  }
+  return cursors;
+}
+
+bool MemoryShuffleReader::sortedBlocks() {
+  if (!initialized_) {
+    initialize();
+  }
+  return sortedBlocks_;
+}
+
+folly::F14FastMap<std::string, int64_t> MemoryShuffleReader::stats() const {
+  folly::F14FastMap<std::string, int64_t> stats =
+      spillReader_ != nullptr ? spillReader_->stats()
+                              : folly::F14FastMap<std::string, int64_t>{};
+  stats["memory.read"] = bytes_;
+  stats["memory.read.blocks"] = numBlocks_;
+  return stats;
+}
+
+std::shared_ptr<ShuffleReader> MemoryShuffleFactory::createReader(
+    const std::string& serializedStr,
+    const int32_t partition,
+    memory::MemoryPool* pool) {
+  const auto readInfo = LocalShuffleReadInfo::deserialize(serializedStr);
+  VELOX_USER_CHECK(
+      !readInfo.hasBlockRange(),
+      "Memory shuffle does not support reading block ranges");
+  return std::make_shared<MemoryShuffleReader>(
+      readInfo.rootPath,
+      readInfo.queryId,
+      readInfo.partitionIds,
+      partition,
+      pool);
+}
+
+std::shared_ptr<ShuffleWriter> MemoryShuffleFactory::createWriter(
+    const std::string& serializedStr,
+    memory::MemoryPool* pool) {
+  static const uint64_t maxBytesPerPartition =
+      SystemConfig::instance()->localShuffleMaxPartitionBytes();
+  const auto writeInfo = LocalShuffleWriteInfo::deserialize(serializedStr);
+  return std::make_shared<MemoryShuffleWriter>(
+      writeInfo.rootPath,
+      writeInfo.queryId,
+      writeInfo.shuffleId,
+      writeInfo.numPartitions,
+      maxBytesPerPartition,
+      pool);
+}
+
+void MemoryShuffleFactory::removeQuery(const std::string& queryId) {
+  MemoryShuffleStore::instance().removeQuery(queryId);
+}
+
+} // namespace facebook::presto::operators
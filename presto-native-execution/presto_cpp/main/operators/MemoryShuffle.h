@@ -0,0 +1,314 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include "presto_cpp/main/operators/LocalPersistentShuffle.h"
+#include "presto_cpp/main/operators/ShuffleInterface.h"
+#include "velox/buffer/Buffer.h"
+#include "velox/common/memory/Memory.h"
+
+namespace facebook::presto::operators {
+
+/// A block of an in-memory shuffle and the memory pool it is allocated from,
+/// which must outlive the block.
+struct MemoryShuffleBlock {
+  std::shared_ptr<velox::memory::MemoryPool> pool;
+  velox::BufferPtr buffer;
+};
+
+/// Process-wide registry of the blocks committed by MemoryShuffleWriters.
+/// Shuffles are keyed by their root path, query, shuffle and map IDs, like
+/// the files of LocalPersistentShuffle, and grouped by query.
+///
+/// Blocks stay in the store until removeQuery() is called for their query,
+/// so that retried reads get them again. Until then, the memory arbitrator
+/// can reclaim the pool of a writer, which spills the blocks of the writer to
+/// the local shuffle files, see spill().
+class MemoryShuffleStore {
+ public:
+  static MemoryShuffleStore& instance();
+
+  /// Adds the blocks of a writer of shuffle 'shuffleId' of 'queryId'.
+  /// 'partitionBlocks' has the blocks of each partition. 'spilled' tells that
+  /// the writer also wrote blocks to the local shuffle files under
+  /// 'rootPath'. 'sortedBlocks' tells that the rows of each block are sorted.
+  /// Throws if another writer of the shuffle did not sort its blocks alike.
+  void commit(
+      const std::string& rootPath,
+      const std::string& queryId,
+      uint32_t shuffleId,
+      uint64_t maxBytesPerPartition,
+      std::vector<std::vector<MemoryShuffleBlock>> partitionBlocks,
+      bool spilled,
+      bool sortedBlocks);
+
+  /// Returns the blocks of 'partition' of 'shuffle' of 'queryId' and pins
+  /// 'shuffle' in memory until release(). Sets 'spilled' if blocks of
+  /// 'shuffle' were spilled and 'sortedBlocks' if the writers sorted the
+  /// blocks. Waits for a spill of 'shuffle' in progress. Throws if no writer
+  /// committed 'shuffle'.
+  std::vector<MemoryShuffleBlock> acquire(
+      const std::string& queryId,
+      const std::string& shuffle,
+      uint32_t partition,
+      bool& spilled,
+      bool& sortedBlocks);
+
+  /// Unpins 'shuffle' of 'queryId' pinned by acquire().
+  void release(const std::string& queryId, const std::string& shuffle);
+
+  /// Spills the blocks allocated from 'pool' to the local shuffle files,
+  /// skipping the shuffles pinned by readers. Returns the capacity of the
+  /// released blocks. Called by the memory arbitrator, so the blocks are
+  /// written and freed outside of the store lock, and the buffers of the
+  /// writes do not come from 'pool'.
+  uint64_t spill(velox::memory::MemoryPool* FOLLY_NONNULL pool);
+
+  /// Drops the blocks of all the shuffles of 'queryId'. Called when the query
+  /// has ended, see TaskManager::removeQuery().
+  void removeQuery(const std::string& queryId);
+
+  /// Returns the number of bytes of the blocks held.
+  uint64_t bytes() const;
+
+ private:
+  struct Shuffle {
+    std::string rootPath;
+    uint32_t shuffleId{0};
+    uint64_t maxBytesPerPartition{0};
+    bool sortedBlocks{false};
+    std::vector<std::vector<MemoryShuffleBlock>> partitionBlocks;
+    bool spilled{false};
+    // Set while blocks taken out of 'partitionBlocks' are being spilled.
+    bool spilling{false};
+    // The number of readers between acquire() and release().
+    uint32_t numReaders{0};
+  };
+
+  // Blocks of a shuffle taken out of the store to be spilled.
+  struct PendingSpill {
+    std::string queryId;
+    std::string shuffle;
+    std::string rootPath;
+    uint32_t shuffleId;
+    uint64_t maxBytesPerPartition;
+    bool sortedBlocks;
+    std::vector<std::vector<MemoryShuffleBlock>> partitionBlocks;
+  };
+
+  // Returns the entry of 'shuffle' of 'queryId' or nullptr.
+  Shuffle* findLocked(const std::string& queryId, const std::string& shuffle);
+
+  // Writes the blocks of 'spill' to the local shuffle files and commits them.
+  static void writeSpill(const PendingSpill& spill);
+
+  mutable std::mutex mutex_;
+  // Notified when a spill completes.
+  std::condition_variable spillCv_;
+  // The shuffles of each query.
+  folly::F14FastMap<std::string, folly::F14FastMap<std::string, Shuffle>>
+      queries_;
+  uint64_t bytes_{0};
+};
+
+/// Shuffle writer that keeps the blocks of the partitions in memory and
+/// commits them to MemoryShuffleStore at noMoreData(). Readers of the same
+/// process get the blocks without copies. Blocks are allocated from a leaf
+/// pool under the query root pool of 'pool', so they are accounted to the
+/// query and outlive the writer task. The reclaimer of that pool spills the
+/// committed blocks through MemoryShuffleStore::spill().
+///
+/// Rows are framed like in LocalPersistentShuffle. Blocks start at 64KB and
+/// double in size up to 'maxBytesPerPartition'. When the memory arbitrator
+/// asks the writer to reclaim memory, all the blocks held are spilled to the
+/// local shuffle files under 'rootPath' through a
+/// LocalPersistentShuffleWriter, which readers then read after the blocks in
+/// memory.
+///
+/// stats() reports the following counters:
+///   memory.write - bytes of the blocks committed in memory.
+///   memory.write.rows - number of collected rows.
+///   memory.write.blocks - number of blocks committed in memory.
+///   memory.write.spilledBytes - bytes spilled to local shuffle files.
+///   memory.write.spills - number of reclaims that spilled.
+class MemoryShuffleWriter : public ShuffleWriter {
+ public:
+  MemoryShuffleWriter(
+      const std::string& rootPath,
+      const std::string& queryId,
+      uint32_t shuffleId,
+      uint32_t numPartitions,
+      uint64_t maxBytesPerPartition,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool);
+
+  void collect(int32_t partition, std::string_view data) override;
+
+  char* reserveRow(int32_t partition, uint32_t size) override;
+
+  bool enableSortedBlocks() override {
+    sortedBlocks_ = true;
+    return true;
+  }
+
+  void noMoreData(bool success) override;
+
+  bool canReclaim() const override {
+    return true;
+  }
+
+  uint64_t reclaim(uint64_t targetBytes) override;
+
+  folly::F14FastMap<std::string, int64_t> stats() const override;
+
+  /// The pool of the blocks.
+  velox::memory::MemoryPool* blockPool() const {
+    return blockPool_.get();
+  }
+
+ private:
+  // Returns space for 'bytes' more bytes at the end of the in-progress block
+  // of 'partition'.
+  char* reserve(int32_t partition, uint64_t bytes);
+
+  // Moves the in-progress block of 'partition' to its completed blocks,
+  // sorting its rows if 'sortedBlocks_' is set.
+  void completeBlock(int32_t partition);
+
+  // Writes the blocks held to the local shuffle files. Returns the capacity
+  // of the released blocks.
+  uint64_t spill();
+
+  const std::string rootPath_;
+  const std::string queryId_;
+  const uint32_t shuffleId_;
+  const uint32_t numPartitions_;
+  const uint64_t maxBytesPerPartition_;
+  velox::memory::MemoryPool* FOLLY_NONNULL const pool_;
+  // The pool of the blocks.
+  std::shared_ptr<velox::memory::MemoryPool> blockPool_;
+
+  // The completed blocks of each partition and the in-progress block and its
+  // size.
+  std::vector<std::vector<MemoryShuffleBlock>> partitionBlocks_;
+  std::vector<velox::BufferPtr> inProgressBlocks_;
+  std::vector<uint64_t> inProgressSizes_;
+
+  // Set by enableSortedBlocks().
+  bool sortedBlocks_{false};
+
+  // Created on first spill.
+  std::unique_ptr<LocalPersistentShuffleWriter> spillWriter_;
+
+  uint64_t bytes_{0};
+  uint64_t numRows_{0};
+  uint64_t numBlocks_{0};
+  uint64_t spilledBytes_{0};
+  uint64_t numSpills_{0};
+};
+
+/// Reads the blocks of a partition from MemoryShuffleStore and then, if the
+/// writers or the store spilled, from the local shuffle files under
+/// 'rootPath'. The blocks in memory are returned without copies. The shuffles
+/// read are pinned in memory until the reader is destroyed. A read that
+/// restarts after a failure gets the blocks from the store again.
+///
+/// blockCursors() returns each block in memory as a single chunk, as it is
+/// held anyway, and the cursors of the spilled blocks.
+///
+/// stats() reports the following counters:
+///   memory.read - bytes of the blocks read from memory.
+///   memory.read.blocks - number of blocks read from memory.
+/// and the counters of LocalPersistentShuffleReader for spilled blocks.
+class MemoryShuffleReader : public ShuffleReader {
+ public:
+  MemoryShuffleReader(
+      const std::string& rootPath,
+      const std::string& queryId,
+      std::vector<std::string> partitionIds,
+      int32_t partition,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool);
+
+  ~MemoryShuffleReader() override;
+
+  bool hasNext() override;
+
+  velox::BufferPtr next(bool success) override;
+
+  bool sortedBlocks() override;
+
+  bool supportsBlockCursors() const override {
+    return true;
+  }
+
+  std::vector<std::unique_ptr<ShuffleBlockCursor>> blockCursors(
+      uint64_t chunkBytes) override;
+
+  folly::F14FastMap<std::string, int64_t> stats() const override;
+
+ private:
+  // Returns a block in memory, see blockCursors().
+  class BlockCursor;
+
+  // Returns a view of 'block' that keeps it alive.
+  velox::BufferPtr readBlock(const MemoryShuffleBlock& block);
+
+  const std::string rootPath_;
+  const std::string queryId_;
+  const std::vector<std::string> partitionIds_;
+  const int32_t partition_;
+  velox::memory::MemoryPool* FOLLY_NONNULL const pool_;
+
+  // Gets the blocks of the partition from the store, pinning the shuffles in
+  // 'pinnedShuffles_', and creates 'spillReader_' if needed.
+  void initialize();
+
+  // Unpins the shuffles in 'pinnedShuffles_'.
+  void releaseShuffles();
+
+  bool initialized_{false};
+  std::vector<std::string> pinnedShuffles_;
+  std::vector<MemoryShuffleBlock> blocks_;
+  size_t blockIndex_{0};
+  // Set if the writers spilled.
+  std::unique_ptr<LocalPersistentShuffleReader> spillReader_;
+  // Set if the writers of the shuffles read sorted their blocks.
+  bool sortedBlocks_{false};
+
+  uint64_t bytes_{0};
+  uint64_t numBlocks_{0};
+};
+
+class MemoryShuffleFactory : public ShuffleInterfaceFactory {
+ public:
+  static constexpr folly::StringPiece kShuffleName{"memory"};
+
+  std::shared_ptr<ShuffleReader> createReader(
+      const std::string& serializedStr,
+      const int32_t partition,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool) override;
+
+  std::shared_ptr<ShuffleWriter> createWriter(
+      const std::string& serializedStr,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool) override;
+
+  bool supportsSortedBlocks() const override {
+    return true;
+  }
+
+  void removeQuery(const std::string& queryId) override;
+};
+
+} // namespace facebook::presto::operators
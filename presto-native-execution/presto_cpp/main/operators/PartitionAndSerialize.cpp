@@ -13,7 +13,8 @@
  */
 #include "presto_cpp/main/operators/PartitionAndSerialize.h"
 #include <folly/lang/Bits.h>
-#include "velox/row/UnsafeRowFast.h"
+#include "presto_cpp/main/operators/SortedShuffle.h"
+#include "velox/serializers/PrestoSerializer.h"
 
 using namespace facebook::velox::exec;
 using namespace facebook::velox;
@@ -40,23 +41,21 @@ class PartitionAndSerializeOperator : public Operator {
             planNode->id(),
             "PartitionAndSerialize"),
         numPartitions_(planNode->numPartitions()),
-        partitionFunction_(
-            numPartitions_ == 1 ? nullptr
-                                : planNode->partitionFunctionFactory()->create(
-                                      planNode->numPartitions())),
-        serializedRowType_{planNode->serializedRowType()} {
-    const auto& inputType = planNode->sources()[0]->outputType()->asRow();
-    const auto& serializedRowTypeNames = serializedRowType_->names();
-    bool identityMapping = true;
-    for (auto i = 0; i < serializedRowTypeNames.size(); ++i) {
-      serializedColumnIndices_.push_back(
-          inputType.getChildIdx(serializedRowTypeNames[i]));
-      if (serializedColumnIndices_.back() != i) {
-        identityMapping = false;
-      }
+        clustered_(planNode->clustered()),
+        serializedRowType_(planNode->serializedRowType()),
+        serializer_(
+            planNode->numPartitions(),
+            planNode->partitionFunctionFactory(),
+            planNode->sources()[0]->outputType()->asRow(),
+            planNode->serializedRowType()) {
+    if (planNode->format() == ShuffleSerializationFormat::kPresto) {
+      prestoSerde_ = std::make_unique<serializer::presto::PrestoVectorSerde>();
     }
-    if (identityMapping) {
-      serializedColumnIndices_.clear();
+    if (planNode->sorted()) {
+      sortKeyEncoder_.emplace(
+          planNode->sources()[0]->outputType()->asRow(),
+          planNode->sortingKeys(),
+          planNode->sortingOrders());
     }
   }
 
@@ -73,15 +72,34 @@ class PartitionAndSerializeOperator : public Operator {
       return nullptr;
     }
 
+    if (prestoSerde_ != nullptr) {
+      auto output = serializePages();
+      input_.reset();
+      return output;
+    }
+
     const auto numInput = input_->size();
 
     // TODO Reuse output vector.
     auto output = BaseVector::create<RowVector>(outputType_, numInput, pool());
 
-    computePartitions(*output->childAt(0)->asFlatVector<int32_t>());
-
-    serializeRows(*output->childAt(1)->asFlatVector<StringView>());
+    auto& partitionsVector = *output->childAt(0)->asFlatVector<int32_t>();
+    if (clustered_) {
+      const auto totalSize = serializer_.prepare(input_);
+      serializeClusteredRows(
+          partitionsVector,
+          *output->childAt(1)->asFlatVector<StringView>(),
+          totalSize);
+    } else {
+      // The partitions go straight to the output.
+      const auto totalSize = serializer_.prepare(
+          input_,
+          reinterpret_cast<uint32_t*>(partitionsVector.mutableRawValues()));
+      serializeRows(
+          *output->childAt(1)->asFlatVector<StringView>(), totalSize);
+    }
 
+    serializer_.clear();
     input_.reset();
 
     return output;
@@ -96,94 +114,346 @@ class PartitionAndSerializeOperator : public Operator {
   }
 
  private:
-  void computePartitions(FlatVector<int32_t>& partitionsVector) {
-    auto numInput = input_->size();
-    partitions_.resize(numInput);
-    if (numPartitions_ == 1) {
-      std::fill(partitions_.begin(), partitions_.end(), 0);
-    } else {
-      partitionFunction_->partition(*input_, partitions_);
+  // The logic of this method is logically identical with
+  // UnsafeRowVectorSerializer::append() and UnsafeRowVectorSerializer::flush().
+  // Rewriting of the serialization logic here to avoid additional copies so
+  // that contents are directly written into passed in vector.
+  void serializeRows(FlatVector<StringView>& dataVector, size_t totalSize) {
+    const auto numInput = input_->size();
+    const auto& rowSizes = serializer_.rowSizes();
+
+    dataVector.resize(numInput);
+
+    // Allocate memory.
+    auto buffer = dataVector.getBufferWithSpace(totalSize);
+    // getBufferWithSpace() may return a buffer that already has content, so we
+    // only use the space after that.
+    auto rawBuffer = buffer->asMutable<char>() + buffer->size();
+    buffer->setSize(buffer->size() + totalSize);
+    memset(rawBuffer, 0, totalSize);
+
+    // Lay out the rows, then serialize them.
+    rowBuffers_.resize(numInput);
+    size_t offset = 0;
+    for (auto i = 0; i < numInput; ++i) {
+      dataVector.setNoCopy(i, StringView(rawBuffer + offset, rowSizes[i]));
+      rowBuffers_[i] = rawBuffer + offset;
+      offset += rowSizes[i];
+    }
+    serializer_.serializeAll(rowBuffers_.data());
+  }
+
+  // Like serializeRows() but orders the rows by partition, using a counting
+  // sort, and prefixes each serialized row with its size. With sorting keys,
+  // the encoded keys go in front of the serialized rows. The rows are not
+  // sorted here, as the shuffle writer sorts each block it writes.
+  void serializeClusteredRows(
+      FlatVector<int32_t>& partitionsVector,
+      FlatVector<StringView>& dataVector,
+      size_t totalSize) {
+    using TRowSize = uint32_t;
+
+    const auto numInput = input_->size();
+    const auto& partitions = serializer_.partitions();
+    const auto& rowSizes = serializer_.rowSizes();
+
+    // Compute the output position of each row.
+    partitionOffsets_.assign(numPartitions_ + 1, 0);
+    for (auto i = 0; i < numInput; ++i) {
+      ++partitionOffsets_[partitions[i] + 1];
+    }
+    for (auto i = 0; i < numPartitions_; ++i) {
+      partitionOffsets_[i + 1] += partitionOffsets_[i];
+    }
+    clusteredRows_.resize(numInput);
+    for (auto i = 0; i < numInput; ++i) {
+      clusteredRows_[partitionOffsets_[partitions[i]]++] = i;
+    }
+    if (sortKeyEncoder_.has_value()) {
+      totalSize += encodeSortKeys();
     }
 
-    // TODO Avoid copy.
     partitionsVector.resize(numInput);
     auto rawPartitions = partitionsVector.mutableRawValues();
-    ::memcpy(rawPartitions, partitions_.data(), sizeof(int32_t) * numInput);
-  }
+    dataVector.resize(numInput);
 
-  RowVectorPtr reorderInputsIfNeeded() {
-    if (serializedColumnIndices_.empty()) {
-      return input_;
-    }
+    totalSize += sizeof(TRowSize) * numInput;
+    auto buffer = dataVector.getBufferWithSpace(totalSize);
+    auto rawBuffer = buffer->asMutable<char>() + buffer->size();
+    buffer->setSize(buffer->size() + totalSize);
+    memset(rawBuffer, 0, totalSize);
 
-    const auto& inputColumns = input_->children();
-    std::vector<VectorPtr> columns(inputColumns.size());
-    for (auto i = 0; i < columns.size(); ++i) {
-      columns[i] = inputColumns[serializedColumnIndices_[i]];
+    rowBuffers_.resize(numInput);
+    size_t offset = 0;
+    for (auto i = 0; i < numInput; ++i) {
+      const auto row = clusteredRows_[i];
+      rawPartitions[i] = partitions[row];
+      if (sortKeyEncoder_.has_value()) {
+        const auto key = sortKey(row);
+        const TRowSize rowSize = sizeof(TRowSize) + key.size() + rowSizes[row];
+        *(TRowSize*)(rawBuffer + offset) = folly::Endian::big(rowSize);
+        offset += sizeof(TRowSize);
+        dataVector.setNoCopy(i, StringView(rawBuffer + offset, rowSize));
+        *(TRowSize*)(rawBuffer + offset) =
+            folly::Endian::big<TRowSize>(key.size());
+        offset += sizeof(TRowSize);
+        ::memcpy(rawBuffer + offset, key.data(), key.size());
+        offset += key.size();
+      } else {
+        const TRowSize rowSize = rowSizes[row];
+        *(TRowSize*)(rawBuffer + offset) = folly::Endian::big(rowSize);
+        offset += sizeof(TRowSize);
+        dataVector.setNoCopy(i, StringView(rawBuffer + offset, rowSize));
+      }
+      rowBuffers_[row] = rawBuffer + offset;
+      offset += rowSizes[row];
     }
-    return std::make_shared<RowVector>(
-        input_->pool(),
-        serializedRowType_,
-        nullptr,
-        input_->size(),
-        std::move(columns));
+    serializer_.serializeAll(rowBuffers_.data());
   }
 
-  // The logic of this method is logically identical with
-  // UnsafeRowVectorSerializer::append() and UnsafeRowVectorSerializer::flush().
-  // Rewriting of the serialization logic here to avoid additional copies so
-  // that contents are directly written into passed in vector.
-  void serializeRows(FlatVector<StringView>& dataVector) {
+  // Encodes the sort keys of the input rows into 'sortKeys_'. Returns the
+  // bytes the keys and their sizes add to the serialized rows.
+  size_t encodeSortKeys() {
+    using TRowSize = uint32_t;
+
     const auto numInput = input_->size();
+    const auto totalSize = sortKeyEncoder_->prepare(input_);
+    const auto& keySizes = sortKeyEncoder_->keySizes();
+    sortKeys_.resize(totalSize);
+    sortKeyOffsets_.resize(numInput + 1);
+    sortKeyOffsets_[0] = 0;
+    for (auto i = 0; i < numInput; ++i) {
+      sortKeyEncoder_->encode(i, sortKeys_.data() + sortKeyOffsets_[i]);
+      sortKeyOffsets_[i + 1] = sortKeyOffsets_[i] + keySizes[i];
+    }
+    return totalSize + sizeof(TRowSize) * numInput;
+  }
 
-    dataVector.resize(numInput);
+  // Returns the encoded sort key of input 'row'.
+  std::string_view sortKey(vector_size_t row) const {
+    return std::string_view(
+        sortKeys_.data() + sortKeyOffsets_[row],
+        sortKeyOffsets_[row + 1] - sortKeyOffsets_[row]);
+  }
+
+  // Serializes the rows of each partition of the input as one PrestoPage.
+  // Returns one output row per non-empty partition, ordered by partition.
+  RowVectorPtr serializePages() {
+    using TRowSize = uint32_t;
 
-    // Compute row sizes.
-    rowSizes_.resize(numInput);
+    const auto numInput = input_->size();
+    const auto& partitions = serializer_.computePartitions(input_);
 
-    velox::row::UnsafeRowFast unsafeRow(reorderInputsIfNeeded());
+    // Group the rows of each partition into ranges of consecutive rows.
+    partitionRanges_.resize(numPartitions_);
+    for (auto& ranges : partitionRanges_) {
+      ranges.clear();
+    }
+    for (auto i = 0; i < numInput; ++i) {
+      auto& ranges = partitionRanges_[partitions[i]];
+      if (!ranges.empty() && ranges.back().begin + ranges.back().size == i) {
+        ++ranges.back().size;
+      } else {
+        ranges.push_back({i, 1});
+      }
+    }
 
+    auto rows = serializer_.reorderInputsIfNeeded(input_);
+    std::vector<int32_t> pagePartitions;
+    std::vector<std::unique_ptr<folly::IOBuf>> pages;
     size_t totalSize = 0;
-    if (auto fixedRowSize = unsafeRow.fixedRowSize(asRowType(input_->type()))) {
-      totalSize += fixedRowSize.value() * numInput;
-      std::fill(rowSizes_.begin(), rowSizes_.end(), fixedRowSize.value());
-    } else {
-      for (auto i = 0; i < numInput; ++i) {
-        const size_t rowSize = unsafeRow.rowSize(i);
-        rowSizes_[i] = rowSize;
-        totalSize += rowSize;
+    for (auto partition = 0; partition < numPartitions_; ++partition) {
+      const auto& ranges = partitionRanges_[partition];
+      if (ranges.empty()) {
+        continue;
+      }
+      vector_size_t numRows = 0;
+      for (const auto& range : ranges) {
+        numRows += range.size;
+      }
+      StreamArena arena(pool());
+      auto serializer =
+          prestoSerde_->createSerializer(serializedRowType_, numRows, &arena);
+      serializer->append(
+          rows, folly::Range<const IndexRange*>(ranges.data(), ranges.size()));
+      IOBufOutputStream stream(*pool());
+      serializer->flush(&stream);
+      pages.push_back(stream.getIOBuf());
+      pagePartitions.push_back(partition);
+      totalSize += pages.back()->computeChainDataLength();
+      if (clustered_) {
+        totalSize += sizeof(TRowSize);
       }
     }
 
-    // Allocate memory.
-    auto buffer = dataVector.getBufferWithSpace(totalSize);
-    // getBufferWithSpace() may return a buffer that already has content, so we
-    // only use the space after that.
+    const auto numPages = pages.size();
+    auto output = BaseVector::create<RowVector>(outputType_, numPages, pool());
+    auto partitionsVector = output->childAt(0)->asFlatVector<int32_t>();
+    auto dataVector = output->childAt(1)->asFlatVector<StringView>();
+    auto buffer = dataVector->getBufferWithSpace(totalSize);
     auto rawBuffer = buffer->asMutable<char>() + buffer->size();
     buffer->setSize(buffer->size() + totalSize);
-    memset(rawBuffer, 0, totalSize);
 
-    // Serialize rows.
     size_t offset = 0;
-    for (auto i = 0; i < numInput; ++i) {
-      dataVector.setNoCopy(i, StringView(rawBuffer + offset, rowSizes_[i]));
-
-      // Write row data.
-      auto size = unsafeRow.serialize(i, rawBuffer + offset);
-      VELOX_DCHECK_EQ(size, rowSizes_[i]);
-      offset += size;
+    for (auto i = 0; i < numPages; ++i) {
+      const TRowSize pageSize = pages[i]->computeChainDataLength();
+      partitionsVector->set(i, pagePartitions[i]);
+      if (clustered_) {
+        *(TRowSize*)(rawBuffer + offset) = folly::Endian::big(pageSize);
+        offset += sizeof(TRowSize);
+      }
+      dataVector->setNoCopy(i, StringView(rawBuffer + offset, pageSize));
+      for (const auto& range : *pages[i]) {
+        ::memcpy(rawBuffer + offset, range.data(), range.size());
+        offset += range.size();
+      }
     }
+    return output;
   }
 
   const uint32_t numPartitions_;
-  std::unique_ptr<core::PartitionFunction> partitionFunction_;
-  std::vector<uint32_t> partitions_;
-  std::vector<uint32_t> rowSizes_;
+  const bool clustered_;
   const RowTypePtr serializedRowType_;
-  std::vector<column_index_t> serializedColumnIndices_;
+  UnsafeRowPartitionSerializer serializer_;
+  // Set if the output is in kPresto format.
+  std::unique_ptr<serializer::presto::PrestoVectorSerde> prestoSerde_;
+  // Used by serializePages().
+  std::vector<std::vector<IndexRange>> partitionRanges_;
+  // Used by serializeClusteredRows().
+  std::vector<vector_size_t> partitionOffsets_;
+  std::vector<vector_size_t> clusteredRows_;
+  // The output location of each input row. Used by serializeRows() and
+  // serializeClusteredRows().
+  std::vector<char*> rowBuffers_;
+  // Set if the rows are sorted within partitions. Used by encodeSortKeys().
+  std::optional<ShuffleSortKeyEncoder> sortKeyEncoder_;
+  std::string sortKeys_;
+  std::vector<size_t> sortKeyOffsets_;
 };
 } // namespace
 
+UnsafeRowPartitionSerializer::UnsafeRowPartitionSerializer(
+    uint32_t numPartitions,
+    const core::PartitionFunctionSpecPtr& partitionFunctionSpec,
+    const RowType& inputType,
+    RowTypePtr serializedRowType)
+    : numPartitions_(numPartitions),
+      partitionFunction_(
+          numPartitions_ == 1
+              ? nullptr
+              : partitionFunctionSpec->create(numPartitions_)),
+      vectorizedPartitionFunction_(
+          dynamic_cast<VectorizedPartitionFunction*>(partitionFunction_.get())),
+      serializedRowType_{std::move(serializedRowType)} {
+  const auto& serializedRowTypeNames = serializedRowType_->names();
+  bool identityMapping = true;
+  for (auto i = 0; i < serializedRowTypeNames.size(); ++i) {
+    serializedColumnIndices_.push_back(
+        inputType.getChildIdx(serializedRowTypeNames[i]));
+    if (serializedColumnIndices_.back() != i) {
+      identityMapping = false;
+    }
+  }
+  if (identityMapping) {
+    serializedColumnIndices_.clear();
+  }
+  if (UnsafeRowColumnarSerializer::isSupported(*serializedRowType_)) {
+    columnarSerializer_.emplace(*serializedRowType_);
+  }
+}
+
+const std::vector<uint32_t>& UnsafeRowPartitionSerializer::computePartitions(
+    const RowVectorPtr& input) {
+  partitions_.resize(input->size());
+  computePartitions(input, partitions_.data());
+  return partitions_;
+}
+
+void UnsafeRowPartitionSerializer::computePartitions(
+    const RowVectorPtr& input,
+    uint32_t* partitions) {
+  if (numPartitions_ == 1) {
+    std::fill(partitions, partitions + input->size(), 0);
+  } else if (vectorizedPartitionFunction_ != nullptr) {
+    vectorizedPartitionFunction_->partition(*input, partitions);
+  } else {
+    partitionFunction_->partition(*input, partitions_);
+    if (partitions != partitions_.data()) {
+      ::memcpy(
+          partitions, partitions_.data(), sizeof(uint32_t) * input->size());
+    }
+  }
+}
+
+size_t UnsafeRowPartitionSerializer::prepare(
+    RowVectorPtr input,
+    uint32_t* partitions) {
+  const auto numInput = input->size();
+  if (partitions != nullptr) {
+    computePartitions(input, partitions);
+  } else {
+    computePartitions(input);
+  }
+
+  // Compute row sizes.
+  rows_ = reorderInputsIfNeeded(input);
+  if (columnarSerializer_.has_value()) {
+    unsafeRow_.reset();
+    return columnarSerializer_->prepare(rows_, rowSizes_);
+  }
+  rowSizes_.resize(numInput);
+  unsafeRow_.emplace(rows_);
+
+  size_t totalSize = 0;
+  if (auto fixedRowSize =
+          unsafeRow_->fixedRowSize(asRowType(input->type()))) {
+    totalSize += fixedRowSize.value() * numInput;
+    std::fill(rowSizes_.begin(), rowSizes_.end(), fixedRowSize.value());
+  } else {
+    for (auto i = 0; i < numInput; ++i) {
+      const size_t rowSize = unsafeRow_->rowSize(i);
+      rowSizes_[i] = rowSize;
+      totalSize += rowSize;
+    }
+  }
+  return totalSize;
+}
+
+void UnsafeRowPartitionSerializer::serializeAll(char* const* rowBuffers) {
+  if (columnarSerializer_.has_value()) {
+    columnarSerializer_->serialize(rowBuffers);
+    return;
+  }
+  for (auto i = 0; i < rows_->size(); ++i) {
+    const auto size = serialize(i, rowBuffers[i]);
+    VELOX_DCHECK_EQ(size, rowSizes_[i]);
+  }
+}
+
+void UnsafeRowPartitionSerializer::clear() {
+  unsafeRow_.reset();
+  rows_.reset();
+}
+
+RowVectorPtr UnsafeRowPartitionSerializer::reorderInputsIfNeeded(
+    const RowVectorPtr& input) const {
+  if (serializedColumnIndices_.empty()) {
+    return input;
+  }
+
+  const auto& inputColumns = input->children();
+  std::vector<VectorPtr> columns(inputColumns.size());
+  for (auto i = 0; i < columns.size(); ++i) {
+    columns[i] = inputColumns[serializedColumnIndices_[i]];
+  }
+  return std::make_shared<RowVector>(
+      input->pool(),
+      serializedRowType_,
+      nullptr,
+      input->size(),
+      std::move(columns));
+}
+
 std::unique_ptr<Operator> PartitionAndSerializeTranslator::toOperator(
     DriverCtx* ctx,
     int32_t id,
@@ -216,6 +486,23 @@ void PartitionAndSerializeNode::addDetails(std::stringstream& stream) const {
   }
   stream << ") " << numPartitions_ << " " << partitionFunctionSpec_->toString()
          << " " << serializedRowType_->toString();
+  if (clustered_) {
+    stream << " clustered";
+  }
+  if (format_ != ShuffleSerializationFormat::kUnsafeRow) {
+    stream << " " << shuffleSerializationFormatName(format_);
+  }
+  if (!sortingKeys_.empty()) {
+    stream << " sorted by (";
+    for (auto i = 0; i < sortingKeys_.size(); ++i) {
+      if (i > 0) {
+        stream << ", ";
+      }
+      stream << sortingKeys_[i]->name() << " "
+             << sortingOrders_[i].toString();
+    }
+    stream << ")";
+  }
 }
 
 folly::dynamic PartitionAndSerializeNode::serialize() const {
@@ -225,12 +512,32 @@ folly::dynamic PartitionAndSerializeNode::serialize() const {
   obj["serializedRowType"] = serializedRowType_->serialize();
   obj["sources"] = ISerializable::serialize(sources_);
   obj["partitionFunctionSpec"] = partitionFunctionSpec_->serialize();
+  obj["clustered"] = clustered_;
+  obj["format"] = shuffleSerializationFormatName(format_);
+  if (!sortingKeys_.empty()) {
+    obj["sortingKeys"] = ISerializable::serialize(sortingKeys_);
+    folly::dynamic sortingOrders = folly::dynamic::array;
+    for (const auto& sortOrder : sortingOrders_) {
+      sortingOrders.push_back(sortOrder.serialize());
+    }
+    obj["sortingOrders"] = sortingOrders;
+  }
   return obj;
 }
 
 velox::core::PlanNodePtr PartitionAndSerializeNode::create(
     const folly::dynamic& obj,
     void* context) {
+  std::vector<core::FieldAccessTypedExprPtr> sortingKeys;
+  std::vector<core::SortOrder> sortingOrders;
+  if (obj.count("sortingKeys")) {
+    sortingKeys =
+        ISerializable::deserialize<std::vector<core::FieldAccessTypedExpr>>(
+            obj["sortingKeys"], context);
+    for (const auto& sortOrder : obj["sortingOrders"]) {
+      sortingOrders.push_back(core::SortOrder::deserialize(sortOrder));
+    }
+  }
   return std::make_shared<PartitionAndSerializeNode>(
       deserializePlanNodeId(obj),
       ISerializable::deserialize<std::vector<velox::core::ITypedExpr>>(
@@ -240,6 +547,11 @@ velox::core::PlanNodePtr PartitionAndSerializeNode::create(
       ISerializable::deserialize<std::vector<velox::core::PlanNode>>(
           obj["sources"], context)[0],
       ISerializable::deserialize<velox::core::PartitionFunctionSpec>(
-          obj["partitionFunctionSpec"], context));
+          obj["partitionFunctionSpec"], context),
+      obj.getDefault("clustered", false).asBool(),
+      shuffleSerializationFormatFromName(
+          obj.getDefault("format", "unsafe-row").asString()),
+      std::move(sortingKeys),
+      std::move(sortingOrders));
 }
 } // namespace facebook::presto::operators
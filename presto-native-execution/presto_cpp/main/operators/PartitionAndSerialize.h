@@ -13,14 +13,33 @@
  */
 #pragma once
 
+#include "presto_cpp/main/operators/ShuffleInterface.h"
+#include "presto_cpp/main/operators/UnsafeRowColumnarSerializer.h"
+#include "presto_cpp/main/operators/VectorizedPartitionFunction.h"
 #include "velox/core/PlanNode.h"
 #include "velox/exec/Operator.h"
+#include "velox/row/UnsafeRowFast.h"
 
 namespace facebook::presto::operators {
 
 /// Partitions the input row based on partition function and serializes the
 /// entire row using UnsafeRow format. The output contains 2 columns: partition
 /// number (INTEGER) and serialized row (VARBINARY).
+///
+/// If 'clustered' is true, the output rows are ordered by partition and the
+/// serialized rows are laid out back to back in one buffer, each preceded by
+/// its size as a big-endian uint32. The serialized rows of a partition thus
+/// form one run of length-prefixed rows that a shuffle writer can append with
+/// a single copy. See ShuffleWriter::collectClusteredBatch().
+///
+/// If 'format' is kPresto, the rows of each partition of an input batch are
+/// serialized together as one PrestoPage instead, and the output has one row
+/// per non-empty partition, ordered by partition.
+///
+/// If 'sortingKeys' are given, each serialized row is preceded by its encoded
+/// sort key, in the format of a sorted shuffle. The shuffle writer sorts the
+/// rows of each block it writes by these keys. See SortedShuffle.h. Sorting
+/// requires 'clustered' and the kUnsafeRow format.
 class PartitionAndSerializeNode : public velox::core::PlanNode {
  public:
   PartitionAndSerializeNode(
@@ -29,15 +48,34 @@ class PartitionAndSerializeNode : public velox::core::PlanNode {
       uint32_t numPartitions,
       velox::RowTypePtr serializedRowType,
       velox::core::PlanNodePtr source,
-      velox::core::PartitionFunctionSpecPtr partitionFunctionFactory)
+      velox::core::PartitionFunctionSpecPtr partitionFunctionFactory,
+      bool clustered = false,
+      ShuffleSerializationFormat format =
+          ShuffleSerializationFormat::kUnsafeRow,
+      std::vector<velox::core::FieldAccessTypedExprPtr> sortingKeys = {},
+      std::vector<velox::core::SortOrder> sortingOrders = {})
       : velox::core::PlanNode(id),
         keys_(std::move(keys)),
         numPartitions_(numPartitions),
         serializedRowType_{std::move(serializedRowType)},
         sources_({std::move(source)}),
-        partitionFunctionSpec_(std::move(partitionFunctionFactory)) {
+        partitionFunctionSpec_(std::move(partitionFunctionFactory)),
+        clustered_(clustered),
+        format_(format),
+        sortingKeys_(std::move(sortingKeys)),
+        sortingOrders_(std::move(sortingOrders)) {
     VELOX_USER_CHECK_NOT_NULL(
         partitionFunctionSpec_, "Partition function factory cannot be null.");
+    VELOX_USER_CHECK_EQ(
+        sortingKeys_.size(),
+        sortingOrders_.size(),
+        "Number of sorting keys and sorting orders must be the same");
+    if (!sortingKeys_.empty()) {
+      VELOX_USER_CHECK(clustered_, "Sorted shuffle requires clustered output");
+      VELOX_USER_CHECK(
+          format_ == ShuffleSerializationFormat::kUnsafeRow,
+          "Sorted shuffle requires the unsafe-row format");
+    }
   }
 
   folly::dynamic serialize() const override;
@@ -74,6 +112,27 @@ class PartitionAndSerializeNode : public velox::core::PlanNode {
     return partitionFunctionSpec_;
   }
 
+  bool clustered() const {
+    return clustered_;
+  }
+
+  ShuffleSerializationFormat format() const {
+    return format_;
+  }
+
+  const std::vector<velox::core::FieldAccessTypedExprPtr>& sortingKeys()
+      const {
+    return sortingKeys_;
+  }
+
+  const std::vector<velox::core::SortOrder>& sortingOrders() const {
+    return sortingOrders_;
+  }
+
+  bool sorted() const {
+    return !sortingKeys_.empty();
+  }
+
   std::string_view name() const override {
     return "PartitionAndSerialize";
   }
@@ -86,6 +145,87 @@ class PartitionAndSerializeNode : public velox::core::PlanNode {
   const velox::RowTypePtr serializedRowType_;
   const std::vector<velox::core::PlanNodePtr> sources_;
   const velox::core::PartitionFunctionSpecPtr partitionFunctionSpec_;
+  const bool clustered_;
+  const ShuffleSerializationFormat format_;
+  const std::vector<velox::core::FieldAccessTypedExprPtr> sortingKeys_;
+  const std::vector<velox::core::SortOrder> sortingOrders_;
+};
+
+/// Computes the partitions of input rows and serializes the rows using
+/// UnsafeRow format. Shared by the operators of PartitionAndSerializeNode and
+/// PartitionAndShuffleWriteNode.
+class UnsafeRowPartitionSerializer {
+ public:
+  UnsafeRowPartitionSerializer(
+      uint32_t numPartitions,
+      const velox::core::PartitionFunctionSpecPtr& partitionFunctionSpec,
+      const velox::RowType& inputType,
+      velox::RowTypePtr serializedRowType);
+
+  /// Computes the partitions and the serialized sizes of the rows of 'input'.
+  /// Returns the total serialized size. If 'partitions' is set, the partitions
+  /// are written there, e.g. to the values of an output vector, instead of to
+  /// partitions().
+  size_t prepare(
+      velox::RowVectorPtr input,
+      uint32_t* FOLLY_NULLABLE partitions = nullptr);
+
+  /// Computes the partitions of the rows of 'input' only.
+  const std::vector<uint32_t>& computePartitions(
+      const velox::RowVectorPtr& input);
+
+  /// Returns the columns of 'input' to serialize, in the serialized order.
+  velox::RowVectorPtr reorderInputsIfNeeded(
+      const velox::RowVectorPtr& input) const;
+
+  /// The partition of each input row.
+  const std::vector<uint32_t>& partitions() const {
+    return partitions_;
+  }
+
+  /// The serialized size of each input row.
+  const std::vector<uint32_t>& rowSizes() const {
+    return rowSizes_;
+  }
+
+  /// Serializes input 'row' to 'buffer', which must be zero filled and have
+  /// space for rowSizes()[row] bytes. Returns the serialized size.
+  size_t serialize(velox::vector_size_t row, char* buffer) {
+    if (!unsafeRow_.has_value()) {
+      unsafeRow_.emplace(rows_);
+    }
+    return unsafeRow_->serialize(row, buffer);
+  }
+
+  /// Serializes each input row i to 'rowBuffers[i]', which must be zero
+  /// filled and have space for rowSizes()[i] bytes. Serializes a column at a
+  /// time if the serialized columns are all of types that
+  /// UnsafeRowColumnarSerializer supports.
+  void serializeAll(char* const* FOLLY_NONNULL rowBuffers);
+
+  /// Releases the input.
+  void clear();
+
+ private:
+  // Writes the partitions of the rows of 'input' to 'partitions'.
+  void computePartitions(
+      const velox::RowVectorPtr& input,
+      uint32_t* FOLLY_NONNULL partitions);
+
+  const uint32_t numPartitions_;
+  std::unique_ptr<velox::core::PartitionFunction> partitionFunction_;
+  // Set if 'partitionFunction_' writes to caller buffers.
+  VectorizedPartitionFunction* FOLLY_NULLABLE vectorizedPartitionFunction_;
+  const velox::RowTypePtr serializedRowType_;
+  std::vector<velox::column_index_t> serializedColumnIndices_;
+  std::vector<uint32_t> partitions_;
+  std::vector<uint32_t> rowSizes_;
+  // The input columns to serialize and their serializers. 'unsafeRow_' is
+  // created on first use if 'columnarSerializer_' is set.
+  velox::RowVectorPtr rows_;
+  std::optional<velox::row::UnsafeRowFast> unsafeRow_;
+  // Set if the serialized columns are all of types it supports.
+  std::optional<UnsafeRowColumnarSerializer> columnarSerializer_;
 };
 
 class PartitionAndSerializeTranslator
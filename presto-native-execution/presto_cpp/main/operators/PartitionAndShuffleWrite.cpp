@@ -0,0 +1,210 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "presto_cpp/main/operators/PartitionAndShuffleWrite.h"
+#include "presto_cpp/main/operators/PartitionAndSerialize.h"
+#include "presto_cpp/main/operators/SharedShuffleWriter.h"
+
+using namespace facebook::velox::exec;
+using namespace facebook::velox;
+
+namespace facebook::presto::operators {
+namespace {
+velox::core::PlanNodeId deserializePlanNodeId(const folly::dynamic& obj) {
+  return obj["id"].asString();
+}
+
+class PartitionAndShuffleWriteOperator : public Operator {
+ public:
+  PartitionAndShuffleWriteOperator(
+      int32_t operatorId,
+      DriverCtx* FOLLY_NONNULL ctx,
+      const std::shared_ptr<const PartitionAndShuffleWriteNode>& planNode)
+      : Operator(
+            ctx,
+            planNode->outputType(),
+            operatorId,
+            planNode->id(),
+            "PartitionAndShuffleWrite"),
+        serializer_(
+            planNode->numPartitions(),
+            planNode->partitionFunctionFactory(),
+            planNode->sources()[0]->outputType()->asRow(),
+            planNode->serializedRowType()) {
+    const auto& shuffleName = planNode->shuffleName();
+    auto shuffleFactory = ShuffleInterfaceFactory::factory(shuffleName);
+    VELOX_CHECK(
+        shuffleFactory != nullptr,
+        fmt::format(
+            "Failed to create shuffle write interface: Shuffle factory "
+            "with name '{}' is not registered.",
+            shuffleName));
+    auto createWriter = [&]() {
+      return shuffleFactory->createWriter(
+          planNode->serializedShuffleWriteInfo(), operatorCtx_->pool());
+    };
+    if (planNode->sharedWriter()) {
+      sharedShuffle_ = SharedShuffleWriter::join(
+          ctx->task->taskId(), planNode->id(), ctx->splitGroupId, createWriter);
+    } else {
+      shuffle_ = createWriter();
+    }
+  }
+
+  bool needsInput() const override {
+    return !noMoreInput_;
+  }
+
+  void addInput(RowVectorPtr input) override {
+    // Partitions and row sizes are computed outside of the lock of a shared
+    // writer.
+    serializer_.prepare(input);
+    const auto& partitions = serializer_.partitions();
+    const auto& rowSizes = serializer_.rowSizes();
+    withWriter([&](ShuffleWriter& writer) {
+      for (auto i = 0; i < input->size(); ++i) {
+        if (auto rawRow = writer.reserveRow(partitions[i], rowSizes[i])) {
+          serializer_.serialize(i, rawRow);
+          continue;
+        }
+        // The writer doesn't support writing rows in place.
+        rowBuffer_.assign(rowSizes[i], 0);
+        serializer_.serialize(i, rowBuffer_.data());
+        writer.collect(partitions[i], rowBuffer_);
+      }
+    });
+    serializer_.clear();
+  }
+
+  void noMoreInput() override {
+    Operator::noMoreInput();
+    // The stats of a shared writer are reported once, by the last driver.
+    folly::F14FastMap<std::string, int64_t> shuffleStats;
+    if (sharedShuffle_ == nullptr) {
+      shuffle_->noMoreData(true);
+      shuffleStats = shuffle_->stats();
+    } else if (sharedShuffle_->noMoreData(true)) {
+      shuffleStats = sharedShuffle_->stats();
+    }
+
+    {
+      auto lockedStats = stats_.wlock();
+      for (const auto& [name, value] : shuffleStats) {
+        lockedStats->runtimeStats[name] = RuntimeMetric(value);
+      }
+    }
+  }
+
+  RowVectorPtr getOutput() override {
+    return nullptr;
+  }
+
+  BlockingReason isBlocked(ContinueFuture* future) override {
+    return withWriter(
+        [&](ShuffleWriter& writer) { return writer.isBlocked(future); });
+  }
+
+  bool isFinished() override {
+    return noMoreInput_;
+  }
+
+  bool canReclaim() const override {
+    return sharedShuffle_ != nullptr ? sharedShuffle_->canReclaim()
+                                     : shuffle_->canReclaim();
+  }
+
+  void reclaim(uint64_t targetBytes) override {
+    withWriter(
+        [&](ShuffleWriter& writer) { return writer.reclaim(targetBytes); });
+  }
+
+ private:
+  // Runs 'func' on the writer of this driver or, with exclusive access, on the
+  // writer shared by the drivers of the task.
+  template <typename Func>
+  auto withWriter(Func&& func) {
+    if (sharedShuffle_ != nullptr) {
+      return sharedShuffle_->withWriter(std::forward<Func>(func));
+    }
+    return func(*shuffle_);
+  }
+
+  UnsafeRowPartitionSerializer serializer_;
+  // Exactly one of 'shuffle_' and 'sharedShuffle_' is set.
+  std::shared_ptr<ShuffleWriter> shuffle_;
+  std::shared_ptr<SharedShuffleWriter> sharedShuffle_;
+  // Used to serialize rows if 'shuffle_' doesn't support writing them in
+  // place.
+  std::string rowBuffer_;
+};
+} // namespace
+
+std::unique_ptr<Operator> PartitionAndShuffleWriteTranslator::toOperator(
+    DriverCtx* ctx,
+    int32_t id,
+    const core::PlanNodePtr& node) {
+  if (auto writeNode =
+          std::dynamic_pointer_cast<const PartitionAndShuffleWriteNode>(node)) {
+    return std::make_unique<PartitionAndShuffleWriteOperator>(
+        id, ctx, writeNode);
+  }
+  return nullptr;
+}
+
+void PartitionAndShuffleWriteNode::addDetails(std::stringstream& stream) const {
+  stream << "(";
+  for (auto i = 0; i < keys_.size(); ++i) {
+    if (i > 0) {
+      stream << ", ";
+    }
+    stream << keys_[i]->toString();
+  }
+  stream << ") " << numPartitions_ << " " << partitionFunctionSpec_->toString()
+         << " " << serializedRowType_->toString() << " " << shuffleName_;
+  if (sharedWriter_) {
+    stream << " shared";
+  }
+}
+
+folly::dynamic PartitionAndShuffleWriteNode::serialize() const {
+  auto obj = PlanNode::serialize();
+  obj["keys"] = ISerializable::serialize(keys_);
+  obj["numPartitions"] = numPartitions_;
+  obj["serializedRowType"] = serializedRowType_->serialize();
+  obj["partitionFunctionSpec"] = partitionFunctionSpec_->serialize();
+  obj["shuffleName"] = ISerializable::serialize<std::string>(shuffleName_);
+  obj["shuffleWriteInfo"] =
+      ISerializable::serialize<std::string>(serializedShuffleWriteInfo_);
+  obj["sources"] = ISerializable::serialize(sources_);
+  obj["sharedWriter"] = sharedWriter_;
+  return obj;
+}
+
+velox::core::PlanNodePtr PartitionAndShuffleWriteNode::create(
+    const folly::dynamic& obj,
+    void* context) {
+  return std::make_shared<PartitionAndShuffleWriteNode>(
+      deserializePlanNodeId(obj),
+      ISerializable::deserialize<std::vector<velox::core::ITypedExpr>>(
+          obj["keys"], context),
+      obj["numPartitions"].asInt(),
+      ISerializable::deserialize<RowType>(obj["serializedRowType"], context),
+      ISerializable::deserialize<velox::core::PartitionFunctionSpec>(
+          obj["partitionFunctionSpec"], context),
+      ISerializable::deserialize<std::string>(obj["shuffleName"], context),
+      ISerializable::deserialize<std::string>(obj["shuffleWriteInfo"], context),
+      ISerializable::deserialize<std::vector<velox::core::PlanNode>>(
+          obj["sources"], context)[0],
+      obj.getDefault("sharedWriter", false).asBool());
+}
+} // namespace facebook::presto::operators
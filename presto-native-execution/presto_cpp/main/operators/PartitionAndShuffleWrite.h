@@ -0,0 +1,125 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "presto_cpp/main/operators/ShuffleInterface.h"
+#include "velox/core/PlanNode.h"
+#include "velox/exec/Operator.h"
+
+namespace facebook::presto::operators {
+
+/// Fuses PartitionAndSerializeNode and ShuffleWriteNode: partitions the input
+/// rows and serializes them using UnsafeRow format directly into the
+/// partition buffers of the shuffle writer, skipping the intermediate
+/// (partition, serialized row) vector. Unlike a PartitionAndSerializeNode
+/// followed by a gather and a ShuffleWriteNode, each driver has its own
+/// shuffle writer, unless 'sharedWriter' is set, in which case all the drivers
+/// of a task write to one SharedShuffleWriter.
+class PartitionAndShuffleWriteNode : public velox::core::PlanNode {
+ public:
+  PartitionAndShuffleWriteNode(
+      const velox::core::PlanNodeId& id,
+      std::vector<velox::core::TypedExprPtr> keys,
+      uint32_t numPartitions,
+      velox::RowTypePtr serializedRowType,
+      velox::core::PartitionFunctionSpecPtr partitionFunctionFactory,
+      const std::string& shuffleName,
+      const std::string& serializedShuffleWriteInfo,
+      velox::core::PlanNodePtr source,
+      bool sharedWriter = false)
+      : velox::core::PlanNode(id),
+        keys_(std::move(keys)),
+        numPartitions_(numPartitions),
+        serializedRowType_{std::move(serializedRowType)},
+        partitionFunctionSpec_(std::move(partitionFunctionFactory)),
+        shuffleName_{shuffleName},
+        serializedShuffleWriteInfo_(serializedShuffleWriteInfo),
+        sources_({std::move(source)}),
+        sharedWriter_(sharedWriter) {
+    VELOX_USER_CHECK_NOT_NULL(
+        partitionFunctionSpec_, "Partition function factory cannot be null.");
+  }
+
+  folly::dynamic serialize() const override;
+
+  static velox::core::PlanNodePtr create(
+      const folly::dynamic& obj,
+      void* context);
+
+  const velox::RowTypePtr& outputType() const override {
+    static const velox::RowTypePtr kRowType{velox::ROW(
+        {"partition", "data"}, {velox::INTEGER(), velox::VARBINARY()})};
+
+    return kRowType;
+  }
+
+  const std::vector<velox::core::PlanNodePtr>& sources() const override {
+    return sources_;
+  }
+
+  const std::vector<velox::core::TypedExprPtr>& keys() const {
+    return keys_;
+  }
+
+  uint32_t numPartitions() const {
+    return numPartitions_;
+  }
+
+  const velox::RowTypePtr& serializedRowType() const {
+    return serializedRowType_;
+  }
+
+  const velox::core::PartitionFunctionSpecPtr& partitionFunctionFactory()
+      const {
+    return partitionFunctionSpec_;
+  }
+
+  const std::string& shuffleName() const {
+    return shuffleName_;
+  }
+
+  const std::string& serializedShuffleWriteInfo() const {
+    return serializedShuffleWriteInfo_;
+  }
+
+  bool sharedWriter() const {
+    return sharedWriter_;
+  }
+
+  std::string_view name() const override {
+    return "PartitionAndShuffleWrite";
+  }
+
+ private:
+  void addDetails(std::stringstream& stream) const override;
+
+  const std::vector<velox::core::TypedExprPtr> keys_;
+  const uint32_t numPartitions_;
+  const velox::RowTypePtr serializedRowType_;
+  const velox::core::PartitionFunctionSpecPtr partitionFunctionSpec_;
+  const std::string shuffleName_;
+  const std::string serializedShuffleWriteInfo_;
+  const std::vector<velox::core::PlanNodePtr> sources_;
+  const bool sharedWriter_;
+};
+
+class PartitionAndShuffleWriteTranslator
+    : public velox::exec::Operator::PlanNodeTranslator {
+ public:
+  std::unique_ptr<velox::exec::Operator> toOperator(
+      velox::exec::DriverCtx* ctx,
+      int32_t id,
+      const velox::core::PlanNodePtr& node) override;
+};
+} // namespace facebook::presto::operators
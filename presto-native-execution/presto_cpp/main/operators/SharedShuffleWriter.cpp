@@ -0,0 +1,83 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "presto_cpp/main/operators/SharedShuffleWriter.h"
+#include <folly/Synchronized.h>
+#include <folly/container/F14Map.h>
+
+namespace facebook::presto::operators {
+
+namespace {
+// The writers shared by the drivers of running tasks. The drivers own them, so
+// an entry expires when the operators of its drivers are destroyed.
+folly::Synchronized<
+    folly::F14FastMap<std::string, std::weak_ptr<SharedShuffleWriter>>>&
+sharedWriters() {
+  static folly::Synchronized<
+      folly::F14FastMap<std::string, std::weak_ptr<SharedShuffleWriter>>>
+      writers;
+  return writers;
+}
+} // namespace
+
+// static
+std::shared_ptr<SharedShuffleWriter> SharedShuffleWriter::join(
+    const std::string& taskId,
+    const std::string& planNodeId,
+    uint32_t splitGroupId,
+    const std::function<std::shared_ptr<ShuffleWriter>()>& createWriter) {
+  const auto key = fmt::format("{}/{}/{}", taskId, planNodeId, splitGroupId);
+  std::shared_ptr<SharedShuffleWriter> writer;
+  sharedWriters().withWLock([&](auto& writers) {
+    // Drops the entries of finished tasks.
+    for (auto it = writers.begin(); it != writers.end();) {
+      if (it->second.expired()) {
+        it = writers.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    auto it = writers.find(key);
+    if (it != writers.end()) {
+      writer = it->second.lock();
+    }
+    // The last reference to the writer may be released outside of the lock
+    // after the entries were checked above, like for the entries dropped.
+    if (writer == nullptr) {
+      writer = std::make_shared<SharedShuffleWriter>(createWriter());
+      writers[key] = writer;
+    }
+  });
+
+  std::lock_guard<std::mutex> l(writer->mutex_);
+  VELOX_CHECK(
+      !writer->finalized_,
+      "Driver joins shared shuffle writer {} after it was finalized",
+      key);
+  ++writer->numPendingDrivers_;
+  return writer;
+}
+
+bool SharedShuffleWriter::noMoreData(bool success) {
+  std::lock_guard<std::mutex> l(mutex_);
+  VELOX_CHECK_GT(numPendingDrivers_, 0);
+  success_ &= success;
+  if (--numPendingDrivers_ > 0) {
+    return false;
+  }
+  finalized_ = true;
+  writer_->noMoreData(success_);
+  return true;
+}
+
+} // namespace facebook::presto::operators
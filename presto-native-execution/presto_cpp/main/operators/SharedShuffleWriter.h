@@ -0,0 +1,76 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <mutex>
+#include "presto_cpp/main/operators/ShuffleInterface.h"
+
+namespace facebook::presto::operators {
+
+/// A shuffle writer shared by all the drivers of a task that run the same
+/// plan node, so that the task has one set of partition buffers and files
+/// instead of one per driver.
+///
+/// Each driver joins the writer when its operator is created, which happens
+/// for all the drivers of a task before any of them runs. Drivers append
+/// through withWriter(), which gives exclusive access to the underlying
+/// writer for a whole input batch. The underlying writer is finalized when
+/// the last driver calls noMoreData().
+class SharedShuffleWriter {
+ public:
+  /// Returns the writer of 'planNodeId' in 'taskId', creating it with
+  /// 'createWriter' for the first driver, and joins the calling driver to it.
+  /// 'splitGroupId' separates the writers of the split groups of a task in
+  /// grouped execution, whose drivers are created one group at a time.
+  static std::shared_ptr<SharedShuffleWriter> join(
+      const std::string& taskId,
+      const std::string& planNodeId,
+      uint32_t splitGroupId,
+      const std::function<std::shared_ptr<ShuffleWriter>()>& createWriter);
+
+  explicit SharedShuffleWriter(std::shared_ptr<ShuffleWriter> writer)
+      : writer_(std::move(writer)) {}
+
+  /// Runs 'func' with exclusive access to the underlying writer.
+  template <typename Func>
+  auto withWriter(Func&& func) {
+    std::lock_guard<std::mutex> l(mutex_);
+    return func(*writer_);
+  }
+
+  /// Called by each driver when done. Finalizes the underlying writer and
+  /// returns true for the last driver. The writer is finalized with
+  /// 'success' false if any driver failed.
+  bool noMoreData(bool success);
+
+  bool canReclaim() const {
+    return writer_->canReclaim();
+  }
+
+  /// Runtime statistics of the underlying writer.
+  folly::F14FastMap<std::string, int64_t> stats() const {
+    std::lock_guard<std::mutex> l(mutex_);
+    return writer_->stats();
+  }
+
+ private:
+  const std::shared_ptr<ShuffleWriter> writer_;
+  mutable std::mutex mutex_;
+  // Number of drivers that joined and have not called noMoreData().
+  int32_t numPendingDrivers_{0};
+  bool success_{true};
+  bool finalized_{false};
+};
+
+} // namespace facebook::presto::operators
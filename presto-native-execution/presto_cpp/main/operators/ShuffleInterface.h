@@ -18,6 +18,39 @@
 
 namespace facebook::presto::operators {
 
+/// Format of the serialized data carried by a shuffle. Both ends of a shuffle
+/// must use the same format.
+enum class ShuffleSerializationFormat {
+  /// Each serialized row is one row in UnsafeRow format.
+  kUnsafeRow,
+  /// Each serialized row is a PrestoPage with the rows of one partition of an
+  /// input batch.
+  kPresto,
+};
+
+inline std::string shuffleSerializationFormatName(
+    ShuffleSerializationFormat format) {
+  switch (format) {
+    case ShuffleSerializationFormat::kUnsafeRow:
+      return "unsafe-row";
+    case ShuffleSerializationFormat::kPresto:
+      return "presto";
+    default:
+      VELOX_UNREACHABLE();
+  }
+}
+
+inline ShuffleSerializationFormat shuffleSerializationFormatFromName(
+    const std::string& name) {
+  if (name == "unsafe-row") {
+    return ShuffleSerializationFormat::kUnsafeRow;
+  }
+  if (name == "presto") {
+    return ShuffleSerializationFormat::kPresto;
+  }
+  VELOX_USER_FAIL("Unsupported shuffle serialization format: {}", name);
+}
+
 class ShuffleWriter {
  public:
   virtual ~ShuffleWriter() = default;
@@ -25,14 +58,92 @@ class ShuffleWriter {
   /// Write to the shuffle one row at a time.
   virtual void collect(int32_t partition, std::string_view data) = 0;
 
+  /// Write a batch of rows. 'partitions' and 'serializedRows' are the INTEGER
+  /// partition and VARBINARY serialized row columns produced by
+  /// PartitionAndSerialize. The default implementation calls collect() for
+  /// each row.
+  virtual void collectBatch(
+      const velox::VectorPtr& partitions,
+      const velox::VectorPtr& serializedRows) {
+    auto partitionValues = partitions->as<velox::SimpleVector<int32_t>>();
+    auto rowValues =
+        serializedRows->as<velox::SimpleVector<velox::StringView>>();
+    for (auto i = 0; i < partitions->size(); ++i) {
+      auto data = rowValues->valueAt(i);
+      collect(
+          partitionValues->valueAt(i),
+          std::string_view(data.data(), data.size()));
+    }
+  }
+
+  /// Write a batch of rows produced by PartitionAndSerialize in clustered
+  /// mode: the rows of each partition are adjacent, and their serialized rows
+  /// are back to back in memory, each preceded by its size as a big-endian
+  /// uint32. The default implementation calls collectBatch().
+  virtual void collectClusteredBatch(
+      const velox::VectorPtr& partitions,
+      const velox::VectorPtr& serializedRows) {
+    collectBatch(partitions, serializedRows);
+  }
+
+  /// Returns a pointer to 'size' bytes of zero filled space to serialize a row
+  /// of 'partition' into, or nullptr if the writer doesn't support writing
+  /// rows in place, in which case the caller uses collect(). The row must be
+  /// written before the next call to the writer.
+  virtual char* reserveRow(int32_t /*partition*/, uint32_t /*size*/) {
+    return nullptr;
+  }
+
+  /// Asks the writer to sort the rows of each block it writes by their sort
+  /// keys, so that readers can merge the blocks of a partition. The rows must
+  /// be in the format of a sorted shuffle, see SortedShuffle.h. Must be called
+  /// before any row is written. Returns false if the writer doesn't support
+  /// sorted blocks.
+  virtual bool enableSortedBlocks() {
+    return false;
+  }
+
   /// Tell the shuffle system the writer is done.
   /// @param success set to false to indicate aborted client.
   virtual void noMoreData(bool success) = 0;
 
+  /// Returns a blocking reason and sets 'future' if the writer cannot accept
+  /// more data until 'future' completes, e.g. because it has too many writes
+  /// in flight.
+  virtual velox::exec::BlockingReason isBlocked(velox::ContinueFuture* future) {
+    return velox::exec::BlockingReason::kNotBlocked;
+  }
+
+  /// Returns true if reclaim() can release memory held by the writer.
+  virtual bool canReclaim() const {
+    return false;
+  }
+
+  /// Releases at least 'targetBytes' of buffered memory if possible, e.g. by
+  /// flushing buffered data. Returns the number of bytes released.
+  virtual uint64_t reclaim(uint64_t /*targetBytes*/) {
+    return 0;
+  }
+
   /// Runtime statistics.
   virtual folly::F14FastMap<std::string, int64_t> stats() const = 0;
 };
 
+/// Reads the length-prefixed rows of one shuffle block in chunks, so that a
+/// reader merging many blocks holds a bounded part of each. See
+/// ShuffleReader::blockCursors().
+class ShuffleBlockCursor {
+ public:
+  virtual ~ShuffleBlockCursor() = default;
+
+  /// Returns the next chunk of whole rows of the block, or nullptr at the end
+  /// of the block.
+  virtual velox::BufferPtr next() = 0;
+
+  /// Restarts from the first row of the block.
+  virtual void reset() = 0;
+};
+
 class ShuffleReader {
  public:
   virtual ~ShuffleReader() = default;
@@ -44,6 +155,29 @@ class ShuffleReader {
   /// @param success set to false to indicate aborted client.
   virtual velox::BufferPtr next(bool success) = 0;
 
+  /// Returns true if the writers of the blocks sorted the rows of each block,
+  /// see ShuffleWriter::enableSortedBlocks(). The rows then carry their sort
+  /// keys and the blocks need to be merged, see SortedShuffleReader. Throws if
+  /// only some of the writers sorted their blocks.
+  virtual bool sortedBlocks() {
+    return false;
+  }
+
+  /// Returns true if blockCursors() is supported.
+  virtual bool supportsBlockCursors() const {
+    return false;
+  }
+
+  /// Returns a cursor over each block of the partition, for reading the blocks
+  /// side by side instead of with next(). The chunks of each cursor have up to
+  /// 'chunkBytes' bytes, or a single larger row, unless the reader can't read
+  /// the block in part. Used to merge the blocks of a sorted shuffle. The
+  /// cursors must not outlive the reader.
+  virtual std::vector<std::unique_ptr<ShuffleBlockCursor>> blockCursors(
+      uint64_t /*chunkBytes*/) {
+    VELOX_UNSUPPORTED("Shuffle reader does not support block cursors");
+  }
+
   /// Runtime statistics.
   virtual folly::F14FastMap<std::string, int64_t> stats() const = 0;
 };
@@ -61,6 +195,26 @@ class ShuffleInterfaceFactory {
       const std::string& serializedShuffleInfo,
       velox::memory::MemoryPool* pool) = 0;
 
+  /// Returns true if the writers created by this factory support
+  /// ShuffleWriter::enableSortedBlocks(). Lets plans use a sorted shuffle
+  /// only if the writers can sort their blocks.
+  virtual bool supportsSortedBlocks() const {
+    return false;
+  }
+
+  /// Releases the shuffle data of 'queryId' that this factory keeps beyond
+  /// the lifetime of the readers and writers, e.g. in memory. Called once
+  /// the query has ended, not when its tasks end, as tasks of later stages
+  /// may read the data after the tasks that wrote it are gone.
+  virtual void removeQuery(const std::string& /*queryId*/) {}
+
+  /// Calls removeQuery() on all the registered factories.
+  static void removeQueryFromAll(const std::string& queryId) {
+    for (auto& [name, factory] : factories()) {
+      factory->removeQuery(queryId);
+    }
+  }
+
   /// Register ShuffleInterfaceFactory to its registry. It returns true if the
   /// registration is successful, false if a factory with the name already
   /// exists.
@@ -12,8 +12,10 @@
  * limitations under the License.
  */
 #include "presto_cpp/main/operators/ShuffleRead.h"
+#include "presto_cpp/main/common/Configs.h"
 #include "velox/exec/Exchange.h"
-#include "velox/serializers/UnsafeRowSerializer.h"
+#include "velox/row/UnsafeRowDeserializers.h"
+#include "velox/serializers/PrestoSerializer.h"
 
 using namespace facebook::velox::exec;
 using namespace facebook::velox;
@@ -24,6 +26,34 @@ velox::core::PlanNodeId deserializePlanNodeId(const folly::dynamic& obj) {
 }
 
 namespace {
+// Reads the PrestoPages written by PartitionAndSerialize in kPresto format.
+// The shuffle prefixes each page with its size. Exchange calls deserialize()
+// until the stream is at end, so each call reads one page.
+class ShufflePrestoVectorSerde : public serializer::presto::PrestoVectorSerde {
+ public:
+  void deserialize(
+      ByteStream* source,
+      memory::MemoryPool* pool,
+      RowTypePtr type,
+      RowVectorPtr* result,
+      const Options* options) override {
+    source->skip(sizeof(uint32_t));
+    PrestoVectorSerde::deserialize(source, pool, type, result, options);
+  }
+};
+
+std::unique_ptr<VectorSerde> createSerde(ShuffleSerializationFormat format) {
+  switch (format) {
+    case ShuffleSerializationFormat::kUnsafeRow:
+      return std::make_unique<UnsafeRowShuffleVectorSerde>(
+          SystemConfig::instance()->shuffleReadBatchBytes());
+    case ShuffleSerializationFormat::kPresto:
+      return std::make_unique<ShufflePrestoVectorSerde>();
+    default:
+      VELOX_UNREACHABLE();
+  }
+}
+
 class ShuffleReadOperator : public Exchange {
  public:
   ShuffleReadOperator(
@@ -39,7 +69,7 @@ class ShuffleReadOperator : public Exchange {
                 shuffleReadNode->outputType()),
             exchangeClient,
             "ShuffleRead"),
-        serde_(std::make_unique<serializer::spark::UnsafeRowVectorSerde>()) {}
+        serde_(createSerde(shuffleReadNode->format())) {}
 
  protected:
   VectorSerde* getSerde() override {
@@ -47,13 +77,54 @@ class ShuffleReadOperator : public Exchange {
   }
 
  private:
-  std::unique_ptr<serializer::spark::UnsafeRowVectorSerde> serde_;
+  std::unique_ptr<VectorSerde> serde_;
 };
 } // namespace
 
+void UnsafeRowShuffleVectorSerde::deserialize(
+    ByteStream* source,
+    memory::MemoryPool* pool,
+    RowTypePtr type,
+    RowVectorPtr* result,
+    const Options* /*options*/) {
+  using TRowSize = uint32_t;
+
+  // Locate the rows of the batch.
+  rows_.clear();
+  uint64_t bytes = 0;
+  while (!source->atEnd() && bytes < batchBytes_) {
+    const auto rowSize = folly::Endian::big(source->read<TRowSize>());
+    auto row = source->nextView(rowSize);
+    VELOX_CHECK_EQ(row.size(), rowSize);
+    rows_.push_back(row);
+    bytes += sizeof(TRowSize) + rowSize;
+  }
+  if (rows_.empty()) {
+    *result = BaseVector::create<RowVector>(type, 0, pool);
+    return;
+  }
+
+  if (type_ != type) {
+    type_ = type;
+    deserializer_.reset();
+    if (UnsafeRowColumnarSerializer::isSupported(*type)) {
+      deserializer_.emplace(type);
+    }
+  }
+  if (deserializer_.has_value()) {
+    *result = deserializer_->deserialize(rows_, pool);
+    return;
+  }
+  std::vector<std::optional<std::string_view>> rows(
+      rows_.begin(), rows_.end());
+  *result = std::dynamic_pointer_cast<RowVector>(
+      row::UnsafeRowDeserializer::deserialize(rows, type, pool));
+}
+
 folly::dynamic ShuffleReadNode::serialize() const {
   auto obj = PlanNode::serialize();
   obj["outputType"] = outputType_->serialize();
+  obj["format"] = shuffleSerializationFormatName(format_);
   return obj;
 }
 
@@ -62,7 +133,9 @@ velox::core::PlanNodePtr ShuffleReadNode::create(
     void* context) {
   return std::make_shared<ShuffleReadNode>(
       deserializePlanNodeId(obj),
-      ISerializable::deserialize<RowType>(obj["outputType"], context));
+      ISerializable::deserialize<RowType>(obj["outputType"], context),
+      shuffleSerializationFormatFromName(
+          obj.getDefault("format", "unsafe-row").asString()));
 }
 
 std::unique_ptr<Operator> ShuffleReadTranslator::toOperator(
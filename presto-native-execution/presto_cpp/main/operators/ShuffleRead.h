@@ -13,14 +13,51 @@
  */
 #pragma once
 
+#include "presto_cpp/main/operators/ShuffleInterface.h"
+#include "presto_cpp/main/operators/UnsafeRowColumnarSerializer.h"
 #include "velox/core/PlanNode.h"
 #include "velox/exec/Operator.h"
+#include "velox/serializers/UnsafeRowSerializer.h"
 
 namespace facebook::presto::operators {
+/// Reads the length-prefixed UnsafeRows of a shuffle block. Each call to
+/// deserialize() turns up to 'batchBytes' of rows into one vector, so that
+/// large blocks give several batches. Exchange calls deserialize() until the
+/// block is at end. The rows are first located in the block and then
+/// deserialized a column at a time with UnsafeRowColumnarDeserializer if the
+/// row type allows.
+class UnsafeRowShuffleVectorSerde
+    : public velox::serializer::spark::UnsafeRowVectorSerde {
+ public:
+  explicit UnsafeRowShuffleVectorSerde(uint64_t batchBytes)
+      : batchBytes_(batchBytes) {}
+
+  void deserialize(
+      velox::ByteStream* FOLLY_NONNULL source,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool,
+      velox::RowTypePtr type,
+      velox::RowVectorPtr* FOLLY_NONNULL result,
+      const Options* FOLLY_NULLABLE options) override;
+
+ private:
+  const uint64_t batchBytes_;
+  // The type and the deserializer of the last deserialized rows. The
+  // deserializer is not set if the type is not supported.
+  velox::RowTypePtr type_;
+  std::optional<UnsafeRowColumnarDeserializer> deserializer_;
+  std::vector<std::string_view> rows_;
+};
+
 class ShuffleReadNode : public velox::core::PlanNode {
  public:
-  ShuffleReadNode(const velox::core::PlanNodeId& id, velox::RowTypePtr type)
-      : PlanNode(id), outputType_(type) {}
+  /// 'format' must match the format the shuffle was written in. See
+  /// PartitionAndSerializeNode.
+  ShuffleReadNode(
+      const velox::core::PlanNodeId& id,
+      velox::RowTypePtr type,
+      ShuffleSerializationFormat format =
+          ShuffleSerializationFormat::kUnsafeRow)
+      : PlanNode(id), outputType_(type), format_(format) {}
 
   folly::dynamic serialize() const override;
 
@@ -32,6 +69,10 @@ class ShuffleReadNode : public velox::core::PlanNode {
     return outputType_;
   }
 
+  ShuffleSerializationFormat format() const {
+    return format_;
+  }
+
   const std::vector<velox::core::PlanNodePtr>& sources() const override {
     static const std::vector<velox::core::PlanNodePtr> kEmptySources;
     return kEmptySources;
@@ -51,10 +92,13 @@ class ShuffleReadNode : public velox::core::PlanNode {
 
  private:
   void addDetails(std::stringstream& stream) const override {
-    // Nothing to add
+    if (format_ != ShuffleSerializationFormat::kUnsafeRow) {
+      stream << shuffleSerializationFormatName(format_);
+    }
   }
 
   velox::RowTypePtr outputType_;
+  const ShuffleSerializationFormat format_;
 };
 
 class ShuffleReadTranslator : public velox::exec::Operator::PlanNodeTranslator {
@@ -33,7 +33,8 @@ class ShuffleWriteOperator : public Operator {
             planNode->outputType(),
             operatorId,
             planNode->id(),
-            "ShuffleWrite") {
+            "ShuffleWrite"),
+        clustered_(planNode->clustered()) {
     const auto& shuffleName = planNode->shuffleName();
     auto shuffleFactory = ShuffleInterfaceFactory::factory(shuffleName);
     VELOX_CHECK(
@@ -44,6 +45,12 @@ class ShuffleWriteOperator : public Operator {
             shuffleName));
     shuffle_ = shuffleFactory->createWriter(
         planNode->serializedShuffleWriteInfo(), operatorCtx_->pool());
+    if (planNode->sorted()) {
+      VELOX_CHECK(
+          shuffle_->enableSortedBlocks(),
+          "Shuffle '{}' does not support sorted shuffle",
+          shuffleName);
+    }
   }
 
   bool needsInput() const override {
@@ -51,12 +58,10 @@ class ShuffleWriteOperator : public Operator {
   }
 
   void addInput(RowVectorPtr input) override {
-    auto partitions = input->childAt(0)->as<SimpleVector<int32_t>>();
-    auto serializedRows = input->childAt(1)->as<SimpleVector<StringView>>();
-    for (auto i = 0; i < input->size(); ++i) {
-      auto partition = partitions->valueAt(i);
-      auto data = serializedRows->valueAt(i);
-      shuffle_->collect(partition, std::string_view(data.data(), data.size()));
+    if (clustered_) {
+      shuffle_->collectClusteredBatch(input->childAt(0), input->childAt(1));
+    } else {
+      shuffle_->collectBatch(input->childAt(0), input->childAt(1));
     }
   }
 
@@ -77,14 +82,23 @@ class ShuffleWriteOperator : public Operator {
   }
 
   BlockingReason isBlocked(ContinueFuture* future) override {
-    return BlockingReason::kNotBlocked;
+    return shuffle_->isBlocked(future);
   }
 
   bool isFinished() override {
     return noMoreInput_;
   }
 
+  bool canReclaim() const override {
+    return shuffle_->canReclaim();
+  }
+
+  void reclaim(uint64_t targetBytes) override {
+    shuffle_->reclaim(targetBytes);
+  }
+
  private:
+  const bool clustered_;
   std::shared_ptr<ShuffleWriter> shuffle_;
 };
 } // namespace
@@ -95,6 +109,8 @@ folly::dynamic ShuffleWriteNode::serialize() const {
   obj["shuffleWriteInfo"] =
       ISerializable::serialize<std::string>(serializedShuffleWriteInfo_);
   obj["sources"] = ISerializable::serialize(sources_);
+  obj["clustered"] = clustered_;
+  obj["sorted"] = sorted_;
   return obj;
 }
 
@@ -106,7 +122,9 @@ velox::core::PlanNodePtr ShuffleWriteNode::create(
       ISerializable::deserialize<std::string>(obj["shuffleName"], context),
       ISerializable::deserialize<std::string>(obj["shuffleWriteInfo"], context),
       ISerializable::deserialize<std::vector<velox::core::PlanNode>>(
-          obj["sources"], context)[0]);
+          obj["sources"], context)[0],
+      obj.getDefault("clustered", false).asBool(),
+      obj.getDefault("sorted", false).asBool());
 }
 
 std::unique_ptr<Operator> ShuffleWriteTranslator::toOperator(
@@ -19,17 +19,25 @@
 
 namespace facebook::presto::operators {
 
+/// Writes the (partition, serialized row) output of PartitionAndSerialize to
+/// a shuffle. 'clustered' tells that the input comes from PartitionAndSerialize
+/// in clustered mode. 'sorted' tells that the input has sorting keys, in which
+/// case the shuffle writer sorts the rows of each block by these keys.
 class ShuffleWriteNode : public velox::core::PlanNode {
  public:
   ShuffleWriteNode(
       const velox::core::PlanNodeId& id,
       const std::string& shuffleName,
       const std::string& serializedShuffleWriteInfo,
-      velox::core::PlanNodePtr source)
+      velox::core::PlanNodePtr source,
+      bool clustered = false,
+      bool sorted = false)
       : velox::core::PlanNode(id),
         shuffleName_{shuffleName},
         serializedShuffleWriteInfo_(serializedShuffleWriteInfo),
-        sources_{std::move(source)} {}
+        sources_{std::move(source)},
+        clustered_(clustered),
+        sorted_(sorted) {}
 
   folly::dynamic serialize() const override;
 
@@ -53,16 +61,30 @@ class ShuffleWriteNode : public velox::core::PlanNode {
     return serializedShuffleWriteInfo_;
   }
 
+  bool clustered() const {
+    return clustered_;
+  }
+
+  bool sorted() const {
+    return sorted_;
+  }
+
   std::string_view name() const override {
     return "ShuffleWrite";
   }
 
  private:
-  void addDetails(std::stringstream& stream) const override {}
+  void addDetails(std::stringstream& stream) const override {
+    if (sorted_) {
+      stream << "sorted";
+    }
+  }
 
   const std::string shuffleName_;
   const std::string serializedShuffleWriteInfo_;
   const std::vector<velox::core::PlanNodePtr> sources_;
+  const bool clustered_;
+  const bool sorted_;
 };
 
 class ShuffleWriteTranslator
@@ -0,0 +1,431 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "presto_cpp/main/operators/SortedShuffle.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace facebook::velox;
+
+namespace facebook::presto::operators {
+
+namespace {
+using TRowSize = uint32_t;
+
+// Encoded sort keys start each key with one of these bytes, so that nulls go
+// before or after all the values.
+constexpr uint8_t kNullFirst = 0;
+constexpr uint8_t kNotNull = 1;
+constexpr uint8_t kNullLast = 2;
+
+// Strings end with two zero bytes, and their zero bytes are followed by 0xFF,
+// so that a string sorts before the strings it is a prefix of.
+constexpr uint8_t kStringEscape = 0xFF;
+
+// Returns the sort key of the length-prefixed row at 'frame'.
+std::string_view frameSortKey(const char* frame) {
+  return shuffleSortKey(std::string_view(
+      frame + sizeof(TRowSize),
+      folly::Endian::big(*reinterpret_cast<const TRowSize*>(frame))));
+}
+
+// Returns a block read whole as a single chunk, for the sources that don't
+// support block cursors.
+class WholeBlockCursor : public ShuffleBlockCursor {
+ public:
+  explicit WholeBlockCursor(BufferPtr block) : block_(std::move(block)) {}
+
+  BufferPtr next() override {
+    if (done_) {
+      return nullptr;
+    }
+    done_ = true;
+    return block_;
+  }
+
+  void reset() override {
+    done_ = false;
+  }
+
+ private:
+  const BufferPtr block_;
+  bool done_{false};
+};
+
+bool keyLess(std::string_view left, std::string_view right) {
+  const auto result =
+      ::memcmp(left.data(), right.data(), std::min(left.size(), right.size()));
+  return result != 0 ? result < 0 : left.size() < right.size();
+}
+
+// Appends the big-endian bytes of 'value', inverted for a descending order.
+template <typename T>
+char* putUnsigned(T value, bool descending, char* out) {
+  value = folly::Endian::big(value);
+  if (descending) {
+    value = static_cast<T>(~value);
+  }
+  ::memcpy(out, &value, sizeof(T));
+  return out + sizeof(T);
+}
+
+// Signed integers compare like unsigned ones once their sign bit is flipped.
+template <typename T>
+char* putSigned(T value, bool descending, char* out) {
+  using U = std::make_unsigned_t<T>;
+  constexpr U kSignBit = U(1) << (sizeof(T) * 8 - 1);
+  return putUnsigned<U>(static_cast<U>(value) ^ kSignBit, descending, out);
+}
+
+// Positive floating point numbers compare like their bits with the sign bit
+// set. Negative ones compare like their inverted bits. NaN is larger than all
+// the other values and -0.0 equal to 0.0, like in Velox comparisons.
+template <typename T, typename U>
+char* putFloatingPoint(T value, bool descending, char* out) {
+  static_assert(sizeof(T) == sizeof(U));
+  constexpr U kSignBit = U(1) << (sizeof(U) * 8 - 1);
+  if (std::isnan(value)) {
+    value = std::numeric_limits<T>::quiet_NaN();
+  } else if (value == 0) {
+    value = 0;
+  }
+  U bits;
+  ::memcpy(&bits, &value, sizeof(U));
+  bits = (bits & kSignBit) ? ~bits : bits | kSignBit;
+  return putUnsigned<U>(bits, descending, out);
+}
+
+char* putString(StringView value, bool descending, char* out) {
+  const uint8_t mask = descending ? 0xFF : 0;
+  for (auto i = 0; i < value.size(); ++i) {
+    const uint8_t byte = value.data()[i];
+    *out++ = byte ^ mask;
+    if (byte == 0) {
+      *out++ = kStringEscape ^ mask;
+    }
+  }
+  *out++ = mask;
+  *out++ = mask;
+  return out;
+}
+
+uint32_t fixedKeySize(TypeKind kind) {
+  switch (kind) {
+    case TypeKind::BOOLEAN:
+    case TypeKind::TINYINT:
+      return 1;
+    case TypeKind::SMALLINT:
+      return 2;
+    case TypeKind::INTEGER:
+    case TypeKind::REAL:
+      return 4;
+    case TypeKind::BIGINT:
+    case TypeKind::DOUBLE:
+      return 8;
+    case TypeKind::TIMESTAMP:
+      return 16;
+    default:
+      VELOX_UNREACHABLE();
+  }
+}
+} // namespace
+
+ShuffleSortKeyEncoder::ShuffleSortKeyEncoder(
+    const RowType& inputType,
+    const std::vector<core::FieldAccessTypedExprPtr>& sortingKeys,
+    const std::vector<core::SortOrder>& sortingOrders)
+    : decodedKeys_(sortingKeys.size()) {
+  VELOX_USER_CHECK_EQ(
+      sortingKeys.size(),
+      sortingOrders.size(),
+      "Number of sorting keys and sorting orders in sorted shuffle must be "
+      "the same");
+  for (auto i = 0; i < sortingKeys.size(); ++i) {
+    const auto channel = inputType.getChildIdx(sortingKeys[i]->name());
+    const auto& type = inputType.childAt(channel);
+    VELOX_USER_CHECK(
+        isSupported(*type),
+        "Unsupported sorting key type in sorted shuffle: {}",
+        type->toString());
+    keys_.push_back({channel, type->kind(), sortingOrders[i]});
+  }
+}
+
+// static
+bool ShuffleSortKeyEncoder::isSupported(const Type& type) {
+  switch (type.kind()) {
+    case TypeKind::BOOLEAN:
+    case TypeKind::TINYINT:
+    case TypeKind::SMALLINT:
+    case TypeKind::INTEGER:
+    case TypeKind::BIGINT:
+    case TypeKind::REAL:
+    case TypeKind::DOUBLE:
+    case TypeKind::TIMESTAMP:
+    case TypeKind::VARCHAR:
+    case TypeKind::VARBINARY:
+      return true;
+    default:
+      return false;
+  }
+}
+
+size_t ShuffleSortKeyEncoder::prepare(const RowVectorPtr& input) {
+  const auto numRows = input->size();
+  keySizes_.assign(numRows, 0);
+  for (auto i = 0; i < keys_.size(); ++i) {
+    const auto& key = keys_[i];
+    auto& decoded = decodedKeys_[i];
+    decoded.decode(*input->childAt(key.channel));
+    const bool variableWidth =
+        key.kind == TypeKind::VARCHAR || key.kind == TypeKind::VARBINARY;
+    const uint32_t fixedSize = variableWidth ? 0 : fixedKeySize(key.kind);
+    for (auto row = 0; row < numRows; ++row) {
+      keySizes_[row] += 1;
+      if (decoded.isNullAt(row)) {
+        continue;
+      }
+      if (!variableWidth) {
+        keySizes_[row] += fixedSize;
+        continue;
+      }
+      const auto value = decoded.valueAt<StringView>(row);
+      keySizes_[row] += value.size() + 2 +
+          std::count(value.data(), value.data() + value.size(), '\0');
+    }
+  }
+  size_t totalSize = 0;
+  for (auto size : keySizes_) {
+    totalSize += size;
+  }
+  return totalSize;
+}
+
+void ShuffleSortKeyEncoder::encode(vector_size_t row, char* buffer) const {
+  char* out = buffer;
+  for (auto i = 0; i < keys_.size(); ++i) {
+    const auto& key = keys_[i];
+    const auto& decoded = decodedKeys_[i];
+    if (decoded.isNullAt(row)) {
+      *out++ = key.sortOrder.isNullsFirst() ? kNullFirst : kNullLast;
+      continue;
+    }
+    *out++ = kNotNull;
+    const bool descending = !key.sortOrder.isAscending();
+    switch (key.kind) {
+      case TypeKind::BOOLEAN:
+        out = putUnsigned<uint8_t>(
+            decoded.valueAt<bool>(row) ? 1 : 0, descending, out);
+        break;
+      case TypeKind::TINYINT:
+        out = putSigned<int8_t>(decoded.valueAt<int8_t>(row), descending, out);
+        break;
+      case TypeKind::SMALLINT:
+        out =
+            putSigned<int16_t>(decoded.valueAt<int16_t>(row), descending, out);
+        break;
+      case TypeKind::INTEGER:
+        out =
+            putSigned<int32_t>(decoded.valueAt<int32_t>(row), descending, out);
+        break;
+      case TypeKind::BIGINT:
+        out =
+            putSigned<int64_t>(decoded.valueAt<int64_t>(row), descending, out);
+        break;
+      case TypeKind::REAL:
+        out = putFloatingPoint<float, uint32_t>(
+            decoded.valueAt<float>(row), descending, out);
+        break;
+      case TypeKind::DOUBLE:
+        out = putFloatingPoint<double, uint64_t>(
+            decoded.valueAt<double>(row), descending, out);
+        break;
+      case TypeKind::TIMESTAMP: {
+        const auto value = decoded.valueAt<Timestamp>(row);
+        out = putSigned<int64_t>(value.getSeconds(), descending, out);
+        out = putUnsigned<uint64_t>(value.getNanos(), descending, out);
+        break;
+      }
+      case TypeKind::VARCHAR:
+      case TypeKind::VARBINARY:
+        out = putString(decoded.valueAt<StringView>(row), descending, out);
+        break;
+      default:
+        VELOX_UNREACHABLE();
+    }
+  }
+  VELOX_DCHECK_EQ(out - buffer, keySizes_[row]);
+}
+
+BufferPtr
+sortShuffleBlock(const char* data, uint64_t size, memory::MemoryPool* pool) {
+  // The offset of each row in 'data' and its sort key.
+  std::vector<std::pair<uint64_t, std::string_view>> rows;
+  for (uint64_t offset = 0; offset < size;) {
+    const auto rowSize =
+        folly::Endian::big(*reinterpret_cast<const TRowSize*>(data + offset));
+    rows.emplace_back(
+        offset,
+        shuffleSortKey(
+            std::string_view(data + offset + sizeof(TRowSize), rowSize)));
+    offset += sizeof(TRowSize) + rowSize;
+  }
+  std::stable_sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+    return keyLess(a.second, b.second);
+  });
+
+  auto sorted = AlignedBuffer::allocate<char>(size, pool);
+  auto* out = sorted->asMutable<char>();
+  for (const auto& [offset, key] : rows) {
+    const auto frameSize = sizeof(TRowSize) +
+        folly::Endian::big(*reinterpret_cast<const TRowSize*>(data + offset));
+    ::memcpy(out, data + offset, frameSize);
+    out += frameSize;
+  }
+  return sorted;
+}
+
+SortedShuffleReader::SortedShuffleReader(
+    std::shared_ptr<ShuffleReader> source,
+    memory::MemoryPool* pool,
+    uint64_t maxBlockBytes,
+    uint64_t chunkBytes)
+    : source_(std::move(source)),
+      pool_(pool),
+      maxBlockBytes_(maxBlockBytes),
+      chunkBytes_(chunkBytes) {
+  VELOX_CHECK_GT(maxBlockBytes_, 0);
+  VELOX_CHECK_GT(chunkBytes_, 0);
+}
+
+void SortedShuffleReader::initialize() {
+  if (initialized_) {
+    return;
+  }
+  initialized_ = true;
+  sorted_ = source_->sortedBlocks();
+  if (!sorted_) {
+    return;
+  }
+  if (source_->supportsBlockCursors()) {
+    for (auto& cursor : source_->blockCursors(chunkBytes_)) {
+      runs_.push_back({std::move(cursor)});
+    }
+  } else {
+    while (source_->hasNext()) {
+      runs_.push_back(
+          {std::make_unique<WholeBlockCursor>(source_->next(true))});
+    }
+  }
+  resetRuns();
+}
+
+// static
+bool SortedShuffleReader::nextChunk(Run& run) {
+  for (;;) {
+    run.chunk = run.cursor->next();
+    if (run.chunk == nullptr) {
+      return false;
+    }
+    if (run.chunk->size() == 0) {
+      continue;
+    }
+    const auto* data = run.chunk->as<char>();
+    run.position = data;
+    run.end = data + run.chunk->size();
+    run.key = frameSortKey(data);
+    return true;
+  }
+}
+
+void SortedShuffleReader::resetRuns() {
+  heap_.clear();
+  for (auto i = 0; i < runs_.size(); ++i) {
+    auto& run = runs_[i];
+    run.cursor->reset();
+    if (nextChunk(run)) {
+      heap_.push_back(i);
+    }
+  }
+  std::make_heap(heap_.begin(), heap_.end(), [&](uint32_t a, uint32_t b) {
+    return keyLess(runs_[b].key, runs_[a].key);
+  });
+}
+
+bool SortedShuffleReader::hasNext() {
+  initialize();
+  return sorted_ ? !heap_.empty() : source_->hasNext();
+}
+
+BufferPtr SortedShuffleReader::next(bool success) {
+  initialize();
+  if (!sorted_) {
+    return source_->next(success);
+  }
+  // On failure, restart from the first row.
+  if (!success) {
+    resetRuns();
+  }
+  VELOX_CHECK(!heap_.empty(), "No more rows in sorted shuffle");
+
+  const auto greater = [&](uint32_t a, uint32_t b) {
+    return keyLess(runs_[b].key, runs_[a].key);
+  };
+  auto buffer = AlignedBuffer::allocate<char>(maxBlockBytes_, pool_);
+  uint64_t size = 0;
+  while (!heap_.empty()) {
+    auto& run = runs_[heap_.front()];
+    const auto rowSize =
+        folly::Endian::big(*reinterpret_cast<const TRowSize*>(run.position));
+    const auto data = shuffleSortedRowData(
+        std::string_view(run.position + sizeof(TRowSize), rowSize));
+    const auto frameSize = sizeof(TRowSize) + data.size();
+    if (size + frameSize > maxBlockBytes_) {
+      if (size > 0) {
+        break;
+      }
+      // A row larger than a block gets a block of its own.
+      AlignedBuffer::reallocate<char>(&buffer, frameSize);
+    }
+    auto* out = buffer->asMutable<char>() + size;
+    *reinterpret_cast<TRowSize*>(out) =
+        folly::Endian::big<TRowSize>(data.size());
+    ::memcpy(out + sizeof(TRowSize), data.data(), data.size());
+    size += frameSize;
+    ++numRows_;
+
+    // The row is copied, so the chunk holding it can go.
+    run.position += sizeof(TRowSize) + rowSize;
+    std::pop_heap(heap_.begin(), heap_.end(), greater);
+    if (run.position < run.end) {
+      run.key = frameSortKey(run.position);
+      std::push_heap(heap_.begin(), heap_.end(), greater);
+    } else if (nextChunk(run)) {
+      std::push_heap(heap_.begin(), heap_.end(), greater);
+    } else {
+      heap_.pop_back();
+    }
+  }
+  ++numBlocks_;
+  buffer->setSize(size);
+  return buffer;
+}
+
+folly::F14FastMap<std::string, int64_t> SortedShuffleReader::stats() const {
+  auto stats = source_->stats();
+  stats["sorted.read.blocks"] = numBlocks_;
+  stats["sorted.read.rows"] = numRows_;
+  return stats;
+}
+
+} // namespace facebook::presto::operators
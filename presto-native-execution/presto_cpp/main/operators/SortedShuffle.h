@@ -0,0 +1,165 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <folly/lang/Bits.h>
+#include "presto_cpp/main/operators/ShuffleInterface.h"
+#include "velox/core/PlanNode.h"
+#include "velox/vector/DecodedVector.h"
+
+/// A sorted shuffle orders the rows of each partition by sorting keys. The
+/// rows carry their encoded sort key in front of the serialized row:
+///
+///   | key size (u32 big-endian) | key | serialized row |
+///
+/// Keys are encoded so that comparing them with memcmp() gives the order of
+/// the sorting keys, see ShuffleSortKeyEncoder. Writers thus sort the rows of
+/// each block without knowing the row type, and SortedShuffleReader merges the
+/// sorted blocks of a partition and strips the keys.
+namespace facebook::presto::operators {
+
+/// Encodes the sorting keys of rows into byte strings that compare with
+/// memcmp() like the keys compare with their sort orders. Supports keys of
+/// boolean, integer, floating point, timestamp, varchar and varbinary types.
+class ShuffleSortKeyEncoder {
+ public:
+  /// Returns true if keys of 'type' can be encoded.
+  static bool isSupported(const velox::Type& type);
+
+  ShuffleSortKeyEncoder(
+      const velox::RowType& inputType,
+      const std::vector<velox::core::FieldAccessTypedExprPtr>& sortingKeys,
+      const std::vector<velox::core::SortOrder>& sortingOrders);
+
+  /// Decodes the key columns of 'input' and computes the encoded key size of
+  /// each row. Returns the total size.
+  size_t prepare(const velox::RowVectorPtr& input);
+
+  /// The encoded key size of each row of the last prepared input.
+  const std::vector<uint32_t>& keySizes() const {
+    return keySizes_;
+  }
+
+  /// Writes the encoded key of 'row' to 'buffer', which must have space for
+  /// keySizes()[row] bytes.
+  void encode(velox::vector_size_t row, char* buffer) const;
+
+ private:
+  struct Key {
+    velox::column_index_t channel;
+    velox::TypeKind kind;
+    velox::core::SortOrder sortOrder;
+  };
+
+  std::vector<Key> keys_;
+  std::vector<velox::DecodedVector> decodedKeys_;
+  std::vector<uint32_t> keySizes_;
+};
+
+/// Returns the encoded sort key of a row of a sorted shuffle.
+inline std::string_view shuffleSortKey(std::string_view row) {
+  const auto keySize =
+      folly::Endian::big(*reinterpret_cast<const uint32_t*>(row.data()));
+  return row.substr(sizeof(uint32_t), keySize);
+}
+
+/// Returns the serialized row of a row of a sorted shuffle, without its key.
+inline std::string_view shuffleSortedRowData(std::string_view row) {
+  const auto keySize =
+      folly::Endian::big(*reinterpret_cast<const uint32_t*>(row.data()));
+  return row.substr(sizeof(uint32_t) + keySize);
+}
+
+/// Returns a copy of the 'size' bytes of length-prefixed rows of a sorted
+/// shuffle at 'data' with the rows ordered by their sort keys. Rows with equal
+/// keys keep their order.
+velox::BufferPtr sortShuffleBlock(
+    const char* data,
+    uint64_t size,
+    velox::memory::MemoryPool* FOLLY_NONNULL pool);
+
+/// Reads all the blocks of a partition of a sorted shuffle from 'source', each
+/// sorted by the writer, and k-way merges their rows. Returns blocks of up to
+/// 'maxBlockBytes' of length-prefixed rows in sort key order, without the sort
+/// keys, so that ShuffleRead deserializes them like the rows of an unsorted
+/// shuffle.
+///
+/// Whether to merge is up to the writers, as reported by
+/// ShuffleReader::sortedBlocks() of 'source'. The blocks of writers that did
+/// not sort them are returned as they are.
+///
+/// The blocks are read side by side through ShuffleReader::blockCursors(),
+/// holding chunks of up to 'chunkBytes' of each block at a time. If 'source'
+/// doesn't support block cursors, its blocks are read whole on the first call
+/// to hasNext() and held until the reader is destroyed.
+///
+/// stats() reports the counters of 'source' and the following:
+///   sorted.read.blocks - number of merged blocks.
+///   sorted.read.rows - number of merged rows.
+class SortedShuffleReader : public ShuffleReader {
+ public:
+  static constexpr uint64_t kDefaultMaxBlockBytes = 1 << 20;
+  static constexpr uint64_t kDefaultChunkBytes = 1 << 20;
+
+  SortedShuffleReader(
+      std::shared_ptr<ShuffleReader> source,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool,
+      uint64_t maxBlockBytes = kDefaultMaxBlockBytes,
+      uint64_t chunkBytes = kDefaultChunkBytes);
+
+  bool hasNext() override;
+
+  velox::BufferPtr next(bool success) override;
+
+  folly::F14FastMap<std::string, int64_t> stats() const override;
+
+ private:
+  // The rows of a sorted block of 'source_'.
+  struct Run {
+    std::unique_ptr<ShuffleBlockCursor> cursor;
+    // The current chunk of the block and the next row in it.
+    velox::BufferPtr chunk;
+    const char* position{nullptr};
+    const char* end{nullptr};
+    // The sort key of the row at 'position'.
+    std::string_view key;
+  };
+
+  // Creates the runs on first call if the blocks of 'source_' are sorted.
+  void initialize();
+
+  // Moves 'run' to the first row of the next non-empty chunk of its block.
+  // Returns false at the end of the block.
+  static bool nextChunk(Run& run);
+
+  // Positions the runs at the first rows of the blocks.
+  void resetRuns();
+
+  const std::shared_ptr<ShuffleReader> source_;
+  velox::memory::MemoryPool* FOLLY_NONNULL const pool_;
+  const uint64_t maxBlockBytes_;
+  const uint64_t chunkBytes_;
+
+  bool initialized_{false};
+  // Set if the blocks of 'source_' are sorted and need to be merged.
+  bool sorted_{false};
+  std::vector<Run> runs_;
+  // Min-heap of the indices of the runs that have rows left.
+  std::vector<uint32_t> heap_;
+
+  uint64_t numBlocks_{0};
+  uint64_t numRows_{0};
+};
+
+} // namespace facebook::presto::operators
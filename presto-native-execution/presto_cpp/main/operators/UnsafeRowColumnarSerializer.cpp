@@ -0,0 +1,403 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "presto_cpp/main/operators/UnsafeRowColumnarSerializer.h"
+
+using namespace facebook::velox;
+
+namespace facebook::presto::operators {
+namespace {
+constexpr uint32_t kSlotBytes = sizeof(uint64_t);
+
+bool isVariableWidth(TypeKind kind) {
+  return kind == TypeKind::VARCHAR || kind == TypeKind::VARBINARY;
+}
+
+uint32_t paddedSize(uint32_t size) {
+  return bits::roundUp(size, kSlotBytes);
+}
+
+// The value of a fixed-width column as written to its slot.
+template <typename T>
+auto slotValue(T value) {
+  if constexpr (std::is_same_v<T, Timestamp>) {
+    return value.toMicros();
+  } else if constexpr (std::is_same_v<T, bool>) {
+    return static_cast<uint8_t>(value);
+  } else {
+    return value;
+  }
+}
+} // namespace
+
+bool UnsafeRowColumnarSerializer::isSupported(const RowType& rowType) {
+  for (const auto& type : rowType.children()) {
+    switch (type->kind()) {
+      case TypeKind::BOOLEAN:
+      case TypeKind::TINYINT:
+      case TypeKind::SMALLINT:
+      case TypeKind::INTEGER:
+      case TypeKind::BIGINT:
+      case TypeKind::REAL:
+      case TypeKind::DOUBLE:
+      case TypeKind::TIMESTAMP:
+      case TypeKind::VARCHAR:
+      case TypeKind::VARBINARY:
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+UnsafeRowColumnarSerializer::UnsafeRowColumnarSerializer(
+    const RowType& rowType)
+    : nullBytes_(bits::nwords(rowType.size()) * sizeof(uint64_t)),
+      fixedRowSize_(nullBytes_ + kSlotBytes * rowType.size()),
+      decoded_(rowType.size()) {
+  VELOX_CHECK(
+      isSupported(rowType),
+      "Unsupported type for columnar UnsafeRow serialization: {}",
+      rowType.toString());
+  for (const auto& type : rowType.children()) {
+    kinds_.push_back(type->kind());
+  }
+}
+
+size_t UnsafeRowColumnarSerializer::prepare(
+    const RowVectorPtr& input,
+    std::vector<uint32_t>& rowSizes) {
+  numRows_ = input->size();
+  rows_.resizeFill(numRows_, true);
+  rowSizes.assign(numRows_, fixedRowSize_);
+  for (auto column = 0; column < kinds_.size(); ++column) {
+    auto& decoded = decoded_[column];
+    decoded.decode(*input->childAt(column), rows_);
+    if (!isVariableWidth(kinds_[column])) {
+      continue;
+    }
+    if (decoded.isConstantMapping()) {
+      if (!decoded.isNullAt(0)) {
+        const auto size = paddedSize(decoded.valueAt<StringView>(0).size());
+        for (auto row = 0; row < numRows_; ++row) {
+          rowSizes[row] += size;
+        }
+      }
+      continue;
+    }
+    for (auto row = 0; row < numRows_; ++row) {
+      if (!decoded.isNullAt(row)) {
+        rowSizes[row] += paddedSize(decoded.valueAt<StringView>(row).size());
+      }
+    }
+  }
+
+  size_t totalSize = 0;
+  for (auto row = 0; row < numRows_; ++row) {
+    totalSize += rowSizes[row];
+  }
+  return totalSize;
+}
+
+void UnsafeRowColumnarSerializer::serialize(char* const* rowBuffers) {
+  for (auto column = 0; column < kinds_.size(); ++column) {
+    switch (kinds_[column]) {
+      case TypeKind::BOOLEAN:
+        serializeFixedWidth<bool>(column, rowBuffers);
+        break;
+      case TypeKind::TINYINT:
+        serializeFixedWidth<int8_t>(column, rowBuffers);
+        break;
+      case TypeKind::SMALLINT:
+        serializeFixedWidth<int16_t>(column, rowBuffers);
+        break;
+      case TypeKind::INTEGER:
+        serializeFixedWidth<int32_t>(column, rowBuffers);
+        break;
+      case TypeKind::BIGINT:
+        serializeFixedWidth<int64_t>(column, rowBuffers);
+        break;
+      case TypeKind::REAL:
+        serializeFixedWidth<float>(column, rowBuffers);
+        break;
+      case TypeKind::DOUBLE:
+        serializeFixedWidth<double>(column, rowBuffers);
+        break;
+      case TypeKind::TIMESTAMP:
+        serializeFixedWidth<Timestamp>(column, rowBuffers);
+        break;
+      default:
+        serializeNulls(column, rowBuffers);
+        break;
+    }
+  }
+
+  // The variable-width data of a row follows its fixed-width part.
+  variableOffsets_.assign(numRows_, fixedRowSize_);
+  for (auto column = 0; column < kinds_.size(); ++column) {
+    if (isVariableWidth(kinds_[column])) {
+      serializeVariableWidth(column, rowBuffers);
+    }
+  }
+}
+
+template <typename T>
+void UnsafeRowColumnarSerializer::serializeFixedWidth(
+    column_index_t column,
+    char* const* rowBuffers) {
+  const auto& decoded = decoded_[column];
+  const auto slotOffset = nullBytes_ + kSlotBytes * column;
+  if (decoded.isConstantMapping()) {
+    if (decoded.isNullAt(0)) {
+      serializeNulls(column, rowBuffers);
+      return;
+    }
+    const auto value = slotValue(decoded.valueAt<T>(0));
+    for (auto row = 0; row < numRows_; ++row) {
+      ::memcpy(rowBuffers[row] + slotOffset, &value, sizeof(value));
+    }
+    return;
+  }
+
+  if (!decoded.mayHaveNulls()) {
+    if constexpr (!std::is_same_v<T, bool>) {
+      if (decoded.isIdentityMapping()) {
+        const auto* values = decoded.data<T>();
+        for (auto row = 0; row < numRows_; ++row) {
+          const auto value = slotValue(values[row]);
+          ::memcpy(rowBuffers[row] + slotOffset, &value, sizeof(value));
+        }
+        return;
+      }
+    }
+    for (auto row = 0; row < numRows_; ++row) {
+      const auto value = slotValue(decoded.valueAt<T>(row));
+      ::memcpy(rowBuffers[row] + slotOffset, &value, sizeof(value));
+    }
+    return;
+  }
+
+  // Null slots stay zero.
+  for (auto row = 0; row < numRows_; ++row) {
+    if (decoded.isNullAt(row)) {
+      bits::setBit(reinterpret_cast<uint8_t*>(rowBuffers[row]), column);
+      continue;
+    }
+    const auto value = slotValue(decoded.valueAt<T>(row));
+    ::memcpy(rowBuffers[row] + slotOffset, &value, sizeof(value));
+  }
+}
+
+void UnsafeRowColumnarSerializer::serializeNulls(
+    column_index_t column,
+    char* const* rowBuffers) {
+  const auto& decoded = decoded_[column];
+  if (!decoded.mayHaveNulls()) {
+    return;
+  }
+  for (auto row = 0; row < numRows_; ++row) {
+    if (decoded.isNullAt(row)) {
+      bits::setBit(reinterpret_cast<uint8_t*>(rowBuffers[row]), column);
+    }
+  }
+}
+
+void UnsafeRowColumnarSerializer::serializeVariableWidth(
+    column_index_t column,
+    char* const* rowBuffers) {
+  const auto& decoded = decoded_[column];
+  const auto slotOffset = nullBytes_ + kSlotBytes * column;
+  for (auto row = 0; row < numRows_; ++row) {
+    if (decoded.isNullAt(row)) {
+      continue;
+    }
+    const auto value = decoded.valueAt<StringView>(row);
+    const uint64_t offset = variableOffsets_[row];
+    ::memcpy(rowBuffers[row] + offset, value.data(), value.size());
+    const uint64_t offsetAndSize = offset << 32 | value.size();
+    ::memcpy(
+        rowBuffers[row] + slotOffset, &offsetAndSize, sizeof(offsetAndSize));
+    variableOffsets_[row] += paddedSize(value.size());
+  }
+}
+
+UnsafeRowColumnarDeserializer::UnsafeRowColumnarDeserializer(
+    RowTypePtr rowType)
+    : rowType_(std::move(rowType)),
+      nullBytes_(bits::nwords(rowType_->size()) * sizeof(uint64_t)) {
+  VELOX_CHECK(
+      UnsafeRowColumnarSerializer::isSupported(*rowType_),
+      "Unsupported type for columnar UnsafeRow deserialization: {}",
+      rowType_->toString());
+}
+
+RowVectorPtr UnsafeRowColumnarDeserializer::deserialize(
+    const std::vector<std::string_view>& rows,
+    memory::MemoryPool* pool) const {
+  std::vector<VectorPtr> columns(rowType_->size());
+  for (auto column = 0; column < columns.size(); ++column) {
+    switch (rowType_->childAt(column)->kind()) {
+      case TypeKind::BOOLEAN:
+        columns[column] = deserializeFixedWidth<bool>(column, rows, pool);
+        break;
+      case TypeKind::TINYINT:
+        columns[column] = deserializeFixedWidth<int8_t>(column, rows, pool);
+        break;
+      case TypeKind::SMALLINT:
+        columns[column] = deserializeFixedWidth<int16_t>(column, rows, pool);
+        break;
+      case TypeKind::INTEGER:
+        columns[column] = deserializeFixedWidth<int32_t>(column, rows, pool);
+        break;
+      case TypeKind::BIGINT:
+        columns[column] = deserializeFixedWidth<int64_t>(column, rows, pool);
+        break;
+      case TypeKind::REAL:
+        columns[column] = deserializeFixedWidth<float>(column, rows, pool);
+        break;
+      case TypeKind::DOUBLE:
+        columns[column] = deserializeFixedWidth<double>(column, rows, pool);
+        break;
+      case TypeKind::TIMESTAMP:
+        columns[column] = deserializeFixedWidth<Timestamp>(column, rows, pool);
+        break;
+      case TypeKind::VARCHAR:
+      case TypeKind::VARBINARY:
+        columns[column] = deserializeVariableWidth(column, rows, pool);
+        break;
+      default:
+        VELOX_UNREACHABLE();
+    }
+  }
+  return std::make_shared<RowVector>(
+      pool, rowType_, nullptr, rows.size(), std::move(columns));
+}
+
+BufferPtr UnsafeRowColumnarDeserializer::deserializeNulls(
+    column_index_t column,
+    const std::vector<std::string_view>& rows,
+    memory::MemoryPool* pool) const {
+  const auto byte = column / 8;
+  const uint8_t mask = 1 << (column % 8);
+  auto numRows = rows.size();
+  vector_size_t firstNull = 0;
+  while (firstNull < numRows && !(rows[firstNull][byte] & mask)) {
+    ++firstNull;
+  }
+  if (firstNull == numRows) {
+    return nullptr;
+  }
+  auto nulls = AlignedBuffer::allocate<bool>(numRows, pool, bits::kNotNull);
+  auto* rawNulls = nulls->asMutable<uint64_t>();
+  for (auto row = firstNull; row < numRows; ++row) {
+    if (rows[row][byte] & mask) {
+      bits::setNull(rawNulls, row);
+    }
+  }
+  return nulls;
+}
+
+template <typename T>
+VectorPtr UnsafeRowColumnarDeserializer::deserializeFixedWidth(
+    column_index_t column,
+    const std::vector<std::string_view>& rows,
+    memory::MemoryPool* pool) const {
+  const auto numRows = rows.size();
+  const auto slotOffset = nullBytes_ + kSlotBytes * column;
+  auto nulls = deserializeNulls(column, rows, pool);
+  auto values = AlignedBuffer::allocate<T>(numRows, pool);
+  // The slots of null values are zero.
+  if constexpr (std::is_same_v<T, bool>) {
+    auto* rawValues = values->template asMutable<uint64_t>();
+    for (auto row = 0; row < numRows; ++row) {
+      bits::setBit(rawValues, row, rows[row][slotOffset] != 0);
+    }
+  } else if constexpr (std::is_same_v<T, Timestamp>) {
+    auto* rawValues = values->template asMutable<Timestamp>();
+    for (auto row = 0; row < numRows; ++row) {
+      int64_t micros;
+      ::memcpy(&micros, rows[row].data() + slotOffset, sizeof(micros));
+      rawValues[row] = Timestamp::fromMicros(micros);
+    }
+  } else {
+    auto* rawValues = values->template asMutable<T>();
+    for (auto row = 0; row < numRows; ++row) {
+      ::memcpy(&rawValues[row], rows[row].data() + slotOffset, sizeof(T));
+    }
+  }
+  return std::make_shared<FlatVector<T>>(
+      pool,
+      rowType_->childAt(column),
+      std::move(nulls),
+      numRows,
+      std::move(values),
+      std::vector<BufferPtr>{});
+}
+
+VectorPtr UnsafeRowColumnarDeserializer::deserializeVariableWidth(
+    column_index_t column,
+    const std::vector<std::string_view>& rows,
+    memory::MemoryPool* pool) const {
+  const auto numRows = rows.size();
+  const auto slotOffset = nullBytes_ + kSlotBytes * column;
+  auto nulls = deserializeNulls(column, rows, pool);
+  const auto* rawNulls = nulls ? nulls->as<uint64_t>() : nullptr;
+
+  // The offset and size of each value. Null values have zero sizes.
+  size_t stringBytes = 0;
+  std::vector<uint64_t> offsetAndSizes(numRows);
+  for (auto row = 0; row < numRows; ++row) {
+    ::memcpy(
+        &offsetAndSizes[row],
+        rows[row].data() + slotOffset,
+        sizeof(uint64_t));
+    const uint32_t size = offsetAndSizes[row];
+    if (!StringView::isInline(size)) {
+      stringBytes += size;
+    }
+  }
+
+  auto values = AlignedBuffer::allocate<StringView>(numRows, pool);
+  auto* rawValues = values->asMutable<StringView>();
+  std::vector<BufferPtr> stringBuffers;
+  char* rawStrings = nullptr;
+  if (stringBytes > 0) {
+    stringBuffers.push_back(AlignedBuffer::allocate<char>(stringBytes, pool));
+    rawStrings = stringBuffers.back()->asMutable<char>();
+  }
+  for (auto row = 0; row < numRows; ++row) {
+    if (rawNulls && bits::isBitNull(rawNulls, row)) {
+      rawValues[row] = StringView();
+      continue;
+    }
+    const uint32_t size = offsetAndSizes[row];
+    const char* data = rows[row].data() + (offsetAndSizes[row] >> 32);
+    if (StringView::isInline(size)) {
+      rawValues[row] = StringView(data, size);
+    } else {
+      ::memcpy(rawStrings, data, size);
+      rawValues[row] = StringView(rawStrings, size);
+      rawStrings += size;
+    }
+  }
+  return std::make_shared<FlatVector<StringView>>(
+      pool,
+      rowType_->childAt(column),
+      std::move(nulls),
+      numRows,
+      std::move(values),
+      std::move(stringBuffers));
+}
+
+} // namespace facebook::presto::operators
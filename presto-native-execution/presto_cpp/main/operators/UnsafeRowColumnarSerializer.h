@@ -0,0 +1,119 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "velox/vector/ComplexVector.h"
+#include "velox/vector/DecodedVector.h"
+
+namespace facebook::presto::operators {
+
+/// Serializes the rows of a RowVector in UnsafeRow format a column at a time,
+/// producing the same bytes as velox::row::UnsafeRowFast. An UnsafeRow has
+/// null bits, one 8-byte slot per column, holding the value of fixed-width
+/// columns and the offset and size of variable-width ones, and the
+/// variable-width data, each value padded to 8 bytes.
+///
+/// prepare() computes the sizes of all the rows. serialize() then writes the
+/// null bits and slots of each column across all the rows and appends the
+/// variable-width data in a second pass. Constant and dictionary encoded
+/// columns are read through their encodings, without flattening them.
+///
+/// Supports columns of BOOLEAN, TINYINT, SMALLINT, INTEGER, BIGINT, REAL,
+/// DOUBLE, TIMESTAMP, VARCHAR and VARBINARY types. Use UnsafeRowFast for rows
+/// of other types.
+class UnsafeRowColumnarSerializer {
+ public:
+  /// Returns true if the columns of 'rowType' are all of supported types.
+  static bool isSupported(const velox::RowType& rowType);
+
+  explicit UnsafeRowColumnarSerializer(const velox::RowType& rowType);
+
+  /// Decodes the columns of 'input' and computes the serialized size of each
+  /// of its rows into 'rowSizes'. Returns the total size.
+  size_t prepare(
+      const velox::RowVectorPtr& input,
+      std::vector<uint32_t>& rowSizes);
+
+  /// Serializes each row i of the last prepared input to 'rowBuffers[i]',
+  /// which must be zero filled and have space for rowSizes[i] bytes.
+  void serialize(char* const* FOLLY_NONNULL rowBuffers);
+
+ private:
+  // Writes the null bits and the values of fixed-width column 'column'.
+  template <typename T>
+  void serializeFixedWidth(
+      velox::column_index_t column,
+      char* const* FOLLY_NONNULL rowBuffers);
+
+  // Writes the null bits of column 'column'.
+  void serializeNulls(
+      velox::column_index_t column,
+      char* const* FOLLY_NONNULL rowBuffers);
+
+  // Appends the values of variable-width column 'column' and writes their
+  // offsets and sizes.
+  void serializeVariableWidth(
+      velox::column_index_t column,
+      char* const* FOLLY_NONNULL rowBuffers);
+
+  // The type of each column.
+  std::vector<velox::TypeKind> kinds_;
+  // The size of the null bits and the fixed-width part of a row.
+  const uint32_t nullBytes_;
+  const uint32_t fixedRowSize_;
+
+  velox::vector_size_t numRows_{0};
+  velox::SelectivityVector rows_;
+  std::vector<velox::DecodedVector> decoded_;
+  // The end of the variable-width data of each row.
+  std::vector<uint32_t> variableOffsets_;
+};
+
+/// Deserializes UnsafeRows of the types UnsafeRowColumnarSerializer supports
+/// a column at a time. Each output column is filled in one pass over the
+/// rows, reading the null bit and the slot of the column at the same offset
+/// of every row. The variable-width values of a column are copied to one
+/// string buffer.
+class UnsafeRowColumnarDeserializer {
+ public:
+  explicit UnsafeRowColumnarDeserializer(velox::RowTypePtr rowType);
+
+  /// Returns a vector with the deserialized 'rows'.
+  velox::RowVectorPtr deserialize(
+      const std::vector<std::string_view>& rows,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool) const;
+
+ private:
+  // Returns the nulls of column 'column', or nullptr if it has none.
+  velox::BufferPtr deserializeNulls(
+      velox::column_index_t column,
+      const std::vector<std::string_view>& rows,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool) const;
+
+  template <typename T>
+  velox::VectorPtr deserializeFixedWidth(
+      velox::column_index_t column,
+      const std::vector<std::string_view>& rows,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool) const;
+
+  velox::VectorPtr deserializeVariableWidth(
+      velox::column_index_t column,
+      const std::vector<std::string_view>& rows,
+      velox::memory::MemoryPool* FOLLY_NONNULL pool) const;
+
+  const velox::RowTypePtr rowType_;
+  const uint32_t nullBytes_;
+};
+
+} // namespace facebook::presto::operators
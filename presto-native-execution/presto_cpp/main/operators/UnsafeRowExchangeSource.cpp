@@ -15,29 +15,59 @@
 #include <folly/Uri.h>
 
 #include "presto_cpp/main/common/Configs.h"
+#include "presto_cpp/main/operators/SortedShuffle.h"
 #include "presto_cpp/main/operators/UnsafeRowExchangeSource.h"
 
 namespace facebook::presto::operators {
 
+bool UnsafeRowExchangeSource::shouldRequestLocked() {
+  if (atEnd_) {
+    return false;
+  }
+  // At most one request is outstanding at a time, since 'shuffle_' is read
+  // outside the queue lock.
+  const bool pending = requestPending_;
+  requestPending_ = true;
+  return !pending;
+}
+
 void UnsafeRowExchangeSource::request() {
-  std::vector<velox::ContinuePromise> promises;
   {
     std::lock_guard<std::mutex> l(queue_->mutex());
     if (atEnd_) {
       return;
     }
+  }
 
-    if (!shuffle_->hasNext()) {
+  velox::BufferPtr buffer;
+  try {
+    if (shuffle_->hasNext()) {
+      buffer = shuffle_->next(true);
+      ++numBatches_;
+    }
+  } catch (const std::exception& e) {
+    {
+      std::lock_guard<std::mutex> l(queue_->mutex());
+      requestPending_ = false;
+    }
+    // Fails the consumers of the queue instead of leaving them waiting.
+    queue_->setError(e.what());
+    return;
+  }
+
+  std::vector<velox::ContinuePromise> promises;
+  {
+    std::lock_guard<std::mutex> l(queue_->mutex());
+    requestPending_ = false;
+    if (buffer == nullptr) {
       atEnd_ = true;
       queue_->enqueueLocked(nullptr, promises);
     } else {
-      auto buffer = shuffle_->next(true);
-      ++numBatches_;
-
       auto ioBuf = folly::IOBuf::wrapBuffer(buffer->as<char>(), buffer->size());
       // NOTE: SerializedPage's onDestructionCb_ captures one reference on
       // 'buffer' to keep its alive until SerializedPage destruction. Also note
-      // that 'buffer' should have been allocated from memory pool. Hence, we
+      // that 'buffer' should have been allocated from memory pool or be a view
+      // whose releaser frees it, e.g. a memory-mapped shuffle block. Hence, we
       // don't need to update the memory usage counting for the associated
       // 'ioBuf' attached to SerializedPage on destruction.
       queue_->enqueueLocked(
@@ -56,9 +86,11 @@ folly::F14FastMap<std::string, int64_t> UnsafeRowExchangeSource::stats() const {
 }
 
 namespace {
-std::optional<std::string> getSerializedShuffleInfo(folly::Uri& uri) {
+std::optional<std::string> getQueryParam(
+    folly::Uri& uri,
+    std::string_view name) {
   for (auto& pair : uri.getQueryParams()) {
-    if (pair.first == "shuffleInfo") {
+    if (pair.first == name) {
       return std::make_optional(pair.second);
     }
   }
@@ -83,17 +115,19 @@ UnsafeRowExchangeSource::createExchangeSource(
       "interface.");
   auto shuffleFactory = ShuffleInterfaceFactory::factory(shuffleName);
   auto uri = folly::Uri(url);
-  auto serializedShuffleInfo = getSerializedShuffleInfo(uri);
+  auto serializedShuffleInfo = getQueryParam(uri, "shuffleInfo");
   VELOX_USER_CHECK(
       serializedShuffleInfo.has_value(),
       "Cannot find shuffleInfo parameter in split url '{}'",
       url);
-  return std::make_unique<UnsafeRowExchangeSource>(
-      uri.host(),
-      destination,
-      std::move(queue),
+  // Merges the blocks if the writers sorted them.
+  auto shuffle = std::make_shared<SortedShuffleReader>(
       shuffleFactory->createReader(
           serializedShuffleInfo.value(), destination, pool),
-      pool);
+      pool,
+      SortedShuffleReader::kDefaultMaxBlockBytes,
+      SystemConfig::instance()->shuffleSortedReadChunkBytes());
+  return std::make_unique<UnsafeRowExchangeSource>(
+      uri.host(), destination, std::move(queue), std::move(shuffle), pool);
 }
 }; // namespace facebook::presto::operators
@@ -30,10 +30,10 @@ class UnsafeRowExchangeSource : public velox::exec::ExchangeSource {
       velox::memory::MemoryPool* FOLLY_NONNULL pool)
       : ExchangeSource(taskId, destination, queue, pool), shuffle_(shuffle) {}
 
-  bool shouldRequestLocked() override {
-    return !atEnd_;
-  }
+  bool shouldRequestLocked() override;
 
+  /// Reads the next block from 'shuffle_' without holding the queue lock, so
+  /// that a slow read doesn't stall the consumers of the queue.
   void request() override;
 
   void close() override {}
@@ -42,6 +42,7 @@ class UnsafeRowExchangeSource : public velox::exec::ExchangeSource {
 
   /// url needs to follow below format:
   /// batch://<taskid>?shuffleInfo=<serialized-shuffle-info>
+  /// The blocks of a sorted shuffle are merged through a SortedShuffleReader.
   static std::unique_ptr<velox::exec::ExchangeSource> createExchangeSource(
       const std::string& url,
       int32_t destination,
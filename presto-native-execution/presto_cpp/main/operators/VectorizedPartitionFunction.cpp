@@ -0,0 +1,381 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "presto_cpp/main/operators/VectorizedPartitionFunction.h"
+#include "velox/connectors/hive/HivePartitionFunction.h"
+#include "velox/exec/HashPartitionFunction.h"
+#include "velox/exec/VectorHasher.h"
+
+using namespace facebook::velox;
+
+namespace facebook::presto::operators {
+namespace {
+// Sets 'hashes[i]' to the hash of row i of 'key' or, if 'mix' is set, to
+// 'mixHash(hashes[i], hash)'. Values of type T are hashed with 'hash' and
+// nulls with 'nullHash'. Flat columns are hashed from their raw values, other
+// encodings are decoded first.
+template <typename T, typename THash, typename HashFunc, typename MixFunc>
+void hashKey(
+    const BaseVector& key,
+    vector_size_t numRows,
+    bool mix,
+    THash nullHash,
+    HashFunc hash,
+    MixFunc mixHash,
+    SelectivityVector& rows,
+    DecodedVector& decoded,
+    THash* hashes) {
+  if constexpr (!std::is_same_v<T, bool>) {
+    if (key.isFlatEncoding()) {
+      const auto* values = key.asUnchecked<FlatVector<T>>()->rawValues();
+      const auto* nulls = key.rawNulls();
+      if (nulls == nullptr && !mix) {
+        for (auto i = 0; i < numRows; ++i) {
+          hashes[i] = hash(values[i]);
+        }
+      } else if (nulls == nullptr) {
+        for (auto i = 0; i < numRows; ++i) {
+          hashes[i] = mixHash(hashes[i], hash(values[i]));
+        }
+      } else {
+        for (auto i = 0; i < numRows; ++i) {
+          const THash valueHash =
+              bits::isBitNull(nulls, i) ? nullHash : hash(values[i]);
+          hashes[i] = mix ? mixHash(hashes[i], valueHash) : valueHash;
+        }
+      }
+      return;
+    }
+  }
+
+  rows.resizeFill(numRows, true);
+  decoded.decode(key, rows);
+  for (auto i = 0; i < numRows; ++i) {
+    const THash valueHash =
+        decoded.isNullAt(i) ? nullHash : hash(decoded.valueAt<T>(i));
+    hashes[i] = mix ? mixHash(hashes[i], valueHash) : valueHash;
+  }
+}
+
+// Hashes a key like VectorHasher.
+template <typename T>
+void hashKey(
+    const BaseVector& key,
+    vector_size_t numRows,
+    bool mix,
+    SelectivityVector& rows,
+    DecodedVector& decoded,
+    uint64_t* hashes) {
+  hashKey<T>(
+      key,
+      numRows,
+      mix,
+      exec::VectorHasher::kNullHash,
+      [](T value) -> uint64_t { return folly::hasher<T>()(value); },
+      [](uint64_t hash, uint64_t valueHash) {
+        return bits::hashMix(hash, valueHash);
+      },
+      rows,
+      decoded,
+      hashes);
+}
+
+// Hashes a key like Hive, with the Java hash codes of the values.
+template <typename T>
+void hiveHashKey(
+    const BaseVector& key,
+    vector_size_t numRows,
+    bool mix,
+    SelectivityVector& rows,
+    DecodedVector& decoded,
+    uint32_t* hashes) {
+  hashKey<T>(
+      key,
+      numRows,
+      mix,
+      uint32_t{0},
+      [](T value) -> uint32_t {
+        if constexpr (std::is_same_v<T, int64_t>) {
+          return value ^ (static_cast<uint64_t>(value) >> 32);
+        } else {
+          return static_cast<int32_t>(value);
+        }
+      },
+      [](uint32_t hash, uint32_t valueHash) { return hash * 31 + valueHash; },
+      rows,
+      decoded,
+      hashes);
+}
+
+bool isPowerOfTwo(uint64_t value) {
+  return (value & (value - 1)) == 0;
+}
+} // namespace
+
+bool VectorizedPartitionFunction::supportsKeys(
+    const RowVector& input,
+    const std::vector<column_index_t>& keyChannels,
+    bool boolean) {
+  if (keyChannels.empty()) {
+    return false;
+  }
+  for (const auto channel : keyChannels) {
+    if (channel == kConstantChannel) {
+      return false;
+    }
+    switch (input.childAt(channel)->typeKind()) {
+      case TypeKind::BIGINT:
+      case TypeKind::INTEGER:
+      case TypeKind::SMALLINT:
+      case TypeKind::TINYINT:
+        break;
+      case TypeKind::BOOLEAN:
+        if (!boolean) {
+          return false;
+        }
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+void VectorizedPartitionFunction::fallbackPartition(
+    core::PartitionFunction& function,
+    const RowVector& input,
+    uint32_t* partitions) {
+  function.partition(input, fallbackPartitions_);
+  ::memcpy(
+      partitions,
+      fallbackPartitions_.data(),
+      sizeof(uint32_t) * input.size());
+}
+
+VectorizedHashPartitionFunction::VectorizedHashPartitionFunction(
+    int numPartitions,
+    const RowTypePtr& inputType,
+    std::vector<column_index_t> keyChannels,
+    const std::vector<VectorPtr>& constValues)
+    : numPartitions_(numPartitions),
+      fastModMultiplier_(fastModMultiplier64(numPartitions)),
+      keyChannels_(std::move(keyChannels)),
+      fallback_(exec::HashPartitionFunctionSpec(
+                    inputType, keyChannels_, constValues)
+                    .create(numPartitions)) {
+  VELOX_CHECK_GT(numPartitions, 0);
+}
+
+void VectorizedHashPartitionFunction::partition(
+    const RowVector& input,
+    uint32_t* partitions) {
+  if (!supportsKeys(input, keyChannels_, false)) {
+    fallbackPartition(*fallback_, input, partitions);
+    return;
+  }
+
+  const auto numRows = input.size();
+  hashes_.resize(numRows);
+  for (auto i = 0; i < keyChannels_.size(); ++i) {
+    const auto& key = *input.childAt(keyChannels_[i]);
+    auto* hashes = hashes_.data();
+    switch (key.typeKind()) {
+      case TypeKind::BIGINT:
+        hashKey<int64_t>(key, numRows, i > 0, rows_, decoded_, hashes);
+        break;
+      case TypeKind::INTEGER:
+        hashKey<int32_t>(key, numRows, i > 0, rows_, decoded_, hashes);
+        break;
+      case TypeKind::SMALLINT:
+        hashKey<int16_t>(key, numRows, i > 0, rows_, decoded_, hashes);
+        break;
+      case TypeKind::TINYINT:
+        hashKey<int8_t>(key, numRows, i > 0, rows_, decoded_, hashes);
+        break;
+      default:
+        VELOX_UNREACHABLE();
+    }
+  }
+
+  if (isPowerOfTwo(numPartitions_)) {
+    const uint64_t mask = numPartitions_ - 1;
+    for (auto i = 0; i < numRows; ++i) {
+      partitions[i] = hashes_[i] & mask;
+    }
+  } else {
+    for (auto i = 0; i < numRows; ++i) {
+      partitions[i] =
+          fastMod64(hashes_[i], fastModMultiplier_, numPartitions_);
+    }
+  }
+}
+
+VectorizedHivePartitionFunction::VectorizedHivePartitionFunction(
+    int numBuckets,
+    std::vector<int> bucketToPartition,
+    std::vector<column_index_t> keyChannels,
+    const std::vector<VectorPtr>& constValues)
+    : numBuckets_(numBuckets),
+      fastModMultiplier_(fastModMultiplier32(numBuckets)),
+      bucketToPartition_(std::move(bucketToPartition)),
+      keyChannels_(std::move(keyChannels)),
+      fallback_(std::make_unique<connector::hive::HivePartitionFunction>(
+          numBuckets,
+          bucketToPartition_,
+          keyChannels_,
+          constValues)) {
+  VELOX_CHECK_GT(numBuckets, 0);
+}
+
+void VectorizedHivePartitionFunction::partition(
+    const RowVector& input,
+    uint32_t* partitions) {
+  if (!supportsKeys(input, keyChannels_, true)) {
+    fallbackPartition(*fallback_, input, partitions);
+    return;
+  }
+
+  const auto numRows = input.size();
+  hashes_.resize(numRows);
+  for (auto i = 0; i < keyChannels_.size(); ++i) {
+    const auto& key = *input.childAt(keyChannels_[i]);
+    auto* hashes = hashes_.data();
+    switch (key.typeKind()) {
+      case TypeKind::BIGINT:
+        hiveHashKey<int64_t>(key, numRows, i > 0, rows_, decoded_, hashes);
+        break;
+      case TypeKind::INTEGER:
+        hiveHashKey<int32_t>(key, numRows, i > 0, rows_, decoded_, hashes);
+        break;
+      case TypeKind::SMALLINT:
+        hiveHashKey<int16_t>(key, numRows, i > 0, rows_, decoded_, hashes);
+        break;
+      case TypeKind::TINYINT:
+        hiveHashKey<int8_t>(key, numRows, i > 0, rows_, decoded_, hashes);
+        break;
+      case TypeKind::BOOLEAN:
+        hiveHashKey<bool>(key, numRows, i > 0, rows_, decoded_, hashes);
+        break;
+      default:
+        VELOX_UNREACHABLE();
+    }
+  }
+
+  constexpr uint32_t kInt32Max = std::numeric_limits<int32_t>::max();
+  if (bucketToPartition_.empty()) {
+    for (auto i = 0; i < numRows; ++i) {
+      partitions[i] =
+          fastMod32(hashes_[i] & kInt32Max, fastModMultiplier_, numBuckets_);
+    }
+  } else {
+    for (auto i = 0; i < numRows; ++i) {
+      partitions[i] = bucketToPartition_[fastMod32(
+          hashes_[i] & kInt32Max, fastModMultiplier_, numBuckets_)];
+    }
+  }
+}
+
+namespace {
+folly::dynamic serializeConstValues(const std::vector<VectorPtr>& values) {
+  folly::dynamic array = folly::dynamic::array;
+  for (const auto& value : values) {
+    array.push_back(core::ConstantTypedExpr(value).serialize());
+  }
+  return array;
+}
+
+std::vector<VectorPtr> deserializeConstValues(
+    const folly::dynamic& obj,
+    void* context) {
+  std::vector<VectorPtr> values;
+  if (!obj.count("constValues")) {
+    return values;
+  }
+  auto* pool = static_cast<memory::MemoryPool*>(context);
+  for (const auto& value : obj["constValues"]) {
+    values.push_back(
+        ISerializable::deserialize<core::ConstantTypedExpr>(value, context)
+            ->toConstantVector(pool));
+  }
+  return values;
+}
+} // namespace
+
+std::unique_ptr<core::PartitionFunction>
+VectorizedHashPartitionFunctionSpec::create(int numPartitions) const {
+  return std::make_unique<VectorizedHashPartitionFunction>(
+      numPartitions, inputType_, keyChannels_, constValues_);
+}
+
+std::string VectorizedHashPartitionFunctionSpec::toString() const {
+  return exec::HashPartitionFunctionSpec(inputType_, keyChannels_, constValues_)
+      .toString();
+}
+
+folly::dynamic VectorizedHashPartitionFunctionSpec::serialize() const {
+  folly::dynamic obj = folly::dynamic::object;
+  obj["name"] = "VectorizedHashPartitionFunctionSpec";
+  obj["inputType"] = inputType_->serialize();
+  obj["keyChannels"] = ISerializable::serialize(keyChannels_);
+  if (!constValues_.empty()) {
+    obj["constValues"] = serializeConstValues(constValues_);
+  }
+  return obj;
+}
+
+core::PartitionFunctionSpecPtr VectorizedHashPartitionFunctionSpec::deserialize(
+    const folly::dynamic& obj,
+    void* context) {
+  return std::make_shared<VectorizedHashPartitionFunctionSpec>(
+      ISerializable::deserialize<RowType>(obj["inputType"], context),
+      ISerializable::deserialize<std::vector<column_index_t>>(
+          obj["keyChannels"]),
+      deserializeConstValues(obj, context));
+}
+
+std::unique_ptr<core::PartitionFunction>
+VectorizedHivePartitionFunctionSpec::create(int /*numPartitions*/) const {
+  return std::make_unique<VectorizedHivePartitionFunction>(
+      numBuckets_, bucketToPartition_, keyChannels_, constValues_);
+}
+
+std::string VectorizedHivePartitionFunctionSpec::toString() const {
+  return connector::hive::HivePartitionFunctionSpec(
+             numBuckets_, bucketToPartition_, keyChannels_, constValues_)
+      .toString();
+}
+
+folly::dynamic VectorizedHivePartitionFunctionSpec::serialize() const {
+  folly::dynamic obj = folly::dynamic::object;
+  obj["name"] = "VectorizedHivePartitionFunctionSpec";
+  obj["numBuckets"] = numBuckets_;
+  obj["bucketToPartition"] = ISerializable::serialize(bucketToPartition_);
+  obj["keyChannels"] = ISerializable::serialize(keyChannels_);
+  if (!constValues_.empty()) {
+    obj["constValues"] = serializeConstValues(constValues_);
+  }
+  return obj;
+}
+
+core::PartitionFunctionSpecPtr VectorizedHivePartitionFunctionSpec::deserialize(
+    const folly::dynamic& obj,
+    void* context) {
+  return std::make_shared<VectorizedHivePartitionFunctionSpec>(
+      obj["numBuckets"].asInt(),
+      ISerializable::deserialize<std::vector<int>>(obj["bucketToPartition"]),
+      ISerializable::deserialize<std::vector<column_index_t>>(
+          obj["keyChannels"]),
+      deserializeConstValues(obj, context));
+}
+
+} // namespace facebook::presto::operators
@@ -0,0 +1,204 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "velox/core/PlanNode.h"
+#include "velox/vector/DecodedVector.h"
+
+/// Hash partition functions with type-specialized kernels for keys of
+/// integer types. The kernels hash the raw values of flat key columns in
+/// tight loops that the compiler vectorizes and reduce the hashes to
+/// partitions with multiplications instead of divisions. The partitions are
+/// the same as those of velox::exec::HashPartitionFunction and
+/// velox::connector::hive::HivePartitionFunction, which handle the keys of
+/// other types and constant keys.
+namespace facebook::presto::operators {
+
+/// Computes a % d for a 64-bit 'a' without division, given
+/// M = fastModMultiplier64(d). See Lemire et al., "Faster Remainder by Direct
+/// Computation", 2019.
+inline __uint128_t fastModMultiplier64(uint64_t d) {
+  return ~__uint128_t{0} / d + 1;
+}
+
+inline uint64_t fastMod64(uint64_t a, __uint128_t M, uint64_t d) {
+  const __uint128_t lowBits = M * a;
+  const __uint128_t bottom = ((lowBits & ~uint64_t{0}) * d) >> 64;
+  const __uint128_t top = (lowBits >> 64) * d;
+  return (bottom + top) >> 64;
+}
+
+/// Like fastMod64() for a 32-bit 'a' and 'd', given
+/// M = fastModMultiplier32(d).
+inline uint64_t fastModMultiplier32(uint32_t d) {
+  return ~uint64_t{0} / d + 1;
+}
+
+inline uint32_t fastMod32(uint32_t a, uint64_t M, uint32_t d) {
+  return (static_cast<__uint128_t>(M * a) * d) >> 64;
+}
+
+/// A partition function that writes the partitions to a caller-provided
+/// buffer, e.g. the values of the partition column of an output vector.
+class VectorizedPartitionFunction : public velox::core::PartitionFunction {
+ public:
+  /// Writes the partition of each row of 'input' to 'partitions', which has
+  /// space for input.size() values.
+  virtual void partition(
+      const velox::RowVector& input,
+      uint32_t* FOLLY_NONNULL partitions) = 0;
+
+  void partition(
+      const velox::RowVector& input,
+      std::vector<uint32_t>& partitions) override {
+    partitions.resize(input.size());
+    partition(input, partitions.data());
+  }
+
+ protected:
+  // Returns true if there are keys and the keys at 'keyChannels' of 'input'
+  // are all columns of the types the kernels support, which are BIGINT,
+  // INTEGER, SMALLINT, TINYINT and, if 'boolean' is set, BOOLEAN.
+  static bool supportsKeys(
+      const velox::RowVector& input,
+      const std::vector<velox::column_index_t>& keyChannels,
+      bool boolean);
+
+  // Computes the partitions of 'input' with 'function' into 'partitions'.
+  void fallbackPartition(
+      velox::core::PartitionFunction& function,
+      const velox::RowVector& input,
+      uint32_t* FOLLY_NONNULL partitions);
+
+  velox::SelectivityVector rows_;
+  velox::DecodedVector decoded_;
+  std::vector<uint32_t> fallbackPartitions_;
+};
+
+/// Partitions like velox::exec::HashPartitionFunction: mixes the
+/// VectorHasher hashes of the keys and takes them modulo the number of
+/// partitions.
+class VectorizedHashPartitionFunction : public VectorizedPartitionFunction {
+ public:
+  VectorizedHashPartitionFunction(
+      int numPartitions,
+      const velox::RowTypePtr& inputType,
+      std::vector<velox::column_index_t> keyChannels,
+      const std::vector<velox::VectorPtr>& constValues = {});
+
+  using VectorizedPartitionFunction::partition;
+
+  void partition(
+      const velox::RowVector& input,
+      uint32_t* FOLLY_NONNULL partitions) override;
+
+ private:
+  const uint32_t numPartitions_;
+  const __uint128_t fastModMultiplier_;
+  const std::vector<velox::column_index_t> keyChannels_;
+  // Partitions the inputs the kernels do not support.
+  const std::unique_ptr<velox::core::PartitionFunction> fallback_;
+  std::vector<uint64_t> hashes_;
+};
+
+/// Partitions like velox::connector::hive::HivePartitionFunction: computes
+/// the Hive bucket of each row from the Java hash codes of the keys and maps
+/// it to a partition with 'bucketToPartition', if not empty.
+class VectorizedHivePartitionFunction : public VectorizedPartitionFunction {
+ public:
+  VectorizedHivePartitionFunction(
+      int numBuckets,
+      std::vector<int> bucketToPartition,
+      std::vector<velox::column_index_t> keyChannels,
+      const std::vector<velox::VectorPtr>& constValues = {});
+
+  using VectorizedPartitionFunction::partition;
+
+  void partition(
+      const velox::RowVector& input,
+      uint32_t* FOLLY_NONNULL partitions) override;
+
+ private:
+  const uint32_t numBuckets_;
+  const uint64_t fastModMultiplier_;
+  const std::vector<int> bucketToPartition_;
+  const std::vector<velox::column_index_t> keyChannels_;
+  const std::unique_ptr<velox::core::PartitionFunction> fallback_;
+  std::vector<uint32_t> hashes_;
+};
+
+/// Drop-in replacement of velox::exec::HashPartitionFunctionSpec creating
+/// VectorizedHashPartitionFunctions.
+class VectorizedHashPartitionFunctionSpec
+    : public velox::core::PartitionFunctionSpec {
+ public:
+  VectorizedHashPartitionFunctionSpec(
+      velox::RowTypePtr inputType,
+      std::vector<velox::column_index_t> keyChannels,
+      std::vector<velox::VectorPtr> constValues = {})
+      : inputType_{std::move(inputType)},
+        keyChannels_{std::move(keyChannels)},
+        constValues_{std::move(constValues)} {}
+
+  std::unique_ptr<velox::core::PartitionFunction> create(
+      int numPartitions) const override;
+
+  std::string toString() const override;
+
+  folly::dynamic serialize() const override;
+
+  static velox::core::PartitionFunctionSpecPtr deserialize(
+      const folly::dynamic& obj,
+      void* context);
+
+ private:
+  const velox::RowTypePtr inputType_;
+  const std::vector<velox::column_index_t> keyChannels_;
+  const std::vector<velox::VectorPtr> constValues_;
+};
+
+/// Drop-in replacement of velox::connector::hive::HivePartitionFunctionSpec
+/// creating VectorizedHivePartitionFunctions.
+class VectorizedHivePartitionFunctionSpec
+    : public velox::core::PartitionFunctionSpec {
+ public:
+  VectorizedHivePartitionFunctionSpec(
+      int numBuckets,
+      std::vector<int> bucketToPartition,
+      std::vector<velox::column_index_t> keyChannels,
+      std::vector<velox::VectorPtr> constValues = {})
+      : numBuckets_{numBuckets},
+        bucketToPartition_{std::move(bucketToPartition)},
+        keyChannels_{std::move(keyChannels)},
+        constValues_{std::move(constValues)} {}
+
+  std::unique_ptr<velox::core::PartitionFunction> create(
+      int numPartitions) const override;
+
+  std::string toString() const override;
+
+  folly::dynamic serialize() const override;
+
+  static velox::core::PartitionFunctionSpecPtr deserialize(
+      const folly::dynamic& obj,
+      void* context);
+
+ private:
+  const int numBuckets_;
+  const std::vector<int> bucketToPartition_;
+  const std::vector<velox::column_index_t> keyChannels_;
+  const std::vector<velox::VectorPtr> constValues_;
+};
+
+} // namespace facebook::presto::operators
@@ -13,6 +13,7 @@
  */
 #include "presto_cpp/main/operators/tests/PlanBuilder.h"
 #include "presto_cpp/main/operators/PartitionAndSerialize.h"
+#include "presto_cpp/main/operators/PartitionAndShuffleWrite.h"
 #include "presto_cpp/main/operators/ShuffleRead.h"
 #include "presto_cpp/main/operators/ShuffleWrite.h"
 #include "velox/exec/HashPartitionFunction.h"
@@ -25,8 +26,17 @@ namespace facebook::presto::operators {
 std::function<PlanNodePtr(std::string nodeId, PlanNodePtr)>
 addPartitionAndSerializeNode(
     uint32_t numPartitions,
-    const std::vector<std::string>& serializedColumns) {
-  return [numPartitions, &serializedColumns](
+    const std::vector<std::string>& serializedColumns,
+    bool clustered,
+    ShuffleSerializationFormat format,
+    const std::vector<std::string>& sortingKeys,
+    const std::vector<core::SortOrder>& sortingOrders) {
+  return [numPartitions,
+          &serializedColumns,
+          clustered,
+          format,
+          sortingKeys,
+          sortingOrders](
              core::PlanNodeId nodeId,
              core::PlanNodePtr source) -> core::PlanNodePtr {
     std::vector<core::TypedExprPtr> keys{
@@ -43,6 +53,12 @@ addPartitionAndSerializeNode(
         ? inputType
         : ROW(std::move(names), std::move(types));
 
+    std::vector<core::FieldAccessTypedExprPtr> sortingKeyExprs;
+    for (const auto& name : sortingKeys) {
+      sortingKeyExprs.push_back(std::make_shared<core::FieldAccessTypedExpr>(
+          inputType->findChild(name), name));
+    }
+
     return std::make_shared<PartitionAndSerializeNode>(
         nodeId,
         keys,
@@ -50,25 +66,62 @@ addPartitionAndSerializeNode(
         serializedType,
         std::move(source),
         std::make_shared<exec::HashPartitionFunctionSpec>(
-            inputType, exec::toChannels(inputType, keys)));
+            inputType, exec::toChannels(inputType, keys)),
+        clustered,
+        format,
+        std::move(sortingKeyExprs),
+        sortingOrders);
+  };
+}
+
+std::function<PlanNodePtr(std::string nodeId, PlanNodePtr)>
+addPartitionAndShuffleWriteNode(
+    uint32_t numPartitions,
+    const std::string& shuffleName,
+    const std::string& serializedWriteInfo,
+    bool sharedWriter) {
+  return [numPartitions, &shuffleName, &serializedWriteInfo, sharedWriter](
+             PlanNodeId nodeId, PlanNodePtr source) -> PlanNodePtr {
+    std::vector<core::TypedExprPtr> keys{
+        std::make_shared<core::FieldAccessTypedExpr>(INTEGER(), "c0")};
+    const auto inputType = source->outputType();
+    return std::make_shared<PartitionAndShuffleWriteNode>(
+        nodeId,
+        keys,
+        numPartitions,
+        inputType,
+        std::make_shared<exec::HashPartitionFunctionSpec>(
+            inputType, exec::toChannels(inputType, keys)),
+        shuffleName,
+        serializedWriteInfo,
+        std::move(source),
+        sharedWriter);
   };
 }
 
 std::function<PlanNodePtr(std::string nodeId, PlanNodePtr)> addShuffleReadNode(
-    const velox::RowTypePtr& outputType) {
-  return [&outputType](
+    const velox::RowTypePtr& outputType,
+    ShuffleSerializationFormat format) {
+  return [&outputType, format](
              PlanNodeId nodeId, PlanNodePtr /* source */) -> PlanNodePtr {
-    return std::make_shared<ShuffleReadNode>(nodeId, outputType);
+    return std::make_shared<ShuffleReadNode>(nodeId, outputType, format);
   };
 }
 
 std::function<PlanNodePtr(std::string nodeId, PlanNodePtr)> addShuffleWriteNode(
     const std::string& shuffleName,
-    const std::string& serializedWriteInfo) {
-  return [&shuffleName, &serializedWriteInfo](
+    const std::string& serializedWriteInfo,
+    bool clustered,
+    bool sorted) {
+  return [&shuffleName, &serializedWriteInfo, clustered, sorted](
              PlanNodeId nodeId, PlanNodePtr source) -> PlanNodePtr {
     return std::make_shared<ShuffleWriteNode>(
-        nodeId, shuffleName, serializedWriteInfo, std::move(source));
+        nodeId,
+        shuffleName,
+        serializedWriteInfo,
+        std::move(source),
+        clustered,
+        sorted);
   };
 }
 } // namespace facebook::presto::operators
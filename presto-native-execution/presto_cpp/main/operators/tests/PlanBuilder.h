@@ -13,6 +13,7 @@
  */
 #pragma once
 
+#include "presto_cpp/main/operators/ShuffleInterface.h"
 #include "velox/core/PlanNode.h"
 
 namespace facebook::presto::operators {
@@ -23,16 +24,32 @@ std::function<
     velox::core::PlanNodePtr(std::string nodeId, velox::core::PlanNodePtr)>
 addPartitionAndSerializeNode(
     uint32_t numPartitions,
-    const std::vector<std::string>& serializedColumns = {});
+    const std::vector<std::string>& serializedColumns = {},
+    bool clustered = false,
+    ShuffleSerializationFormat format = ShuffleSerializationFormat::kUnsafeRow,
+    const std::vector<std::string>& sortingKeys = {},
+    const std::vector<velox::core::SortOrder>& sortingOrders = {});
 
 std::function<
     velox::core::PlanNodePtr(std::string nodeId, velox::core::PlanNodePtr)>
-addShuffleReadNode(const velox::RowTypePtr& outputType);
+addPartitionAndShuffleWriteNode(
+    uint32_t numPartitions,
+    const std::string& shuffleName,
+    const std::string& serializedWriteInfo,
+    bool sharedWriter = false);
+
+std::function<
+    velox::core::PlanNodePtr(std::string nodeId, velox::core::PlanNodePtr)>
+addShuffleReadNode(
+    const velox::RowTypePtr& outputType,
+    ShuffleSerializationFormat format = ShuffleSerializationFormat::kUnsafeRow);
 
 std::function<
     velox::core::PlanNodePtr(std::string nodeId, velox::core::PlanNodePtr)>
 addShuffleWriteNode(
     const std::string& shuffleName,
-    const std::string& serializedWriteInfo);
+    const std::string& serializedWriteInfo,
+    bool clustered = false,
+    bool sorted = false);
 
 } // namespace facebook::presto::operators
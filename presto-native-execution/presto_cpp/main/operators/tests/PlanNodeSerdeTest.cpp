@@ -13,6 +13,8 @@
  */
 #include <gtest/gtest.h>
 
+#include "presto_cpp/main/operators/PartitionAndSerialize.h"
+#include "presto_cpp/main/operators/VectorizedPartitionFunction.h"
 #include "presto_cpp/main/operators/tests/PlanBuilder.h"
 #include "presto_cpp/main/types/PrestoToVeloxQueryPlan.h"
 #include "velox/core/PlanNode.h"
@@ -76,6 +78,38 @@ TEST_F(PlanNodeSerdeTest, partitionAndSerializeNode) {
   testSerde(plan);
 }
 
+TEST_F(PlanNodeSerdeTest, vectorizedPartitionFunctionSpecs) {
+  std::vector<core::PartitionFunctionSpecPtr> specs = {
+      std::make_shared<VectorizedHashPartitionFunctionSpec>(
+          type_, std::vector<column_index_t>{0, 1}),
+      std::make_shared<VectorizedHivePartitionFunctionSpec>(
+          8,
+          std::vector<int>{0, 1, 2, 3, 0, 1, 2, 3},
+          std::vector<column_index_t>{1}),
+  };
+  for (const auto& spec : specs) {
+    auto copy = velox::ISerializable::deserialize<core::PartitionFunctionSpec>(
+        spec->serialize(), pool());
+    ASSERT_EQ(spec->toString(), copy->toString());
+    ASSERT_EQ(spec->serialize(), copy->serialize());
+  }
+
+  auto plan = exec::test::PlanBuilder()
+                  .values(data_, true)
+                  .addNode([&](auto nodeId, auto source) {
+                    return std::make_shared<PartitionAndSerializeNode>(
+                        nodeId,
+                        std::vector<core::TypedExprPtr>{},
+                        4,
+                        type_,
+                        std::move(source),
+                        specs[0]);
+                  })
+                  .localPartition({})
+                  .planNode();
+  testSerde(plan);
+}
+
 TEST_F(PlanNodeSerdeTest, shuffleReadNode) {
   auto plan = exec::test::PlanBuilder()
                   .addNode(addShuffleReadNode(type_))
@@ -12,20 +12,31 @@
  * limitations under the License.
  */
 #include <folly/Uri.h>
+#include <filesystem>
+#include <numeric>
+#include <thread>
 #include "folly/init/Init.h"
 #include "presto_cpp/external/json/json.hpp"
 #include "presto_cpp/main/operators/LocalPersistentShuffle.h"
+#include "presto_cpp/main/operators/MemoryShuffle.h"
 #include "presto_cpp/main/operators/PartitionAndSerialize.h"
+#include "presto_cpp/main/operators/PartitionAndShuffleWrite.h"
 #include "presto_cpp/main/operators/ShuffleRead.h"
 #include "presto_cpp/main/operators/ShuffleWrite.h"
+#include "presto_cpp/main/operators/SortedShuffle.h"
+#include "presto_cpp/main/operators/UnsafeRowColumnarSerializer.h"
 #include "presto_cpp/main/operators/UnsafeRowExchangeSource.h"
+#include "presto_cpp/main/operators/VectorizedPartitionFunction.h"
 #include "presto_cpp/main/operators/tests/PlanBuilder.h"
+#include "velox/common/base/tests/GTestUtils.h"
 #include "velox/connectors/hive/HivePartitionFunction.h"
 #include "velox/exec/Exchange.h"
+#include "velox/exec/HashPartitionFunction.h"
 #include "velox/exec/tests/utils/OperatorTestBase.h"
 #include "velox/exec/tests/utils/PlanBuilder.h"
 #include "velox/exec/tests/utils/TempDirectoryPath.h"
 #include "velox/row/UnsafeRowDeserializers.h"
+#include "velox/serializers/PrestoSerializer.h"
 #include "velox/vector/fuzzer/VectorFuzzer.h"
 
 using namespace facebook::velox;
@@ -261,13 +272,12 @@ void registerExchangeSource(const std::string& shuffleName) {
           auto uri = folly::Uri(taskId);
           for (auto& pair : uri.getQueryParams()) {
             if (pair.first == "shuffleInfo") {
-              return std::make_unique<UnsafeRowExchangeSource>(
-                  taskId,
-                  destination,
-                  std::move(queue),
+              auto reader = std::make_shared<SortedShuffleReader>(
                   ShuffleInterfaceFactory::factory(shuffleName)
                       ->createReader(pair.second, destination, pool),
                   pool);
+              return std::make_unique<UnsafeRowExchangeSource>(
+                  taskId, destination, std::move(queue), reader, pool);
             }
           }
           VELOX_USER_FAIL(
@@ -311,10 +321,15 @@ class UnsafeRowShuffleTest : public exec::test::OperatorTestBase {
     ShuffleInterfaceFactory::registerFactory(
         std::string(LocalPersistentShuffleFactory::kShuffleName),
         std::make_unique<LocalPersistentShuffleFactory>());
+    ShuffleInterfaceFactory::registerFactory(
+        std::string(MemoryShuffleFactory::kShuffleName),
+        std::make_unique<MemoryShuffleFactory>());
     exec::Operator::registerOperator(
         std::make_unique<PartitionAndSerializeTranslator>());
     exec::Operator::registerOperator(
         std::make_unique<ShuffleWriteTranslator>());
+    exec::Operator::registerOperator(
+        std::make_unique<PartitionAndShuffleWriteTranslator>());
   }
 
   static std::string makeTaskId(
@@ -368,6 +383,30 @@ class UnsafeRowShuffleTest : public exec::test::OperatorTestBase {
         row::UnsafeRowDeserializer::deserialize(rows, rowType, pool()));
   }
 
+  // Deserializes the PrestoPages in 'serializedResult' into one vector per
+  // page.
+  std::vector<RowVectorPtr> deserializePages(
+      const RowVectorPtr& serializedResult,
+      const RowTypePtr& rowType) {
+    auto serializedData =
+        serializedResult->childAt(1)->as<FlatVector<StringView>>();
+    serializer::presto::PrestoVectorSerde serde;
+    std::vector<RowVectorPtr> pages;
+    for (auto i = 0; i < serializedData->size(); ++i) {
+      auto page = serializedData->valueAt(i);
+      ByteStream input;
+      ByteRange range{
+          reinterpret_cast<uint8_t*>(const_cast<char*>(page.data())),
+          (int32_t)page.size(),
+          0};
+      input.resetInput({range});
+      RowVectorPtr result;
+      serde.deserialize(&input, pool(), rowType, &result);
+      pages.push_back(result);
+    }
+    return pages;
+  }
+
   RowVectorPtr copyResultVector(const RowVectorPtr& result) {
     auto vector = std::static_pointer_cast<RowVector>(
         BaseVector::create(result->type(), result->size(), pool()));
@@ -402,12 +441,19 @@ class UnsafeRowShuffleTest : public exec::test::OperatorTestBase {
       const std::string& serializedShuffleReadInfo,
       size_t numPartitions,
       size_t numMapDrivers,
-      const std::vector<RowVectorPtr>& data) {
+      const std::vector<RowVectorPtr>& data,
+      bool fusePartitionAndShuffleWrite = false,
+      bool clustered = false,
+      ShuffleSerializationFormat format =
+          ShuffleSerializationFormat::kUnsafeRow,
+      bool sharedWriter = false) {
     // Register new shuffle related operators.
     exec::Operator::registerOperator(
         std::make_unique<PartitionAndSerializeTranslator>());
     exec::Operator::registerOperator(
         std::make_unique<ShuffleWriteTranslator>());
+    exec::Operator::registerOperator(
+        std::make_unique<PartitionAndShuffleWriteTranslator>());
     exec::Operator::registerOperator(std::make_unique<ShuffleReadTranslator>());
 
     // Flatten the inputs to avoid issues assertEqualResults referred here:
@@ -420,13 +466,23 @@ class UnsafeRowShuffleTest : public exec::test::OperatorTestBase {
       flattenInputs.push_back(vectorMaker_.flatten<RowVector>(input));
     }
 
-    auto writerPlan = exec::test::PlanBuilder()
-                          .values(flattenInputs, true)
-                          .addNode(addPartitionAndSerializeNode(numPartitions))
-                          .localPartition({})
-                          .addNode(addShuffleWriteNode(
-                              shuffleName, serializedShuffleWriteInfo))
-                          .planNode();
+    auto writerPlan = fusePartitionAndShuffleWrite
+        ? exec::test::PlanBuilder()
+              .values(flattenInputs, true)
+              .addNode(addPartitionAndShuffleWriteNode(
+                  numPartitions,
+                  shuffleName,
+                  serializedShuffleWriteInfo,
+                  sharedWriter))
+              .planNode()
+        : exec::test::PlanBuilder()
+              .values(flattenInputs, true)
+              .addNode(addPartitionAndSerializeNode(
+                  numPartitions, {}, clustered, format))
+              .localPartition({})
+              .addNode(addShuffleWriteNode(
+                  shuffleName, serializedShuffleWriteInfo, clustered))
+              .planNode();
 
     auto writerTaskId = makeTaskId("leaf", 0);
     auto writerTask = makeTask(writerTaskId, writerPlan, 0);
@@ -453,7 +509,7 @@ class UnsafeRowShuffleTest : public exec::test::OperatorTestBase {
     // from shuffle.
     for (auto i = 0; i < numPartitions; ++i) {
       auto plan = exec::test::PlanBuilder()
-                      .addNode(addShuffleReadNode(dataType))
+                      .addNode(addShuffleReadNode(dataType, format))
                       .project(dataType->names())
                       .planNode();
 
@@ -487,6 +543,53 @@ class UnsafeRowShuffleTest : public exec::test::OperatorTestBase {
     velox::exec::test::assertEqualResults(expectedOutputVectors, outputVectors);
   }
 
+  // Reads the length-prefixed rows of all the blocks of 'reader'. Optionally
+  // returns the number of blocks read.
+  static std::vector<std::string> readShuffleRows(
+      ShuffleReader& reader,
+      int* numBlocks = nullptr) {
+    std::vector<std::string> rows;
+    while (reader.hasNext()) {
+      auto buffer = reader.next(true);
+      if (numBlocks != nullptr) {
+        ++*numBlocks;
+      }
+      const auto* data = buffer->as<char>();
+      size_t offset = 0;
+      while (offset < buffer->size()) {
+        const auto rowSize = folly::Endian::big(
+            *reinterpret_cast<const uint32_t*>(data + offset));
+        offset += sizeof(uint32_t);
+        rows.emplace_back(data + offset, rowSize);
+        offset += rowSize;
+      }
+    }
+    return rows;
+  }
+
+  // Reads back the rows written to 'partition' of the local persistent shuffle
+  // in 'rootPath'. Optionally returns the number of blocks read.
+  std::vector<std::string> readLocalShuffleRows(
+      const std::string& rootPath,
+      uint32_t partition,
+      int* numBlocks = nullptr,
+      folly::Executor* executor = nullptr,
+      uint32_t numReadAheadBlocks = 0,
+      bool mmapReads = false,
+      bool directIo = false) {
+    LocalPersistentShuffleReader reader(
+        rootPath,
+        "query_id",
+        {fmt::format("shuffle_0_0_{}", partition)},
+        partition,
+        pool(),
+        executor,
+        numReadAheadBlocks,
+        mmapReads,
+        directIo);
+    return readShuffleRows(reader, numBlocks);
+  }
+
   void cleanupDirectory(const std::string& rootPath) {
     auto fileSystem = velox::filesystems::getFileSystem(rootPath, nullptr);
     auto files = fileSystem->list(rootPath);
@@ -520,6 +623,42 @@ TEST_F(UnsafeRowShuffleTest, operators) {
   TestShuffleWriter::reset();
 }
 
+TEST_F(UnsafeRowShuffleTest, exchangeSourceReadError) {
+  class FailingShuffleReader : public ShuffleReader {
+   public:
+    bool hasNext() override {
+      return true;
+    }
+
+    BufferPtr next(bool /*success*/) override {
+      VELOX_FAIL("Shuffle read failed");
+    }
+
+    folly::F14FastMap<std::string, int64_t> stats() const override {
+      return {};
+    }
+  };
+
+  auto queue = std::make_shared<exec::ExchangeQueue>(1 << 20);
+  queue->addSourceLocked();
+  queue->noMoreSources();
+  auto source = std::make_shared<UnsafeRowExchangeSource>(
+      "task_id", 0, queue, std::make_shared<FailingShuffleReader>(), pool());
+  {
+    std::lock_guard<std::mutex> l(queue->mutex());
+    ASSERT_TRUE(source->shouldRequestLocked());
+  }
+  source->request();
+
+  std::lock_guard<std::mutex> l(queue->mutex());
+  // The failed request is no longer pending and its error reaches the queue.
+  ASSERT_TRUE(source->shouldRequestLocked());
+  bool atEnd;
+  ContinueFuture future;
+  VELOX_ASSERT_THROW(
+      queue->dequeueLocked(&atEnd, &future), "Shuffle read failed");
+}
+
 TEST_F(UnsafeRowShuffleTest, endToEnd) {
   size_t numPartitions = 5;
   size_t numMapDrivers = 2;
@@ -587,6 +726,21 @@ TEST_F(UnsafeRowShuffleTest, persistentShuffleDeser) {
   EXPECT_EQ(shuffleReadInfo.queryId, "query_id");
   EXPECT_EQ(shuffleReadInfo.partitionIds, partitionIds);
   EXPECT_EQ(shuffleReadInfo.numPartitions, 11);
+  EXPECT_FALSE(shuffleReadInfo.hasBlockRange());
+
+  serializedReadInfo =
+      "{\n"
+      "  \"rootPath\": \"abc\",\n"
+      "  \"queryId\": \"query_id\",\n"
+      "  \"partitionIds\": [ \"shuffle1\" ],\n"
+      "  \"numPartitions\": 11,\n"
+      "  \"blockBegin\": 3,\n"
+      "  \"blockEnd\": 7\n"
+      "}";
+  shuffleReadInfo = LocalShuffleReadInfo::deserialize(serializedReadInfo);
+  EXPECT_TRUE(shuffleReadInfo.hasBlockRange());
+  EXPECT_EQ(shuffleReadInfo.blockBegin, 3);
+  EXPECT_EQ(shuffleReadInfo.blockEnd, 7);
 
   std::string badSerializedInfo =
       "{\n"
@@ -645,6 +799,1429 @@ TEST_F(UnsafeRowShuffleTest, persistentShuffle) {
   cleanupDirectory(rootPath);
 }
 
+TEST_F(UnsafeRowShuffleTest, persistentShuffleFusedPartitionAndWrite) {
+  uint32_t numPartitions = 1;
+  uint32_t numMapDrivers = 2;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  auto data = vectorMaker_.rowVector({
+      makeFlatVector<int32_t>({1, 2, 3, 4, 5, 6}),
+      makeFlatVector<StringView>({"a", "bb", "ccc", "dddd", "eeeee", "f"}),
+  });
+
+  velox::exec::ExchangeSource::factories().clear();
+  registerExchangeSource(
+      std::string(LocalPersistentShuffleFactory::kShuffleName));
+  runShuffleTest(
+      std::string(LocalPersistentShuffleFactory::kShuffleName),
+      fmt::format(kLocalShuffleWriteInfoFormat, rootPath, numPartitions),
+      fmt::format(kLocalShuffleReadInfoFormat, rootPath, numPartitions),
+      numPartitions,
+      numMapDrivers,
+      {data},
+      true);
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleSharedTaskWriter) {
+  uint32_t numPartitions = 1;
+  uint32_t numMapDrivers = 4;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  auto data = vectorMaker_.rowVector({
+      makeFlatVector<int32_t>(1'000, [](auto row) { return row; }),
+      makeFlatVector<int64_t>(1'000, [](auto row) { return row * 10; }),
+  });
+
+  velox::exec::ExchangeSource::factories().clear();
+  registerExchangeSource(
+      std::string(LocalPersistentShuffleFactory::kShuffleName));
+  for (bool sharedWriter : {false, true}) {
+    SCOPED_TRACE(fmt::format("sharedWriter: {}", sharedWriter));
+    runShuffleTest(
+        std::string(LocalPersistentShuffleFactory::kShuffleName),
+        fmt::format(kLocalShuffleWriteInfoFormat, rootPath, numPartitions),
+        fmt::format(kLocalShuffleReadInfoFormat, rootPath, numPartitions),
+        numPartitions,
+        numMapDrivers,
+        {data},
+        true,
+        false,
+        ShuffleSerializationFormat::kUnsafeRow,
+        sharedWriter);
+
+    // Each writer commits one manifest.
+    auto fileSystem = velox::filesystems::getFileSystem(rootPath, nullptr);
+    int32_t numManifests = 0;
+    for (const auto& file : fileSystem->list(rootPath)) {
+      if (file.find(".manifest") != std::string::npos) {
+        ++numManifests;
+      }
+    }
+    ASSERT_EQ(numManifests, sharedWriter ? 1 : numMapDrivers);
+    cleanupDirectory(rootPath);
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleMultipleWriters) {
+  const uint32_t numPartitions = 4;
+  const uint32_t numDrivers = 4;
+  const uint32_t numRows = 2'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  // Like the drivers of a task, the writers are created on the same thread and
+  // then run on different threads. Their blocks are written in the
+  // background, so that no block file exists yet when the others pick their
+  // names.
+  std::vector<std::shared_ptr<LocalPersistentShuffleWriter>> writers;
+  for (auto driver = 0; driver < numDrivers; ++driver) {
+    writers.push_back(std::make_shared<LocalPersistentShuffleWriter>(
+        rootPath,
+        "query_id",
+        0,
+        numPartitions,
+        1 << 10,
+        pool(),
+        false,
+        executor_.get(),
+        1'000));
+  }
+  std::vector<std::thread> threads;
+  for (auto driver = 0; driver < numDrivers; ++driver) {
+    threads.emplace_back([&, driver]() {
+      for (auto i = 0; i < numRows; ++i) {
+        writers[driver]->collect(
+            i % numPartitions, fmt::format("driver-{}-row-{}", driver, i));
+      }
+      writers[driver]->noMoreData(true);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (auto partition = 0; partition < numPartitions; ++partition) {
+    std::vector<std::string> expectedRows;
+    for (auto driver = 0; driver < numDrivers; ++driver) {
+      for (auto i = partition; i < numRows; i += numPartitions) {
+        expectedRows.push_back(fmt::format("driver-{}-row-{}", driver, i));
+      }
+    }
+    int numBlocks = 0;
+    auto rows = readLocalShuffleRows(rootPath, partition, &numBlocks);
+    ASSERT_GT(numBlocks, numDrivers);
+    std::sort(rows.begin(), rows.end());
+    std::sort(expectedRows.begin(), expectedRows.end());
+    ASSERT_EQ(rows, expectedRows);
+  }
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleClustered) {
+  uint32_t numPartitions = 1;
+  uint32_t numMapDrivers = 2;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  auto data = vectorMaker_.rowVector({
+      makeFlatVector<int32_t>({1, 2, 3, 4, 5, 6}),
+      makeFlatVector<StringView>({"a", "bb", "ccc", "dddd", "eeeee", "f"}),
+  });
+
+  velox::exec::ExchangeSource::factories().clear();
+  registerExchangeSource(
+      std::string(LocalPersistentShuffleFactory::kShuffleName));
+  runShuffleTest(
+      std::string(LocalPersistentShuffleFactory::kShuffleName),
+      fmt::format(kLocalShuffleWriteInfoFormat, rootPath, numPartitions),
+      fmt::format(kLocalShuffleReadInfoFormat, rootPath, numPartitions),
+      numPartitions,
+      numMapDrivers,
+      {data},
+      false,
+      true);
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShufflePrestoFormat) {
+  uint32_t numPartitions = 3;
+  uint32_t numMapDrivers = 2;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  auto data = makeRowVector({
+      makeFlatVector<int32_t>(1'000, [](auto row) { return row; }),
+      makeFlatVector<int64_t>(
+          1'000, [](auto row) { return row * 3; }, nullEvery(7)),
+      makeFlatVector<StringView>(
+          1'000,
+          [](auto row) {
+            return StringView::makeInline(std::string(row % 13, 'x'));
+          }),
+  });
+
+  velox::exec::ExchangeSource::factories().clear();
+  registerExchangeSource(
+      std::string(LocalPersistentShuffleFactory::kShuffleName));
+  for (bool clustered : {false, true}) {
+    SCOPED_TRACE(fmt::format("clustered: {}", clustered));
+    runShuffleTest(
+        std::string(LocalPersistentShuffleFactory::kShuffleName),
+        fmt::format(kLocalShuffleWriteInfoFormat, rootPath, numPartitions),
+        fmt::format(kLocalShuffleReadInfoFormat, rootPath, numPartitions),
+        numPartitions,
+        numMapDrivers,
+        {data},
+        false,
+        clustered,
+        ShuffleSerializationFormat::kPresto);
+    cleanupDirectory(rootPath);
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleConsolidatedFiles) {
+  const uint32_t numPartitions = 4;
+  const uint32_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  // Use small blocks to flush each partition several times.
+  auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+      rootPath, "query_id", 0, numPartitions, 1 << 10, pool(), true);
+  std::vector<std::vector<std::string>> expectedRows(numPartitions);
+  for (auto i = 0; i < numRows; ++i) {
+    const auto partition = i % numPartitions;
+    expectedRows[partition].push_back(fmt::format("row-{}", i));
+    writer->collect(partition, expectedRows[partition].back());
+  }
+  writer->noMoreData(true);
+
+  // One data file and one manifest regardless of the number of blocks.
+  auto fileSystem = velox::filesystems::getFileSystem(rootPath, nullptr);
+  ASSERT_EQ(fileSystem->list(rootPath).size(), 2);
+
+  for (auto partition = 0; partition < numPartitions; ++partition) {
+    int numBlocks = 0;
+    ASSERT_EQ(
+        readLocalShuffleRows(rootPath, partition, &numBlocks),
+        expectedRows[partition]);
+    ASSERT_GT(numBlocks, 1);
+  }
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleStats) {
+  const uint32_t numPartitions = 4;
+  const std::string row(96, 'x');
+  const uint64_t rowBytes = sizeof(uint32_t) + row.size();
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  for (bool consolidatedFiles : {false, true}) {
+    SCOPED_TRACE(fmt::format("consolidatedFiles: {}", consolidatedFiles));
+    // Partition 1 gets 5 times as many rows as each of the others.
+    auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+        rootPath,
+        "query_id",
+        0,
+        numPartitions,
+        1 << 10,
+        pool(),
+        consolidatedFiles);
+    std::vector<uint64_t> expectedRows = {10, 50, 10, 10};
+    for (auto partition = 0; partition < numPartitions; ++partition) {
+      for (auto i = 0; i < expectedRows[partition]; ++i) {
+        writer->collect(partition, row);
+      }
+    }
+    writer->noMoreData(true);
+
+    for (auto partition = 0; partition < numPartitions; ++partition) {
+      ASSERT_EQ(writer->partitionRows()[partition], expectedRows[partition]);
+      ASSERT_EQ(
+          writer->partitionBytes()[partition],
+          expectedRows[partition] * rowBytes);
+    }
+    auto stats = writer->stats();
+    ASSERT_EQ(stats.at("local.write.rows"), 80);
+    ASSERT_EQ(stats.at("local.write.rawBytes"), 80 * rowBytes);
+    ASSERT_EQ(stats.at("local.write"), 80 * rowBytes);
+    ASSERT_EQ(stats.at("local.write.maxPartition"), 1);
+    ASSERT_EQ(stats.at("local.write.maxPartitionRows"), 50);
+    ASSERT_EQ(stats.at("local.write.maxPartitionBytes"), 50 * rowBytes);
+    ASSERT_EQ(stats.at("local.write.partitionSkewPct"), 250);
+    auto fileSystem = velox::filesystems::getFileSystem(rootPath, nullptr);
+    const auto numFiles = fileSystem->list(rootPath).size();
+    ASSERT_EQ(stats.at("local.write.files"), numFiles);
+    if (consolidatedFiles) {
+      ASSERT_EQ(numFiles, 2);
+    } else {
+      // One file per block and the manifest.
+      ASSERT_EQ(stats.at("local.write.blocks") + 1, numFiles);
+    }
+    ASSERT_GT(stats.at("local.write.blocks"), numPartitions);
+    ASSERT_GT(stats.at("local.write.wallNanos"), 0);
+
+    LocalPersistentShuffleReader reader(
+        rootPath, "query_id", {"shuffle_0_0_1"}, 1, pool());
+    while (reader.hasNext()) {
+      reader.next(true);
+    }
+    auto readStats = reader.stats();
+    ASSERT_EQ(readStats.at("local.read"), 50 * rowBytes);
+    ASSERT_EQ(readStats.at("local.read.rawBytes"), 50 * rowBytes);
+    ASSERT_GT(readStats.at("local.read.blocks"), 1);
+    ASSERT_GT(readStats.at("local.read.files"), 0);
+    ASSERT_GT(readStats.at("local.read.wallNanos"), 0);
+    cleanupDirectory(rootPath);
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleManifest) {
+  const uint32_t numPartitions = 4;
+  const uint32_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto fileSystem = velox::filesystems::getFileSystem(rootPath, nullptr);
+
+  for (bool consolidatedFiles : {false, true}) {
+    SCOPED_TRACE(fmt::format("consolidatedFiles: {}", consolidatedFiles));
+    auto committedWriter = std::make_shared<LocalPersistentShuffleWriter>(
+        rootPath,
+        "query_id",
+        0,
+        numPartitions,
+        1 << 10,
+        pool(),
+        consolidatedFiles);
+    auto uncommittedWriter = std::make_shared<LocalPersistentShuffleWriter>(
+        rootPath,
+        "query_id",
+        0,
+        numPartitions,
+        1 << 10,
+        pool(),
+        consolidatedFiles);
+    std::vector<std::vector<std::string>> expectedRows(numPartitions);
+    for (auto i = 0; i < numRows; ++i) {
+      const auto partition = i % numPartitions;
+      expectedRows[partition].push_back(fmt::format("row-{}", i));
+      committedWriter->collect(partition, expectedRows[partition].back());
+      // Stores some blocks without committing them.
+      uncommittedWriter->collect(partition, "uncommitted");
+    }
+    committedWriter->noMoreData(true);
+
+    // Only the committed writer has a manifest and no temporary file is left.
+    int numManifests = 0;
+    for (const auto& file : fileSystem->list(rootPath)) {
+      ASSERT_EQ(file.find(".tmp"), std::string::npos);
+      if (file.find(".manifest") != std::string::npos) {
+        ++numManifests;
+      }
+    }
+    ASSERT_EQ(numManifests, 1);
+
+    for (auto partition = 0; partition < numPartitions; ++partition) {
+      ASSERT_EQ(
+          readLocalShuffleRows(rootPath, partition), expectedRows[partition]);
+    }
+    uncommittedWriter.reset();
+    cleanupDirectory(rootPath);
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleFailure) {
+  const uint32_t numPartitions = 4;
+  const uint32_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto fileSystem = velox::filesystems::getFileSystem(rootPath, nullptr);
+  auto writerPool = memory::addDefaultLeafMemoryPool("shuffleWriter");
+
+  // The files of a writer that committed in the same root directory are kept.
+  auto committedWriter = std::make_shared<LocalPersistentShuffleWriter>(
+      rootPath, "query_id", 0, numPartitions, 1 << 10, pool());
+  for (auto i = 0; i < numRows; ++i) {
+    committedWriter->collect(i % numPartitions, fmt::format("row-{}", i));
+  }
+  committedWriter->noMoreData(true);
+  auto committedFiles = fileSystem->list(rootPath);
+  std::sort(committedFiles.begin(), committedFiles.end());
+  ASSERT_FALSE(committedFiles.empty());
+
+  for (bool consolidatedFiles : {false, true}) {
+    for (bool backgroundWrites : {false, true}) {
+      SCOPED_TRACE(fmt::format(
+          "consolidatedFiles: {}, backgroundWrites: {}",
+          consolidatedFiles,
+          backgroundWrites));
+      auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+          rootPath,
+          "query_id",
+          0,
+          numPartitions,
+          1 << 10,
+          writerPool.get(),
+          consolidatedFiles,
+          backgroundWrites ? executor_.get() : nullptr,
+          4);
+      for (auto i = 0; i < numRows; ++i) {
+        writer->collect(i % numPartitions, fmt::format("row-{}", i));
+      }
+      // Some blocks are stored and the others are still in progress.
+      ASSERT_GT(writer->stats().at("local.write.blocks"), 0);
+      writer->noMoreData(false);
+
+      // The in-progress blocks are dropped instead of being stored after the
+      // cleanup.
+      auto files = fileSystem->list(rootPath);
+      std::sort(files.begin(), files.end());
+      ASSERT_EQ(files, committedFiles);
+      ASSERT_EQ(writerPool->currentBytes(), 0);
+    }
+  }
+  for (auto partition = 0; partition < numPartitions; ++partition) {
+    ASSERT_EQ(
+        readLocalShuffleRows(rootPath, partition).size(),
+        numRows / numPartitions);
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleBackgroundWrites) {
+  const uint32_t numPartitions = 4;
+  const uint32_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  for (bool consolidatedFiles : {false, true}) {
+    SCOPED_TRACE(fmt::format("consolidatedFiles: {}", consolidatedFiles));
+    auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+        rootPath,
+        "query_id",
+        0,
+        numPartitions,
+        1 << 10,
+        pool(),
+        consolidatedFiles,
+        executor_.get(),
+        1);
+    std::vector<std::vector<std::string>> expectedRows(numPartitions);
+    for (auto i = 0; i < numRows; ++i) {
+      ContinueFuture future = ContinueFuture::makeEmpty();
+      if (writer->isBlocked(&future) != exec::BlockingReason::kNotBlocked) {
+        future.wait();
+      }
+      const auto partition = i % numPartitions;
+      expectedRows[partition].push_back(fmt::format("row-{}", i));
+      writer->collect(partition, expectedRows[partition].back());
+    }
+    writer->noMoreData(true);
+
+    ContinueFuture future = ContinueFuture::makeEmpty();
+    ASSERT_EQ(writer->isBlocked(&future), exec::BlockingReason::kNotBlocked);
+    for (auto partition = 0; partition < numPartitions; ++partition) {
+      // Per-block files are not read back in the order they were written.
+      auto rows = readLocalShuffleRows(rootPath, partition);
+      std::sort(rows.begin(), rows.end());
+      std::sort(expectedRows[partition].begin(), expectedRows[partition].end());
+      ASSERT_EQ(rows, expectedRows[partition]);
+    }
+    cleanupDirectory(rootPath);
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleReadAhead) {
+  const uint32_t numPartitions = 2;
+  const uint32_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+      rootPath, "query_id", 0, numPartitions, 1 << 10, pool(), true);
+  std::vector<std::vector<std::string>> expectedRows(numPartitions);
+  for (auto i = 0; i < numRows; ++i) {
+    const auto partition = i % numPartitions;
+    expectedRows[partition].push_back(fmt::format("row-{}", i));
+    writer->collect(partition, expectedRows[partition].back());
+  }
+  writer->noMoreData(true);
+
+  for (auto numReadAheadBlocks : {1, 3, 100}) {
+    SCOPED_TRACE(fmt::format("numReadAheadBlocks: {}", numReadAheadBlocks));
+    for (auto partition = 0; partition < numPartitions; ++partition) {
+      int numBlocks = 0;
+      ASSERT_EQ(
+          readLocalShuffleRows(
+              rootPath,
+              partition,
+              &numBlocks,
+              executor_.get(),
+              numReadAheadBlocks),
+          expectedRows[partition]);
+      ASSERT_GT(numBlocks, 1);
+    }
+  }
+
+  // A failed read restarts from the first block.
+  LocalPersistentShuffleReader reader(
+      rootPath, "query_id", {"shuffle_0_0_0"}, 0, pool(), executor_.get(), 2);
+  ASSERT_TRUE(reader.hasNext());
+  auto first = reader.next(true);
+  ASSERT_TRUE(reader.hasNext());
+  reader.next(true);
+  auto retried = reader.next(false);
+  ASSERT_EQ(
+      std::string_view(first->as<char>(), first->size()),
+      std::string_view(retried->as<char>(), retried->size()));
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleMmapReads) {
+  const uint32_t numPartitions = 2;
+  const uint32_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  for (bool consolidatedFiles : {false, true}) {
+    for (auto compression :
+         {LocalShuffleCompression::kNone, LocalShuffleCompression::kLz4}) {
+      SCOPED_TRACE(fmt::format(
+          "consolidatedFiles: {}, compression: {}",
+          consolidatedFiles,
+          static_cast<int>(compression)));
+      auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+          rootPath,
+          "query_id",
+          0,
+          numPartitions,
+          1 << 10,
+          pool(),
+          consolidatedFiles,
+          nullptr,
+          0,
+          compression);
+      std::vector<std::vector<std::string>> expectedRows(numPartitions);
+      for (auto i = 0; i < numRows; ++i) {
+        const auto partition = i % numPartitions;
+        expectedRows[partition].push_back(fmt::format("row-{}", i));
+        writer->collect(partition, expectedRows[partition].back());
+      }
+      writer->noMoreData(true);
+
+      for (auto partition = 0; partition < numPartitions; ++partition) {
+        ASSERT_EQ(
+            readLocalShuffleRows(
+                rootPath, partition, nullptr, executor_.get(), 2, true),
+            expectedRows[partition]);
+      }
+
+      // Mapped blocks stay valid until the last reference to them is gone,
+      // even after the reader is destroyed.
+      std::vector<BufferPtr> blocks;
+      {
+        LocalPersistentShuffleReader reader(
+            rootPath,
+            "query_id",
+            {"shuffle_0_0_0"},
+            0,
+            pool(),
+            nullptr,
+            0,
+            true);
+        while (reader.hasNext()) {
+          blocks.push_back(reader.next(true));
+        }
+        auto stats = reader.stats();
+        ASSERT_GT(stats.at("local.read.mappedBytes"), 0);
+        if (compression == LocalShuffleCompression::kNone) {
+          ASSERT_GT(stats.at("local.read.mappedBytesInUse"), 0);
+        } else {
+          // Decompressed blocks don't keep their mappings.
+          ASSERT_EQ(stats.at("local.read.mappedBytesInUse"), 0);
+        }
+      }
+      std::string data;
+      for (const auto& block : blocks) {
+        data.append(block->as<char>(), block->size());
+      }
+      size_t offset = 0;
+      for (const auto& row : expectedRows[0]) {
+        offset += sizeof(uint32_t);
+        ASSERT_EQ(data.substr(offset, row.size()), row);
+        offset += row.size();
+      }
+      ASSERT_EQ(offset, data.size());
+      cleanupDirectory(rootPath);
+    }
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleDirectIo) {
+  const uint32_t numPartitions = 3;
+  const uint32_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto fileSystem = velox::filesystems::getFileSystem(rootPath, nullptr);
+
+  for (bool consolidatedFiles : {false, true}) {
+    for (auto compression :
+         {LocalShuffleCompression::kNone, LocalShuffleCompression::kLz4}) {
+      SCOPED_TRACE(fmt::format(
+          "consolidatedFiles: {}, compression: {}",
+          consolidatedFiles,
+          static_cast<int>(compression)));
+      auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+          rootPath,
+          "query_id",
+          0,
+          numPartitions,
+          1 << 10,
+          pool(),
+          consolidatedFiles,
+          executor_.get(),
+          2,
+          compression,
+          0,
+          true);
+      std::vector<std::vector<std::string>> expectedRows(numPartitions);
+      for (auto i = 0; i < numRows; ++i) {
+        const auto partition = i % numPartitions;
+        expectedRows[partition].push_back(fmt::format("row-{}", i));
+        writer->collect(partition, expectedRows[partition].back());
+      }
+      writer->noMoreData(true);
+
+      // Blocks are padded to the direct I/O alignment.
+      for (const auto& file : fileSystem->list(rootPath)) {
+        if (file.find(".manifest") == std::string::npos) {
+          ASSERT_EQ(fileSystem->openFileForRead(file)->size() % 4096, 0);
+        }
+      }
+
+      // The padding is invisible to readers with and without direct I/O.
+      for (bool directIo : {false, true}) {
+        for (auto partition = 0; partition < numPartitions; ++partition) {
+          ASSERT_EQ(
+              readLocalShuffleRows(
+                  rootPath,
+                  partition,
+                  nullptr,
+                  executor_.get(),
+                  2,
+                  false,
+                  directIo),
+              expectedRows[partition]);
+        }
+      }
+
+      if (consolidatedFiles) {
+        // The blocks of a partition share one data file, which direct I/O
+        // reads open once.
+        LocalPersistentShuffleReader reader(
+            rootPath,
+            "query_id",
+            {"shuffle_0_0_0"},
+            0,
+            pool(),
+            nullptr,
+            0,
+            false,
+            true);
+        while (reader.hasNext()) {
+          reader.next(true);
+        }
+        const auto stats = reader.stats();
+        ASSERT_GT(stats.at("local.read.blocks"), 1);
+        // The manifest and the data file.
+        ASSERT_EQ(stats.at("local.read.files"), 2);
+      }
+      cleanupDirectory(rootPath);
+    }
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleCollectBatch) {
+  const uint32_t numPartitions = 5;
+  const vector_size_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  std::vector<std::string> rows;
+  for (auto i = 0; i < numRows; ++i) {
+    rows.push_back(fmt::format("row-{}-{}", i, std::string(i % 37, 'x')));
+  }
+  // Partition 0 gets most of the rows so that it needs several blocks per
+  // batch.
+  auto partitions = makeFlatVector<int32_t>(
+      numRows, [](auto row) { return row % 3 == 0 ? row % numPartitions : 0; });
+  auto serializedRows = makeFlatVector<StringView>(
+      numRows, [&](auto row) { return StringView(rows[row]); });
+  auto dictionaryRows = BaseVector::wrapInDictionary(
+      nullptr,
+      makeIndices(numRows, [](auto row) { return row; }),
+      numRows,
+      serializedRows);
+
+  std::vector<std::vector<std::string>> expectedRows(numPartitions);
+  for (auto batch = 0; batch < 2; ++batch) {
+    for (auto i = 0; i < numRows; ++i) {
+      expectedRows[partitions->valueAt(i)].push_back(rows[i]);
+    }
+  }
+
+  // The rows are not laid out as collectClusteredBatch() expects, which then
+  // falls back to collectBatch().
+  for (bool clustered : {false, true}) {
+    for (const auto& batchRows : {serializedRows, dictionaryRows}) {
+      SCOPED_TRACE(fmt::format(
+          "clustered: {}, dictionary: {}",
+          clustered,
+          batchRows == dictionaryRows));
+      auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+          rootPath, "query_id", 0, numPartitions, 1 << 10, pool(), true);
+      for (auto batch = 0; batch < 2; ++batch) {
+        if (clustered) {
+          writer->collectClusteredBatch(partitions, batchRows);
+        } else {
+          writer->collectBatch(partitions, batchRows);
+        }
+      }
+      writer->noMoreData(true);
+
+      for (auto partition = 0; partition < numPartitions; ++partition) {
+        ASSERT_EQ(
+            readLocalShuffleRows(rootPath, partition),
+            expectedRows[partition]);
+      }
+      cleanupDirectory(rootPath);
+    }
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleCompression) {
+  const uint32_t numPartitions = 3;
+  const uint32_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto fileSystem = velox::filesystems::getFileSystem(rootPath, nullptr);
+
+  for (bool consolidatedFiles : {false, true}) {
+    std::optional<uint64_t> uncompressedBytes;
+    for (auto compression :
+         {LocalShuffleCompression::kNone,
+          LocalShuffleCompression::kLz4,
+          LocalShuffleCompression::kZstd}) {
+      SCOPED_TRACE(fmt::format(
+          "consolidatedFiles: {}, compression: {}",
+          consolidatedFiles,
+          static_cast<int>(compression)));
+      auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+          rootPath,
+          "query_id",
+          0,
+          numPartitions,
+          4 << 10,
+          pool(),
+          consolidatedFiles,
+          nullptr,
+          0,
+          compression);
+      std::vector<std::vector<std::string>> expectedRows(numPartitions);
+      for (auto i = 0; i < numRows; ++i) {
+        const auto partition = i % numPartitions;
+        expectedRows[partition].push_back(
+            fmt::format("{:0>64}", fmt::format("row-{}", i % 10)));
+        writer->collect(partition, expectedRows[partition].back());
+      }
+      writer->noMoreData(true);
+
+      uint64_t fileBytes = 0;
+      for (const auto& file : fileSystem->list(rootPath)) {
+        fileBytes += fileSystem->openFileForRead(file)->size();
+      }
+      if (compression == LocalShuffleCompression::kNone) {
+        uncompressedBytes = fileBytes;
+      } else {
+        ASSERT_LT(fileBytes * 3, uncompressedBytes.value());
+      }
+
+      for (auto partition = 0; partition < numPartitions; ++partition) {
+        auto rows = readLocalShuffleRows(rootPath, partition);
+        std::sort(rows.begin(), rows.end());
+        std::sort(
+            expectedRows[partition].begin(), expectedRows[partition].end());
+        ASSERT_EQ(rows, expectedRows[partition]);
+      }
+      cleanupDirectory(rootPath);
+    }
+  }
+
+  VELOX_ASSERT_THROW(
+      localShuffleCompressionFromString("snappy"),
+      "Unsupported local shuffle compression codec: snappy");
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleMemoryBudget) {
+  const uint32_t numPartitions = 100;
+  const uint32_t numRows = 20'000;
+  const uint64_t maxBufferedBytes = 256 << 10;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto writerPool = memory::addDefaultLeafMemoryPool("shuffleWriter");
+
+  auto writer = std::make_shared<LocalPersistentShuffleWriter>(
+      rootPath,
+      "query_id",
+      0,
+      numPartitions,
+      1 << 20,
+      writerPool.get(),
+      true,
+      nullptr,
+      0,
+      LocalShuffleCompression::kNone,
+      maxBufferedBytes);
+  ASSERT_TRUE(writer->canReclaim());
+  std::vector<std::vector<std::string>> expectedRows(numPartitions);
+  for (auto i = 0; i < numRows; ++i) {
+    // Skew the rows towards the first partitions.
+    const auto partition = i % 3 == 0 ? i % numPartitions : i % 5;
+    expectedRows[partition].push_back(fmt::format("{:0>100}", i));
+    writer->collect(partition, expectedRows[partition].back());
+    // Growing a buffer briefly holds both its old and new copies.
+    ASSERT_LE(writerPool->currentBytes(), 2 * maxBufferedBytes);
+  }
+
+  ASSERT_GT(writerPool->currentBytes(), 0);
+  const auto bytesBeforeReclaim = writerPool->currentBytes();
+  // Reclaiming releases at least one partition buffer.
+  ASSERT_GT(writer->reclaim(1), 0);
+  ASSERT_LT(writerPool->currentBytes(), bytesBeforeReclaim);
+  writer->reclaim(std::numeric_limits<uint64_t>::max());
+  ASSERT_EQ(writerPool->currentBytes(), 0);
+  writer->noMoreData(true);
+
+  for (auto partition = 0; partition < numPartitions; ++partition) {
+    ASSERT_EQ(
+        readLocalShuffleRows(rootPath, partition), expectedRows[partition]);
+  }
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, memoryShuffle) {
+  uint32_t numPartitions = 1;
+  uint32_t numMapDrivers = 2;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  auto data = vectorMaker_.rowVector({
+      makeFlatVector<int32_t>({1, 2, 3, 4, 5, 6}),
+      makeFlatVector<int64_t>({10, 20, 30, 40, 50, 60}),
+  });
+
+  velox::exec::ExchangeSource::factories().clear();
+  registerExchangeSource(std::string(MemoryShuffleFactory::kShuffleName));
+  runShuffleTest(
+      std::string(MemoryShuffleFactory::kShuffleName),
+      fmt::format(kLocalShuffleWriteInfoFormat, rootPath, numPartitions),
+      fmt::format(kLocalShuffleReadInfoFormat, rootPath, numPartitions),
+      numPartitions,
+      numMapDrivers,
+      {data});
+  // The blocks stay in memory until the query ends and nothing was spilled.
+  ASSERT_GT(MemoryShuffleStore::instance().bytes(), 0);
+  ASSERT_TRUE(std::filesystem::is_empty(rootPath));
+  ShuffleInterfaceFactory::removeQueryFromAll("query_id");
+  ASSERT_EQ(MemoryShuffleStore::instance().bytes(), 0);
+}
+
+TEST_F(UnsafeRowShuffleTest, memoryShuffleSpill) {
+  const uint32_t numPartitions = 4;
+  const uint32_t numRows = 10'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto writerPool = memory::addDefaultLeafMemoryPool("shuffleWriter");
+
+  auto writer = std::make_shared<MemoryShuffleWriter>(
+      rootPath, "query_id", 0, numPartitions, 1 << 20, writerPool.get());
+  ASSERT_TRUE(writer->canReclaim());
+  std::vector<std::vector<std::string>> expectedRows(numPartitions);
+  for (auto i = 0; i < numRows; ++i) {
+    const auto partition = i % numPartitions;
+    expectedRows[partition].push_back(fmt::format("{:0>100}", i));
+    writer->collect(partition, expectedRows[partition].back());
+    // Spills the first half of the rows.
+    if (i == numRows / 2) {
+      ASSERT_GT(writer->reclaim(1), 0);
+    }
+  }
+  writer->noMoreData(true);
+  auto writerStats = writer->stats();
+  ASSERT_EQ(writerStats.at("memory.write.rows"), numRows);
+  ASSERT_EQ(writerStats.at("memory.write.spills"), 1);
+  ASSERT_GT(writerStats.at("memory.write.spilledBytes"), 0);
+  ASSERT_GT(writerStats.at("memory.write"), 0);
+  ASSERT_EQ(
+      MemoryShuffleStore::instance().bytes(),
+      writerStats.at("memory.write"));
+
+  for (auto partition = 0; partition < numPartitions; ++partition) {
+    MemoryShuffleReader reader(
+        rootPath,
+        "query_id",
+        {fmt::format("shuffle_0_0_{}", partition)},
+        partition,
+        pool());
+    auto rows = readShuffleRows(reader);
+    // The rows spilled come after the ones still in memory.
+    std::sort(rows.begin(), rows.end());
+    ASSERT_EQ(rows, expectedRows[partition]);
+    const auto readerStats = reader.stats();
+    ASSERT_GT(readerStats.at("memory.read.blocks"), 0);
+    ASSERT_GT(readerStats.at("local.read"), 0);
+  }
+  MemoryShuffleStore::instance().removeQuery("query_id");
+  ASSERT_EQ(MemoryShuffleStore::instance().bytes(), 0);
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, memoryShuffleStoreSpill) {
+  const uint32_t numPartitions = 2;
+  const uint32_t numRows = 1'000;
+  auto& store = MemoryShuffleStore::instance();
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto writerPool = memory::addDefaultLeafMemoryPool("shuffleWriter");
+
+  auto writer = std::make_shared<MemoryShuffleWriter>(
+      rootPath, "query_id", 0, numPartitions, 1 << 20, writerPool.get());
+  ASSERT_NE(writer->blockPool()->reclaimer(), nullptr);
+  std::vector<std::vector<std::string>> expectedRows(numPartitions);
+  for (auto i = 0; i < numRows; ++i) {
+    const auto partition = i % numPartitions;
+    expectedRows[partition].push_back(fmt::format("{:0>100}", i));
+    writer->collect(partition, expectedRows[partition].back());
+  }
+  writer->noMoreData(true);
+
+  auto readRows = [&](MemoryShuffleReader& reader) {
+    auto rows = readShuffleRows(reader);
+    std::sort(rows.begin(), rows.end());
+    return rows;
+  };
+  auto makeReader = [&](int32_t partition) {
+    return std::make_unique<MemoryShuffleReader>(
+        rootPath,
+        "query_id",
+        std::vector<std::string>{fmt::format("shuffle_0_0_{}", partition)},
+        partition,
+        pool());
+  };
+
+  // Reads are repeatable, also after a failure.
+  for (auto partition = 0; partition < numPartitions; ++partition) {
+    ASSERT_EQ(readRows(*makeReader(partition)), expectedRows[partition]);
+    auto reader = makeReader(partition);
+    ASSERT_EQ(readRows(*reader), expectedRows[partition]);
+    reader->next(false);
+    ASSERT_EQ(reader->stats().at("memory.read.blocks"), 2);
+  }
+
+  // The blocks of a shuffle being read are not spilled.
+  const auto bytes = store.bytes();
+  ASSERT_GT(bytes, 0);
+  {
+    auto reader = makeReader(0);
+    ASSERT_TRUE(reader->hasNext());
+    ASSERT_EQ(store.spill(writer->blockPool()), 0);
+    ASSERT_EQ(store.bytes(), bytes);
+  }
+
+  ASSERT_GT(store.spill(writer->blockPool()), 0);
+  ASSERT_EQ(store.bytes(), 0);
+  for (auto partition = 0; partition < numPartitions; ++partition) {
+    auto reader = makeReader(partition);
+    ASSERT_EQ(readRows(*reader), expectedRows[partition]);
+    const auto readerStats = reader->stats();
+    ASSERT_EQ(readerStats.at("memory.read.blocks"), 0);
+    ASSERT_GT(readerStats.at("local.read"), 0);
+  }
+  store.removeQuery("query_id");
+
+  // Reading a shuffle that is not committed fails instead of returning no
+  // rows.
+  VELOX_ASSERT_THROW(makeReader(0)->hasNext(), "is not committed");
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, memoryShuffleArbitrationReclaim) {
+  const uint32_t numPartitions = 2;
+  const uint32_t numRows = 1'000;
+  auto& store = MemoryShuffleStore::instance();
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  // A query pool with a reclaimer, through which the memory arbitrator
+  // reclaims from the pools of the query.
+  auto queryPool = memory::defaultMemoryManager().addRootPool(
+      "memoryShuffleArbitrationReclaim",
+      memory::kMaxMemory,
+      memory::MemoryReclaimer::create());
+  auto writerPool = queryPool->addLeafChild("shuffleWriter");
+
+  auto writer = std::make_shared<MemoryShuffleWriter>(
+      rootPath, "query_id", 0, numPartitions, 1 << 20, writerPool.get());
+  std::vector<std::vector<std::string>> expectedRows(numPartitions);
+  for (auto i = 0; i < numRows; ++i) {
+    const auto partition = i % numPartitions;
+    expectedRows[partition].push_back(fmt::format("{:0>100}", i));
+    writer->collect(partition, expectedRows[partition].back());
+  }
+  writer->noMoreData(true);
+  ASSERT_EQ(writer->blockPool()->parent(), queryPool.get());
+  ASSERT_GT(writer->blockPool()->currentBytes(), 0);
+  ASSERT_GT(store.bytes(), 0);
+
+  // Reclaiming from the query pool spills the committed blocks through the
+  // reclaimer of the block pool and frees their memory.
+  ASSERT_GT(queryPool->reclaim(store.bytes()), 0);
+  ASSERT_EQ(writer->blockPool()->currentBytes(), 0);
+  ASSERT_EQ(store.bytes(), 0);
+
+  for (auto partition = 0; partition < numPartitions; ++partition) {
+    MemoryShuffleReader reader(
+        rootPath,
+        "query_id",
+        {fmt::format("shuffle_0_0_{}", partition)},
+        partition,
+        pool());
+    auto rows = readShuffleRows(reader);
+    std::sort(rows.begin(), rows.end());
+    ASSERT_EQ(rows, expectedRows[partition]);
+    const auto readerStats = reader.stats();
+    ASSERT_EQ(readerStats.at("memory.read.blocks"), 0);
+    ASSERT_GT(readerStats.at("local.read"), 0);
+  }
+  store.removeQuery("query_id");
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, sortKeyEncoding) {
+  auto sortedRows = [&](const RowVectorPtr& data,
+                        const std::vector<core::SortOrder>& sortingOrders) {
+    const auto& rowType = asRowType(data->type());
+    std::vector<core::FieldAccessTypedExprPtr> sortingKeys;
+    for (auto i = 0; i < sortingOrders.size(); ++i) {
+      sortingKeys.push_back(std::make_shared<core::FieldAccessTypedExpr>(
+          rowType->childAt(i), rowType->nameOf(i)));
+    }
+    ShuffleSortKeyEncoder encoder(*rowType, sortingKeys, sortingOrders);
+    encoder.prepare(data);
+    std::vector<std::string> keys;
+    for (auto i = 0; i < data->size(); ++i) {
+      keys.emplace_back(encoder.keySizes()[i], '\0');
+      encoder.encode(i, keys.back().data());
+    }
+    std::vector<int32_t> rows(data->size());
+    std::iota(rows.begin(), rows.end(), 0);
+    std::stable_sort(rows.begin(), rows.end(), [&](auto left, auto right) {
+      return keys[left] < keys[right];
+    });
+    return rows;
+  };
+
+  // Strings with embedded zero bytes sort after their prefixes.
+  auto data = makeRowVector({
+      makeNullableFlatVector<int64_t>(
+          {5, std::nullopt, -3, 5, 0, std::nullopt, -3}),
+      makeFlatVector<StringView>(
+          {"b",
+           "x",
+           StringView("a\0b", 3),
+           StringView("b\0", 2),
+           "z",
+           "",
+           "a"}),
+  });
+  ASSERT_EQ(
+      sortedRows(
+          data, {core::SortOrder(true, true), core::SortOrder(false, true)}),
+      std::vector<int32_t>({1, 5, 2, 6, 4, 3, 0}));
+
+  // NaN is larger than all the other values and -0.0 equal to 0.0.
+  data = makeRowVector({makeNullableFlatVector<double>(
+      {1.5,
+       std::nan(""),
+       -std::numeric_limits<double>::infinity(),
+       -0.0,
+       std::nullopt,
+       -2.5,
+       0.0})});
+  ASSERT_EQ(
+      sortedRows(data, {core::SortOrder(true, false)}),
+      std::vector<int32_t>({2, 5, 3, 6, 0, 1, 4}));
+  ASSERT_EQ(
+      sortedRows(data, {core::SortOrder(false, true)}),
+      std::vector<int32_t>({4, 1, 0, 3, 6, 5, 2}));
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleSorted) {
+  const uint32_t numPartitions = 1;
+  const uint32_t numMapDrivers = 2;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  std::vector<RowVectorPtr> data;
+  for (auto i = 0; i < 3; ++i) {
+    data.push_back(makeRowVector({
+        makeFlatVector<int32_t>(100, [](auto row) { return row; }),
+        makeFlatVector<int64_t>(
+            100, [i](auto row) { return (row * 37 + i * 11) % 101; }),
+    }));
+  }
+
+  exec::Operator::registerOperator(
+      std::make_unique<PartitionAndSerializeTranslator>());
+  exec::Operator::registerOperator(std::make_unique<ShuffleWriteTranslator>());
+  exec::Operator::registerOperator(std::make_unique<ShuffleReadTranslator>());
+  const std::string shuffleName(LocalPersistentShuffleFactory::kShuffleName);
+  const auto writeInfo =
+      fmt::format(kLocalShuffleWriteInfoFormat, rootPath, numPartitions);
+  auto writerPlan =
+      exec::test::PlanBuilder()
+          .values(data, true)
+          .addNode(addPartitionAndSerializeNode(
+              numPartitions,
+              {},
+              true,
+              ShuffleSerializationFormat::kUnsafeRow,
+              {"c1"},
+              {core::SortOrder(false, false)}))
+          .localPartition({})
+          .addNode(addShuffleWriteNode(shuffleName, writeInfo, true, true))
+          .planNode();
+  auto writerTask = makeTask(makeTaskId("leaf", 0), writerPlan, 0);
+  exec::Task::start(writerTask, numMapDrivers);
+  ASSERT_TRUE(exec::test::waitForTaskCompletion(writerTask.get(), 3'000'000));
+
+  registerExchangeSource(shuffleName);
+  exec::test::CursorParameters params;
+  params.planNode = exec::test::PlanBuilder()
+                        .addNode(addShuffleReadNode(asRowType(data[0]->type())))
+                        .planNode();
+  params.destination = 0;
+  const auto readInfo =
+      fmt::format(kLocalShuffleReadInfoFormat, rootPath, numPartitions);
+  bool noMoreSplits = false;
+  auto [taskCursor, results] = readCursor(params, [&](auto* task) {
+    if (noMoreSplits) {
+      return;
+    }
+    addRemoteSplits(task, {makeTaskId("read", 0, readInfo)});
+    noMoreSplits = true;
+  });
+
+  // Each driver of the values node produces all the input. The rows come out
+  // sorted by c1 in descending order.
+  std::vector<int64_t> values;
+  for (const auto& result : results) {
+    auto c1 = result->childAt(1)->asFlatVector<int64_t>();
+    for (auto i = 0; i < result->size(); ++i) {
+      values.push_back(c1->valueAt(i));
+    }
+  }
+  ASSERT_EQ(values.size(), 300 * numMapDrivers);
+  ASSERT_TRUE(std::is_sorted(values.begin(), values.end(), std::greater<>()));
+  auto readStats = taskCursor->task()
+                       ->taskStats()
+                       .pipelineStats[0]
+                       .operatorStats[0]
+                       .runtimeStats;
+  ASSERT_EQ(readStats.at("sorted.read.rows").sum, 300 * numMapDrivers);
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, sortedShuffleReaderMerge) {
+  const uint32_t numRows = 1'000;
+
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto writerPool = memory::addDefaultLeafMemoryPool("shuffleWriter");
+
+  // Small blocks make the writer sort many blocks for the reader to merge.
+  LocalPersistentShuffleWriter writer(
+      rootPath, "query_id", 0, 1, 1 << 10, writerPool.get());
+  ASSERT_TRUE(writer.enableSortedBlocks());
+  std::vector<uint64_t> values;
+  for (auto i = 0; i < numRows; ++i) {
+    const uint64_t value = (i * 7919) % numRows;
+    values.push_back(value);
+    // Rows in sorted shuffle format with the value as key and as row data.
+    const auto key = folly::Endian::big(value);
+    const auto keySize = folly::Endian::big<uint32_t>(sizeof(key));
+    std::string row(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+    row.append(reinterpret_cast<const char*>(&key), sizeof(key));
+    row.append(std::to_string(value));
+    writer.collect(0, row);
+  }
+  writer.noMoreData(true);
+  std::sort(values.begin(), values.end());
+
+  SortedShuffleReader reader(
+      std::make_shared<LocalPersistentShuffleReader>(
+          rootPath,
+          "query_id",
+          std::vector<std::string>{"shuffle_0_0_0"},
+          0,
+          pool()),
+      pool(),
+      4 << 10,
+      64);
+  std::vector<uint64_t> readValues;
+  while (reader.hasNext()) {
+    auto buffer = reader.next(true);
+    ASSERT_LE(buffer->size(), 4 << 10);
+    const auto* data = buffer->as<char>();
+    size_t offset = 0;
+    while (offset < buffer->size()) {
+      const auto rowSize = folly::Endian::big(
+          *reinterpret_cast<const uint32_t*>(data + offset));
+      offset += sizeof(uint32_t);
+      readValues.push_back(
+          folly::to<uint64_t>(folly::StringPiece(data + offset, rowSize)));
+      offset += rowSize;
+    }
+  }
+  ASSERT_EQ(readValues, values);
+  const auto stats = reader.stats();
+  ASSERT_GT(stats.at("local.read.blocks"), 1);
+  ASSERT_GT(stats.at("sorted.read.blocks"), 1);
+  ASSERT_EQ(stats.at("sorted.read.rows"), numRows);
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleBlockCursors) {
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto writerPool = memory::addDefaultLeafMemoryPool("shuffleWriter");
+  const uint64_t chunkBytes = 100;
+
+  for (const auto compression :
+       {LocalShuffleCompression::kNone, LocalShuffleCompression::kLz4}) {
+    SCOPED_TRACE(static_cast<int>(compression));
+    LocalPersistentShuffleWriter writer(
+        rootPath,
+        "query_id",
+        0,
+        1,
+        1 << 10,
+        writerPool.get(),
+        false,
+        nullptr,
+        0,
+        compression);
+    // Rows of varying sizes, some larger than a chunk.
+    for (auto i = 0; i < 100; ++i) {
+      writer.collect(0, std::string(i % 10 == 0 ? 3 * chunkBytes : i, 'x'));
+    }
+    writer.noMoreData(true);
+
+    LocalPersistentShuffleReader reader(
+        rootPath,
+        "query_id",
+        std::vector<std::string>{"shuffle_0_0_0"},
+        0,
+        pool());
+    std::vector<std::string> blocks;
+    while (reader.hasNext()) {
+      auto block = reader.next(true);
+      blocks.emplace_back(block->as<char>(), block->size());
+    }
+    ASSERT_GT(blocks.size(), 1);
+
+    auto cursors = reader.blockCursors(chunkBytes);
+    ASSERT_EQ(cursors.size(), blocks.size());
+    for (auto i = 0; i < cursors.size(); ++i) {
+      // A restarted cursor reads its block again.
+      for (auto pass = 0; pass < 2; ++pass) {
+        cursors[i]->reset();
+        std::string block;
+        while (auto chunk = cursors[i]->next()) {
+          const auto* data = chunk->as<char>();
+          const auto firstRowSize = folly::Endian::big(
+              *reinterpret_cast<const uint32_t*>(data));
+          // Chunks of uncompressed blocks hold whole rows, up to 'chunkBytes'
+          // or one larger row.
+          if (compression == LocalShuffleCompression::kNone) {
+            ASSERT_TRUE(
+                chunk->size() <= chunkBytes ||
+                chunk->size() == sizeof(uint32_t) + firstRowSize);
+          }
+          block.append(data, chunk->size());
+        }
+        ASSERT_EQ(block, blocks[i]);
+      }
+    }
+    cleanupDirectory(rootPath);
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, sortedShuffleReaderFollowsWriters) {
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+  auto writerPool = memory::addDefaultLeafMemoryPool("shuffleWriter");
+  auto makeReader = [&]() {
+    return std::make_unique<SortedShuffleReader>(
+        std::make_shared<LocalPersistentShuffleReader>(
+            rootPath,
+            "query_id",
+            std::vector<std::string>{"shuffle_0_0_0"},
+            0,
+            pool()),
+        pool());
+  };
+
+  // The blocks of a writer that did not sort them are returned as they are,
+  // even if the rows look like they carry sort keys.
+  LocalPersistentShuffleWriter writer(
+      rootPath, "query_id", 0, 1, 1 << 20, writerPool.get());
+  std::vector<std::string> rows;
+  for (auto i = 0; i < 10; ++i) {
+    rows.push_back(fmt::format("{:0>20}", 10 - i));
+    writer.collect(0, rows.back());
+  }
+  writer.noMoreData(true);
+  auto reader = makeReader();
+  ASSERT_EQ(readShuffleRows(*reader), rows);
+  ASSERT_EQ(reader->stats().at("sorted.read.rows"), 0);
+
+  // Writers of a shuffle that disagree on sorting fail the readers instead
+  // of corrupting the rows.
+  LocalPersistentShuffleWriter sortedWriter(
+      rootPath, "query_id", 0, 1, 1 << 20, writerPool.get());
+  ASSERT_TRUE(sortedWriter.enableSortedBlocks());
+  sortedWriter.noMoreData(true);
+  VELOX_ASSERT_THROW(makeReader()->hasNext(), "disagree on sorted blocks");
+  cleanupDirectory(rootPath);
+}
+
+TEST_F(UnsafeRowShuffleTest, persistentShuffleBlockRanges) {
+  velox::filesystems::registerLocalFileSystem();
+  auto rootDirectory = velox::exec::test::TempDirectoryPath::create();
+  auto rootPath = rootDirectory->path;
+
+  // Two writers of one skewed partition with small blocks.
+  for (auto writerId = 0; writerId < 2; ++writerId) {
+    LocalPersistentShuffleWriter writer(
+        rootPath, "query_id", 0, 1, 1 << 10, pool());
+    for (auto i = 0; i < 1'000; ++i) {
+      writer.collect(0, fmt::format("{}-{:0>20}", writerId, i));
+    }
+    writer.noMoreData(true);
+  }
+
+  auto makeReader = [&](uint32_t blockBegin, uint32_t blockEnd) {
+    return LocalPersistentShuffleReader(
+        rootPath,
+        "query_id",
+        {"shuffle_0_0_0"},
+        0,
+        pool(),
+        nullptr,
+        0,
+        false,
+        false,
+        blockBegin,
+        blockEnd);
+  };
+  auto reader = makeReader(0, std::numeric_limits<uint32_t>::max());
+  const auto blockSizes = reader.blockSizes();
+  ASSERT_GT(blockSizes.size(), 4);
+  const auto totalBytes =
+      std::accumulate(blockSizes.begin(), blockSizes.end(), uint64_t{0});
+  const auto allRows = readShuffleRows(reader);
+  ASSERT_EQ(allRows.size(), 2'000);
+
+  // The ranges cover all the blocks and their readers together read all the
+  // rows in the same order.
+  const auto ranges = splitLocalShuffleBlocks(blockSizes, totalBytes / 4);
+  ASSERT_GE(ranges.size(), 4);
+  ASSERT_EQ(ranges.front().first, 0);
+  ASSERT_EQ(ranges.back().second, blockSizes.size());
+  std::vector<std::string> rangeRows;
+  for (auto i = 0; i < ranges.size(); ++i) {
+    if (i > 0) {
+      ASSERT_EQ(ranges[i].first, ranges[i - 1].second);
+    }
+    auto rangeReader = makeReader(ranges[i].first, ranges[i].second);
+    for (auto& row : readShuffleRows(rangeReader)) {
+      rangeRows.push_back(std::move(row));
+    }
+    ASSERT_EQ(
+        rangeReader.stats().at("local.read.blocks"),
+        ranges[i].second - ranges[i].first);
+  }
+  ASSERT_EQ(rangeRows, allRows);
+
+  // Ranges past the last block read nothing.
+  auto emptyReader = makeReader(blockSizes.size(), blockSizes.size() + 2);
+  ASSERT_FALSE(emptyReader.hasNext());
+
+  ASSERT_EQ(
+      splitLocalShuffleBlocks({10, 50, 5, 5, 30, 10}, 40),
+      (std::vector<std::pair<uint32_t, uint32_t>>{
+          {0, 1}, {1, 2}, {2, 5}, {5, 6}}));
+  cleanupDirectory(rootPath);
+}
+
 TEST_F(UnsafeRowShuffleTest, persistentShuffleFuzz) {
   // For unit testing, these numbers are set to relatively small values.
   // For stress testing, the following parameters and the fuzzer vector,
@@ -737,6 +2314,102 @@ TEST_F(UnsafeRowShuffleTest, partitionAndSerializeOperator) {
   testPartitionAndSerialize(plan, data);
 }
 
+TEST_F(UnsafeRowShuffleTest, partitionAndSerializeClustered) {
+  const uint32_t numPartitions = 7;
+  auto data = makeRowVector({
+      makeFlatVector<int32_t>(1'000, [](auto row) { return row; }),
+      makeFlatVector<StringView>(
+          1'000,
+          [](auto row) {
+            return StringView::makeInline(std::string(row % 11, 'x'));
+          }),
+  });
+
+  exec::test::CursorParameters params;
+  params.planNode =
+      exec::test::PlanBuilder()
+          .values({data})
+          .addNode(addPartitionAndSerializeNode(numPartitions, {}, true))
+          .planNode();
+  auto [taskCursor, serializedResults] =
+      readCursor(params, [](auto /*task*/) {});
+  ASSERT_EQ(serializedResults.size(), 1);
+
+  // The serialized rows must not be copied to keep their layout.
+  const auto& results = serializedResults[0];
+  auto partitions = results->childAt(0)->asFlatVector<int32_t>();
+  auto serializedRows = results->childAt(1)->asFlatVector<StringView>();
+  for (auto i = 0; i < results->size(); ++i) {
+    if (i > 0) {
+      ASSERT_LE(partitions->valueAt(i - 1), partitions->valueAt(i));
+    }
+    // Each serialized row is preceded by its size.
+    const auto row = serializedRows->valueAt(i);
+    uint32_t rowSize;
+    ::memcpy(&rowSize, row.data() - sizeof(uint32_t), sizeof(uint32_t));
+    ASSERT_EQ(folly::Endian::big(rowSize), row.size());
+    if (i > 0 && partitions->valueAt(i - 1) == partitions->valueAt(i)) {
+      const auto previous = serializedRows->valueAt(i - 1);
+      ASSERT_EQ(
+          previous.data() + previous.size() + sizeof(uint32_t), row.data());
+    }
+  }
+
+  velox::exec::test::assertEqualResults(
+      {data}, {deserialize(results, asRowType(data->type()))});
+}
+
+TEST_F(UnsafeRowShuffleTest, partitionAndSerializePrestoFormat) {
+  const uint32_t numPartitions = 5;
+  auto data = makeRowVector({
+      makeFlatVector<int32_t>(1'000, [](auto row) { return row; }),
+      makeFlatVector<int64_t>(1'000, [](auto row) { return row * 10; }),
+      makeFlatVector<StringView>(
+          1'000,
+          [](auto row) {
+            return StringView::makeInline(std::string(row % 11, 'x'));
+          }),
+  });
+  auto rowType = asRowType(data->type());
+
+  for (bool clustered : {false, true}) {
+    SCOPED_TRACE(fmt::format("clustered: {}", clustered));
+    exec::test::CursorParameters params;
+    params.planNode = exec::test::PlanBuilder()
+                          .values({data})
+                          .addNode(addPartitionAndSerializeNode(
+                              numPartitions,
+                              {},
+                              clustered,
+                              ShuffleSerializationFormat::kPresto))
+                          .planNode();
+    auto [taskCursor, serializedResults] =
+        readCursor(params, [](auto /*task*/) {});
+    ASSERT_EQ(serializedResults.size(), 1);
+
+    // There is one page per partition, in partition order.
+    const auto& results = serializedResults[0];
+    ASSERT_EQ(results->size(), numPartitions);
+    auto partitions = results->childAt(0)->asFlatVector<int32_t>();
+    for (auto i = 0; i < numPartitions; ++i) {
+      ASSERT_EQ(partitions->valueAt(i), i);
+    }
+    if (clustered) {
+      // Each page is preceded by its size.
+      auto pages = results->childAt(1)->asFlatVector<StringView>();
+      for (auto i = 0; i < numPartitions; ++i) {
+        const auto page = pages->valueAt(i);
+        uint32_t pageSize;
+        ::memcpy(&pageSize, page.data() - sizeof(uint32_t), sizeof(uint32_t));
+        ASSERT_EQ(folly::Endian::big(pageSize), page.size());
+      }
+    }
+
+    velox::exec::test::assertEqualResults(
+        {data}, deserializePages(results, rowType));
+  }
+}
+
 TEST_F(UnsafeRowShuffleTest, partitionAndSerializeWithDifferentColumnOrder) {
   auto data = makeRowVector({
       makeFlatVector<int32_t>(1'000, [](auto row) { return row; }),
@@ -787,6 +2460,23 @@ TEST_F(UnsafeRowShuffleTest, shuffleWriterToString) {
       "-- ShuffleWrite[] -> partition:INTEGER, data:VARBINARY\n");
 }
 
+TEST_F(UnsafeRowShuffleTest, partitionAndShuffleWriteToString) {
+  auto data = makeRowVector({
+      makeFlatVector<int32_t>(1'000, [](auto row) { return row; }),
+      makeFlatVector<int64_t>(1'000, [](auto row) { return row * 10; }),
+  });
+
+  auto plan = exec::test::PlanBuilder()
+                  .values({data}, true)
+                  .addNode(addPartitionAndShuffleWriteNode(
+                      4,
+                      std::string(TestShuffleFactory::kShuffleName),
+                      fmt::format(kTestShuffleInfoFormat, 10, 10)))
+                  .planNode();
+
+  ASSERT_EQ(plan->toString(false, false), "-- PartitionAndShuffleWrite\n");
+}
+
 TEST_F(UnsafeRowShuffleTest, partitionAndSerializeToString) {
   auto data = makeRowVector({
       makeFlatVector<int32_t>(1'000, [](auto row) { return row; }),
@@ -802,6 +2492,228 @@ TEST_F(UnsafeRowShuffleTest, partitionAndSerializeToString) {
   // TODO Add a check for plan->toString(true, false)
 }
 
+TEST_F(UnsafeRowShuffleTest, columnarSerializer) {
+  auto rowType = ROW(
+      {"c0", "c1", "c2", "c3", "c4", "c5", "c6", "c7", "c8", "c9"},
+      {BOOLEAN(),
+       TINYINT(),
+       SMALLINT(),
+       INTEGER(),
+       BIGINT(),
+       REAL(),
+       DOUBLE(),
+       TIMESTAMP(),
+       VARCHAR(),
+       VARBINARY()});
+  ASSERT_TRUE(UnsafeRowColumnarSerializer::isSupported(*rowType));
+  ASSERT_FALSE(UnsafeRowColumnarSerializer::isSupported(
+      *ROW({BIGINT(), ARRAY(DOUBLE())})));
+
+  VectorFuzzer::Options opts;
+  opts.vectorSize = 500;
+  opts.nullRatio = 0.1;
+  opts.stringVariableLength = true;
+  opts.stringLength = 30;
+  opts.timestampPrecision =
+      VectorFuzzer::Options::TimestampPrecision::kMicroSeconds;
+  VectorFuzzer fuzzer(opts, pool());
+  UnsafeRowColumnarSerializer serializer(*rowType);
+  std::vector<uint32_t> rowSizes;
+  for (auto i = 0; i < 20; ++i) {
+    // Fuzzed columns are flat, constant or dictionary encoded.
+    auto input = fuzzer.fuzzRow(rowType);
+    const auto totalSize = serializer.prepare(input, rowSizes);
+
+    std::vector<char> buffer(totalSize, 0);
+    std::vector<char*> rowBuffers(input->size());
+    size_t offset = 0;
+    for (auto row = 0; row < input->size(); ++row) {
+      rowBuffers[row] = buffer.data() + offset;
+      offset += rowSizes[row];
+    }
+    ASSERT_EQ(offset, totalSize);
+    serializer.serialize(rowBuffers.data());
+
+    // The rows are the same as those of UnsafeRowFast.
+    row::UnsafeRowFast unsafeRow(input);
+    for (auto row = 0; row < input->size(); ++row) {
+      ASSERT_EQ(rowSizes[row], unsafeRow.rowSize(row));
+      std::vector<char> expected(rowSizes[row], 0);
+      unsafeRow.serialize(row, expected.data());
+      ASSERT_EQ(
+          std::string_view(rowBuffers[row], rowSizes[row]),
+          std::string_view(expected.data(), expected.size()))
+          << "at row " << row;
+    }
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, columnarDeserializer) {
+  // The BIGINT and VARCHAR rows are deserialized a column at a time, the rows
+  // with an ARRAY by UnsafeRowDeserializer.
+  for (const auto& rowType :
+       {ROW({"c0", "c1", "c2", "c3", "c4"},
+            {BIGINT(), VARCHAR(), BOOLEAN(), TIMESTAMP(), REAL()}),
+        ROW({"c0", "c1"}, {BIGINT(), ARRAY(VARCHAR())})}) {
+    VectorFuzzer::Options opts;
+    opts.vectorSize = 1'000;
+    opts.nullRatio = 0.1;
+    opts.stringVariableLength = true;
+    opts.stringLength = 40;
+    opts.containerHasNulls = false;
+    opts.timestampPrecision =
+        VectorFuzzer::Options::TimestampPrecision::kMicroSeconds;
+    VectorFuzzer fuzzer(opts, pool());
+    auto input = fuzzer.fuzzRow(rowType);
+
+    // A shuffle block of length-prefixed rows.
+    row::UnsafeRowFast unsafeRow(input);
+    std::string block;
+    for (auto row = 0; row < input->size(); ++row) {
+      const uint32_t rowSize = unsafeRow.rowSize(row);
+      const auto prefix = folly::Endian::big(rowSize);
+      block.append(reinterpret_cast<const char*>(&prefix), sizeof(prefix));
+      const auto offset = block.size();
+      block.resize(offset + rowSize, 0);
+      unsafeRow.serialize(row, block.data() + offset);
+    }
+
+    // Small batches split the block.
+    UnsafeRowShuffleVectorSerde serde(block.size() / 7);
+    ByteStream source;
+    ByteRange range{
+        reinterpret_cast<uint8_t*>(block.data()), (int32_t)block.size(), 0};
+    source.resetInput({range});
+    vector_size_t offset = 0;
+    int32_t numBatches = 0;
+    while (!source.atEnd()) {
+      RowVectorPtr result;
+      serde.deserialize(&source, pool(), rowType, &result);
+      ASSERT_GT(result->size(), 0);
+      velox::test::assertEqualVectors(
+          input->slice(offset, result->size()), result);
+      offset += result->size();
+      ++numBatches;
+    }
+    ASSERT_EQ(offset, input->size());
+    ASSERT_GE(numBatches, 7);
+    ASSERT_LE(numBatches, 8);
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, fastMod) {
+  std::mt19937_64 rng(1);
+  for (const uint64_t d : {1, 2, 3, 7, 10, 1'000, 65'537, 2'147'483'647}) {
+    const auto M64 = fastModMultiplier64(d);
+    const auto M32 = fastModMultiplier32(d);
+    for (const uint64_t a :
+         {uint64_t{0}, d - 1, d, ~uint64_t{0}, uint64_t{1} << 63}) {
+      ASSERT_EQ(fastMod64(a, M64, d), a % d);
+    }
+    for (auto i = 0; i < 10'000; ++i) {
+      const auto a = rng();
+      ASSERT_EQ(fastMod64(a, M64, d), a % d);
+      ASSERT_EQ(fastMod32(a, M32, d), static_cast<uint32_t>(a) % d);
+    }
+    ASSERT_EQ(fastMod32(~uint32_t{0}, M32, d), ~uint32_t{0} % d);
+  }
+}
+
+TEST_F(UnsafeRowShuffleTest, vectorizedPartitionFunctions) {
+  // The first keys are supported by the kernels, the VARCHAR and DOUBLE keys
+  // go to the Velox partition functions.
+  auto rowType = ROW(
+      {"c0", "c1", "c2", "c3", "c4", "c5", "c6"},
+      {BIGINT(), INTEGER(), SMALLINT(), TINYINT(), BOOLEAN(), VARCHAR(),
+       DOUBLE()});
+  const std::vector<std::vector<column_index_t>> keyChannelSets = {
+      {0}, {1}, {2, 3}, {0, 1, 2, 3}, {3, 4}, {1, 5}, {6}};
+
+  VectorFuzzer::Options opts;
+  opts.vectorSize = 1'000;
+  opts.nullRatio = 0.1;
+  VectorFuzzer fuzzer(opts, pool());
+  std::vector<uint32_t> expected;
+  std::vector<uint32_t> actual;
+  for (auto iter = 0; iter < 10; ++iter) {
+    auto input = fuzzer.fuzzRow(rowType);
+    for (const auto& keyChannels : keyChannelSets) {
+      for (const auto numPartitions : {1, 2, 7, 16, 1'000}) {
+        SCOPED_TRACE(fmt::format(
+            "keys: {}, partitions: {}",
+            folly::join(", ", keyChannels),
+            numPartitions));
+        const bool hasBoolean = std::count(
+            keyChannels.begin(), keyChannels.end(), column_index_t{4});
+        if (!hasBoolean) {
+          exec::HashPartitionFunctionSpec(rowType, keyChannels)
+              .create(numPartitions)
+              ->partition(*input, expected);
+          VectorizedHashPartitionFunctionSpec(rowType, keyChannels)
+              .create(numPartitions)
+              ->partition(*input, actual);
+          ASSERT_EQ(actual, expected);
+        }
+
+        std::vector<int> bucketToPartition(numPartitions * 2);
+        for (auto i = 0; i < bucketToPartition.size(); ++i) {
+          bucketToPartition[i] = (i * 7) % numPartitions;
+        }
+        for (const auto& buckets : {std::vector<int>{}, bucketToPartition}) {
+          connector::hive::HivePartitionFunction(
+              numPartitions * 2, buckets, keyChannels)
+              .partition(*input, expected);
+          VectorizedHivePartitionFunctionSpec(
+              numPartitions * 2, buckets, keyChannels)
+              .create(numPartitions)
+              ->partition(*input, actual);
+          ASSERT_EQ(actual, expected);
+        }
+      }
+    }
+  }
+
+  // PartitionAndSerialize writes the partitions to its output directly.
+  auto data = makeRowVector({
+      makeFlatVector<int64_t>(1'000, [](auto row) { return row * 3; }),
+      makeFlatVector<int32_t>(
+          1'000, [](auto row) { return row; }, nullEvery(7)),
+  });
+  auto dataType = asRowType(data->type());
+  std::vector<core::TypedExprPtr> keys{
+      std::make_shared<core::FieldAccessTypedExpr>(BIGINT(), "c0"),
+      std::make_shared<core::FieldAccessTypedExpr>(INTEGER(), "c1")};
+  exec::test::CursorParameters params;
+  params.planNode =
+      exec::test::PlanBuilder()
+          .values({data})
+          .addNode([&](auto nodeId, auto source) {
+            return std::make_shared<PartitionAndSerializeNode>(
+                nodeId,
+                keys,
+                5,
+                dataType,
+                std::move(source),
+                std::make_shared<VectorizedHashPartitionFunctionSpec>(
+                    dataType, std::vector<column_index_t>{0, 1}));
+          })
+          .planNode();
+  auto [taskCursor, serializedResults] =
+      readCursor(params, [](auto /*task*/) {});
+  ASSERT_EQ(serializedResults.size(), 1);
+  const auto& results = serializedResults[0];
+  exec::HashPartitionFunctionSpec(dataType, {0, 1})
+      .create(5)
+      ->partition(*data, expected);
+  auto partitions = results->childAt(0)->asFlatVector<int32_t>();
+  ASSERT_EQ(partitions->size(), expected.size());
+  for (auto i = 0; i < expected.size(); ++i) {
+    ASSERT_EQ(partitions->valueAt(i), expected[i]);
+  }
+  velox::exec::test::assertEqualResults(
+      {data}, {deserialize(results, dataType)});
+}
+
 class DummyShuffleInterfaceFactory : public ShuffleInterfaceFactory {
  public:
   std::shared_ptr<ShuffleReader> createReader(
@@ -92,6 +92,10 @@ class Producer {
       const std::vector<std::string>& pathMatch) {
     protocol::TaskId taskId = pathMatch[1];
     long sequence = std::stol(pathMatch[3]);
+    {
+      std::lock_guard<std::mutex> l(mutex_);
+      resultTokens_.push_back(sequence);
+    }
 
     return new http::CallbackRequestHandler(
         [this, taskId, sequence](
@@ -130,6 +134,7 @@ class Producer {
           auto lastAckPromise = folly::Promise<bool>::makeEmpty();
           {
             std::lock_guard<std::mutex> l(mutex_);
+            ++numAcks_;
             if (sequence > startSequence_) {
               for (int i = startSequence_; i < sequence && !queue_.empty();
                    ++i) {
@@ -220,6 +225,18 @@ class Producer {
     return promise_;
   }
 
+  /// Returns the number of acknowledge requests received.
+  int numAcks() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return numAcks_;
+  }
+
+  /// Returns the tokens of the result requests received.
+  std::vector<int64_t> resultTokens() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return resultTokens_;
+  }
+
  private:
   std::tuple<std::string, bool> getData(int64_t sequence) {
     std::string data;
@@ -277,6 +294,8 @@ class Producer {
   folly::Promise<bool> deleteResultsPromise_ =
       folly::Promise<bool>::makeEmpty();
   bool receivedDeleteResults_ = false;
+  int numAcks_ = 0;
+  std::vector<int64_t> resultTokens_;
 };
 
 std::string toString(exec::SerializedPage* page) {
@@ -735,6 +754,124 @@ TEST_P(PrestoExchangeSourceTestSuite, memoryAllocationAndUsageCheck) {
   ASSERT_EQ(192512, peakMemoryBytes);
 }
 
+TEST_P(PrestoExchangeSourceTestSuite, acknowledgedByResultRequests) {
+  std::vector<std::string> pages = {"page1 - xx", "page2 - xxxxx"};
+  const bool useHttps = GetParam();
+  auto producer = std::make_unique<Producer>();
+  auto producerServer = createHttpServer(useHttps);
+  producer->registerEndpoints(producerServer.get());
+
+  test::HttpServerWrapper serverWrapper(std::move(producerServer));
+  auto producerAddress = serverWrapper.start().get();
+
+  auto queue = std::make_shared<exec::ExchangeQueue>(1 << 20);
+  queue->addSourceLocked();
+  queue->noMoreSources();
+
+  // The pages are acknowledged by the next result requests, which are sent
+  // before the separate acknowledge requests are due.
+  {
+    for (const auto& page : pages) {
+      producer->enqueue(page);
+    }
+    producer->noMoreData();
+    auto exchangeSource = std::make_shared<PrestoExchangeSource>(
+        makeProducerUri(producerAddress, useHttps),
+        3,
+        queue,
+        pool_.get(),
+        getClientCa(useHttps),
+        getCiphers(useHttps),
+        60'000);
+    requestNextPage(queue, exchangeSource);
+    for (int i = 0; i < pages.size(); i++) {
+      auto page = waitForNextPage(queue);
+      ASSERT_EQ(toString(page.get()), pages[i]) << "at " << i;
+      requestNextPage(queue, exchangeSource);
+    }
+    waitForEndMarker(queue);
+    producer->waitForDeleteResults();
+    ASSERT_EQ(producer->numAcks(), 0);
+    ASSERT_EQ(producer->resultTokens(), std::vector<int64_t>({0, 1, 2}));
+  }
+
+  // Without a next result request, the pages are acknowledged with a
+  // separate request once the delay expires.
+  {
+    auto otherProducer = std::make_unique<Producer>();
+    auto otherServer = createHttpServer(useHttps);
+    otherProducer->registerEndpoints(otherServer.get());
+    test::HttpServerWrapper otherWrapper(std::move(otherServer));
+    auto otherAddress = otherWrapper.start().get();
+
+    auto otherQueue = std::make_shared<exec::ExchangeQueue>(1 << 20);
+    otherQueue->addSourceLocked();
+    otherQueue->noMoreSources();
+    otherProducer->enqueue(pages[0]);
+    auto exchangeSource = std::make_shared<PrestoExchangeSource>(
+        makeProducerUri(otherAddress, useHttps),
+        3,
+        otherQueue,
+        pool_.get(),
+        getClientCa(useHttps),
+        getCiphers(useHttps),
+        10);
+    requestNextPage(otherQueue, exchangeSource);
+    auto page = waitForNextPage(otherQueue);
+    ASSERT_EQ(toString(page.get()), pages[0]);
+    for (int i = 0; i < 1'000 && otherProducer->numAcks() == 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(otherProducer->numAcks(), 1);
+    ASSERT_EQ(otherProducer->resultTokens(), std::vector<int64_t>({0}));
+
+    page.reset();
+    exchangeSource->close();
+    otherProducer->waitForDeleteResults();
+    otherWrapper.stop();
+  }
+  serverWrapper.stop();
+  EXPECT_EQ(pool_->currentBytes(), 0);
+}
+
+TEST_P(PrestoExchangeSourceTestSuite, eventBaseLoad) {
+  const bool useHttps = GetParam();
+  auto producer = std::make_unique<Producer>();
+  auto producerServer = createHttpServer(useHttps);
+  producer->registerEndpoints(producerServer.get());
+
+  test::HttpServerWrapper serverWrapper(std::move(producerServer));
+  auto producerAddress = serverWrapper.start().get();
+
+  auto queue = std::make_shared<exec::ExchangeQueue>(1 << 20);
+  std::vector<std::shared_ptr<PrestoExchangeSource>> exchangeSources;
+  for (int i = 0; i < 3; ++i) {
+    exchangeSources.push_back(std::make_shared<PrestoExchangeSource>(
+        makeProducerUri(producerAddress, useHttps),
+        i,
+        queue,
+        pool_.get(),
+        getClientCa(useHttps),
+        getCiphers(useHttps)));
+  }
+
+  // The sources of one remote host share an event base of the network IO
+  // executor.
+  auto* eventBase = exchangeSources[0]->testingEventBase();
+  ASSERT_NE(eventBase, nullptr);
+  for (const auto& exchangeSource : exchangeSources) {
+    ASSERT_EQ(exchangeSource->testingEventBase(), eventBase);
+  }
+  int64_t maxClients;
+  int64_t avgClients;
+  PrestoExchangeSource::getEventBaseLoad(maxClients, avgClients);
+  ASSERT_GE(maxClients, 3);
+  ASSERT_LE(avgClients, maxClients);
+
+  exchangeSources.clear();
+  serverWrapper.stop();
+}
+
 INSTANTIATE_TEST_CASE_P(
     PrestoExchangeSourceTest,
     PrestoExchangeSourceTestSuite,
@@ -24,8 +24,11 @@
 #include "velox/vector/FlatVector.h"
 #include "presto_cpp/main/types/TypeSignatureTypeConverter.h"
 #include "presto_cpp/main/operators/PartitionAndSerialize.h"
+#include "presto_cpp/main/operators/PartitionAndShuffleWrite.h"
 #include "presto_cpp/main/operators/ShuffleWrite.h"
 #include "presto_cpp/main/operators/ShuffleRead.h"
+#include "presto_cpp/main/operators/SortedShuffle.h"
+#include "presto_cpp/main/operators/VectorizedPartitionFunction.h"
 #include "presto_cpp/presto_protocol/presto_protocol.h"
 #include <velox/core/Expressions.h>
 // clang-format on
@@ -2067,7 +2070,8 @@ core::PlanFragment VeloxQueryPlanConverterBase::toVeloxQueryPlan(
                     numPartitions,
                     false, // broadcast
                     partitioningScheme.replicateNullsAndAny,
-                    std::make_shared<HashPartitionFunctionSpec>(
+                    std::make_shared<
+                        operators::VectorizedHashPartitionFunctionSpec>(
                         inputType, keyChannels, constValues),
                     outputType,
                     sourceNode);
@@ -2114,7 +2118,7 @@ core::PlanFragment VeloxQueryPlanConverterBase::toVeloxQueryPlan(
         numPartitions,
         false, // broadcast
         partitioningScheme.replicateNullsAndAny,
-        std::make_shared<HivePartitionFunctionSpec>(
+        std::make_shared<operators::VectorizedHivePartitionFunctionSpec>(
             hivePartitioningHandle->bucketCount,
             bucketToPartition,
             keyChannels,
@@ -2186,10 +2190,20 @@ velox::core::PlanFragment VeloxBatchQueryPlanConverter::toVeloxQueryPlan(
   // If the serializedShuffleWriteInfo is not nullptr, it means this fragment
   // ends with a shuffle stage. We convert the PartitionedOutputNode to a
   // chain of following nodes:
-  // (1) A PartitionAndSerializeNode.
+  // (1) A PartitionAndSerializeNode. If 'clustered_' is set, or the rows are
+  //     sorted, it clusters its output by partition so that the shuffle
+  //     writer can append the rows of a partition at once.
   // (2) A "gather" LocalPartitionNode that gathers results from multiple
   //     threads to one thread.
   // (3) A ShuffleWriteNode.
+  // If 'fusePartitionAndShuffleWrite_' is set and rows are serialized in
+  // UnsafeRow format, these are fused into a single
+  // PartitionAndShuffleWriteNode instead.
+  // If sorted shuffles are enabled and supported, a partial sort feeding the
+  // PartitionedOutputNode, which precedes a merging exchange, moves to the
+  // PartitionAndSerializeNode and the shuffle writers, which sort the rows of
+  // each partition block. Readers then merge the sorted blocks. Otherwise the
+  // partial sort stays in the plan.
   // To be noted, whether the last node of the plan is PartitionedOutputNode
   // can't guarantee the query has shuffle stage, for example a plan with
   // TableWriteNode can also have PartitionedOutputNode to distribute the
@@ -2199,14 +2213,49 @@ velox::core::PlanFragment VeloxBatchQueryPlanConverter::toVeloxQueryPlan(
     return planFragment;
   }
 
+  const bool unsafeRow =
+      serializationFormat_ == operators::ShuffleSerializationFormat::kUnsafeRow;
+  auto source = partitionedOutputNode->sources()[0];
+  std::vector<core::FieldAccessTypedExprPtr> sortingKeys;
+  std::vector<core::SortOrder> sortingOrders;
+  if (auto orderBy = std::dynamic_pointer_cast<const core::OrderByNode>(source);
+      orderBy != nullptr && orderBy->isPartial() &&
+      supportsSortedShuffle(orderBy->sortingKeys())) {
+    sortingKeys = orderBy->sortingKeys();
+    sortingOrders = orderBy->sortingOrders();
+    source = orderBy->sources()[0];
+  }
+  const bool sorted = !sortingKeys.empty();
+  // Sorted shuffles require clustered output.
+  const bool clustered = clustered_ || sorted;
+
+  if (fusePartitionAndShuffleWrite_ && unsafeRow && !sorted) {
+    planFragment.planNode =
+        std::make_shared<operators::PartitionAndShuffleWriteNode>(
+            "root",
+            partitionedOutputNode->keys(),
+            partitionedOutputNode->numPartitions(),
+            partitionedOutputNode->outputType(),
+            partitionedOutputNode->partitionFunctionSpecPtr(),
+            shuffleName_,
+            std::move(*serializedShuffleWriteInfo_),
+            partitionedOutputNode->sources()[0],
+            sharedShuffleWriter_);
+    return planFragment;
+  }
+
   auto partitionAndSerializeNode =
       std::make_shared<operators::PartitionAndSerializeNode>(
           "shuffle-partition-serialize",
           partitionedOutputNode->keys(),
           partitionedOutputNode->numPartitions(),
           partitionedOutputNode->outputType(),
-          partitionedOutputNode->sources()[0],
-          partitionedOutputNode->partitionFunctionSpecPtr());
+          source,
+          partitionedOutputNode->partitionFunctionSpecPtr(),
+          clustered,
+          serializationFormat_,
+          std::move(sortingKeys),
+          std::move(sortingOrders));
 
   planFragment.planNode = std::make_shared<operators::ShuffleWriteNode>(
       "root",
@@ -2214,7 +2263,9 @@ velox::core::PlanFragment VeloxBatchQueryPlanConverter::toVeloxQueryPlan(
       std::move(*serializedShuffleWriteInfo_),
       core::LocalPartitionNode::gather(
           "shuffle-gather",
-          std::vector<core::PlanNodePtr>{partitionAndSerializeNode}));
+          std::vector<core::PlanNodePtr>{partitionAndSerializeNode}),
+      clustered,
+      sorted);
   return planFragment;
 }
 
@@ -2223,7 +2274,29 @@ velox::core::PlanNodePtr VeloxBatchQueryPlanConverter::toVeloxQueryPlan(
     const std::shared_ptr<protocol::TableWriteInfo>& /* tableWriteInfo */,
     const protocol::TaskId& taskId) {
   auto rowType = toRowType(node->outputVariables);
-  return std::make_shared<operators::ShuffleReadNode>(node->id, rowType);
+  // The shuffle readers merge the blocks of a sorted shuffle on their own, as
+  // the writers record whether they sorted them, see SortedShuffleReader.
+  return std::make_shared<operators::ShuffleReadNode>(
+      node->id, rowType, serializationFormat_);
+}
+
+bool VeloxBatchQueryPlanConverter::supportsSortedShuffle(
+    const std::vector<core::FieldAccessTypedExprPtr>& sortingKeys) const {
+  if (!sortedShuffle_ || sortingKeys.empty() ||
+      serializationFormat_ !=
+          operators::ShuffleSerializationFormat::kUnsafeRow) {
+    return false;
+  }
+  if (!operators::ShuffleInterfaceFactory::factory(shuffleName_)
+           ->supportsSortedBlocks()) {
+    return false;
+  }
+  for (const auto& key : sortingKeys) {
+    if (!operators::ShuffleSortKeyEncoder::isSupported(*key->type())) {
+      return false;
+    }
+  }
+  return true;
 }
 
 void registerPrestoPlanNodeSerDe() {
@@ -2232,9 +2305,18 @@ void registerPrestoPlanNodeSerDe() {
   registry.Register(
       "PartitionAndSerializeNode",
       presto::operators::PartitionAndSerializeNode::create);
+  registry.Register(
+      "PartitionAndShuffleWriteNode",
+      presto::operators::PartitionAndShuffleWriteNode::create);
   registry.Register(
       "ShuffleReadNode", presto::operators::ShuffleReadNode::create);
   registry.Register(
       "ShuffleWriteNode", presto::operators::ShuffleWriteNode::create);
+  registry.Register(
+      "VectorizedHashPartitionFunctionSpec",
+      presto::operators::VectorizedHashPartitionFunctionSpec::deserialize);
+  registry.Register(
+      "VectorizedHivePartitionFunctionSpec",
+      presto::operators::VectorizedHivePartitionFunctionSpec::deserialize);
 }
 } // namespace facebook::presto
@@ -182,13 +182,34 @@ class VeloxBatchQueryPlanConverter : public VeloxQueryPlanConverterBase {
  public:
   using VeloxQueryPlanConverterBase::toVeloxQueryPlan;
 
+  /// If 'fusePartitionAndShuffleWrite' is true, a shuffle stage ends with a
+  /// PartitionAndShuffleWriteNode instead of a PartitionAndSerializeNode,
+  /// a gather and a ShuffleWriteNode. Fusing is not supported with the
+  /// kPresto 'serializationFormat', which is used by both the shuffle write
+  /// and read nodes. If 'sharedShuffleWriter' is also true, the drivers of a
+  /// fused task share one shuffle writer. If 'clustered' is true and the
+  /// nodes are not fused, the PartitionAndSerializeNode orders its output by
+  /// partition for the shuffle writer. If 'sortedShuffle' is true, a partial
+  /// sort feeding a shuffle turns into a sorted shuffle when the shuffle
+  /// supports it, see supportsSortedShuffle().
   VeloxBatchQueryPlanConverter(
       const std::string& shuffleName,
       std::shared_ptr<std::string>&& serializedShuffleWriteInfo,
-      velox::memory::MemoryPool* pool)
+      velox::memory::MemoryPool* pool,
+      bool fusePartitionAndShuffleWrite = false,
+      operators::ShuffleSerializationFormat serializationFormat =
+          operators::ShuffleSerializationFormat::kUnsafeRow,
+      bool sharedShuffleWriter = false,
+      bool clustered = false,
+      bool sortedShuffle = false)
       : VeloxQueryPlanConverterBase(pool),
         shuffleName_(shuffleName),
-        serializedShuffleWriteInfo_(std::move(serializedShuffleWriteInfo)) {}
+        serializedShuffleWriteInfo_(std::move(serializedShuffleWriteInfo)),
+        fusePartitionAndShuffleWrite_(fusePartitionAndShuffleWrite),
+        serializationFormat_(serializationFormat),
+        sharedShuffleWriter_(sharedShuffleWriter),
+        clustered_(clustered),
+        sortedShuffle_(sortedShuffle) {}
 
   velox::core::PlanFragment toVeloxQueryPlan(
       const protocol::PlanFragment& fragment,
@@ -202,8 +223,20 @@ class VeloxBatchQueryPlanConverter : public VeloxQueryPlanConverterBase {
       const protocol::TaskId& taskId) override;
 
  private:
+  // Returns true if a shuffle sorted by 'sortingKeys' is enabled and
+  // supported by the shuffle writers, the serialization format and the types
+  // of the keys.
+  bool supportsSortedShuffle(
+      const std::vector<velox::core::FieldAccessTypedExprPtr>& sortingKeys)
+      const;
+
   const std::string shuffleName_;
   const std::shared_ptr<std::string> serializedShuffleWriteInfo_;
+  const bool fusePartitionAndShuffleWrite_;
+  const operators::ShuffleSerializationFormat serializationFormat_;
+  const bool sharedShuffleWriter_;
+  const bool clustered_;
+  const bool sortedShuffle_;
 };
 
 void registerPrestoPlanNodeSerDe();
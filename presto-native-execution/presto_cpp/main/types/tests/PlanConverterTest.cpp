@@ -19,6 +19,7 @@
 #include "presto_cpp/main/common/tests/test_json.h"
 #include "presto_cpp/main/operators/LocalPersistentShuffle.h"
 #include "presto_cpp/main/operators/PartitionAndSerialize.h"
+#include "presto_cpp/main/operators/PartitionAndShuffleWrite.h"
 #include "presto_cpp/main/operators/ShuffleRead.h"
 #include "presto_cpp/main/operators/ShuffleWrite.h"
 #include "presto_cpp/main/types/PrestoToVeloxQueryPlan.h"
@@ -74,13 +75,24 @@ std::shared_ptr<const core::PlanNode> assertToVeloxQueryPlan(
 std::shared_ptr<const core::PlanNode> assertToBatchVeloxQueryPlan(
     const std::string& fileName,
     const std::string& shuffleName,
-    std::shared_ptr<std::string>&& serializedShuffleWriteInfo) {
+    std::shared_ptr<std::string>&& serializedShuffleWriteInfo,
+    bool fusePartitionAndShuffleWrite = false,
+    operators::ShuffleSerializationFormat serializationFormat =
+        operators::ShuffleSerializationFormat::kUnsafeRow,
+    bool sharedShuffleWriter = false,
+    bool clustered = false) {
   const std::string fragment = slurp(getDataPath(fileName));
 
   protocol::PlanFragment prestoPlan = json::parse(fragment);
   auto pool = memory::addDefaultLeafMemoryPool();
   VeloxBatchQueryPlanConverter converter(
-      shuffleName, std::move(serializedShuffleWriteInfo), pool.get());
+      shuffleName,
+      std::move(serializedShuffleWriteInfo),
+      pool.get(),
+      fusePartitionAndShuffleWrite,
+      serializationFormat,
+      sharedShuffleWriter,
+      clustered);
   return converter
       .toVeloxQueryPlan(
           prestoPlan, nullptr, "20201107_130540_00011_wrpkw.1.2.3")
@@ -171,6 +183,96 @@ TEST_F(PlanConverterTest, batchPlanConversion) {
           localPartition->sources().back());
   ASSERT_NE(partitionAndSerializeNode, nullptr);
   ASSERT_EQ(partitionAndSerializeNode->numPartitions(), 3);
+  ASSERT_FALSE(partitionAndSerializeNode->clustered());
+  ASSERT_FALSE(shuffleWrite->clustered());
+
+  root = assertToBatchVeloxQueryPlan(
+      "ScanAggBatch.json",
+      std::string(operators::LocalPersistentShuffleFactory::kShuffleName),
+      std::make_shared<std::string>(fmt::format(
+          "{{\n"
+          "  \"rootPath\": \"{}\",\n"
+          "  \"numPartitions\": {}\n"
+          "}}",
+          exec::test::TempDirectoryPath::create()->path,
+          10)),
+      false,
+      operators::ShuffleSerializationFormat::kUnsafeRow,
+      false,
+      true);
+  shuffleWrite =
+      std::dynamic_pointer_cast<const operators::ShuffleWriteNode>(root);
+  ASSERT_NE(shuffleWrite, nullptr);
+  partitionAndSerializeNode =
+      std::dynamic_pointer_cast<const operators::PartitionAndSerializeNode>(
+          shuffleWrite->sources().back()->sources().back());
+  ASSERT_NE(partitionAndSerializeNode, nullptr);
+  ASSERT_TRUE(partitionAndSerializeNode->clustered());
+  ASSERT_TRUE(shuffleWrite->clustered());
+
+  root = assertToBatchVeloxQueryPlan(
+      "ScanAggBatch.json",
+      std::string(operators::LocalPersistentShuffleFactory::kShuffleName),
+      std::make_shared<std::string>(fmt::format(
+          "{{\n"
+          "  \"rootPath\": \"{}\",\n"
+          "  \"numPartitions\": {}\n"
+          "}}",
+          exec::test::TempDirectoryPath::create()->path,
+          10)),
+      true);
+  auto partitionAndShuffleWrite =
+      std::dynamic_pointer_cast<const operators::PartitionAndShuffleWriteNode>(
+          root);
+  ASSERT_NE(partitionAndShuffleWrite, nullptr);
+  ASSERT_EQ(partitionAndShuffleWrite->numPartitions(), 3);
+  ASSERT_EQ(
+      partitionAndShuffleWrite->shuffleName(),
+      operators::LocalPersistentShuffleFactory::kShuffleName.toString());
+  ASSERT_FALSE(partitionAndShuffleWrite->sharedWriter());
+
+  root = assertToBatchVeloxQueryPlan(
+      "ScanAggBatch.json",
+      std::string(operators::LocalPersistentShuffleFactory::kShuffleName),
+      std::make_shared<std::string>(fmt::format(
+          "{{\n"
+          "  \"rootPath\": \"{}\",\n"
+          "  \"numPartitions\": {}\n"
+          "}}",
+          exec::test::TempDirectoryPath::create()->path,
+          10)),
+      true,
+      operators::ShuffleSerializationFormat::kUnsafeRow,
+      true);
+  partitionAndShuffleWrite =
+      std::dynamic_pointer_cast<const operators::PartitionAndShuffleWriteNode>(
+          root);
+  ASSERT_NE(partitionAndShuffleWrite, nullptr);
+  ASSERT_TRUE(partitionAndShuffleWrite->sharedWriter());
+
+  // Fusing is not supported with the Presto serialization format.
+  root = assertToBatchVeloxQueryPlan(
+      "ScanAggBatch.json",
+      std::string(operators::LocalPersistentShuffleFactory::kShuffleName),
+      std::make_shared<std::string>(fmt::format(
+          "{{\n"
+          "  \"rootPath\": \"{}\",\n"
+          "  \"numPartitions\": {}\n"
+          "}}",
+          exec::test::TempDirectoryPath::create()->path,
+          10)),
+      true,
+      operators::ShuffleSerializationFormat::kPresto);
+  shuffleWrite =
+      std::dynamic_pointer_cast<const operators::ShuffleWriteNode>(root);
+  ASSERT_NE(shuffleWrite, nullptr);
+  partitionAndSerializeNode =
+      std::dynamic_pointer_cast<const operators::PartitionAndSerializeNode>(
+          shuffleWrite->sources().back()->sources().back());
+  ASSERT_NE(partitionAndSerializeNode, nullptr);
+  ASSERT_EQ(
+      partitionAndSerializeNode->format(),
+      operators::ShuffleSerializationFormat::kPresto);
 
   auto curNode = assertToBatchVeloxQueryPlan(
       "FinalAgg.json",
@@ -184,4 +286,7 @@ TEST_F(PlanConverterTest, batchPlanConversion) {
   shuffleReadNode =
       std::dynamic_pointer_cast<const operators::ShuffleReadNode>(curNode);
   ASSERT_NE(shuffleReadNode, nullptr);
+  ASSERT_EQ(
+      shuffleReadNode->format(),
+      operators::ShuffleSerializationFormat::kUnsafeRow);
 }